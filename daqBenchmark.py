@@ -0,0 +1,153 @@
+"""
+Throughput of the DAQ over a grid of run settings, measured on the real
+daq6000a collection path (settings, rapid block, transfers, file writing)
+against the simulated driver built by 'make 6ka-sim'.
+
+    python3 daqBenchmark.py --waveforms 1000,10000 --samples 100,1000 --bits 8,16 --units 1,2
+
+Every point runs in its own process, so its peak RSS is its own. For each it
+reports captures/s, MB/s written to disk, CPU seconds and peak RSS, plus the
+slowest stage of the runs (see getLastRunStats). The simulated scope is set
+through the PICOSIM_ environment variables, PICOSIM_REPLAY replays a
+recorded .dat instead of generated pulses.
+"""
+import os
+import sys
+import json
+import time
+import glob
+import argparse
+import resource
+import itertools
+import subprocess
+
+g_stages = ["configure", "arm", "triggerWait", "transfer", "write", "reset"]
+g_columns = ["units", "waveforms", "samples", "bits", "runs", "seconds", "captures/s", "MB/s", "cpu s", "peak MB", "slowest"]
+
+def parseList(text):
+    return [int(float(v)) for v in text.split(",") if v != ""]
+
+def runPoint(args, point):
+    """Collects args.runs runs of one point, in this process"""
+    sys.path.insert(0, args.module)
+    import daq6000a as daq
+
+    units, waveforms, samples, bits = point
+    daq.setFileFormatVersion(args.format)
+    daq.setDoubleBuffering(args.doubleBuffering)
+    daq.setRapidBlockWindow(args.window)
+    daq.setBit8Buffers(bits == 8)
+    daq.setRunStatsLog(os.path.join(args.dir, "runStats.jsonl"))
+    for i in range(units):
+        daq.multiSeriesInitDaq("SIM00/%04d" % (i + 1))
+
+    ranges = [2 if i < args.channels else 99 for i in range(4)]
+    daq.multiSeriesSetDaqSettings(
+                    0, ranges[0], samples,
+                    0, ranges[1], samples,
+                    0, ranges[2], samples,
+                    0, ranges[3], samples,
+                    100, 2, waveforms, 0)
+
+    begin = time.time()
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    for run in range(args.runs):
+        daq.multiSeriesCollectData(os.path.join(args.dir, "bench%i" % run))
+    daq.waitForWrites()
+    seconds = time.time() - begin
+    end = resource.getrusage(resource.RUSAGE_SELF)
+
+    written = sum(os.path.getsize(f) for f in glob.glob(os.path.join(args.dir, "bench*")))
+    daq.multiSeriesCloseDaq()
+
+    stages = dict.fromkeys(g_stages, 0.0)
+    with open(os.path.join(args.dir, "runStats.jsonl")) as f:
+        for line in f:
+            run = json.loads(line)
+            for stage in g_stages:
+                stages[stage] += max(u[stage] for u in run["units"])
+
+    return {"units": units, "waveforms": waveforms, "samples": samples, "bits": bits, "runs": args.runs,
+            "seconds": seconds,
+            "captures/s": units * waveforms * args.runs / seconds,
+            "MB/s": written / seconds / 1e6,
+            "cpu s": end.ru_utime + end.ru_stime - usage.ru_utime - usage.ru_stime,
+            "peak MB": end.ru_maxrss / 1024, # KiB on Linux
+            "slowest": max(g_stages, key=lambda s: stages[s]),
+            "stages": stages}
+
+def bufferBytes(args, point):
+    units, waveforms, samples, bits = point
+    return units * waveforms * samples * args.channels * bits // 8 * (2 if args.doubleBuffering else 1)
+
+def clean(directory):
+    files = glob.glob(os.path.join(directory, "bench*"))
+    files += [os.path.join(directory, f) for f in ["runStats.jsonl", "point.json"]]
+    for f in files:
+        if os.path.exists(f):
+            os.remove(f)
+
+def printRow(values):
+    print("".join("%12s" % v for v in values))
+
+def main():
+    parser = argparse.ArgumentParser(description="DAQ throughput on the simulated ps6000a")
+    parser.add_argument("--waveforms", default="1000,10000,100000", help="numWaveforms values")
+    parser.add_argument("--samples", default="100,1000,5000", help="post trigger samples per channel")
+    parser.add_argument("--bits", default="8,16", help="buffer sample widths")
+    parser.add_argument("--units", default="1,2", help="unit counts")
+    parser.add_argument("--channels", type=int, default=4, help="active channels per unit")
+    parser.add_argument("--runs", type=int, default=3, help="collections per point")
+    parser.add_argument("--format", type=int, default=1, help=".dat format version")
+    parser.add_argument("--window", type=int, default=0, help="rapid block window segments, 0 off")
+    parser.add_argument("--single-buffering", dest="doubleBuffering", action="store_false")
+    parser.add_argument("--max-gb", type=float, default=4, help="skip points needing more buffer memory")
+    parser.add_argument("--dir", default="daqBenchmark", help="scratch directory for the files")
+    parser.add_argument("--module", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "sim"),
+                        help="directory of the simulated daq6000a module")
+    parser.add_argument("--csv", default="", help="also write the results here")
+    parser.add_argument("--verbose", action="store_true", help="show the DAQ output")
+    parser.add_argument("--point", default="", help=argparse.SUPPRESS)
+    parser.add_argument("--result", default="", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.point:
+        result = runPoint(args, json.loads(args.point))
+        with open(args.result, "w") as f:
+            json.dump(result, f)
+        return
+
+    points = list(itertools.product(parseList(args.units), parseList(args.waveforms),
+                                    parseList(args.samples), parseList(args.bits)))
+    env = dict(os.environ)
+    env.setdefault("PICOSIM_UNITS", str(max(p[0] for p in points)))
+    os.makedirs(args.dir, exist_ok=True)
+    resultFile = os.path.join(args.dir, "point.json")
+
+    results = []
+    printRow(g_columns)
+    for point in points:
+        if bufferBytes(args, point) > args.max_gb * 1e9:
+            printRow(list(point) + ["skipped"]) # see --max-gb
+            continue
+        clean(args.dir)
+        cmd = [sys.executable, os.path.abspath(__file__), "--point", json.dumps(point), "--result", resultFile]
+        cmd += sys.argv[1:]
+        out = None if args.verbose else subprocess.DEVNULL
+        if subprocess.call(cmd, env=env, stdout=out, stderr=out) != 0 or not os.path.exists(resultFile):
+            printRow(list(point) + ["failed"]) # see --verbose
+            continue
+        with open(resultFile) as f:
+            result = json.load(f)
+        results.append(result)
+        printRow([result[c] if not isinstance(result[c], float) else "%.1f" % result[c] for c in g_columns])
+
+    clean(args.dir)
+    if args.csv:
+        with open(args.csv, "w") as f:
+            f.write(",".join(g_columns + g_stages) + "\n")
+            for r in results:
+                f.write(",".join([str(r[c]) for c in g_columns] + [str(r["stages"][s]) for s in g_stages]) + "\n")
+
+if __name__ == '__main__':
+    main()
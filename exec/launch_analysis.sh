@@ -39,7 +39,9 @@ analyse_input_dir=${pre_analyse_output_dir}
 analyse_output_dir="${base_dir}plots/analyse/"
 
 if [ ${what} == "batch-pre-analyse" ]; then
-	files=$(ls ${pre_analyse_input_dir}*/*.dat)
+	# Listing updates the catalog too, it only re-reads new or modified files, see src/tools/datIndex.cpp
+	# Kept to one level of run directories, like the ls listing before it
+	files=$(./datIndex ${pre_analyse_input_dir} list | grep -E "^${pre_analyse_input_dir%/}/[^/]+/[^/]+\.dat$")
 	./analysis ${what} ${pre_analyse_output_dir} ${files}
 
 elif [ ${what} == "analyse" ]; then
@@ -1,5 +1,6 @@
 import os
 import sys
+import json
 from datetime import datetime
 import time
 import IV_Curve as vc
@@ -10,6 +11,21 @@ import isegNhqControl as nhq
 
 ### GLOBAL FLAGS ###
 g_quickPlots = True
+g_datFormatVersion = 1 # 2 writes little-endian, 4 KiB aligned .dat files
+g_datCompression = False # lossless, needs g_datFormatVersion = 2
+g_hugePageBuffers = False # data buffers on reserved hugetlb pages, falls back to normal pages
+g_lockDataBuffers = False # mlock the data buffers, needs a large enough RLIMIT_MEMLOCK
+g_doubleBuffering = True # write each run in the background while the next one is captured
+g_windowSegments = 0 # capture runs in windows of this many segments, allows runs longer than scope memory
+g_downsampling = (0, 1, 0, 1, 0, 1, 0, 1) # per channel (mode, ratio): 1 aggregate, 2 decimate, 3 average, needs g_datFormatVersion = 2
+g_summaryMode = 0 # 1 also writes per waveform summaries (.sum), 2 writes them instead of the .dat, see sc.readSummary
+g_summaryBaseline = (0, 100) # inclusive sample window
+g_summaryWindows = [(160, 275)] # inclusive charge windows in samples, up to 4
+g_darkStreamSeconds = 0 # > 0 streams the dark run for this long and keeps only the pulses, see runDarkStreaming
+g_darkStreamIntervalNs = 16 # streaming sample interval, the driver picks the nearest it supports
+g_darkStreamThresholdMv = -5 # pulse threshold, negative for falling pulses
+g_runStatsFile = "runStats.jsonl" # per run DAQ stage timings, appended in the data directory, "" turns them off
+g_cppSweep = True # runs every bias and LED point in one daq.runSweep call, see sweepPlan. Not for dark streaming
 ####################
 
 def endNotification():
@@ -31,7 +47,17 @@ def endNotification():
         return
     return
 
+def setSummary(mode):
+    daq.setSummary(mode, *g_summaryBaseline, [w[0] for w in g_summaryWindows], [w[1] for w in g_summaryWindows])
+
 def initPicoScopes(picoList, fnGen):
+    daq.setFileFormatVersion(g_datFormatVersion)
+    daq.setFileCompression(g_datCompression)
+    daq.setDownsampling(*g_downsampling)
+    setSummary(g_summaryMode)
+    daq.setDataBufferOptions(g_hugePageBuffers, g_lockDataBuffers)
+    daq.setDoubleBuffering(g_doubleBuffering)
+    daq.setRapidBlockWindow(g_windowSegments)
     for ps in picoList:
         status = daq.multiSeriesInitDaq(ps)
         if status == 0:
@@ -44,54 +70,106 @@ def initPicoScopes(picoList, fnGen):
         exit()
 
 def closePicoscopes():
+    daq.waitForWrites()
     daq.multiSeriesCloseDaq()
     gen.clearFunctionGenerator()
     return
 
+def reportRunStats(fileName, since=0):
+    # Where the DAQ time went over the runs started after since. The units run in
+    # parallel, so every run counts its slowest unit per stage. With double buffering
+    # the writes overlap the next capture
+    stages = ["configure", "arm", "triggerWait", "transfer", "write", "reset"]
+    totals = dict.fromkeys(stages, 0.0)
+    runs = 0
+    try:
+        with open(fileName) as f:
+            for line in f:
+                run = json.loads(line)
+                if run["start"] < since:
+                    continue
+                runs += 1
+                for stage in stages:
+                    totals[stage] += max([u[stage] for u in run["units"]], default=0)
+    except OSError:
+        return
+    total = sum(totals.values())
+    if total == 0:
+        return
+    print("DAQ time over %d runs:" % runs)
+    for stage in stages:
+        print("    %-12s %9.1f s %5.1f %%" % (stage, totals[stage], 100 * totals[stage] / total))
+
+g_mvListRanges = [2, 4, 6] # voltage range of each of a bias' LED voltage lists, the PMT included
+
+def biasFilePattern(bias, mppcStr, date, pmt, d, extra):
+    """Output basename of a bias point, %s is the LED point"""
+    s = r'%s'
+    return d + r"%s_%sV_%s_%skV_%s%s" % \
+                (date, str(bias), s, pmt, mppcStr, extra)
+
+def darkSettings():
+    """multiSeriesSetDaqSettings arguments of the dark run: no LED, very low voltage range"""
+    return (0, 1, 2000,
+            0, 1, 2000,
+            0, 1, 2000,
+            0, 1, 2000,
+            100, 2, 5000, 0)
+
+def mvListSettings(vRange, pmtVRange):
+    """multiSeriesSetDaqSettings arguments of the LED runs at one voltage range"""
+    return (0, vRange, 400,
+            0, vRange, 400,
+            0, vRange, 400,
+            0, pmtVRange, 400, # 50mV is good for all, may want to reduce it for mv50List
+            100, 2, 20000, 0)
+
 def daqPerBias(bias, mppcStr, mvLists, date, pmt, d, extra):
     """Runs DAQ for a range of LED Voltages for a given bias voltage"""
-    s = r'%s'
-    outFilePattern = d + r"%s_%sV_%s_%skV_%s%s" % \
-                        (date, str(bias), s, pmt, mppcStr, extra)
+    outFilePattern = biasFilePattern(bias, mppcStr, date, pmt, d, extra)
     
-    runDark(outFilePattern)
-
-    if len(mvLists) > 0:
-        runMvList(2, outFilePattern, mvLists[0], 2)
+    if g_darkStreamSeconds > 0:
+        runDarkStreaming(outFilePattern)
+    else:
+        runDark(outFilePattern)
 
-    if len(mvLists) > 1:
-        runMvList(4, outFilePattern, mvLists[1], 4)
-    
-    if len(mvLists) > 2:
-        runMvList(6, outFilePattern, mvLists[2], 6)
+    for vRange, mvList in zip(g_mvListRanges, mvLists):
+        runMvList(vRange, outFilePattern, mvList, vRange)
 
     return
 
 def runDark(oFilePattern):
     """Runs DAQ for dark photos: no LED, very low voltage range"""
-    daq.multiSeriesSetDaqSettings(
-                    0, 1, 2000,
-                    0, 1, 2000,
-                    0, 1, 2000,
-                    0, 1, 2000,
-                    100, 2, 5000, 0)
-    
+    daq.multiSeriesSetDaqSettings(*darkSettings())
 
     gen.runFunctionGenerator(0,38)
     out = oFilePattern % "Dark"
     print("\n\n\nNext DAQ: %s" % out)
     daq.multiSeriesCollectData(out)
-    if g_quickPlots: sc.quickPlot(out + "_%s.dat")
+    if g_quickPlots and g_summaryMode != 2:
+        daq.waitForWrites()
+        sc.quickPlot(out + "_%s.dat")
+    return
+
+def runDarkStreaming(oFilePattern):
+    """Streams the dark run untriggered, writing only the pulse snippets to .pulses files"""
+    t = g_darkStreamThresholdMv
+    daq.multiSeriesSetDaqSettings(
+                    t, 1, 2000,
+                    t, 1, 2000,
+                    t, 1, 2000,
+                    t, 1, 2000,
+                    100, 2, 5000, 0)
+
+    gen.runFunctionGenerator(0,38)
+    out = oFilePattern % "DarkStream"
+    print("\n\n\nNext DAQ: %s" % out)
+    daq.multiSeriesStreamData(out, g_darkStreamIntervalNs, g_darkStreamSeconds)
     return
 
 def runMvList(vRange, oFilePatternRaw, mvList, pmtVRange=2):
     """Runs DAQ for range of LED voltages for a given bias and voltage range"""
-    daq.multiSeriesSetDaqSettings(
-                    0, vRange, 400,
-                    0, vRange, 400,
-                    0, vRange, 400,
-                    0, pmtVRange, 400, # 50mV is good for all, may want to reduce it for mv50List
-                    100, 2, 20000, 0)
+    daq.multiSeriesSetDaqSettings(*mvListSettings(vRange, pmtVRange))
 
     oFilePattern = oFilePatternRaw % ("%imV")
     for mv in mvList:
@@ -99,10 +177,39 @@ def runMvList(vRange, oFilePatternRaw, mvList, pmtVRange=2):
         gen.runFunctionGenerator(mv,38)
         print("\n\n\nNext DAQ: %s" % out)
         daq.multiSeriesCollectData(out)
-        if g_quickPlots: sc.quickPlot(out + "_%s.dat")
+        if g_quickPlots and g_summaryMode != 2:
+            daq.waitForWrites()
+            sc.quickPlot(out + "_%s.dat")
 
     return
 
+def sweepStep(name, bias, ledMv, settings):
+    """One daq.runSweep step from multiSeriesSetDaqSettings arguments"""
+    return {"name": name, "bias": bias, "ledMv": ledMv,
+            "ranges": list(settings[1:12:3]),
+            "triggers": list(settings[0:12:3]) + [settings[12]],
+            "samples": list(settings[2:12:3]),
+            "timebase": settings[13], "waveforms": settings[14], "preTrigger": settings[15]}
+
+def sweepPlan(biasList, ledVoltageMap, mppcStr, date, pmt, d, extra):
+    """The runs of daqPerBias for every bias, as one daq.runSweep schedule"""
+    plan = []
+    for bias in biasList:
+        outFilePattern = biasFilePattern(bias, mppcStr, date, pmt, d, extra)
+        plan.append(sweepStep(outFilePattern % "Dark", bias, 0, darkSettings()))
+        for vRange, mvList in zip(g_mvListRanges, ledVoltageMap[bias]):
+            for mv in mvList:
+                plan.append(sweepStep((outFilePattern % "%imV") % mv, bias, mv, mvListSettings(vRange, vRange)))
+    return plan
+
+def sweepProgress(index, name, stage):
+    """daq.runSweep callback, the quick plots of a run are drawn while the next one is captured"""
+    if stage == "capturing":
+        print("\n\n\nNext DAQ: %s" % name)
+    elif stage == "written" and g_quickPlots and g_summaryMode != 2:
+        sc.quickPlot(name + "_%s.dat")
+    return True
+
 def quickCheck(bias, mppcStr, ledV, date, pmt, d, extra, picoscopes):
     """
     Runs short DAQ with high LED and bias to check if the signals seem reasonable.
@@ -122,7 +229,10 @@ def quickCheck(bias, mppcStr, ledV, date, pmt, d, extra, picoscopes):
     
     gen.runFunctionGenerator(ledV,38)
     print("\n\n\nNext DAQ: %s" % out)
+    setSummary(0) # the checks read the .dat
     daq.multiSeriesCollectData(out)
+    daq.waitForWrites()
+    setSummary(g_summaryMode)
 
     ex = False
     for ps in picoscopes:
@@ -238,6 +348,8 @@ def main(mppcList, reset, extra=''):
         return
 
     initPicoScopes(picoscopes, fnGen)
+    if g_runStatsFile:
+        daq.setRunStatsLog(path + g_runStatsFile)
  
     vc.runSetup(vs, targetVoltage, "2.5e-4")
 
@@ -261,10 +373,15 @@ def main(mppcList, reset, extra=''):
         safeExit(vs, isegSer, jumpTarget, "Quick check failed, early ramp down initiated")
 
     try:
-        for bias in biasVoltageList:
-            vc.rampVoltage(vs, bias)
-            mvLists = ledVoltageMap[bias]
-            daqPerBias(bias, mppcStr, mvLists, date, pmt, path, extra)
+        if g_cppSweep and g_darkStreamSeconds == 0:
+            plan = sweepPlan(biasVoltageList, ledVoltageMap, mppcStr, date, pmt, path, extra)
+            daq.runSweep(plan, lambda bias: vc.rampVoltage(vs, bias),
+                         lambda mv: gen.runFunctionGenerator(mv, 38), sweepProgress)
+        else:
+            for bias in biasVoltageList:
+                vc.rampVoltage(vs, bias)
+                mvLists = ledVoltageMap[bias]
+                daqPerBias(bias, mppcStr, mvLists, date, pmt, path, extra)
     except KeyboardInterrupt:
         safeExit(vs, isegSer, jumpTarget, "Data collection loop was interrupted by user")
     except Exception as e:
@@ -299,6 +416,8 @@ def main(mppcList, reset, extra=''):
         exit()
     
     closePicoscopes()
+    if g_runStatsFile:
+        reportRunStats(path + g_runStatsFile, start)
     print("Total elapsed time:", int(time.time() - start), "s")
     endNotification()
 
@@ -8,6 +8,7 @@
 #include <cstdio>
 #include <ctime>
 #include <chrono>
+#include <future>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -54,6 +55,14 @@
 #include "Math/MinimizerOptions.h"
 #include "TError.h"
 
+#include "datCatalog.h"
+#include "datReader.h"
+#include "waveformBlock.h"
+#include "common/adcCodec.h"
+#include "common/adcKernels.h"
+#include "common/datFormat.h"
+#include "common/sampleKernels.h"
+
 struct sample
 {
 	double voltage; // [mV]
@@ -104,24 +113,6 @@ struct gaussParams
 	double sigma;
 };
 
-struct dataHeader
-{
-	uint8_t timebase;
-	std::string activeChannels;
-	uint8_t numActive;
-	std::string activeTriggers;
-	bool bit8Buffer;
-	float auxTriggerThreshold;
-	std::vector<float> chTriggerThreshold;
-	std::vector<uint8_t> chVRanges;
-	std::vector<uint16_t> chSamples;
-	int16_t preTriggerSamples;
-	uint32_t numWaveforms;
-	int32_t timestamp;
-	std::string modelNumber;
-	std::string serialNumber;
-};
-
 struct dataCollectionParameters
 {
 	std::vector<std::string> biasFullVec;
@@ -255,6 +246,8 @@ const uint32_t g_integratedLowerWindow = 160;
 const uint32_t g_integratedUpperWindow = 275;
 
 bool g_quickPreAnalysis = false;
+const bool g_rawAdcPreAnalysis = true; // analyse ADC counts, converting only the results to mV
+const uint32_t g_preAnalysisBatchSize = 1024; // waveforms decoded at a time, 0 for the whole file
 const uint32_t g_quickBaselineLowerWindow = 0;
 const uint32_t g_quickBaselineUpperWindow = 20;
 
@@ -0,0 +1,77 @@
+#ifndef datCatalog_h
+#define datCatalog_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "datReader.h"
+
+// Kept free of ROOT, like datReader, so that exec/datIndex can share it
+
+struct catalogEntry
+{
+	std::string path;     // relative to the catalog directory
+	uint64_t size;
+	int64_t mtimeNs;
+	// From the file name: <date>_<bias>V_<led>mV_<pmt>_<mppc>_<serial>.dat, led is "Dark" for dark runs
+	std::string date;
+	std::string bias;
+	std::string led;
+	std::string pmt;
+	std::string mppc;
+	std::string serial;
+	bool validHeader;     // header decoded and every channel payload fits in the file
+	uint32_t headerBytes;
+	dataHeader header;
+};
+
+// Empty fields match anything
+struct catalogQuery
+{
+	std::string date;
+	std::string bias;
+	std::string led;
+	std::string pmt;
+	std::string mppc;
+	std::string serial;
+};
+
+/*
+ * Index of every .dat file below a directory, kept in <directory>/.datCatalog.
+ * Construction loads the catalog and brings it up to date: only files whose
+ * size or mtime changed are opened again, so an unchanged campaign of
+ * thousands of files costs one stat() per file. The catalog is rewritten
+ * (atomically) only when something changed.
+ */
+class datCatalog
+{
+public:
+	datCatalog(const std::string &directory);
+
+	const std::string &directory() const {return m_directory;}
+	const std::vector<catalogEntry> &entries() const {return m_entries;}
+	size_t rescanned() const {return m_rescanned;}
+
+	std::string fullPath(const catalogEntry &e) const;
+	std::vector<const catalogEntry *> select(const catalogQuery &q) const;
+	// First match or nullptr
+	const catalogEntry *find(const catalogQuery &q) const;
+
+	// Re-scans the directory, returns false if the catalog could not be written
+	bool update();
+
+private:
+	bool load();
+	bool save() const;
+
+	std::string m_directory;
+	std::vector<catalogEntry> m_entries; // sorted by path
+	size_t m_rescanned = 0;
+};
+
+// Parses the run settings out of a .dat file name, false if it does not follow the naming scheme
+bool parseDatFileName(const std::string &path, catalogEntry &e);
+
+#endif // datCatalog_h
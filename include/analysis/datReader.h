@@ -0,0 +1,128 @@
+#ifndef datReader_h
+#define datReader_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Kept free of ROOT so that it can be shared outside of exec/analysis
+
+struct dataHeader
+{
+	uint8_t timebase;
+	std::string activeChannels;
+	uint8_t numActive;
+	std::string activeTriggers;
+	bool bit8Buffer;
+	float auxTriggerThreshold;
+	std::vector<float> chTriggerThreshold;
+	std::vector<uint8_t> chVRanges;
+	std::vector<uint16_t> chSamples;
+	int16_t preTriggerSamples;
+	uint32_t numWaveforms;
+	int32_t timestamp;
+	std::string modelNumber;
+	std::string serialNumber;
+	uint32_t version;               // .dat format version, see common/datFormat.h
+	std::vector<uint64_t> chOffset; // byte offset of each channel payload, 0 if inactive
+	std::vector<uint64_t> chBytes;  // stored payload size of each channel
+	uint8_t codec;                  // datCodec, DAT_CODEC_RAW for v1
+	std::vector<uint8_t> chDownsampleMode;   // datDownsampling, see common/datFormat.h
+	std::vector<uint32_t> chDownsampleRatio; // captured samples per stored sample, 1 if not downsampled
+};
+
+// 1 for channels that were not downsampled
+inline uint32_t downsampleRatio(const dataHeader &d, const int ch)
+{
+	return ch < (int) d.chDownsampleRatio.size() ? std::max<uint32_t>(1, d.chDownsampleRatio[ch]) : 1;
+}
+
+// View of one channel's samples inside a mapped file, no copy is made
+struct channelView
+{
+	const uint8_t *data; // first byte of the channel payload
+	uint32_t numWaveforms;
+	uint16_t numSamples;
+	bool bit8;
+	bool bigEndian; // v1 payloads are big-endian, v2 are in host order
+
+	size_t sampleBytes() const
+	{
+		return bit8 ? sizeof(int8_t) : sizeof(int16_t);
+	}
+	const uint8_t *waveform(const uint32_t wf) const
+	{
+		return data + (size_t) wf * numSamples * sampleBytes();
+	}
+	int16_t adc(const uint32_t wf, const uint16_t i) const
+	{
+		const uint8_t *p = waveform(wf) + (size_t) i * sampleBytes();
+		if (bit8)
+			return (int8_t) p[0];
+		if (bigEndian)
+			return (int16_t) ((p[0] << 8) | p[1]);
+		return (int16_t) (p[0] | (p[1] << 8));
+	}
+};
+
+/*
+ * Read-only memory map of a .dat file (v1 or v2). The header is decoded straight from
+ * the mapped bytes and channel payloads are handed out as views into the
+ * mapping, so nothing goes through an istream. Encoded (DAT_CODEC_ADC) payloads
+ * are decoded once at open, on every core, and the views point at the result.
+ * Mirrors std::ifstream: check isOpen() after construction.
+ */
+class datFile
+{
+public:
+	datFile(const std::string &filePath);
+	~datFile();
+
+	datFile(const datFile &) = delete;
+	datFile &operator=(const datFile &) = delete;
+
+	bool isOpen() const {return m_data != nullptr;}
+	const dataHeader &header() const {return m_header;}
+	const uint8_t *bytes() const {return m_data;}
+	size_t size() const {return m_size;}
+	size_t headerSize() const {return m_headerSize;}
+
+	bool isActive(const int ch) const;
+	channelView channel(const int ch) const;
+
+	// Page cache hints for waveforms [first, first + count) of every channel,
+	// no-ops for encoded files
+	void willNeed(const uint32_t first, const uint32_t count) const;
+	void dontNeed(const uint32_t first, const uint32_t count) const;
+
+private:
+	void advise(const uint32_t first, const uint32_t count, const int advice) const;
+
+	bool decodePayload();
+
+	const uint8_t *m_data = nullptr;
+	size_t m_size = 0;
+	std::vector<uint8_t> m_decoded;       // encoded files only, channels back to back
+	uint64_t m_decodedOffset[4] = {};
+	size_t m_headerSize = 0;
+	dataHeader m_header = {};
+};
+
+// Enough bytes for any header: v2 is 256 bytes, v1 is 32 plus the model and serial strings
+const size_t g_headerReadBytes = 4096;
+
+// Decodes a v1 or v2 header from raw file bytes, returns the header length or 0 if incomplete
+size_t decodeHeader(const uint8_t *bytes, const size_t size, dataHeader &d);
+
+// Decodes the header of a file with a single read and no mapping, returns the header length or 0.
+// fileSize is set if given
+size_t readFileHeader(const std::string &filePath, dataHeader &d, uint64_t *fileSize = nullptr);
+
+// True if every active channel payload lies inside a file of fileSize bytes
+bool payloadInFile(const dataHeader &d, const uint64_t fileSize);
+
+size_t payloadSize(const dataHeader &d);
+
+#endif // datReader_h
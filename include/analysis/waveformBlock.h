@@ -0,0 +1,122 @@
+#ifndef waveformBlock_h
+#define waveformBlock_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include "datReader.h"
+
+const size_t g_blockAlignment = 64; // one cache line
+
+// Non-owning view of a single waveform, the time axis is computed from the timebase
+template <typename T>
+struct waveformView
+{
+	const T *data;
+	uint32_t size;
+	double timebase; // [ns] per sample
+
+	T operator[](const uint32_t i) const {return data[i];}
+	double time(const uint32_t i) const {return timebase * i;}
+	const T *begin() const {return data;}
+	const T *end() const {return data + size;}
+};
+
+/*
+ * Contiguous channel x waveform x sample storage for a whole .dat file.
+ * Every channel starts on a 64 byte boundary and every waveform is padded
+ * to a whole number of cache lines, so per-waveform kernels never share a
+ * line with the next waveform.
+ * T is float for mV samples, or int8_t/int16_t for raw ADC counts.
+ * A block can also hold a batch of a file: it is sized for a fixed number
+ * of waveforms and resize() sets how many of them are currently in use.
+ */
+template <typename T>
+class waveformBlock
+{
+public:
+	waveformBlock(const dataHeader &d, const double timebase)
+		: waveformBlock(d, timebase, d.numWaveforms)
+	{
+	}
+
+	waveformBlock(const dataHeader &d, const double timebase, const uint32_t capacity)
+		: m_numWaveforms(capacity), m_capacity(capacity)
+	{
+		size_t total(0);
+		for (int ch(0); ch < 4; ++ch)
+		{
+			m_active[ch] = d.activeChannels.at(ch) == '1';
+			m_numSamples[ch] = m_active[ch] ? d.chSamples.at(ch) : 0;
+			m_range[ch] = d.chVRanges.at(ch);
+			m_timebase[ch] = timebase * downsampleRatio(d, ch);
+			m_stride[ch] = roundUp(m_numSamples[ch] * sizeof(T)) / sizeof(T);
+			m_offset[ch] = total;
+			total += m_stride[ch] * m_capacity;
+		}
+		m_size = total;
+
+		void *p = nullptr;
+		if (posix_memalign(&p, g_blockAlignment, std::max(m_size * sizeof(T), g_blockAlignment)) != 0)
+		{
+			throw std::bad_alloc();
+		}
+		m_data.reset((T *) p);
+	}
+
+	bool isActive(const int ch) const {return m_active[ch];}
+	uint32_t numWaveforms() const {return m_numWaveforms;}
+	uint32_t capacity() const {return m_capacity;}
+	uint16_t numSamples(const int ch) const {return m_numSamples[ch];}
+	uint8_t range(const int ch) const {return m_range[ch];}
+	double timebase(const int ch) const {return m_timebase[ch];}
+	size_t bytes() const {return m_size * sizeof(T);}
+
+	void resize(const uint32_t numWaveforms)
+	{
+		if (numWaveforms > m_capacity)
+		{
+			throw std::length_error("waveformBlock::resize beyond capacity");
+		}
+		m_numWaveforms = numWaveforms;
+	}
+
+	T *waveformData(const int ch, const uint32_t wf)
+	{
+		return m_data.get() + m_offset[ch] + m_stride[ch] * wf;
+	}
+	waveformView<T> waveform(const int ch, const uint32_t wf) const
+	{
+		return waveformView<T>{m_data.get() + m_offset[ch] + m_stride[ch] * wf,
+							   m_numSamples[ch], m_timebase[ch]};
+	}
+
+private:
+	struct freeDeleter
+	{
+		void operator()(T *p) const {free(p);}
+	};
+
+	static size_t roundUp(const size_t n)
+	{
+		return (n + g_blockAlignment - 1) / g_blockAlignment * g_blockAlignment;
+	}
+
+	std::unique_ptr<T[], freeDeleter> m_data;
+	size_t m_size = 0;
+	uint32_t m_numWaveforms;
+	uint32_t m_capacity;
+	double m_timebase[4]; // [ns] per stored sample, the capture timebase times the downsampling ratio
+	bool m_active[4];
+	uint16_t m_numSamples[4];
+	uint8_t m_range[4];
+	size_t m_stride[4]; // elements between consecutive waveforms
+	size_t m_offset[4]; // elements from the start of the block
+};
+
+#endif // waveformBlock_h
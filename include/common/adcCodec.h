@@ -0,0 +1,43 @@
+#ifndef adcCodec_h
+#define adcCodec_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Lossless codec for ADC waveforms, used for .dat v2 channel payloads with
+ * codec DAT_CODEC_ADC (see common/datFormat.h). No external library.
+ *
+ * Each waveform is stored as its baseline plus the residuals from it. Trailing
+ * zero bits common to the whole waveform are dropped first (16 bit buffers of
+ * an 8 bit ADC only hold multiples of 256), then the zigzagged residuals are
+ * bit-packed in groups of 32 samples at the width of the group's largest
+ * residual. Samples sitting on the baseline pack to a few bits each, a pulse
+ * only widens the groups it spans.
+ *
+ * Stream layout, little-endian:
+ *   uint32 numWaveforms, numSamples, sampleBytes, blockWaveforms
+ *   uint64 blockEnd[numBlocks]   byte offset of the end of each block
+ *   blocks                       independent, so they are coded in parallel
+ * A block holds blockWaveforms waveforms (fewer in the last one), each as
+ *   int16 baseline, uint8 shift, then per group: uint8 width, 4 x width bytes
+ * and ends with 8 zero bytes so the decoder can use unaligned 64 bit loads.
+ */
+
+const uint32_t g_adcCodecBlockWaveforms = 256;
+
+// Encodes numWaveforms waveforms of numSamples samples (sampleBytes 1 or 2, host
+// order). threads = 0 uses every core
+std::vector<uint8_t> adcEncode(const void *const *waveforms, const uint32_t numWaveforms, const uint32_t numSamples,
+							   const uint32_t sampleBytes, unsigned threads = 0);
+
+// Decodes waveforms [first, first + count) of a stream into out, back to back.
+// Returns false if the stream is malformed or does not match the arguments
+bool adcDecode(const uint8_t *in, const size_t size, void *out, const uint32_t first, const uint32_t count,
+			   const uint32_t numSamples, const uint32_t sampleBytes, unsigned threads = 0);
+
+// numWaveforms of a stream, 0 if it is malformed
+uint32_t adcStreamWaveforms(const uint8_t *in, const size_t size);
+
+#endif // adcCodec_h
@@ -0,0 +1,57 @@
+#ifndef adcKernels_h
+#define adcKernels_h
+
+#include <cstdint>
+
+/*
+ * Waveform kernels working on raw int8/int16 ADC counts with integer
+ * accumulators. Callers convert the results to mV (and ns) once, instead
+ * of converting every sample up front.
+ * All windows are inclusive: [lower, upper].
+ */
+
+// mV per ADC count for the given full scale, 8 bit buffers span +-128 and 16 bit +-32512
+template <typename T>
+inline double adcScale(const int rangeMv)
+{
+	return rangeMv / (sizeof(T) == 1 ? 128.0 : 32512.0);
+}
+
+template <typename T>
+inline int64_t adcSum(const T *data, const uint32_t lower, const uint32_t upper)
+{
+	int64_t sum(0);
+	for (uint32_t i0(lower); i0 <= upper; ++i0)
+	{
+		sum += data[i0];
+	}
+	return sum;
+}
+
+// Index of the first smallest sample
+template <typename T>
+inline uint32_t adcArgMin(const T *data, const uint32_t n)
+{
+	uint32_t index(0);
+	for (uint32_t i0(1); i0 < n; ++i0)
+	{
+		if (data[i0] < data[index])
+			index = i0;
+	}
+	return index;
+}
+
+// Index of the first largest sample
+template <typename T>
+inline uint32_t adcArgMax(const T *data, const uint32_t n)
+{
+	uint32_t index(0);
+	for (uint32_t i0(1); i0 < n; ++i0)
+	{
+		if (data[i0] > data[index])
+			index = i0;
+	}
+	return index;
+}
+
+#endif // adcKernels_h
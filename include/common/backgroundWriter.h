@@ -0,0 +1,49 @@
+#ifndef backgroundWriter_h
+#define backgroundWriter_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * One worker thread running queued jobs (file writes) in order, so the DAQ
+ * modules can arm the next capture while the previous one goes to disk. The
+ * thread starts with the first job and is joined by the destructor once the
+ * queue is empty.
+ *
+ * A job that throws does not stop the queue: the first error is kept and
+ * rethrown (as std::runtime_error) by the next wait().
+ */
+class backgroundWriter
+{
+public:
+	backgroundWriter() {}
+	~backgroundWriter();
+
+	backgroundWriter(const backgroundWriter &) = delete;
+	backgroundWriter &operator=(const backgroundWriter &) = delete;
+
+	void push(std::function<void()> job);
+	// Blocks until every job pushed so far has finished
+	void wait();
+	// Jobs queued or running
+	size_t pending();
+
+private:
+	void run();
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	std::condition_variable m_idle;
+	std::deque<std::function<void()>> m_jobs;
+	bool m_running = false; // a job is executing
+	bool m_stop = false;
+	std::string m_error;
+};
+
+#endif // backgroundWriter_h
@@ -0,0 +1,70 @@
+#ifndef captureSignal_h
+#define captureSignal_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Completion of a rapid-block capture, signalled by the driver callbacks and
+ * waited on without polling: an eventfd is written once every expected run
+ * has called notify(), the waiting thread sleeps in poll() until then. Each
+ * run is tracked separately, so any number of units can share one signal.
+ *
+ * cancel() only touches an atomic flag and the eventfd, so it is safe from a
+ * signal handler. wait() installs a SIGINT handler that cancels the capture
+ * for as long as it is waiting and restores the previous one afterwards.
+ */
+class captureSignal
+{
+public:
+	enum result
+	{
+		completed,
+		cancelled,
+		timedOut
+	};
+
+	captureSignal();
+	~captureSignal();
+
+	captureSignal(const captureSignal &) = delete;
+	captureSignal &operator=(const captureSignal &) = delete;
+
+	// Call before starting runs 0 .. expected - 1, the run flags are reused
+	void reset(const uint32_t expected);
+	// Driver callback thread, repeated calls for the same run are ignored
+	void notify(const uint32_t run = 0);
+	// Async-signal-safe
+	void cancel();
+	// timeoutMs == 0 waits until completed or cancelled
+	result wait(const uint32_t timeoutMs);
+
+	uint32_t finished() const {return m_finished.load();}
+	bool runFinished(const uint32_t run) const {return run < m_expected.load() && m_runs.load()[run].done.load();}
+	// When notify() was first called for run, valid once wait() returned completed
+	std::chrono::steady_clock::time_point finishedAt(const uint32_t run) const;
+	bool cancelRequested() const {return m_cancelled.load();}
+
+private:
+	void wake();
+
+	struct runState
+	{
+		std::atomic<bool> done;
+		std::atomic<int64_t> finishedAt; // steady_clock ticks
+	};
+
+	int m_fd = -1;
+	std::atomic<uint32_t> m_expected {0};
+	std::atomic<runState *> m_runs {nullptr};
+	uint32_t m_capacity = 0;
+	// Only grows, older arrays are kept as a late callback may still be using one
+	std::vector<std::unique_ptr<runState[]>> m_storage;
+	std::atomic<uint32_t> m_finished {0};
+	std::atomic<bool> m_cancelled {false};
+};
+
+#endif // captureSignal_h
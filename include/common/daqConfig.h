@@ -0,0 +1,135 @@
+#ifndef daqConfig_h
+#define daqConfig_h
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/backgroundWriter.h"
+#include "common/datFormat.h"
+#include "common/datWriter.h"
+#include "common/runStats.h"
+#include "common/sampleArena.h"
+#include "common/summaryFormat.h"
+
+/*
+ * The model-independent half of the ps6000a and ps3000a DAQ modules: the
+ * setup of a unit's runs, the settings of the set* calls and the .dat and
+ * .sum files written from a capture. The scopes themselves are driven
+ * through daqUnit (common/daqSeries.h). A daqConfig copy is a snapshot of a
+ * capture: its buffers are shared, so queued files are written from it while
+ * the unit captures into its other set.
+ */
+class daqConfig
+{
+public:
+	std::string name;  // UnitName, for runStats
+	std::string model;
+	char serial[32];
+	std::bitset<4> activeChannels;
+	std::bitset<5> activeTriggers;
+	std::bitset<4> timebase;
+	std::bitset<16> chVoltageRanges;
+	std::vector<int16_t> chTriggerThresholdADC;
+	int16_t auxTriggerThresholdADC;
+	std::vector<uint16_t> chPostSamplesPerWaveform; // NOTE: Excludes pre trigger samples
+	uint16_t maxPostSamples;
+	int16_t samplesPreTrigger;
+	uint32_t numWaveforms;
+	std::vector<std::vector<void*>> dataBuffers; // slices of arena
+	std::shared_ptr<sampleArena> arena = std::make_shared<sampleArena>();
+	std::shared_ptr<sampleArena> spareArena = std::make_shared<sampleArena>(); // double buffering, see queueDataFile
+	bool bit8Buffers; // if true, write out only 8 bits to buffer and file
+	std::vector<uint8_t> chDownsampleMode = std::vector<uint8_t>(4, DAT_DOWNSAMPLE_NONE); // datDownsampling, done by the scope
+	std::vector<uint32_t> chDownsampleRatio = std::vector<uint32_t>(4, 1);
+
+	bool dataConfigured = false;
+	bool unitInitialised = false;
+
+	// Inputs of the driver setup last applied to the unit, see configureUnit
+	std::vector<int16_t> appliedRanges;
+	std::vector<int16_t> appliedTriggers; // mV, channels A-D then aux
+	std::vector<int64_t> appliedData;
+
+	// Samples per waveform in the buffers and the file, after downsampling
+	uint32_t storedSamples(int ch);
+	// Sample bytes taken off the scope per capture, after downsampling
+	uint64_t capturedBytes();
+	// The driver setup is unknown, the next configureUnit applies everything
+	void forgetApplied();
+	bool downsampled(int ch);
+	void print();
+};
+
+// Settings of the set* calls below, shared by every unit of the module
+extern uint32_t g_fileFormatVersion;  // .dat version written, see common/datFormat.h
+extern bool g_compressFiles;          // v2 only, payloads are written through common/adcCodec
+extern bool g_hugePageBuffers;        // data buffer arena options, see common/sampleArena.h
+extern bool g_lockDataBuffers;
+extern uint32_t g_rapidBlockWindow;   // see setRapidBlockWindow in the modules
+extern bool g_bit8Buffers;            // see setBit8Buffers, the ps3000a module clears it
+extern std::vector<uint8_t> g_chDownsampleMode; // see setDownsampling
+extern std::vector<uint32_t> g_chDownsampleRatio;
+extern uint8_t g_summaryMode;         // see setSummary
+extern summaryWindow g_summaryBaseline;
+extern std::vector<summaryWindow> g_summaryWindows;
+extern bool g_doubleBuffered;         // see queueDataFile
+extern backgroundWriter g_writer;
+extern std::string g_runStatsLog;     // see setRunStatsLog
+
+int setFileFormatVersion(uint32_t version);
+int setDataBufferOptions(bool hugePages, bool lock);
+// 8 bit (the default) or 16 bit samples in the data buffers and files.
+// Used from the next set*DaqSettings call
+int setBit8Buffers(bool enable);
+int setFileCompression(bool enable);
+/*
+ * Per channel driver downsampling (datDownsampling: 0 none, 1 aggregate,
+ * 2 decimate, 3 average) by ratio captured samples per stored sample.
+ * Used from the next set*DaqSettings call, needs .dat format version 2
+ */
+int setDownsampling(uint8_t chAMode, uint32_t chARatio, uint8_t chBMode, uint32_t chBRatio,
+                    uint8_t chCMode, uint32_t chCRatio, uint8_t chDMode, uint32_t chDRatio);
+/*
+ * Per waveform summaries (common/waveformSummary.h) of every capture: mode 0
+ * off, 1 written next to the .dat as <name>.sum, 2 written instead of it.
+ * The baseline and up to 4 charge windows are inclusive sample ranges, as
+ * lists of lower and upper edges.
+ */
+int setSummary(uint8_t mode, uint32_t baselineLower, uint32_t baselineUpper,
+               std::vector<uint32_t> windowLowers, std::vector<uint32_t> windowUppers);
+int setDoubleBuffering(bool enable);
+// Blocks until every queued file is written, rethrows the first write error
+int waitForWrites();
+/*
+ * Appends every collected run to path as one JSON line (common/runStats.h)
+ * once its files are written, "" (the default) logs nothing
+ */
+int setRunStatsLog(std::string path);
+
+// Both throw runtime_error
+void setDataOutput(char *outputFileName, datWriter &of);
+void closeDataOutput(datWriter &of);
+
+// Both malloc'd, free them
+char *concatTwoChar(char *line1, char *line2);
+// Replaces '/' with '-' and adds '_' to the start
+char *formatSerial(char *serial);
+// <basename>_<serial>.dat, malloc'd
+char *createFileName(char *serial, char *outputFileBasename);
+
+datHeaderV2 dataHeaderV2(daqConfig &dcc);
+// In the format of g_fileFormatVersion
+void writeDataHeader(daqConfig &dcc, datWriter &of);
+void writeDataOut(daqConfig &dcc, datWriter &of);
+// The .dat and, with setSummary, the .sum of a capture
+void writeDataFile(daqConfig &dcc, char *outputFile, std::shared_ptr<runStats> run);
+// One thread per unit, the first error is rethrown once every file is closed
+void writeDataFiles(std::vector<daqConfig *> &configs, std::vector<std::string> &outputFiles,
+                    std::shared_ptr<runStats> run);
+// Once every file of the run is on disk
+void finishRunStats(std::shared_ptr<runStats> run);
+
+#endif // daqConfig_h
@@ -0,0 +1,100 @@
+#ifndef daqSeries_h
+#define daqSeries_h
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+#include "common/daqConfig.h"
+#include "common/runStats.h"
+
+/*
+ * A unit as the model-independent DAQ code below drives it. Each DAQ module
+ * implements the driver calls on its dataCollectionConfig, which adds the
+ * model's UNIT; everything else (the cached setup, double buffering,
+ * multi-unit runs and sweeps) is shared by the models.
+ */
+class daqUnit : public daqConfig
+{
+public:
+	virtual ~daqUnit() {}
+
+	// Channels A-D, 99 off
+	virtual void setVoltages(int16_t ranges[4]) = 0;
+	// Threshold in ADC counts at the range of channel ch, 4 is aux (always +-1V)
+	virtual int16_t mvToAdc(int ch, int16_t mv) = 0;
+	// activeTriggers and their thresholds
+	virtual void setTriggers() = 0;
+	// A negative samplesPreTrigger as a post trigger delay
+	virtual void setDaqDelay() = 0;
+	// Registers dataBuffers, slices of *arena, for the current geometry
+	virtual void setDataBuffers() = 0;
+};
+
+// The units of a module's multiSeries calls, and their capture together
+class daqModel
+{
+public:
+	virtual ~daqModel() {}
+
+	// Every multiSeriesInitDaq unit, configured or not
+	virtual std::vector<daqUnit *> units() = 0;
+	// One rapid-block run of every configured unit
+	virtual void collectRapidBlocks() = 0;
+};
+
+void setActiveChannels(daqUnit &dcc, int16_t aChVoltage, int16_t bChVoltage, int16_t cChVoltage,
+                       int16_t dChVoltage);
+void setTriggerConfig(daqUnit &dcc, int16_t aTrigVoltageMv, int16_t bTrigVoltageMv, int16_t cTrigVoltageMv,
+                      int16_t dTrigVoltageMv, int16_t auxTrigVoltageMv);
+void setDataConfig(daqUnit &dcc, uint8_t timebase, uint32_t numWaveforms, int16_t samplesPreTrigger,
+                   uint16_t chAWfSamples, uint16_t chBWfSamples, uint16_t chCWfSamples, uint16_t chDWfSamples,
+                   bool bit8Buffers);
+void freeDataBuffers(daqUnit &dcc);
+/*
+ * Sets a unit up for the next runs, redoing only the driver calls whose
+ * inputs changed since the last call: channel ranges, triggers (their ADC
+ * thresholds depend on the ranges) and the segments and data buffer
+ * registrations, which are kept across runs. Between LED steps nothing
+ * changes and the scope is only armed again.
+ */
+void configureUnit(daqUnit &dcc, std::vector<int16_t> ranges, std::vector<int16_t> triggersMv,
+                   uint8_t timebase, uint32_t numWaveforms, int16_t samplesPreTrigger, std::vector<uint16_t> wfSamples);
+
+/*
+ * Double buffering: the buffer set holding capture N goes to g_writer with a
+ * copy of the config, the unit's other set is registered with the driver so
+ * capture N+1 can be armed straight away. The caller must have waited for
+ * g_writer first, the other set belongs to capture N-1 until it is on disk.
+ */
+void queueDataFile(daqUnit &dcc, char *outputFile, std::shared_ptr<runStats> run);
+/*
+ * One run of every configured unit, its files written, or queued with double
+ * buffering. written is called once they are on disk, from g_writer if queued
+ */
+void collectMultiRun(daqModel &model, char *outputFileBasename, std::function<void()> written = nullptr);
+
+/*
+ * Runs schedule (see sweepStep in daqSeries.cpp) on its own thread, with
+ * every unit of model. onStep(index, name, stage) is called on this thread
+ * for every "capturing" and "written" event, so checks and plots of a step
+ * run while the next one is captured; a False return stops the sweep after
+ * the step being captured, as does Ctrl+C. setLed (e.g. the daq6000
+ * function generator) and setBias are called from the sweep thread. Returns
+ * the number of steps written
+ */
+int sweepUnits(daqModel &model, pybind11::list schedule, pybind11::object setBias, pybind11::object setLed,
+               pybind11::object onStep);
+
+/*
+ * Where the last collection spent its time: name (the output basename),
+ * start (unix time), written (false while its files are queued) and units,
+ * per serial the seconds of every stage plus waveforms and bytes captured
+ */
+pybind11::dict getLastRunStats();
+
+#endif // daqSeries_h
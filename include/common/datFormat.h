@@ -0,0 +1,161 @@
+#ifndef datFormat_h
+#define datFormat_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * .dat file format, version 2
+ *
+ * Version 1 (writeDataHeader) is a packed big-endian bit field header with
+ * two NUL-terminated strings, followed by the big-endian samples. Version 2
+ * replaces it with:
+ *
+ *   [0, 256)           datHeaderV2, little-endian, including a per-channel
+ *                      offset table
+ *   [256, 4096)        zero padding
+ *   channel payloads   each channel starts on a g_datPayloadAlignment
+ *                      boundary and holds numWaveforms x numSamples samples
+ *                      in host (little-endian) order, int8 or int16, or
+ *                      an adcCodec stream when codec is DAT_CODEC_ADC
+ *
+ * A channel downsampled by the scope stores one sample per downsampleRatio
+ * captured samples, numSamples counts the stored ones. Aggregated waveforms
+ * hold the maximum of every bin followed by the minimum of every bin.
+ * preTriggerSamples stays in captured samples.
+ *
+ * A v1 file can never start with the v2 magic: bits 6-7 of the second v1
+ * byte are always zero while the second magic byte is 'P' (0x50).
+ * Files are read and written with plain memcpy, so only little-endian hosts
+ * (x86-64, ARM Linux) are supported for v2.
+ */
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, ".dat v2 support assumes a little-endian host");
+
+const char g_datMagic[8] = {'\x89', 'P', 'M', 'T', 'D', 'A', 'T', '\n'};
+const uint32_t g_datVersion1 = 1;
+const uint32_t g_datVersion2 = 2;
+const size_t g_datPayloadAlignment = 4096;
+
+// How the channel payloads are stored
+enum datCodec
+{
+	DAT_CODEC_RAW = 0, // numWaveforms x numSamples samples
+	DAT_CODEC_ADC = 1  // lossless, see common/adcCodec.h
+};
+
+// Driver-side downsampling of a channel
+enum datDownsampling
+{
+	DAT_DOWNSAMPLE_NONE = 0,
+	DAT_DOWNSAMPLE_AGGREGATE = 1, // max and min of each bin
+	DAT_DOWNSAMPLE_DECIMATE = 2,  // first sample of each bin
+	DAT_DOWNSAMPLE_AVERAGE = 3
+};
+
+#pragma pack(push, 1)
+
+struct datChannelV2
+{
+	uint64_t offset;           // from the start of the file, 0 if the channel is inactive
+	uint64_t bytes;            // numWaveforms x waveformStride, or the encoded size
+	uint32_t numSamples;       // per waveform, including pre trigger samples
+	uint32_t waveformStride;   // bytes between consecutive decoded waveforms
+	int16_t triggerThresholdAdc;
+	uint8_t vRange;            // index into the driver's range table
+	uint8_t downsampleMode;    // datDownsampling
+	uint32_t downsampleRatio;  // captured samples per stored sample, 0 or 1 if not downsampled
+};
+
+struct datHeaderV2
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;      // sizeof(datHeaderV2), later versions may grow it
+	uint32_t payloadAlignment;
+	uint8_t timebase;
+	uint8_t sampleBytes;       // 1 or 2
+	uint8_t activeChannels;    // bit 0 = channel A
+	uint8_t activeTriggers;    // bit 0 = aux, bits 1-4 = channels A-D
+	int16_t auxTriggerThresholdAdc;
+	int16_t preTriggerSamples;
+	uint32_t numWaveforms;
+	int64_t timestamp;         // unix time
+	char model[32];            // NUL padded
+	char serial[32];           // NUL padded
+	uint8_t codec;             // datCodec
+	uint8_t reserved[23];
+	datChannelV2 channels[4];
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(datChannelV2) == 32, "datChannelV2 layout changed");
+static_assert(sizeof(datHeaderV2) == 256, "datHeaderV2 layout changed");
+
+inline bool isDatV2(const uint8_t *bytes, const size_t size)
+{
+	return size >= sizeof(g_datMagic) && memcmp(bytes, g_datMagic, sizeof(g_datMagic)) == 0;
+}
+
+inline uint64_t datAlign(const uint64_t n)
+{
+	return (n + g_datPayloadAlignment - 1) / g_datPayloadAlignment * g_datPayloadAlignment;
+}
+
+// Fills the fixed fields, the caller sets the acquisition settings
+inline void datInitHeaderV2(datHeaderV2 &h)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, g_datMagic, sizeof(g_datMagic));
+	h.version = g_datVersion2;
+	h.headerBytes = sizeof(datHeaderV2);
+	h.payloadAlignment = g_datPayloadAlignment;
+}
+
+// Lays out the channel payloads once numWaveforms, sampleBytes and each
+// channel's numSamples are set (and for encoded files each channel's bytes).
+// Returns the total file size
+inline uint64_t datLayoutV2(datHeaderV2 &h)
+{
+	uint64_t offset = datAlign(h.headerBytes);
+	uint64_t end = h.headerBytes;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		datChannelV2 &c = h.channels[ch];
+		if (!(h.activeChannels & (1 << ch)))
+		{
+			c.offset = 0;
+			c.bytes = 0;
+			continue;
+		}
+		c.waveformStride = c.numSamples * h.sampleBytes;
+		if (h.codec == DAT_CODEC_RAW)
+		{
+			c.bytes = (uint64_t) c.waveformStride * h.numWaveforms;
+		}
+		c.offset = offset;
+		end = offset + c.bytes;
+		offset = datAlign(end);
+	}
+	return end;
+}
+
+// Samples stored per waveform for rawSamples captured samples
+inline uint32_t datStoredSamples(const uint32_t rawSamples, const uint8_t mode, const uint32_t ratio)
+{
+	if (mode == DAT_DOWNSAMPLE_NONE || ratio <= 1)
+	{
+		return rawSamples;
+	}
+	return rawSamples / ratio * (mode == DAT_DOWNSAMPLE_AGGREGATE ? 2 : 1);
+}
+
+// Raw payloads only
+inline uint64_t datWaveformOffsetV2(const datHeaderV2 &h, const int ch, const uint32_t wf)
+{
+	return h.channels[ch].offset + (uint64_t) wf * h.channels[ch].waveformStride;
+}
+
+#endif // datFormat_h
@@ -0,0 +1,63 @@
+#ifndef datWriter_h
+#define datWriter_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+
+/*
+ * Output file for the DAQ modules, a drop-in for the subset of std::ofstream
+ * they use (open, write, seekp, tellp, close) plus a bulk waveform writer.
+ *
+ * Small writes (the header fields) are collected in memory and go out with the
+ * next waveform batch. Waveform buffers are handed to the kernel as they are
+ * with pwritev, up to IOV_MAX per call, so a channel of 20000 waveforms costs a
+ * few dozen syscalls and no copy, or a single one when the waveforms are
+ * contiguous (common/sampleArena.h). v1 16 bit payloads must be big-endian on
+ * disk: they are swapped into a staging buffer that is reused between calls
+ * and written in g_writeStagingBytes chunks.
+ */
+
+const size_t g_writeStagingBytes = 4 << 20;
+
+class datWriter
+{
+public:
+	datWriter() {}
+	~datWriter();
+
+	datWriter(const datWriter &) = delete;
+	datWriter &operator=(const datWriter &) = delete;
+
+	// Creates or truncates the file
+	bool open(const char *path);
+	bool is_open() const {return m_fd >= 0;}
+	// Flushes and closes, false if any write failed since open()
+	bool close();
+
+	datWriter &write(const char *data, const size_t bytes);
+	datWriter &seekp(const uint64_t offset);
+	uint64_t tellp() const {return m_pos + m_pending.size();}
+
+	// numWaveforms buffers of waveformBytes each, back to back at tellp(). bigEndian16
+	// stores host order 16 bit samples big-endian (v1 payloads)
+	datWriter &writeWaveforms(const void *const *waveforms, const uint32_t numWaveforms, const size_t waveformBytes,
+							  const bool bigEndian16);
+
+	// False once a write failed
+	explicit operator bool() const {return m_ok;}
+
+private:
+	bool flush();
+	bool pwritevAll(iovec *iov, int count, uint64_t offset);
+
+	int m_fd = -1;
+	bool m_ok = false;
+	uint64_t m_pos = 0;           // file offset of m_pending
+	std::vector<char> m_pending;  // small writes not yet in the file
+	std::vector<int16_t> m_staging;
+};
+
+#endif // datWriter_h
@@ -0,0 +1,9 @@
+#ifndef jsonString_h
+#define jsonString_h
+
+#include <string>
+
+// s as a quoted JSON string, quotes, backslashes and control characters escaped
+std::string jsonString(const std::string &s);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef pulseFinder_h
+#define pulseFinder_h
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Threshold-crossing pulse finder for one channel of a continuous stream.
+ * A negative threshold looks for falling crossings below it, a positive one
+ * for rising crossings above it. After a crossing the signal has to return
+ * past the threshold before the next one counts.
+ *
+ * Every crossing is counted. A crossing outside a snippet starts one: the
+ * preSamples samples before it and the postSamples samples from it onwards
+ * are handed to the callback once complete. Crossings inside a snippet only
+ * add to the count.
+ */
+class pulseFinder
+{
+public:
+	// sample is the stream index of snippet[0]
+	typedef std::function<void(uint64_t sample, const int16_t *snippet, uint32_t n)> snippetFn;
+
+	pulseFinder(const int16_t threshold, const uint32_t preSamples, const uint32_t postSamples, snippetFn onSnippet);
+
+	void process(const int16_t *samples, const size_t n);
+
+	uint64_t samples() const {return m_samples;}
+	uint64_t pulses() const {return m_pulses;}
+	uint64_t snippets() const {return m_snippets;}
+	uint32_t snippetSamples() const {return m_pre + m_post;}
+
+private:
+	bool beyond(const int16_t v) const {return m_falling ? v < m_threshold : v > m_threshold;}
+
+	int16_t m_threshold;
+	bool m_falling;
+	uint32_t m_pre;
+	uint32_t m_post;
+	snippetFn m_onSnippet;
+
+	std::vector<int16_t> m_history; // last m_pre samples, circular
+	uint32_t m_historyPos = 0;
+	std::vector<int16_t> m_snippet;
+	bool m_collecting = false;
+	uint32_t m_filled = 0;          // samples in m_snippet
+	uint64_t m_snippetStart = 0;
+	bool m_armed = false;           // last sample was on the quiet side of the threshold
+	uint64_t m_samples = 0;
+	uint64_t m_pulses = 0;
+	uint64_t m_snippets = 0;
+};
+
+#endif // pulseFinder_h
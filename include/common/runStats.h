@@ -0,0 +1,93 @@
+#ifndef runStats_h
+#define runStats_h
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Wall time of every stage of a DAQ run, per unit. The wrappers and the DAQ
+ * modules add to the run being collected (runStats::current()) through
+ * stageTimer; finish() closes it once the data is off the scopes, the file
+ * writes (possibly queued) keep a pointer to it and add their own time.
+ */
+
+enum daqStage
+{
+	STAGE_CONFIGURE = 0,    // channels, triggers and buffer registration
+	STAGE_ARM = 1,          // window buffers, overlapped transfer and RunBlock
+	STAGE_TRIGGER_WAIT = 2, // RunBlock until the driver callback, overlapped window transfers too
+	STAGE_TRANSFER = 3,     // bulk transfers after the capture
+	STAGE_WRITE = 4,        // files, summaries included
+	STAGE_RESET = 5,        // Stop, double buffer swap
+	DAQ_STAGES = 6
+};
+
+extern const char *const g_daqStageNames[DAQ_STAGES];
+
+class runStats
+{
+public:
+	struct unitStats
+	{
+		std::string unit;
+		double seconds[DAQ_STAGES];
+		uint32_t waveforms;
+		uint64_t bytes;          // sample bytes taken off the scope
+	};
+
+	void add(const std::string &unit, const daqStage stage, const double seconds);
+	void setData(const std::string &unit, const uint32_t waveforms, const uint64_t bytes);
+	// Files are on disk, every stage is in
+	void setWritten();
+
+	std::string name() const;
+	double start() const;        // unix time of the first stage
+	bool written() const;
+	std::vector<unitStats> units() const;
+	// One line, no newline
+	std::string json() const;
+	// Appends json() to path, nothing if path is empty
+	void log(const std::string &path) const;
+
+	// The run being collected
+	static std::shared_ptr<runStats> current();
+	// Names and closes the current run and starts the next one. Returns the closed run
+	static std::shared_ptr<runStats> finish(const std::string &name);
+	// The run closed last
+	static std::shared_ptr<runStats> last();
+
+private:
+	unitStats &find(const std::string &unit);
+
+	mutable std::mutex m_mutex;
+	std::string m_name;
+	double m_start = 0;
+	bool m_written = false;
+	std::vector<unitStats> m_units;
+};
+
+// Adds the time from construction to stop() (or destruction) to a stage of a run
+class stageTimer
+{
+public:
+	stageTimer(const std::string &unit, const daqStage stage, std::shared_ptr<runStats> run = runStats::current());
+	~stageTimer() {stop();}
+
+	stageTimer(const stageTimer &) = delete;
+	stageTimer &operator=(const stageTimer &) = delete;
+
+	void stop();
+
+private:
+	std::shared_ptr<runStats> m_run;
+	std::string m_unit;
+	daqStage m_stage;
+	std::chrono::steady_clock::time_point m_begin;
+	bool m_stopped = false;
+};
+
+#endif // runStats_h
@@ -0,0 +1,55 @@
+#ifndef sampleArena_h
+#define sampleArena_h
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * One block of memory holding every rapid-block segment of a unit, carved
+ * into per-channel, per-waveform slices by SetDataBuffers. The block is kept
+ * between collections and only grows when a new geometry needs more room, so
+ * the driver buffers stay registered and nothing is allocated between LED
+ * steps. Every page is faulted in at allocation, never during a run.
+ *
+ * Transparent hugepages are requested with madvise. hugePages asks for
+ * explicit hugetlb pages first, lock mlock()s the block; both fall back
+ * (with a warning) when the system does not allow them, e.g. no reserved
+ * hugepages or a low RLIMIT_MEMLOCK.
+ */
+
+// Alignment of each channel's slice, waveforms are packed back to back inside it
+const size_t g_arenaChannelAlignment = 4096;
+
+class sampleArena
+{
+public:
+	sampleArena() {}
+	~sampleArena();
+
+	sampleArena(const sampleArena &) = delete;
+	sampleArena &operator=(const sampleArena &) = delete;
+
+	// Applied by the next reserve()
+	void setOptions(const bool hugePages, const bool lock);
+	// Makes the block at least bytes long, keeps it when it already is and the options
+	// did not change. Existing contents are not preserved. Returns false if allocation failed
+	bool reserve(const size_t bytes);
+	void release();
+
+	uint8_t *data() const {return m_data;}
+	size_t capacity() const {return m_capacity;}
+	bool hugePages() const {return m_hugePages;}
+	bool locked() const {return m_locked;}
+
+private:
+	uint8_t *m_data = nullptr;
+	size_t m_capacity = 0;
+	size_t m_mapped = 0;
+	bool m_hugePages = false;
+	bool m_locked = false;
+	bool m_wantHugePages = false;
+	bool m_wantLock = false;
+	bool m_optionsChanged = false;
+};
+
+#endif // sampleArena_h
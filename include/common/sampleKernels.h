@@ -0,0 +1,40 @@
+#ifndef sampleKernels_h
+#define sampleKernels_h
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Block kernels for the 16 bit sample payload of .dat files (big-endian in
+ * v1, host order in v2).
+ * Each call handles a whole waveform (or channel) in one pass. The AVX2,
+ * SSE4.1 or scalar version is picked at runtime from the host CPU.
+ * Inputs and outputs may be unaligned, in and out may alias for swaps.
+ */
+
+enum sampleIsa
+{
+	ISA_SCALAR,
+	ISA_SSE41,
+	ISA_AVX2
+};
+
+// Host samples -> big-endian file samples (and back, the swap is symmetric)
+void swapBigEndian16(const void *in, int16_t *out, const size_t n);
+
+// Big-endian 16 bit ADC counts -> mV, same rounding as adc2mv() in the analysis
+void beAdcToMv(const void *in, float *out, const size_t n, const int rangeMv, const bool invert);
+
+// Host order 16 bit ADC counts (.dat v2 payloads) -> mV, same rounding as adc2mv()
+void adc16ToMv(const void *in, float *out, const size_t n, const int rangeMv, const bool invert);
+
+// 8 bit ADC counts -> mV, same rounding as adc8Bit2mv() in the analysis
+void adc8ToMv(const int8_t *in, float *out, const size_t n, const int rangeMv, const bool invert);
+
+sampleIsa sampleKernelIsa();
+const char *sampleIsaName(const sampleIsa isa);
+
+// Forces a kernel set, e.g. for benchmarks. Returns false if the CPU lacks it
+bool setSampleKernelIsa(const sampleIsa isa);
+
+#endif // sampleKernels_h
@@ -0,0 +1,145 @@
+#ifndef sampleRing_h
+#define sampleRing_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+/*
+ * Wakes a consumer sleeping until one of its rings has new samples or is
+ * closed. Read sequence() before looking at the rings, then waitPast() it:
+ * a push in between has already moved the sequence on, nothing is missed.
+ */
+class ringSignal
+{
+public:
+	void notify()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_sequence;
+		}
+		m_changed.notify_all();
+	}
+
+	uint64_t sequence()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sequence;
+	}
+
+	void waitPast(const uint64_t sequence)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait(lock, [&]() {return m_sequence != sequence;});
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	uint64_t m_sequence = 0;
+};
+
+/*
+ * Lock-free single-producer single-consumer ring of samples, between the
+ * streaming thread copying out of the driver buffers and the thread looking
+ * for pulses. The producer only advances m_head, the consumer only m_tail,
+ * both are free running and wrap through the power of two mask.
+ *
+ * push() never blocks: samples that do not fit are left to the caller,
+ * which counts them as dropped rather than stalling the driver. push() and
+ * close() notify signal, if given, so the consumer does not have to poll.
+ */
+template <typename T>
+class sampleRing
+{
+public:
+	// Capacity is rounded up to a power of two
+	explicit sampleRing(size_t capacity, ringSignal *signal = nullptr)
+		: m_signal(signal)
+	{
+		size_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		m_data.resize(size);
+		m_mask = size - 1;
+	}
+
+	sampleRing(const sampleRing &) = delete;
+	sampleRing &operator=(const sampleRing &) = delete;
+
+	// Producer, returns the samples written
+	size_t push(const T *data, size_t n)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		const size_t tail = m_tail.load(std::memory_order_acquire);
+		n = std::min(n, m_data.size() - (head - tail));
+		copyIn(data, head, n);
+		m_head.store(head + n, std::memory_order_release);
+		if (m_signal != nullptr && n > 0)
+		{
+			m_signal->notify();
+		}
+		return n;
+	}
+
+	// Consumer, returns the samples read
+	size_t pop(T *out, size_t max)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t head = m_head.load(std::memory_order_acquire);
+		const size_t n = std::min(max, head - tail);
+		copyOut(out, tail, n);
+		m_tail.store(tail + n, std::memory_order_release);
+		return n;
+	}
+
+	size_t size() const {return m_head.load() - m_tail.load();}
+	size_t capacity() const {return m_data.size();}
+	// Producer, samples push() takes at least
+	size_t space() const {return m_data.size() - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));}
+
+	// Producer is done, the consumer drains what is left
+	void close()
+	{
+		m_closed.store(true, std::memory_order_release);
+		if (m_signal != nullptr)
+		{
+			m_signal->notify();
+		}
+	}
+	bool closed() const {return m_closed.load(std::memory_order_acquire);}
+
+private:
+	void copyIn(const T *in, size_t pos, size_t n)
+	{
+		const size_t start = pos & m_mask;
+		const size_t first = std::min(n, m_data.size() - start);
+		memcpy(m_data.data() + start, in, first * sizeof(T));
+		memcpy(m_data.data(), in + first, (n - first) * sizeof(T));
+	}
+
+	void copyOut(T *out, size_t pos, size_t n) const
+	{
+		const size_t start = pos & m_mask;
+		const size_t first = std::min(n, m_data.size() - start);
+		memcpy(out, m_data.data() + start, first * sizeof(T));
+		memcpy(out + first, m_data.data(), (n - first) * sizeof(T));
+	}
+
+	std::vector<T> m_data;
+	size_t m_mask;
+	ringSignal *m_signal;
+	alignas(64) std::atomic<size_t> m_head {0};
+	alignas(64) std::atomic<size_t> m_tail {0};
+	std::atomic<bool> m_closed {false};
+};
+
+#endif // sampleRing_h
@@ -0,0 +1,74 @@
+#ifndef streamFormat_h
+#define streamFormat_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * .pulses file format, written by streaming acquisitions
+ *
+ *   [0, 256)    streamHeader, little-endian like .dat v2
+ *   records     streamPulse followed by snippetSamples int16 samples of its
+ *               channel, in the order the pulses were found
+ *
+ * The header is written again when the run ends, with the final sample,
+ * pulse and snippet counts. A run cut short (crash, power) keeps samples = 0
+ * and its records can still be read up to the last complete one.
+ */
+
+const char g_streamMagic[8] = {'\x89', 'P', 'M', 'T', 'S', 'T', 'R', '\n'};
+const uint32_t g_streamVersion = 1;
+
+#pragma pack(push, 1)
+
+struct streamChannel
+{
+	int16_t thresholdAdc;      // 0 if no pulses were looked for
+	uint8_t vRange;            // index into the driver's range table
+	uint8_t reserved;
+	uint32_t snippetSamples;   // per record, preSamples of them before the crossing
+	uint64_t pulses;           // threshold crossings
+	uint64_t snippets;         // records written, crossings inside a snippet have none
+};
+
+struct streamHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;      // sizeof(streamHeader)
+	double sampleIntervalNs;
+	uint64_t samples;          // per channel
+	uint64_t droppedSamples;   // per channel, lost to a full ring, later records are early by up to this many samples
+	int64_t timestamp;         // unix time of the start
+	char model[32];            // NUL padded
+	char serial[32];           // NUL padded
+	uint8_t activeChannels;    // bit 0 = channel A
+	uint8_t reserved0;
+	uint16_t preSamples;
+	uint8_t reserved[44];
+	streamChannel channels[4];
+};
+
+struct streamPulse
+{
+	uint64_t sample;           // stream index of the first snippet sample
+	uint8_t channel;
+	uint8_t reserved[7];
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(streamChannel) == 24, "streamChannel layout changed");
+static_assert(sizeof(streamHeader) == 256, "streamHeader layout changed");
+static_assert(sizeof(streamPulse) == 16, "streamPulse layout changed");
+
+inline void streamInitHeader(streamHeader &h)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, g_streamMagic, sizeof(h.magic));
+	h.version = g_streamVersion;
+	h.headerBytes = sizeof(streamHeader);
+}
+
+#endif // streamFormat_h
@@ -0,0 +1,111 @@
+#ifndef summaryFormat_h
+#define summaryFormat_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * .sum file format, per waveform summaries written by the DAQ next to (or
+ * instead of) the .dat file of a capture, see common/waveformSummary.h
+ *
+ *   [0, 256)    summaryHeader, little-endian like .dat v2
+ *   records     per active channel, numWaveforms records of recordBytes
+ *               starting at the channel's offset
+ *
+ * A record is a summaryRecord followed by numWindows float charges. Values
+ * stay in ADC counts and stored samples, readers scale them with the
+ * channel's vRange, timebase and downsampleRatio like .dat samples:
+ *   baseline   mean of the baseline window
+ *   minimum    smallest sample of the waveform, at minimumIndex
+ *   charge     sum of the window minus baseline x window length
+ * Windows are inclusive, [lower, upper], and cut to the channel's numSamples.
+ * Aggregated channels are summarised from their minima.
+ */
+
+const char g_summaryMagic[8] = {'\x89', 'P', 'M', 'T', 'S', 'U', 'M', '\n'};
+const uint32_t g_summaryVersion = 1;
+const uint32_t g_summaryMaxWindows = 4;
+
+#pragma pack(push, 1)
+
+struct summaryWindow
+{
+	uint32_t lower;
+	uint32_t upper;
+};
+
+struct summaryChannel
+{
+	uint64_t offset;           // from the start of the file, 0 if the channel is inactive
+	uint32_t numSamples;       // stored samples per waveform, as in the .dat
+	uint32_t downsampleRatio;  // 0 or 1 if not downsampled
+	uint8_t downsampleMode;    // datDownsampling
+	uint8_t vRange;            // index into the driver's range table
+	uint8_t reserved[6];
+};
+
+struct summaryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;      // sizeof(summaryHeader)
+	uint32_t recordBytes;      // sizeof(summaryRecord) + 4 x numWindows
+	uint8_t timebase;
+	uint8_t sampleBytes;       // of the summarised samples, 1 or 2
+	uint8_t activeChannels;    // bit 0 = channel A
+	uint8_t numWindows;
+	int16_t preTriggerSamples;
+	uint16_t reserved0;
+	uint32_t numWaveforms;
+	int64_t timestamp;         // unix time
+	char model[32];            // NUL padded
+	char serial[32];           // NUL padded
+	summaryWindow baseline;
+	summaryWindow windows[g_summaryMaxWindows];
+	uint8_t reserved[16];
+	summaryChannel channels[4];
+};
+
+struct summaryRecord
+{
+	float baseline;
+	int16_t minimum;
+	uint16_t reserved;
+	uint32_t minimumIndex;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(summaryChannel) == 24, "summaryChannel layout changed");
+static_assert(sizeof(summaryHeader) == 256, "summaryHeader layout changed");
+static_assert(sizeof(summaryRecord) == 12, "summaryRecord layout changed");
+
+inline void summaryInitHeader(summaryHeader &h)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, g_summaryMagic, sizeof(h.magic));
+	h.version = g_summaryVersion;
+	h.headerBytes = sizeof(summaryHeader);
+}
+
+// Sets recordBytes and the channel offsets once numWindows, numWaveforms and
+// activeChannels are set. Returns the total file size
+inline uint64_t summaryLayout(summaryHeader &h)
+{
+	h.recordBytes = sizeof(summaryRecord) + sizeof(float) * h.numWindows;
+	uint64_t offset = h.headerBytes;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (!(h.activeChannels & (1 << ch)))
+		{
+			h.channels[ch].offset = 0;
+			continue;
+		}
+		h.channels[ch].offset = offset;
+		offset += (uint64_t) h.recordBytes * h.numWaveforms;
+	}
+	return offset;
+}
+
+#endif // summaryFormat_h
@@ -0,0 +1,52 @@
+#ifndef sweepEvents_h
+#define sweepEvents_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+/*
+ * Progress of a sweep (a schedule of DAQ runs) from the thread running it to
+ * the thread reporting it. The runner pushes an event per step and stage and
+ * calls finish() when it is done; the reporter takes them in order with
+ * next(), and can ask the runner to stop after the step it is on.
+ */
+class sweepEvents
+{
+public:
+	struct event
+	{
+		uint32_t step;
+		std::string stage;
+	};
+
+	enum result
+	{
+		received,
+		timedOut,
+		finished       // every event has been taken and the runner is done
+	};
+
+	void push(const uint32_t step, const std::string &stage);
+	// Runner side, error is "" on success
+	void finish(const std::string &error);
+	result next(event &e, const uint32_t timeoutMs);
+	// The runner's error, valid once next() returned finished
+	std::string error();
+
+	void stop() {m_stop.store(true);}
+	bool stopRequested() const {return m_stop.load();}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::deque<event> m_events;
+	bool m_finished = false;
+	std::string m_error;
+	std::atomic<bool> m_stop {false};
+};
+
+#endif // sweepEvents_h
@@ -0,0 +1,25 @@
+#ifndef waveformSummary_h
+#define waveformSummary_h
+
+#include <cstdint>
+#include <vector>
+
+#include "common/summaryFormat.h"
+
+/*
+ * Online feature extraction: reduces each captured waveform to a .sum record
+ * (baseline, minimum and its index, charge in every window) with the integer
+ * kernels of common/adcKernels.h, so runs only needing those numbers can skip
+ * most of the .dat volume. Same definitions as the quick pre-analysis, but
+ * with a plain mean for the baseline.
+ */
+
+// Records for numWaveforms waveforms of numSamples samples (sampleBytes 1 or 2),
+// back to back. aggregated waveforms hold maxima then minima, only the minima
+// are summarised. threads = 0 uses every core
+std::vector<uint8_t> summariseWaveforms(const void *const *waveforms, const uint32_t numWaveforms,
+										const uint32_t numSamples, const uint32_t sampleBytes,
+										const summaryWindow &baseline, const std::vector<summaryWindow> &windows,
+										const bool aggregated, unsigned threads = 0);
+
+#endif // waveformSummary_h
@@ -24,6 +24,8 @@
 
 #include <libps3000a/PicoStatus.h>
 
+#include "common/sampleArena.h"
+
 // #define PS3000A_MAX_CHANNELS 4
 
 typedef enum enPSChannel
@@ -148,13 +150,22 @@ const double psmVRange[PS_MAX_RANGES] =
 
 void set_info(UNIT *unit);
 
+// Serial of the unit, its run stats are kept under it
+std::string UnitName(UNIT *unit);
+
 void SetDefaults(UNIT *unit);
 
 void SetVoltages(UNIT *unit, int16_t ranges[4]);
 
+/*
+ * chDownsampleMode (datDownsampling) and chDownsampleRatio have the scope
+ * downsample a channel as it is transferred. Its buffers then hold
+ * datStoredSamples() samples per waveform, see common/datFormat.h
+ */
 std::vector<std::vector<void*>> SetDataBuffers(UNIT *unit, std::bitset<4> activeChannels, 
 	std::vector<uint16_t> samplesPostPerChannel, int16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers);
+	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers, sampleArena &arena,
+	std::vector<uint8_t> chDownsampleMode, std::vector<uint32_t> chDownsampleRatio);
 
 void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples);
 
@@ -165,6 +176,18 @@ void SetSimpleAuxTrigger(UNIT *unit);
 
 void SetDaqDelay(UNIT *unit, int16_t delay);
 
+/*
+ * Splits rapid-block runs longer than segments waveforms into windows of that
+ * many segments, each transferred by the driver as soon as it is captured
+ * while the next window is armed. Runs can then be longer than scope memory.
+ * 0 (the default) captures every run in one block. Applied by SetDataBuffers.
+ */
+void SetRapidBlockWindow(uint32_t segments);
+
+// Longest wait for a rapid-block capture to complete, 0 waits until it completes or SIGINT.
+// Until set, single-unit captures wait without a limit and multi-unit captures for 5 s
+void SetCaptureTimeout(uint32_t timeoutMs);
+
 void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms);
 
@@ -24,6 +24,8 @@
 
 #include <libps6000/PicoStatus.h>
 
+#include "common/sampleArena.h"
+
 typedef enum enBOOL{FALSE,TRUE} BOOL;
 
 typedef enum {
@@ -97,13 +99,16 @@ void SetVoltages(UNIT *unit, int16_t ranges[4]);
 
 std::vector<std::vector<int16_t*>> SetDataBuffers(UNIT *unit, std::bitset<4> activeChannels, 
 	std::vector<uint16_t> samplesPostPerChannel, uint16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples);
+	uint32_t numWaveforms, uint16_t maxPostSamples, sampleArena &arena);
 
 void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples);
 
 void SetSimpleTriggerSettings(UNIT *unit, int16_t threshold, 
 		PS6000_THRESHOLD_DIRECTION dir, PS6000_CHANNEL ch);
 
+// Longest wait for a rapid-block capture to complete, 0 waits until it completes or SIGINT
+void SetCaptureTimeout(uint32_t timeoutMs);
+
 void StartRapidBlock(UNIT *unit, uint16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms);
 
@@ -24,6 +24,10 @@
 
 #include <libps6000a/PicoStatus.h>
 
+#include "common/captureSignal.h"
+#include "common/sampleArena.h"
+#include "common/sampleRing.h"
+
 #define PS6000A_MAX_CHANNELS 8 //analog chs only
 
 typedef enum enPSChannel
@@ -113,13 +117,22 @@ typedef struct
 
 void set_info(UNIT *unit);
 
+// Serial of the unit, its run stats are kept under it
+std::string UnitName(UNIT *unit);
+
 void SetDefaults(UNIT *unit);
 
 void SetVoltages(UNIT *unit, int16_t ranges[4]);
 
+/*
+ * chDownsampleMode (datDownsampling) and chDownsampleRatio have the scope
+ * downsample a channel as it is transferred. Its buffers then hold
+ * datStoredSamples() samples per waveform, see common/datFormat.h
+ */
 std::vector<std::vector<void*>> SetDataBuffers(UNIT *unit, std::bitset<4> activeChannels, 
 	std::vector<uint16_t> samplesPostPerChannel, int16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers);
+	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers, sampleArena &arena,
+	std::vector<uint8_t> chDownsampleMode, std::vector<uint32_t> chDownsampleRatio);
 
 void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples);
 
@@ -130,6 +143,18 @@ void SetSimpleAuxTrigger(UNIT *unit);
 
 void SetDaqDelay(UNIT *unit, int16_t delay);
 
+/*
+ * Splits rapid-block runs longer than segments waveforms into windows of that
+ * many segments, each transferred by the driver as soon as it is captured
+ * while the next window is armed. Runs can then be longer than scope memory.
+ * 0 (the default) captures every run in one block. Applied by SetDataBuffers.
+ */
+void SetRapidBlockWindow(uint32_t segments);
+
+// Longest wait for a rapid-block capture to complete, 0 waits until it completes or SIGINT.
+// Until set, single-unit captures wait without a limit and multi-unit captures for 5 s
+void SetCaptureTimeout(uint32_t timeoutMs);
+
 void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms);
 
@@ -137,6 +162,17 @@ void StartMultiRapidBlock(std::vector<UNIT *> vecUnit, std::vector<int16_t> vecP
 	std::vector<uint16_t> vecPostTriggerMax, std::vector<uint8_t> vecTimebase,
 	std::vector<uint32_t> vecNumWaveforms);
 
+/*
+ * Streams the active channels, untriggered, into one ring per active channel
+ * (channel order) until samples per channel have been taken or stop is
+ * cancelled. Samples the fullest ring cannot take are dropped from every
+ * channel, so the channels stay aligned, and counted once in dropped. The
+ * caller closes the rings once it has the results. sampleIntervalNs is updated to the interval the
+ * scope chose. Returns the samples streamed per channel
+ */
+uint64_t StartStreaming(UNIT *unit, std::bitset<4> activeChannels, double &sampleIntervalNs,
+	uint64_t samples, std::vector<sampleRing<int16_t> *> rings, uint64_t &dropped, captureSignal &stop);
+
 void disableTrigger(UNIT *unit);
 
 void SetMultiTriggerSettings(UNIT *unit, std::bitset<5> triggers, std::vector<int8_t> thresholds,
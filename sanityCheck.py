@@ -1,83 +1,145 @@
 import sys
+import struct
 import numpy as np
 import matplotlib.pyplot as plt
+try:
+    import datreader # compiled zero-copy reader, 'make datreader'
+except ImportError:
+    datreader = None
 
 ps6000VRanges = [10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 
                  10000, 20000, 50000]
 
+# .dat v2, see include/common/datFormat.h
+datMagic = b'\x89PMTDAT\n'
+datHeaderV1 = struct.Struct('>BBh4hH4HHIi')
+datHeaderV2 = struct.Struct('<8sIIIBBBBhhIq32s32sB23x')
+datChannelV2 = struct.Struct('<QQIIhBBI')
+datCodecAdc = 1
+
+# .sum, see include/common/summaryFormat.h
+sumMagic = b'\x89PMTSUM\n'
+sumHeader = struct.Struct('<8sIIIBBBBhHIq32s32s10I16x') # baseline and 4 charge windows as 10 edges
+sumChannel = struct.Struct('<QIIBB6x')
+
 plt.ion()
 g_fig = None
 g_picoscopes = None
 
-def byteBin(byte):
-    return '{0:08b}'.format(ord(byte))
-
-def byteHex(byte):
-    return '{0:02x}'.format(ord(byte))
-
-def bytesBin(f,n):
-    s = ""
-    for i in range(n):
-        s += byteBin(f.read(1))
-    return s
-
-def bytesInt(f,n):
-    s = ""
-    for i in range(n):
-        s += byteHex(f.read(1))
-    return int(s,16)
-
-def bytesHex(f,n):
-    s = ""
-    for i in range(n):
-        s += byteHex(f.read(1))
-    return s
-
-def bytesTwos(f,n):
-    hexStr = bytesHex(f,n)
-
-    value = int(hexStr, 16)
-    if value & (1 << (n * 8 - 1)):
-        value -= 1 << n * 8
-    return value
-
-def bytesString(f, n = 0): # xxx: if n = 0, read until 0 byte, else read n bytes
-    c = f.read(1)
-    s = ''
-    while c != b'\0':
-        s += c.decode()
-        c = f.read(1)
-    return s
-
 def adc2mv(value, range):
     return (value / 32512) * ps6000VRanges[range]
 
+def readHeaderV2(f):
+    d = {}
+    (magic, version, headerBytes, alignment, timebase, sampleBytes, activeChannels,
+     activeTriggers, auxThreshold, preTrigger, numWaveforms, timestamp, model,
+     serial, codec) = datHeaderV2.unpack(f.read(datHeaderV2.size))
+    d['version'] = version
+    d['codec'] = codec
+    d['timebase'] = timebase
+    d['activeChannels'] = ''.join('1' if activeChannels & (1 << i) else '0' for i in range(4))
+    d['activeTriggers'] = ''.join('1' if activeTriggers & (1 << i) else '0' for i in range(5))
+    d['8bitReadout'] = '1' if sampleBytes == 1 else '0'
+    d['auxTriggerThreshold'] = adc2mv(auxThreshold, 6)
+    for i in range(4):
+        (offset, nBytes, samples, stride, threshold,
+         vRange, downsampleMode, downsampleRatio) = datChannelV2.unpack(f.read(datChannelV2.size))
+        c = 'ch' + chr(ord('A') + i)
+        d[c + 'TriggerThreshold'] = adc2mv(threshold, 6)
+        d[c + 'VRange'] = vRange
+        d[c + 'Samples'] = samples
+        d[c + 'Offset'] = offset
+        d[c + 'Bytes'] = nBytes
+        downsampled = downsampleMode != 0 and downsampleRatio > 1
+        d[c + 'DownsampleMode'] = downsampleMode if downsampled else 0
+        d[c + 'DownsampleRatio'] = downsampleRatio if downsampled else 1
+    d['preTriggerSamples'] = preTrigger
+    d['numWaveforms'] = numWaveforms
+    d['timestamp'] = timestamp
+    d['modelNumber'] = model.rstrip(b'\0').decode()
+    d['serialNumber'] = serial.rstrip(b'\0').decode()
+
+    return d
+
 def readHeader(f):
+    if f.read(len(datMagic)) == datMagic:
+        f.seek(-len(datMagic), 1)
+        return readHeaderV2(f)
+    f.seek(-len(datMagic), 1)
+
     d = {}
+    d['version'] = 1
+    d['codec'] = 0
     nCh = 4
-    b = f.read(1)
-    d['timebase'] = ord(b) >> 4
-    d['activeChannels'] = byteBin(b)[4:]
-    activeTriggers8bitReadout = byteBin(f.read(1))
+    # One read for the fixed big-endian prefix, see writeDataHeader in the daq sources
+    (timebaseActive, triggers8bit, auxThreshold, *chThresholds, vRanges, aSamples, bSamples, cSamples,
+     dSamples, preTrigger, numWaveforms, timestamp) = datHeaderV1.unpack(f.read(datHeaderV1.size))
+    d['timebase'] = timebaseActive >> 4
+    d['activeChannels'] = '{0:04b}'.format(timebaseActive & 0x0f)
+    activeTriggers8bitReadout = '{0:08b}'.format(triggers8bit)
     d['activeTriggers'] = activeTriggers8bitReadout[3:]
     d['8bitReadout'] = activeTriggers8bitReadout[2]
-    d['auxTriggerThreshold'] = adc2mv(bytesTwos(f,2),6)
-    for i in range(nCh):
-        d['ch' + chr(ord('A') + i) + 'TriggerThreshold'] = adc2mv(bytesTwos(f,2),6)
-    vRanges = bytesBin(f,2)
-    for i in range(nCh):
-        d['ch' + chr(ord('A') + i) + 'VRange'] = int(vRanges[4*i:4*(i + 1)],2)
+    d['auxTriggerThreshold'] = adc2mv(auxThreshold,6)
+    chSamples = [aSamples, bSamples, cSamples, dSamples]
     for i in range(nCh):
-        d['ch' + chr(ord('A') + i) + 'Samples'] = bytesInt(f,2)
-    d['preTriggerSamples'] = bytesInt(f,2)
-    d['numWaveforms'] = bytesInt(f,4)
-    d['timestamp'] = bytesTwos(f,4)
-    
-    d['modelNumber'] = bytesString(f)
-    d['serialNumber'] = bytesString(f)
+        d['ch' + chr(ord('A') + i) + 'TriggerThreshold'] = adc2mv(chThresholds[i],6)
+        d['ch' + chr(ord('A') + i) + 'VRange'] = (vRanges >> (12 - 4 * i)) & 0x0f
+        d['ch' + chr(ord('A') + i) + 'Samples'] = chSamples[i]
+        d['ch' + chr(ord('A') + i) + 'DownsampleMode'] = 0
+        d['ch' + chr(ord('A') + i) + 'DownsampleRatio'] = 1
+    d['preTriggerSamples'] = preTrigger
+    d['numWaveforms'] = numWaveforms
+    d['timestamp'] = timestamp
+
+    # Model and serial are NUL terminated, leave f on the first sample
+    start = f.tell()
+    strings = f.read(256).split(b'\0', 2)
+    d['modelNumber'] = strings[0].decode()
+    d['serialNumber'] = strings[1].decode()
+    f.seek(start + len(strings[0]) + len(strings[1]) + 2)
 
     return d
 
+# numpy version of adcDecode in src/common/adcCodec.cpp, slow but fine for quick checks
+def decodeAdcStream(buf, dtype):
+    nWf, nSamples, sampleBytes, blockWf = struct.unpack_from('<IIII', buf, 0)
+    nBlocks = (nWf + blockWf - 1) // blockWf
+    pos = 16 + 8 * nBlocks
+    data = np.empty((nWf, nSamples), dtype=np.int64)
+    for wf in range(nWf):
+        if wf > 0 and wf % blockWf == 0:
+            pos = struct.unpack_from('<Q', buf, 16 + 8 * (wf // blockWf - 1))[0]
+        base, shift = struct.unpack_from('<hB', buf, pos)
+        pos += 3
+        for g in range(0, nSamples, 32):
+            width = buf[pos]
+            bits = np.unpackbits(np.frombuffer(buf, np.uint8, 4 * width, pos + 1), bitorder='little')
+            u = bits.reshape(32, width).astype(np.int64) @ (1 << np.arange(width, dtype=np.int64))
+            pos += 1 + 4 * width
+            n = min(32, nSamples - g)
+            data[wf, g:g + n] = base + ((u[:n] >> 1) ^ -(u[:n] & 1)) * (1 << shift)
+    return data.astype(dtype)
+
+def readChannelAdc(f, d, ch):
+    c = 'ch' + chr(ord('A') + ch)
+    nWf = d['numWaveforms']
+    nSamples = d[c + 'Samples']
+    if d['8bitReadout'] == '1':
+        dtype = 'i1'
+    else:
+        dtype = '<i2' if d['version'] == 2 else '>i2'
+    if d['version'] == 2:
+        f.seek(d[c + 'Offset'])
+    if d['codec'] == datCodecAdc:
+        return decodeAdcStream(f.read(d[c + 'Bytes']), dtype)
+    return np.fromfile(f, dtype=dtype, count=nWf * nSamples).reshape((nWf,nSamples))
+
+def adcToMv(chADCData, d, ch):
+    vRange = d['ch' + chr(ord('A') + ch) + 'VRange']
+    if d['8bitReadout'] == '1':
+        return chADCData / 256.0 * ps6000VRanges[vRange]
+    return adc2mv(chADCData, vRange)
+
 def readData(f, d):
 
     data = []
@@ -85,16 +147,7 @@ def readData(f, d):
     for ch in range(4):
         if d['activeChannels'][ch] == '0':
             continue
-        nWf = d['numWaveforms']
-        nSamples = d['ch' + chr(ord('A') + ch) + 'Samples']
-        if d['8bitReadout'] == '1':
-            chADCData = np.fromfile(f, dtype='i1', count=nWf * nSamples).reshape((nWf,nSamples))
-            chData = chADCData / 256.0 * ps6000VRanges[d['ch' + chr(ord('A') + ch) + 'VRange']]
-        else:
-            chADCData = np.fromfile(f, dtype='>i2', count=nWf * nSamples).reshape((nWf,nSamples))
-            chData = adc2mv(chADCData, d['ch' + chr(ord('A') + ch) + 'VRange'])
-
-        data.append(chData)
+        data.append(adcToMv(readChannelAdc(f, d, ch), d, ch))
 
     return data
 
@@ -105,37 +158,69 @@ def readDataAdc(f, d):
     for ch in range(4):
         if d['activeChannels'][ch] == '0':
             continue
-        nWf = d['numWaveforms']
-        nSamples = d['ch' + chr(ord('A') + ch) + 'Samples']
-        if d['8bitReadout'] == '1':
-            chADCData = np.fromfile(f, dtype='i1', count=nWf * nSamples).reshape((nWf,nSamples))
-        else:
-            chADCData = np.fromfile(f, dtype='>i2', count=nWf * nSamples).reshape((nWf,nSamples))
-
-        data.append(chADCData)
+        data.append(readChannelAdc(f, d, ch))
 
     return data
 
 def readFile(fname):
-    with open(fname, 'rb') as f:
-        header = readHeader(f)
-        data = readData(f, header)
-    return header, data
+    header, adcData = readFileAdc(fname)
+    active = [ch for ch in range(4) if header['activeChannels'][ch] == '1']
+    return header, [adcToMv(chADCData, header, ch) for chADCData, ch in zip(adcData, active)]
 
+# With datreader the arrays are read-only views of the file, see src/datreader/datreader.cpp
 def readFileAdc(fname):
+    if datreader is not None:
+        return datreader.readFileAdc(fname)
     with open(fname, 'rb') as f:
         header = readHeader(f)
         data = readDataAdc(f, header)
     return header, data
 
-def integrate(chData, chBaseline):
-    dim = chData.shape
-    argMin = np.argmin(chData, axis=1, keepdims=True)
+# Per waveform summaries written by the DAQ, in ADC counts and stored samples.
+# Returns the header and per active channel a numpy record array with
+# baseline, minimum, minimumIndex and charge (numWaveforms x numWindows)
+def readSummary(fname):
+    with open(fname, 'rb') as f:
+        buf = f.read()
+    (magic, version, headerBytes, recordBytes, timebase, sampleBytes, activeChannels, numWindows,
+     preTrigger, _, numWaveforms, timestamp, model, serial, *edges) = sumHeader.unpack_from(buf, 0)
+    if magic != sumMagic:
+        raise ValueError("%s is not a summary file" % fname)
+    d = {}
+    d['version'] = version
+    d['timebase'] = timebase
+    d['activeChannels'] = ''.join('1' if activeChannels & (1 << i) else '0' for i in range(4))
+    d['8bitReadout'] = '1' if sampleBytes == 1 else '0'
+    d['preTriggerSamples'] = preTrigger
+    d['numWaveforms'] = numWaveforms
+    d['timestamp'] = timestamp
+    d['modelNumber'] = model.rstrip(b'\0').decode()
+    d['serialNumber'] = serial.rstrip(b'\0').decode()
+    d['baselineWindow'] = edges[0:2]
+    d['chargeWindows'] = [edges[2 + 2 * i:4 + 2 * i] for i in range(numWindows)]
+
+    dtype = np.dtype([('baseline', '<f4'), ('minimum', '<i2'), ('reserved', '<u2'), ('minimumIndex', '<u4'),
+                      ('charge', '<f4', (numWindows,))])
+    data = []
+    for i in range(4):
+        offset, samples, ratio, mode, vRange = sumChannel.unpack_from(buf, sumHeader.size + i * sumChannel.size)
+        c = 'ch' + chr(ord('A') + i)
+        d[c + 'VRange'] = vRange
+        d[c + 'Samples'] = samples
+        d[c + 'DownsampleMode'] = mode
+        d[c + 'DownsampleRatio'] = max(ratio, 1)
+        if activeChannels & (1 << i):
+            data.append(np.frombuffer(buf, dtype, numWaveforms, offset))
+    return d, data
 
-    ind = np.indices(dim)[1]
+def integrate(chData, chBaseline):
+    # Sum over (argMin - 10, argMin + 40), only that window is gathered
+    argMin = np.argmin(chData, axis=1)[:, np.newaxis]
+    ind = argMin + np.arange(-9, 40)
+    valid = (ind >= 0) & (ind < chData.shape[1])
+    window = np.take_along_axis(chData, np.clip(ind, 0, chData.shape[1] - 1), axis=1)
 
-    charge = np.sum(chData - chBaseline[:, np.newaxis], axis=1, 
-                    where=(ind > argMin - 10) & (ind < argMin + 40))
+    charge = np.sum(window - chBaseline[:, np.newaxis], axis=1, where=valid)
 
     return charge
 
@@ -219,9 +304,7 @@ def main(fileName, plot=True, output=True, show=True):
 
     print("\n%s" % fileName)
 
-    with open(fileName, 'rb') as f:
-        header = readHeader(f)
-        data = readData(f, header)
+    header, data = readFile(fileName)
 
     dims = (len(data), len(data[0]))
 
@@ -0,0 +1,445 @@
+#include "datCatalog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char g_catalogMagic[8] = {'P', 'M', 'T', 'D', 'A', 'T', 'C', 'T'};
+const uint32_t g_catalogVersion = 2;
+const std::string g_catalogName(".datCatalog");
+// path, size, mtime, six name fields and validHeader, every string empty
+const size_t g_minEntryBytes = 7 * sizeof(uint16_t) + sizeof(uint64_t) + sizeof(int64_t) + sizeof(uint8_t);
+
+///////////////////////////////////////////////////////////////////////////////
+///                              Serialisation                              ///
+///////////////////////////////////////////////////////////////////////////////
+
+// Host order, the catalog is a local cache and is rebuilt if it does not load
+class catalogWriter
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	template <typename T>
+	void put(const T &v)
+	{
+		const uint8_t *p = (const uint8_t *) &v;
+		bytes.insert(bytes.end(), p, p + sizeof(T));
+	}
+	void put(const std::string &s)
+	{
+		put((uint16_t) s.size());
+		bytes.insert(bytes.end(), s.begin(), s.end());
+	}
+	template <typename T>
+	void put(const std::vector<T> &v)
+	{
+		for (size_t i0(0); i0 < 4; ++i0)
+		{
+			put(i0 < v.size() ? v[i0] : T());
+		}
+	}
+};
+
+class catalogReader
+{
+public:
+	catalogReader(const std::vector<uint8_t> &bytes) : m_p(bytes.data()), m_end(bytes.data() + bytes.size()) {}
+
+	bool ok() const {return m_ok;}
+	size_t remaining() const {return m_end - m_p;}
+
+	template <typename T>
+	void get(T &v)
+	{
+		if ((size_t) (m_end - m_p) < sizeof(T))
+		{
+			m_ok = false;
+			v = T();
+			return;
+		}
+		memcpy(&v, m_p, sizeof(T));
+		m_p += sizeof(T);
+	}
+	void get(std::string &s)
+	{
+		uint16_t n;
+		get(n);
+		if (!m_ok || (size_t) (m_end - m_p) < n)
+		{
+			m_ok = false;
+			return;
+		}
+		s.assign((const char *) m_p, n);
+		m_p += n;
+	}
+	template <typename T>
+	void get(std::vector<T> &v)
+	{
+		v.resize(4);
+		for (T &x : v)
+		{
+			get(x);
+		}
+	}
+
+private:
+	const uint8_t *m_p;
+	const uint8_t *m_end;
+	bool m_ok = true;
+};
+
+static void putEntry(catalogWriter &w, const catalogEntry &e)
+{
+	w.put(e.path);
+	w.put(e.size);
+	w.put(e.mtimeNs);
+	for (const std::string *s : {&e.date, &e.bias, &e.led, &e.pmt, &e.mppc, &e.serial})
+	{
+		w.put(*s);
+	}
+	w.put((uint8_t) e.validHeader);
+	if (!e.validHeader)
+	{
+		return;
+	}
+	const dataHeader &h = e.header;
+	w.put(e.headerBytes);
+	w.put(h.version);
+	w.put(h.codec);
+	w.put(h.timebase);
+	w.put(h.activeChannels);
+	w.put(h.numActive);
+	w.put(h.activeTriggers);
+	w.put((uint8_t) h.bit8Buffer);
+	w.put(h.auxTriggerThreshold);
+	w.put(h.chTriggerThreshold);
+	w.put(h.chVRanges);
+	w.put(h.chSamples);
+	w.put(h.preTriggerSamples);
+	w.put(h.numWaveforms);
+	w.put(h.timestamp);
+	w.put(h.modelNumber);
+	w.put(h.serialNumber);
+	w.put(h.chOffset);
+	w.put(h.chBytes);
+	w.put(h.chDownsampleMode);
+	w.put(h.chDownsampleRatio);
+}
+
+static void getEntry(catalogReader &r, catalogEntry &e)
+{
+	r.get(e.path);
+	r.get(e.size);
+	r.get(e.mtimeNs);
+	for (std::string *s : {&e.date, &e.bias, &e.led, &e.pmt, &e.mppc, &e.serial})
+	{
+		r.get(*s);
+	}
+	uint8_t b;
+	r.get(b);
+	e.validHeader = b;
+	e.header = {};
+	e.headerBytes = 0;
+	if (!e.validHeader)
+	{
+		return;
+	}
+	dataHeader &h = e.header;
+	r.get(e.headerBytes);
+	r.get(h.version);
+	r.get(h.codec);
+	r.get(h.timebase);
+	r.get(h.activeChannels);
+	r.get(h.numActive);
+	r.get(h.activeTriggers);
+	r.get(b);
+	h.bit8Buffer = b;
+	r.get(h.auxTriggerThreshold);
+	r.get(h.chTriggerThreshold);
+	r.get(h.chVRanges);
+	r.get(h.chSamples);
+	r.get(h.preTriggerSamples);
+	r.get(h.numWaveforms);
+	r.get(h.timestamp);
+	r.get(h.modelNumber);
+	r.get(h.serialNumber);
+	r.get(h.chOffset);
+	r.get(h.chBytes);
+	r.get(h.chDownsampleMode);
+	r.get(h.chDownsampleRatio);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                Scanning                                 ///
+///////////////////////////////////////////////////////////////////////////////
+
+struct fileStat
+{
+	std::string path;
+	uint64_t size;
+	int64_t mtimeNs;
+};
+
+// Every *.dat below root, hidden entries skipped
+static void listDatFiles(const std::string &root, const std::string &relative, std::vector<fileStat> &out)
+{
+	const std::string dirPath = relative.empty() ? root : root + "/" + relative;
+	DIR *dir = opendir(dirPath.c_str());
+	if (dir == nullptr)
+	{
+		return;
+	}
+	while (dirent *d = readdir(dir))
+	{
+		const std::string name(d->d_name);
+		if (name.empty() || name[0] == '.')
+		{
+			continue;
+		}
+		const std::string rel = relative.empty() ? name : relative + "/" + name;
+		struct stat st;
+		if (stat((root + "/" + rel).c_str(), &st) != 0)
+		{
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+		{
+			listDatFiles(root, rel, out);
+		}
+		else if (S_ISREG(st.st_mode) && name.size() > 4 && name.compare(name.size() - 4, 4, ".dat") == 0)
+		{
+			out.push_back({rel, (uint64_t) st.st_size, (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec});
+		}
+	}
+	closedir(dir);
+}
+
+// Reads and checks the header only, the payload is never touched
+static void readEntryHeader(const std::string &filePath, catalogEntry &e)
+{
+	e.header = {};
+	size_t headerBytes = readFileHeader(filePath, e.header);
+	e.validHeader = headerBytes != 0 && payloadInFile(e.header, e.size);
+	e.headerBytes = e.validHeader ? headerBytes : 0;
+	if (!e.validHeader)
+	{
+		e.header = {};
+	}
+}
+
+bool parseDatFileName(const std::string &path, catalogEntry &e)
+{
+	e.date.clear();
+	e.bias.clear();
+	e.led.clear();
+	e.pmt.clear();
+	e.mppc.clear();
+	e.serial.clear();
+
+	std::string name = path.substr(path.find_last_of('/') + 1);
+	name = name.substr(0, name.size() - 4); // .dat
+	std::vector<std::string> parts;
+	size_t start(0);
+	for (size_t pos(0); pos <= name.size(); ++pos)
+	{
+		if (pos == name.size() || name[pos] == '_')
+		{
+			parts.push_back(name.substr(start, pos - start));
+			start = pos + 1;
+		}
+	}
+	// The mppc string may itself hold '_' (notes after the numbers)
+	if (parts.size() < 6 || parts[1].size() < 2 || parts[1].back() != 'V')
+	{
+		return false;
+	}
+	if (parts[2] != "Dark" && (parts[2].size() < 3 || parts[2].compare(parts[2].size() - 2, 2, "mV") != 0))
+	{
+		return false;
+	}
+
+	e.date = parts[0];
+	e.bias = parts[1].substr(0, parts[1].size() - 1);
+	e.led = parts[2] == "Dark" ? parts[2] : parts[2].substr(0, parts[2].size() - 2);
+	e.pmt = parts[3];
+	e.mppc = parts[4];
+	for (size_t i0(5); i0 + 1 < parts.size(); ++i0)
+	{
+		e.mppc += "_" + parts[i0];
+	}
+	e.serial = parts.back();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 Catalog                                 ///
+///////////////////////////////////////////////////////////////////////////////
+
+datCatalog::datCatalog(const std::string &directory) : m_directory(directory)
+{
+	while (m_directory.size() > 1 && m_directory.back() == '/')
+	{
+		m_directory.pop_back();
+	}
+	load();
+	update();
+}
+
+std::string datCatalog::fullPath(const catalogEntry &e) const
+{
+	return m_directory + "/" + e.path;
+}
+
+static bool matches(const std::string &field, const std::string &wanted)
+{
+	return wanted.empty() || field == wanted;
+}
+
+std::vector<const catalogEntry *> datCatalog::select(const catalogQuery &q) const
+{
+	std::vector<const catalogEntry *> out;
+	for (const catalogEntry &e : m_entries)
+	{
+		if (matches(e.date, q.date) && matches(e.bias, q.bias) && matches(e.led, q.led) && matches(e.pmt, q.pmt)
+			&& matches(e.mppc, q.mppc) && matches(e.serial, q.serial))
+		{
+			out.push_back(&e);
+		}
+	}
+	return out;
+}
+
+const catalogEntry *datCatalog::find(const catalogQuery &q) const
+{
+	std::vector<const catalogEntry *> found = select(q);
+	return found.empty() ? nullptr : found.front();
+}
+
+bool datCatalog::update()
+{
+	std::vector<fileStat> files;
+	listDatFiles(m_directory, "", files);
+	std::sort(files.begin(), files.end(), [](const fileStat &a, const fileStat &b) {return a.path < b.path;});
+
+	std::map<std::string, catalogEntry *> known;
+	for (catalogEntry &e : m_entries)
+	{
+		known[e.path] = &e;
+	}
+
+	bool changed(files.size() != m_entries.size());
+	m_rescanned = 0;
+	std::vector<catalogEntry> entries;
+	entries.reserve(files.size());
+	for (const fileStat &f : files)
+	{
+		auto it = known.find(f.path);
+		if (it != known.end() && it->second->size == f.size && it->second->mtimeNs == f.mtimeNs)
+		{
+			entries.push_back(std::move(*it->second));
+			continue;
+		}
+		catalogEntry e;
+		e.path = f.path;
+		e.size = f.size;
+		e.mtimeNs = f.mtimeNs;
+		parseDatFileName(e.path, e);
+		readEntryHeader(fullPath(e), e);
+		entries.push_back(std::move(e));
+		m_rescanned++;
+		changed = true;
+	}
+	m_entries.swap(entries);
+	return changed ? save() : true;
+}
+
+bool datCatalog::load()
+{
+	std::ifstream f(m_directory + "/" + g_catalogName, std::ios::binary);
+	if (!f.is_open())
+	{
+		return false;
+	}
+	std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	catalogReader r(bytes);
+	char magic[sizeof(g_catalogMagic)];
+	for (char &c : magic)
+	{
+		r.get(c);
+	}
+	uint32_t version, count;
+	r.get(version);
+	r.get(count);
+	if (!r.ok() || memcmp(magic, g_catalogMagic, sizeof(magic)) != 0 || version != g_catalogVersion)
+	{
+		return false;
+	}
+	if (count > r.remaining() / g_minEntryBytes)
+	{
+		std::cerr << "WARNING: '" << m_directory << "/" << g_catalogName << "' is corrupt, re-scanning" << std::endl;
+		return false;
+	}
+
+	std::vector<catalogEntry> entries(count);
+	for (catalogEntry &e : entries)
+	{
+		getEntry(r, e);
+	}
+	if (!r.ok())
+	{
+		std::cerr << "WARNING: '" << m_directory << "/" << g_catalogName << "' is corrupt, re-scanning" << std::endl;
+		return false;
+	}
+	m_entries.swap(entries);
+	return true;
+}
+
+bool datCatalog::save() const
+{
+	catalogWriter w;
+	for (char c : g_catalogMagic)
+	{
+		w.put(c);
+	}
+	w.put(g_catalogVersion);
+	w.put((uint32_t) m_entries.size());
+	for (const catalogEntry &e : m_entries)
+	{
+		putEntry(w, e);
+	}
+
+	// Written next to the catalog under a unique name and renamed over it, readers never see half
+	// a file and concurrent updates of the same directory do not write into each other's
+	const std::string path = m_directory + "/" + g_catalogName;
+	std::vector<char> tmp(path.begin(), path.end());
+	const std::string suffix(".XXXXXX");
+	tmp.insert(tmp.end(), suffix.begin(), suffix.end());
+	tmp.push_back('\0');
+	const int fd = mkstemp(tmp.data());
+	if (fd < 0)
+	{
+		std::cerr << "WARNING: could not write '" << path << "'" << std::endl;
+		return false;
+	}
+	fchmod(fd, 0644);
+	FILE *f = fdopen(fd, "wb");
+	bool ok = f != nullptr && fwrite(w.bytes.data(), 1, w.bytes.size(), f) == w.bytes.size();
+	ok = (f != nullptr ? fclose(f) == 0 : close(fd) == 0) && ok;
+	if (!ok || rename(tmp.data(), path.c_str()) != 0)
+	{
+		std::cerr << "WARNING: could not write '" << path << "'" << std::endl;
+		unlink(tmp.data());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,365 @@
+#include "datReader.h"
+#include "common/adcCodec.h"
+#include "common/datFormat.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////
+///                             Header decoding                             ///
+///////////////////////////////////////////////////////////////////////////////
+
+// Fixed part of the header, see writeDataHeader in the daq sources
+const size_t g_headerPrefixBytes = 32;
+// Trigger thresholds are always stored on the 1V range
+const float g_thresholdRangeMv = 1000.0f;
+
+static uint16_t beU16(const uint8_t *p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t beU32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static float thresholdMv(const uint8_t *p)
+{
+	return ((int16_t) beU16(p) / 32512.0f) * g_thresholdRangeMv;
+}
+
+// Bits are stored with channel A as the most significant bit, as in the old string parser
+static std::string bitString(const uint8_t byte, const int nBits)
+{
+	std::string s(nBits, '0');
+	for (int i0(0); i0 < nBits; ++i0)
+	{
+		if (byte & (1 << (nBits - 1 - i0)))
+			s[i0] = '1';
+	}
+	return s;
+}
+
+static size_t decodeHeaderV1(const uint8_t *bytes, const size_t size, dataHeader &d)
+{
+	const int nCh(4);
+	if (size < g_headerPrefixBytes)
+	{
+		return 0;
+	}
+
+	d = {};
+	d.version = g_datVersion1;
+	d.timebase = bytes[0] >> 4;
+	d.activeChannels = bitString(bytes[0], 4);
+	d.numActive = __builtin_popcount(bytes[0] & 0x0f);
+	d.activeTriggers = bitString(bytes[1], 5);
+	d.bit8Buffer = bytes[1] & (1 << 5);
+	d.auxTriggerThreshold = thresholdMv(bytes + 2);
+	for (int i0(0); i0 < nCh; ++i0)
+	{
+		d.chTriggerThreshold.push_back(thresholdMv(bytes + 4 + 2 * i0));
+	}
+	uint16_t vRanges = beU16(bytes + 12);
+	for (int i0(0); i0 < nCh; ++i0)
+	{
+		d.chVRanges.push_back((vRanges >> (12 - 4 * i0)) & 0x0f);
+	}
+	for (int i0(0); i0 < nCh; ++i0)
+	{
+		d.chSamples.push_back(beU16(bytes + 14 + 2 * i0));
+	}
+	d.preTriggerSamples = (int16_t) beU16(bytes + 22);
+	d.numWaveforms = beU32(bytes + 24);
+	d.timestamp = (int32_t) beU32(bytes + 28);
+
+	size_t pos(g_headerPrefixBytes);
+	for (std::string *s : {&d.modelNumber, &d.serialNumber})
+	{
+		while (pos < size && bytes[pos] != '\0')
+		{
+			*s += (char) bytes[pos++];
+		}
+		if (pos == size)
+		{
+			return 0;
+		}
+		pos++; // terminating '\0'
+	}
+
+	// Channels follow each other straight after the header
+	size_t offset(pos);
+	for (int ch(0); ch < nCh; ++ch)
+	{
+		const size_t bytes = (size_t) d.numWaveforms * d.chSamples.at(ch) * (d.bit8Buffer ? 1 : 2);
+		d.chOffset.push_back(d.activeChannels[ch] == '1' ? offset : 0);
+		d.chBytes.push_back(d.activeChannels[ch] == '1' ? bytes : 0);
+		d.chDownsampleMode.push_back(DAT_DOWNSAMPLE_NONE);
+		d.chDownsampleRatio.push_back(1);
+		if (d.activeChannels[ch] == '1')
+		{
+			offset += bytes;
+		}
+	}
+	return pos;
+}
+
+static size_t decodeHeaderV2(const uint8_t *bytes, const size_t size, dataHeader &d)
+{
+	datHeaderV2 h;
+	if (size < sizeof(h))
+	{
+		return 0;
+	}
+	memcpy(&h, bytes, sizeof(h));
+	if (h.version != g_datVersion2 || h.headerBytes < sizeof(h) || (h.sampleBytes != 1 && h.sampleBytes != 2)
+		|| (h.codec != DAT_CODEC_RAW && h.codec != DAT_CODEC_ADC))
+	{
+		return 0;
+	}
+
+	d = {};
+	d.version = h.version;
+	d.codec = h.codec;
+	d.timebase = h.timebase;
+	d.activeChannels = std::string(4, '0');
+	d.activeTriggers = std::string(5, '0');
+	for (int i0(0); i0 < 5; ++i0)
+	{
+		if (h.activeTriggers & (1 << i0))
+			d.activeTriggers[i0] = '1';
+	}
+	d.numActive = __builtin_popcount(h.activeChannels & 0x0f);
+	d.bit8Buffer = h.sampleBytes == 1;
+	d.auxTriggerThreshold = (h.auxTriggerThresholdAdc / 32512.0f) * g_thresholdRangeMv;
+	for (int ch(0); ch < 4; ++ch)
+	{
+		const datChannelV2 &c = h.channels[ch];
+		const bool active = h.activeChannels & (1 << ch);
+		// Waveforms must be packed back to back, that is all the readers handle
+		if (active && (c.waveformStride != c.numSamples * h.sampleBytes || c.numSamples > UINT16_MAX))
+		{
+			return 0;
+		}
+		d.activeChannels[ch] = active ? '1' : '0';
+		d.chTriggerThreshold.push_back((c.triggerThresholdAdc / 32512.0f) * g_thresholdRangeMv);
+		d.chVRanges.push_back(c.vRange);
+		d.chSamples.push_back(active ? c.numSamples : 0);
+		d.chOffset.push_back(active ? c.offset : 0);
+		d.chBytes.push_back(active ? c.bytes : 0);
+		const bool downsampled = c.downsampleMode != DAT_DOWNSAMPLE_NONE && c.downsampleRatio > 1;
+		d.chDownsampleMode.push_back(downsampled ? c.downsampleMode : (uint8_t) DAT_DOWNSAMPLE_NONE);
+		d.chDownsampleRatio.push_back(downsampled ? c.downsampleRatio : 1);
+		if (active && h.codec == DAT_CODEC_RAW && c.bytes != (uint64_t) c.waveformStride * h.numWaveforms)
+		{
+			return 0;
+		}
+	}
+	d.preTriggerSamples = h.preTriggerSamples;
+	d.numWaveforms = h.numWaveforms;
+	d.timestamp = (int32_t) h.timestamp;
+	d.modelNumber = std::string(h.model, strnlen(h.model, sizeof(h.model)));
+	d.serialNumber = std::string(h.serial, strnlen(h.serial, sizeof(h.serial)));
+	return h.headerBytes;
+}
+
+size_t decodeHeader(const uint8_t *bytes, const size_t size, dataHeader &d)
+{
+	if (isDatV2(bytes, size))
+	{
+		return decodeHeaderV2(bytes, size, d);
+	}
+	return decodeHeaderV1(bytes, size, d);
+}
+
+size_t readFileHeader(const std::string &filePath, dataHeader &d, uint64_t *fileSize)
+{
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	struct stat st;
+	uint8_t bytes[g_headerReadBytes];
+	ssize_t n = fstat(fd, &st) == 0 ? pread(fd, bytes, sizeof(bytes), 0) : -1;
+	close(fd);
+	if (n <= 0)
+	{
+		return 0;
+	}
+	if (fileSize != nullptr)
+	{
+		*fileSize = st.st_size;
+	}
+	return decodeHeader(bytes, n, d);
+}
+
+bool payloadInFile(const dataHeader &d, const uint64_t fileSize)
+{
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (d.activeChannels.at(ch) == '1' && d.chOffset.at(ch) + d.chBytes.at(ch) > fileSize)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t payloadSize(const dataHeader &d)
+{
+	size_t total(0);
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (d.activeChannels[ch] == '0')
+		{
+			continue;
+		}
+		total += (size_t) d.numWaveforms * d.chSamples.at(ch) * (d.bit8Buffer ? 1 : 2);
+	}
+	return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                              Mapped file                                ///
+///////////////////////////////////////////////////////////////////////////////
+
+datFile::datFile(const std::string &filePath)
+{
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return;
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps its own reference
+	if (map == MAP_FAILED)
+	{
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	const uint8_t *data = (const uint8_t *) map;
+	size_t headerSize = decodeHeader(data, st.st_size, m_header);
+	bool complete(headerSize != 0 && payloadInFile(m_header, st.st_size));
+	m_data = data;
+	m_size = st.st_size;
+	if (complete && m_header.codec == DAT_CODEC_ADC)
+	{
+		complete = decodePayload();
+	}
+	if (!complete)
+	{
+		std::cerr << "WARNING: '" << filePath << "' is truncated or not a .dat file" << std::endl;
+		munmap(map, st.st_size);
+		std::vector<uint8_t>().swap(m_decoded);
+		m_data = nullptr;
+		m_size = 0;
+		return;
+	}
+	m_headerSize = headerSize;
+}
+
+bool datFile::decodePayload()
+{
+	const size_t sampleBytes = m_header.bit8Buffer ? 1 : 2;
+	uint64_t total(0);
+	for (int ch(0); ch < 4; ++ch)
+	{
+		m_decodedOffset[ch] = total;
+		if (isActive(ch))
+		{
+			total += (uint64_t) m_header.numWaveforms * m_header.chSamples.at(ch) * sampleBytes;
+		}
+	}
+	m_decoded.resize(total);
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (isActive(ch) && m_header.numWaveforms > 0
+			&& !adcDecode(m_data + m_header.chOffset[ch], m_header.chBytes[ch], m_decoded.data() + m_decodedOffset[ch],
+						  0, m_header.numWaveforms, m_header.chSamples.at(ch), sampleBytes))
+		{
+			return false;
+		}
+	}
+	// Only the decoded copy is read from now on
+	madvise((void *) m_data, m_size, MADV_DONTNEED);
+	return true;
+}
+
+datFile::~datFile()
+{
+	if (m_data != nullptr)
+	{
+		munmap((void *) m_data, m_size);
+	}
+}
+
+bool datFile::isActive(const int ch) const
+{
+	return m_header.activeChannels.at(ch) == '1';
+}
+
+channelView datFile::channel(const int ch) const
+{
+	if (!isOpen() || !isActive(ch))
+	{
+		return channelView{nullptr, 0, 0, m_header.bit8Buffer, m_header.version == g_datVersion1};
+	}
+	const uint8_t *data = m_header.codec == DAT_CODEC_ADC ? m_decoded.data() + m_decodedOffset[ch]
+														 : m_data + m_header.chOffset[ch];
+	return channelView{data, m_header.numWaveforms,
+					   m_header.chSamples.at(ch), m_header.bit8Buffer, m_header.version == g_datVersion1};
+}
+
+void datFile::willNeed(const uint32_t first, const uint32_t count) const
+{
+	advise(first, count, MADV_WILLNEED);
+}
+
+void datFile::dontNeed(const uint32_t first, const uint32_t count) const
+{
+	advise(first, count, MADV_DONTNEED);
+}
+
+void datFile::advise(const uint32_t first, const uint32_t count, const int advice) const
+{
+	if (!isOpen() || m_header.codec != DAT_CODEC_RAW || first >= m_header.numWaveforms)
+	{
+		return;
+	}
+	const uint32_t last = std::min(m_header.numWaveforms, first + count);
+	const size_t page = sysconf(_SC_PAGESIZE);
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (!isActive(ch))
+		{
+			continue;
+		}
+		const channelView view = channel(ch);
+		size_t begin = view.waveform(first) - m_data;
+		size_t end = view.waveform(last) - m_data;
+		// Only drop whole pages inside the range, prefetch every page touching it
+		begin = (advice == MADV_DONTNEED) ? (begin + page - 1) / page * page : begin / page * page;
+		end = (advice == MADV_DONTNEED) ? end / page * page : (end + page - 1) / page * page;
+		if (end > begin)
+		{
+			madvise((void *) (m_data + begin), std::min(end, m_size) - begin, advice);
+		}
+	}
+}
@@ -92,83 +92,6 @@ void progressBar(int current, int total, std::string label)
 ///                          Extraction functions                           ///
 ///////////////////////////////////////////////////////////////////////////////
 
-std::string byteBin(const char byte)
-{
-	return std::bitset<8>(static_cast<unsigned char>(byte)).to_string();
-}
-
-std::string byteHex(const char byte)
-{
-	std::stringstream ss;
-	ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(byte));
-	return ss.str();
-}
-
-std::string bytesBin(std::ifstream &f,
-					 const int n)
-{
-	std::string s;
-	for (int i0(0); i0 < n; ++i0)
-	{
-		char byte;
-		f.read(&byte, 1);
-		s += byteBin(byte);
-	}
-	return s;
-}
-
-int bytesInt(std::ifstream &f,
-			 const int n)
-{
-	std::string s;
-	for (int i0(0); i0 < n; ++i0)
-	{
-		char byte;
-		f.read(&byte, 1);
-		s += byteHex(byte);
-	}
-	return std::stoi(s, nullptr, 16);
-}
-
-std::string bytesHex(std::ifstream &f,
-					 const int n)
-{
-	std::string s;
-	for (int i0(0); i0 < n; ++i0)
-	{
-		char byte;
-		f.read(&byte, 1);
-		s += byteHex(byte);
-	}
-	return s;
-}
-
-int64_t bytesTwos(std::ifstream &f,
-			  	  const int n)
-{
-	std::string hexStr(bytesHex(f, n));
-	int64_t value(std::stoi(hexStr, nullptr, 16));
-	if (value & (1 << (n * 8 - 1)))
-	{
-		value -= 1 << (n * 8);
-	}
-	return value;
-}
-
-std::string bytesString(std::ifstream &f,
-						const int n = 0)
-{
-	char c;
-	std::string s;
-	f.read(&c, 1);
-	while (c != '\0')
-	{
-		s += c;
-		f.read(&c, 1);
-	}
-	return s;
-}
-
 float adc2mv(const int16_t value, const int range)
 {
 	return (value / 32512.0f) * VRanges[range];
@@ -179,43 +102,20 @@ float adc8Bit2mv(const int8_t value, const int range)
 	return (value / 128.0f) * VRanges[range];
 }
 
+// Decodes the header from one read, leaves f at the first v1 sample (v2 readers seek per channel)
 dataHeader readHeader(std::ifstream &f)
 {
 	dataHeader d = {};
-	int nCh(4);
-	char b;
-	int numActive(0);
-	f.read(&b, 1);
-	d.timebase = b >> 4;
-	d.activeChannels = byteBin(b).substr(4);
-
-	for (char c : d.activeChannels)
-		if (c == '1') 
-			numActive++;
-	d.numActive = numActive;
-
-	std::string activeTriggers8BitBuffer = byteBin(f.get());
-	d.activeTriggers = activeTriggers8BitBuffer.substr(3);
-	d.bit8Buffer = (activeTriggers8BitBuffer.at(2) == '1');
-	d.auxTriggerThreshold = adc2mv(bytesTwos(f, 2), 6);
-	for (int i0(0); i0 < nCh; ++i0)
+	std::streampos start = f.tellg();
+	std::vector<uint8_t> bytes(g_headerReadBytes);
+	f.read((char *) bytes.data(), bytes.size());
+	size_t headerBytes = decodeHeader(bytes.data(), f.gcount(), d);
+	f.clear();
+	f.seekg(start + (std::streamoff) headerBytes);
+	if (headerBytes == 0)
 	{
-		d.chTriggerThreshold.push_back(adc2mv(bytesTwos(f, 2), 6));
+		std::cerr << "WARNING: could not decode the file header" << std::endl;
 	}
-	std::string vRanges = bytesBin(f, 2);
-	for (int i0(0); i0 < nCh; ++i0)
-	{
-		d.chVRanges.push_back(std::stoi(vRanges.substr(4 * i0, 4), nullptr, 2));
-	}
-	for (int i0(0); i0 < nCh; ++i0)
-	{
-		d.chSamples.push_back(bytesInt(f, 2));
-	}
-	d.preTriggerSamples = bytesInt(f, 2);
-	d.numWaveforms = bytesInt(f, 4);
-	d.timestamp = bytesTwos(f, 4);
-	d.modelNumber = bytesString(f);
-	d.serialNumber = bytesString(f);
 	return d;
 }
 
@@ -243,6 +143,26 @@ void printHeader(const dataHeader &header)
 	std::cout << "" << std::endl;
 }
 
+double getTimebase(const dataHeader &d)
+{
+	double timebase(pow(2, d.timebase) * 0.2);
+	return timebase;
+}
+
+// [ns] between the stored samples of channel ch, longer than the capture timebase when downsampled
+double getTimebase(const dataHeader &d, const int ch)
+{
+	return getTimebase(d) * downsampleRatio(d, ch);
+}
+
+// Time of stored sample i of channel ch, aggregated waveforms restart for the minima half
+double sampleTime(const dataHeader &d, const int ch, const int i)
+{
+	const int n(d.chSamples.at(ch));
+	const bool aggregated(d.chDownsampleMode.at(ch) == DAT_DOWNSAMPLE_AGGREGATE && downsampleRatio(d, ch) > 1);
+	return getTimebase(d, ch) * (aggregated ? i % (n / 2) : i);
+}
+
 bool isLittleEndian()
 {
 	uint32_t i(1);
@@ -250,12 +170,32 @@ bool isLittleEndian()
 	return bool(*c);
 }
 
+// Reads one channel's samples as stored (decoding DAT_CODEC_ADC payloads), v2 channels are seeked to
+void readChannelAdc(std::ifstream &f, const dataHeader &d, const int ch, void *out, const size_t sampleBytes)
+{
+	const size_t bytes = (size_t) d.numWaveforms * d.chSamples.at(ch) * sampleBytes;
+	if (d.version == g_datVersion2)
+	{
+		f.seekg(d.chOffset.at(ch));
+	}
+	if (d.codec == DAT_CODEC_RAW)
+	{
+		f.read(reinterpret_cast<char *>(out), bytes);
+		return;
+	}
+	std::vector<uint8_t> encoded(d.chBytes.at(ch));
+	f.read(reinterpret_cast<char *>(encoded.data()), encoded.size());
+	if (d.numWaveforms > 0 && !adcDecode(encoded.data(), f.gcount(), out, 0, d.numWaveforms, d.chSamples.at(ch), sampleBytes))
+	{
+		std::cerr << "WARNING: channel " << (char) ('A' + ch) << " payload is corrupt" << std::endl;
+		memset(out, 0, bytes);
+	}
+}
+
 std::vector<std::vector<std::vector<sample>>> readData16Bit(std::ifstream &f, dataHeader &d)
 {
 	std::vector<std::vector<std::vector<sample>>> data;
-	bool little(isLittleEndian());
 	int nWf = d.numWaveforms;
-	double timeBase = pow(2, d.timebase) * 0.2;
 	for (int ch(0); ch < 4; ++ch)
 	{
 		if (d.activeChannels[ch] == '0')
@@ -264,20 +204,10 @@ std::vector<std::vector<std::vector<sample>>> readData16Bit(std::ifstream &f, da
 		}
 		int nSamples = d.chSamples.at(ch);
 		std::vector<int16_t> chADCData(nWf * nSamples);
-		int16_t *chADCDataPter = chADCData.data();
-		if (little)
+		readChannelAdc(f, d, ch, chADCData.data(), sizeof(int16_t));
+		if (d.version == g_datVersion1)
 		{
-			for (int i0(0); i0 < nSamples * nWf; ++i0)
-			{
-				int16_t tmp;
-				f.read(reinterpret_cast<char *>(&tmp), sizeof(int16_t));
-				*chADCDataPter = __builtin_bswap16(tmp);
-				chADCDataPter++;
-			}
-		}
-		else
-		{
-			f.read(reinterpret_cast<char *>(chADCData.data()), nWf * nSamples * sizeof(int16_t));
+			swapBigEndian16(chADCData.data(), chADCData.data(), chADCData.size()); // no-op on big-endian hosts
 		}
 		std::vector<std::vector<sample>> chData(nWf);
 		for (int i0(0); i0 < nWf; ++i0)
@@ -285,7 +215,7 @@ std::vector<std::vector<std::vector<sample>>> readData16Bit(std::ifstream &f, da
 			std::vector<sample> wfChData(nSamples);
 			for (int i1(0); i1 < nSamples; ++i1)
 			{
-				sample newSample{adc2mv(chADCData[i0 * nSamples + i1], d.chVRanges.at(ch)) * (positiveSignals ? -1 : 1), timeBase * i1};
+				sample newSample{adc2mv(chADCData[i0 * nSamples + i1], d.chVRanges.at(ch)) * (positiveSignals ? -1 : 1), sampleTime(d, ch, i1)};
 				wfChData.at(i1) = (newSample);
 				// std::cout << newSample.time << " / " << newSample.voltage << std::endl;
 			}
@@ -300,7 +230,6 @@ std::vector<std::vector<std::vector<sample>>> readData8Bit(std::ifstream &f, dat
 {
 	std::vector<std::vector<std::vector<sample>>> data;
 	int nWf = d.numWaveforms;
-	double timeBase = pow(2, d.timebase) * 0.2;
 	for (int ch(0); ch < 4; ++ch)
 	{
 		if (d.activeChannels[ch] == '0')
@@ -309,15 +238,14 @@ std::vector<std::vector<std::vector<sample>>> readData8Bit(std::ifstream &f, dat
 		}
 		int nSamples = d.chSamples.at(ch);
 		std::vector<int8_t> chADCData(nWf * nSamples);
-
-		f.read(reinterpret_cast<char *>(chADCData.data()), sizeof(int8_t) * nWf * nSamples);
+		readChannelAdc(f, d, ch, chADCData.data(), sizeof(int8_t));
 		std::vector<std::vector<sample>> chData(nWf);
 		for (int i0(0); i0 < nWf; ++i0)
 		{
 			std::vector<sample> wfChData(nSamples);
 			for (int i1(0); i1 < nSamples; ++i1)
 			{
-				sample newSample{adc8Bit2mv(chADCData.at(i0 * nSamples + i1), d.chVRanges.at(ch)) * (positiveSignals ? -1 : 1), timeBase * i1};
+				sample newSample{adc8Bit2mv(chADCData.at(i0 * nSamples + i1), d.chVRanges.at(ch)) * (positiveSignals ? -1 : 1), sampleTime(d, ch, i1)};
 				wfChData.at(i1) = (newSample);
 				// std::cout << newSample.time << " / " << newSample.voltage << std::endl;
 			}
@@ -333,6 +261,128 @@ std::vector<std::vector<std::vector<sample>>> readData(std::ifstream &f, dataHea
 	return (d.bit8Buffer ? readData8Bit(f, d) : readData16Bit(f, d));
 }
 
+dataHeader readHeader(const datFile &f)
+{
+	return f.header();
+}
+
+std::vector<std::vector<std::vector<sample>>> readData(const datFile &f, dataHeader &d)
+{
+	std::vector<std::vector<std::vector<sample>>> data;
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (d.activeChannels[ch] == '0')
+		{
+			continue;
+		}
+		const channelView view = f.channel(ch);
+		const int range = d.chVRanges.at(ch);
+		std::vector<float> mv(view.numSamples);
+		std::vector<double> times(view.numSamples);
+		for (int i1(0); i1 < view.numSamples; ++i1)
+		{
+			times[i1] = sampleTime(d, ch, i1);
+		}
+		std::vector<std::vector<sample>> chData(view.numWaveforms);
+		for (uint32_t i0(0); i0 < view.numWaveforms; ++i0)
+		{
+			std::vector<sample> wfChData(view.numSamples);
+			if (view.bit8)
+			{
+				const int8_t *wf = (const int8_t *) view.waveform(i0);
+				for (int i1(0); i1 < view.numSamples; ++i1)
+				{
+					wfChData[i1] = {adc8Bit2mv(wf[i1], range) * (positiveSignals ? -1 : 1), times[i1]};
+				}
+			}
+			else
+			{
+				if (view.bigEndian)
+				{
+					beAdcToMv(view.waveform(i0), mv.data(), view.numSamples, VRanges[range], positiveSignals);
+				}
+				else
+				{
+					adc16ToMv(view.waveform(i0), mv.data(), view.numSamples, VRanges[range], positiveSignals);
+				}
+				for (int i1(0); i1 < view.numSamples; ++i1)
+				{
+					wfChData[i1] = {mv[i1], times[i1]};
+				}
+			}
+			chData[i0] = std::move(wfChData);
+		}
+		data.push_back(std::move(chData));
+	}
+	return data;
+}
+
+// Fills data with waveforms [first, first + data.numWaveforms()) of the file
+void readWaveformBatch(const datFile &f, const dataHeader &d, const uint32_t first, waveformBlock<float> &data)
+{
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (!data.isActive(ch))
+		{
+			continue;
+		}
+		const channelView view = f.channel(ch);
+		const int range = d.chVRanges.at(ch);
+		for (uint32_t i0(0); i0 < data.numWaveforms(); ++i0)
+		{
+			float *out = data.waveformData(ch, i0);
+			if (view.bit8)
+			{
+				adc8ToMv((const int8_t *) view.waveform(first + i0), out, view.numSamples, VRanges[range], positiveSignals);
+			}
+			else if (view.bigEndian)
+			{
+				beAdcToMv(view.waveform(first + i0), out, view.numSamples, VRanges[range], positiveSignals);
+			}
+			else
+			{
+				adc16ToMv(view.waveform(first + i0), out, view.numSamples, VRanges[range], positiveSignals);
+			}
+		}
+	}
+}
+
+waveformBlock<float> readWaveformBlock(const datFile &f, const dataHeader &d)
+{
+	waveformBlock<float> data(d, getTimebase(d));
+	readWaveformBatch(f, d, 0, data);
+	return data;
+}
+
+template <typename T>
+void readAdcBatch(const datFile &f, const dataHeader &d, const uint32_t first, waveformBlock<T> &data)
+{
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (!data.isActive(ch))
+		{
+			continue;
+		}
+		const channelView view = f.channel(ch);
+		if (view.sampleBytes() != sizeof(T))
+		{
+			throw std::invalid_argument("ADC block type does not match the file sample size");
+		}
+		for (uint32_t i0(0); i0 < data.numWaveforms(); ++i0)
+		{
+			T *out = data.waveformData(ch, i0);
+			if (view.bigEndian && !view.bit8)
+			{
+				swapBigEndian16(view.waveform(first + i0), (int16_t *) out, view.numSamples);
+			}
+			else
+			{
+				memcpy(out, view.waveform(first + i0), view.numSamples * sizeof(T));
+			}
+		}
+	}
+}
+
 int getNumSamples(dataHeader &d)
 {
 	int numSamples(d.chSamples.at(0));
@@ -347,11 +397,6 @@ int getNumSamples(dataHeader &d)
 	return numSamples;
 }
 
-double getTimebase(const dataHeader &d)
-{
-	double timebase(pow(2, d.timebase) * 0.2);
-	return timebase;
-}
 
 environmentSample getSample(std::vector<environmentSample> &data, int32_t &timestamp)
 {
@@ -471,20 +516,27 @@ sample getMinDataSingle(const std::vector<sample> &data)
 	return *(std::min_element(data.begin(), data.end()));
 }
 
+sample getMinDataSingle(const waveformView<float> &data)
+{
+	const float *minPtr = std::min_element(data.begin(), data.end());
+	const uint32_t index = minPtr - data.begin();
+	return sample{*minPtr, data.time(index)};
+}
+
 sample getMaxDataSingle(const std::vector<sample> &data)
 {
 	return *(std::max_element(data.begin(), data.end()));
 }
 
-gaussParams baseLine(const std::vector<sample> &data,
+gaussParams baseLine(const waveformView<float> &data,
 					 const int windowLowerEdge,
 					 const int windowUpperEdge)
 {
 	double x(0), x2(0);
 	for (int i0(windowLowerEdge); i0 <= windowUpperEdge; ++i0)
 	{
-		x += data[i0].voltage / (windowUpperEdge - windowLowerEdge + 1);
-		x2 += data[i0].voltage * data[i0].voltage / (windowUpperEdge - windowLowerEdge + 1);
+		x += (double) data[i0] / (windowUpperEdge - windowLowerEdge + 1);
+		x2 += (double) data[i0] * data[i0] / (windowUpperEdge - windowLowerEdge + 1);
 	}
 	gaussParams parameters{x, sqrt(((windowUpperEdge - windowLowerEdge + 1) / (windowUpperEdge - windowLowerEdge)) * (x2 - x * x))};
 	return parameters;
@@ -512,7 +564,7 @@ double dc(double *x, double *p)
 	return p[0];
 }
 
-gaussParams baseLineLandau(const std::vector<sample> &data,
+gaussParams baseLineLandau(const waveformView<float> &data,
 						   const int windowLowerEdge,
 						   const int windowUpperEdge)
 {
@@ -557,7 +609,7 @@ gaussParams baseLineLandau(const std::vector<sample> &data,
 
 	for (int i = windowLowerEdge ; i <= windowUpperEdge ; i++)
 	{
-		hist->SetBinContent(i, data.at(i).voltage);
+		hist->SetBinContent(i, data[i]);
 	}
 
 	TFitResultPtr fitSingle = hist->Fit(fnSingle, fitOptions);
@@ -585,7 +637,7 @@ gaussParams baseLineLandau(const std::vector<sample> &data,
 	return gaussParams{fitDouble->Parameter(0), fitDouble->ParError(0)};
 }
 
-double chargeIntegrationFixed(const std::vector<sample> &data,
+double chargeIntegrationFixed(const waveformView<float> &data,
 						 	  const double timebase,
 						 	  const double baseline,
 							  const uint32_t lowerWindow,
@@ -593,12 +645,12 @@ double chargeIntegrationFixed(const std::vector<sample> &data,
 {
 	double integratedChargeRaw(0);
 	int lowerEdge(std::max((uint32_t) 0,lowerWindow));
-	int upperEdge(std::min((uint32_t) data.size() - 1,upperWindow));
+	int upperEdge(std::min((uint32_t) data.size - 1,upperWindow));
 	double totalBaseline(baseline * (upperEdge - lowerEdge + 1));
 
 	for (int i0(lowerEdge) ; i0 <= upperEdge ; ++i0)
 	{
-		integratedChargeRaw += data.at(i0).voltage;
+		integratedChargeRaw += data[i0];
 	}
 
 	double integratedCharge((integratedChargeRaw - totalBaseline) * timebase);
@@ -606,28 +658,67 @@ double chargeIntegrationFixed(const std::vector<sample> &data,
 	return integratedCharge;
 }
 
-void getWaveformProperties(const std::vector<std::vector<sample>> &dataChannel,
+/*
+ * The pre-analysis windows of one channel in its stored samples: the windows
+ * in capture samples divided by the downsampling ratio and clamped to the
+ * waveform. Aggregated waveforms are analysed on their minima half only.
+ */
+struct sampleWindows
+{
+	uint32_t skip;       // stored samples before the analysed ones, the maxima of aggregated waveforms
+	uint32_t numSamples; // analysed
+	uint32_t baselineLower;
+	uint32_t baselineUpper;
+	uint32_t quickLower;
+	uint32_t quickUpper;
+	uint32_t lower;      // charge integration
+	uint32_t upper;
+
+	template <typename T>
+	waveformView<T> view(const waveformView<T> &wf) const {return {wf.data + skip, numSamples, wf.timebase};}
+};
+
+sampleWindows preAnalysisWindows(const dataHeader &d, const int ch, const uint32_t lowerWindow, const uint32_t upperWindow)
+{
+	const uint32_t ratio(downsampleRatio(d, ch));
+	const uint32_t n(d.chSamples.at(ch));
+	sampleWindows w;
+	w.skip = (d.chDownsampleMode.at(ch) == DAT_DOWNSAMPLE_AGGREGATE && ratio > 1) ? n / 2 : 0;
+	w.numSamples = n - w.skip;
+	const uint32_t last(w.numSamples > 0 ? w.numSamples - 1 : 0);
+	auto edge = [&](const uint32_t window) {return std::min(window / ratio, last);};
+	w.baselineLower = edge(g_baselineLowerWindow);
+	w.baselineUpper = edge(g_baselineUpperWindow);
+	w.quickLower = edge(g_quickBaselineLowerWindow);
+	w.quickUpper = edge(g_quickBaselineUpperWindow);
+	w.lower = edge(lowerWindow);
+	w.upper = edge(upperWindow);
+	return w;
+}
+
+void getWaveformProperties(const waveformBlock<float> &data,
+						   const int ch,
 						   Double_t* integratedChargeChannel,
 						   Double_t* minimumTimeChannel,
 						   Double_t* minimumVoltageChannel,
 						   const double timebase,
-						   const uint32_t lowerWindow,
-						   const uint32_t upperWindow,
+						   const sampleWindows &windows,
 						   const bool quickPreAnalysis)
 {
-	for (uint i0(0) ; i0 < dataChannel.size() ; ++i0)
+	for (uint i0(0) ; i0 < data.numWaveforms() ; ++i0)
 	{
+		const waveformView<float> wf = windows.view(data.waveform(ch, i0));
 		gaussParams baseLineValue;
 		if (quickPreAnalysis)
 		{
-			baseLineValue = baseLine(dataChannel.at(i0), g_quickBaselineLowerWindow, g_quickBaselineUpperWindow);
+			baseLineValue = baseLine(wf, windows.quickLower, windows.quickUpper);
 		}
 		else
 		{
-			baseLineValue = baseLineLandau(dataChannel.at(i0), g_baselineLowerWindow, g_baselineUpperWindow);
+			baseLineValue = baseLineLandau(wf, windows.baselineLower, windows.baselineUpper);
 		}
-		Double_t charge = chargeIntegrationFixed(dataChannel.at(i0), timebase, baseLineValue.mean, lowerWindow, upperWindow);
-		sample minSample = getMinDataSingle(dataChannel.at(i0));
+		Double_t charge = chargeIntegrationFixed(wf, timebase, baseLineValue.mean, windows.lower, windows.upper);
+		sample minSample = getMinDataSingle(wf);
 
 		integratedChargeChannel[i0] = charge;
 		minimumTimeChannel[i0] = minSample.time;
@@ -636,9 +727,55 @@ void getWaveformProperties(const std::vector<std::vector<sample>> &dataChannel,
 	}
 }
 
+// Same results as getWaveformProperties, computed on ADC counts and converted once per waveform
+template <typename T>
+void getWaveformPropertiesAdc(const waveformBlock<T> &data,
+							  const int ch,
+							  Double_t* integratedChargeChannel,
+							  Double_t* minimumTimeChannel,
+							  Double_t* minimumVoltageChannel,
+							  const double timebase,
+							  const sampleWindows &windows,
+							  const bool quickPreAnalysis)
+{
+	const double mvPerAdc = adcScale<T>(VRanges[data.range(ch)]) * (positiveSignals ? -1 : 1);
+	const uint32_t nSamples = windows.numSamples;
+	const uint32_t lowerEdge = windows.lower;
+	const uint32_t upperEdge = windows.upper;
+	const uint32_t quickWindow = windows.quickUpper - windows.quickLower + 1;
+	std::vector<float> baselineWindow(windows.baselineUpper + 1); // the fit still needs mV
+
+	for (uint i0(0) ; i0 < data.numWaveforms() ; ++i0)
+	{
+		const waveformView<T> wf = windows.view(data.waveform(ch, i0));
+		double baselineMv;
+		if (quickPreAnalysis)
+		{
+			baselineMv = mvPerAdc * adcSum(wf.data, windows.quickLower, windows.quickUpper) / quickWindow;
+		}
+		else
+		{
+			for (uint32_t i1(windows.baselineLower) ; i1 <= windows.baselineUpper ; ++i1)
+			{
+				baselineWindow[i1] = wf[i1] * mvPerAdc;
+			}
+			waveformView<float> window{baselineWindow.data(), (uint32_t) baselineWindow.size(), timebase};
+			baselineMv = baseLineLandau(window, windows.baselineLower, windows.baselineUpper).mean;
+		}
+		const int64_t chargeAdc = adcSum(wf.data, lowerEdge, upperEdge);
+		// With inverted signals the most negative mV sample is the largest ADC count
+		const uint32_t minIndex = (mvPerAdc > 0) ? adcArgMin(wf.data, nSamples) : adcArgMax(wf.data, nSamples);
+
+		integratedChargeChannel[i0] = (mvPerAdc * chargeAdc - baselineMv * (upperEdge - lowerEdge + 1)) * timebase;
+		minimumTimeChannel[i0] = wf.time(minIndex);
+		minimumVoltageChannel[i0] = mvPerAdc * wf[minIndex];
+	}
+}
+
 void processLedPreAnalysis(const dataHeader &header,
-							const std::vector<std::vector<std::vector<sample>>> &data,
+							const waveformBlock<float> &data,
 							Double_t* outData,
+							const uint32_t firstWaveform = 0,
 							const uint32_t lowerWindow = g_integratedLowerWindow,
 							const uint32_t upperWindow = g_integratedUpperWindow)
 {
@@ -650,21 +787,23 @@ void processLedPreAnalysis(const dataHeader &header,
 		}
 
 		const int wfs = header.numWaveforms;
-		Double_t *outDataCh = outData + i0 * 3 * wfs;
+		Double_t *outDataCh = outData + i0 * 3 * wfs + firstWaveform;
 
-		std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		if (firstWaveform == 0)
+		{
+			std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		}
 
-		getWaveformProperties(data.at(i0), outDataCh, outDataCh + wfs, outDataCh + 2 * wfs,
-				getTimebase(header), lowerWindow, upperWindow, g_quickPreAnalysis || (i0 == 3));
+		getWaveformProperties(data, i0, outDataCh, outDataCh + wfs, outDataCh + 2 * wfs, getTimebase(header, i0),
+				preAnalysisWindows(header, i0, lowerWindow, upperWindow), g_quickPreAnalysis || (i0 == 3));
 	}
 }
 
 void processDarkPreAnalysis(const dataHeader &header,
-							const std::vector<std::vector<std::vector<sample>>> &data,
-							Double_t* outData)
+							const waveformBlock<float> &data,
+							Double_t* outData,
+							const uint32_t firstWaveform = 0)
 {
-	double timebase = getTimebase(header);
-
 	for (uint i0(0) ; i0 < header.activeChannels.length() ; ++i0)
 	{
 		if (header.activeChannels.at(i0) == '0')
@@ -672,26 +811,183 @@ void processDarkPreAnalysis(const dataHeader &header,
 			continue;
 		}
 
-		uint32_t upperWindow = header.chSamples.at(i0);
+		double timebase = getTimebase(header, i0);
+		const sampleWindows windows = preAnalysisWindows(header, i0, 0, 0);
+		uint32_t upperWindow = windows.numSamples;
 		const int wfs = header.numWaveforms;
 
-		Double_t *outDataCh = outData + i0 * wfs;
-		std::vector<std::vector<sample>> dataChannel = data.at(i0);
+		Double_t *outDataCh = outData + i0 * wfs + firstWaveform;
 
-		gaussParams baseLineValue(baseLine(dataChannel.at(i0), 0, dataChannel.size() - 1));
-
-		std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		if (firstWaveform == 0)
+		{
+			std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		}
 
-		for (uint i1(0) ; i1 < dataChannel.size() ; ++i1)
+		for (uint i1(0) ; i1 < data.numWaveforms() ; ++i1)
 		{
-			// Double_t charge = chargeIntegrationFixed(dataChannel.at(i1), timebase, baseLineValue.mean, 0, upperWindow);
-			Double_t charge = chargeIntegrationFixed(dataChannel.at(i1), timebase, 0, 0, upperWindow);
+			// Double_t charge = chargeIntegrationFixed(data.waveform(i0, i1), timebase, baseLineValue.mean, 0, upperWindow);
+			Double_t charge = chargeIntegrationFixed(windows.view(data.waveform(i0, i1)), timebase, 0, 0, upperWindow);
 
 			outDataCh[i1] = charge;
 		}
 	}
 }
 
+template <typename T>
+void processLedPreAnalysisAdc(const dataHeader &header,
+							  const waveformBlock<T> &data,
+							  Double_t* outData,
+							  const uint32_t firstWaveform = 0,
+							  const uint32_t lowerWindow = g_integratedLowerWindow,
+							  const uint32_t upperWindow = g_integratedUpperWindow)
+{
+	for (int i0(0) ; i0 < (int) header.activeChannels.length() ; ++i0)
+	{
+		if (header.activeChannels.at(i0) == '0')
+		{
+			continue;
+		}
+
+		const int wfs = header.numWaveforms;
+		Double_t *outDataCh = outData + i0 * 3 * wfs + firstWaveform;
+
+		if (firstWaveform == 0)
+		{
+			std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		}
+
+		getWaveformPropertiesAdc(data, i0, outDataCh, outDataCh + wfs, outDataCh + 2 * wfs, getTimebase(header, i0),
+				preAnalysisWindows(header, i0, lowerWindow, upperWindow), g_quickPreAnalysis || (i0 == 3));
+	}
+}
+
+template <typename T>
+void processDarkPreAnalysisAdc(const dataHeader &header,
+							   const waveformBlock<T> &data,
+							   Double_t* outData,
+							   const uint32_t firstWaveform = 0)
+{
+	for (uint i0(0) ; i0 < header.activeChannels.length() ; ++i0)
+	{
+		if (header.activeChannels.at(i0) == '0')
+		{
+			continue;
+		}
+
+		const double timebase = getTimebase(header, i0);
+		const double mvPerAdc = adcScale<T>(VRanges[data.range(i0)]) * (positiveSignals ? -1 : 1);
+		const sampleWindows windows = preAnalysisWindows(header, i0, 0, 0);
+		const uint32_t upperEdge = windows.numSamples - 1;
+		const int wfs = header.numWaveforms;
+
+		Double_t *outDataCh = outData + i0 * wfs + firstWaveform;
+
+		if (firstWaveform == 0)
+		{
+			std::cout << "###### Analysing Channel " << (char) ('A' + i0) << std::endl;
+		}
+
+		for (uint i1(0) ; i1 < data.numWaveforms() ; ++i1)
+		{
+			outDataCh[i1] = mvPerAdc * adcSum(windows.view(data.waveform(i0, i1)).data, 0, upperEdge) * timebase;
+		}
+	}
+}
+
+/*
+ * Decodes and analyses g_preAnalysisBatchSize waveforms at a time, so memory
+ * stays bounded by the batch rather than the file. While batch N is analysed
+ * batch N+1 is decoded on a second thread into the other block.
+ */
+template <typename T, typename Reader, typename Processor>
+void preAnalyseInBatches(const datFile &file, const dataHeader &header, Reader read, Processor process)
+{
+	const uint32_t total = header.numWaveforms;
+	const uint32_t batch = (g_preAnalysisBatchSize == 0) ? total : std::min(total, g_preAnalysisBatchSize);
+	if (total == 0)
+	{
+		return;
+	}
+
+	const double timebase = getTimebase(header);
+	waveformBlock<T> blocks[2] = {waveformBlock<T>(header, timebase, batch),
+								  waveformBlock<T>(header, timebase, (batch < total) ? batch : 0)};
+
+	auto decode = [&](waveformBlock<T> &block, const uint32_t first)
+	{
+		block.resize(std::min(batch, total - first));
+		file.willNeed(first + batch, batch);
+		read(file, header, first, block);
+		file.dontNeed(first, batch);
+	};
+
+	decode(blocks[0], 0);
+	for (uint32_t first(0), i0(0); first < total; first += batch, ++i0)
+	{
+		std::future<void> next;
+		if (first + batch < total)
+		{
+			next = std::async(std::launch::async, decode, std::ref(blocks[(i0 + 1) % 2]), first + batch);
+		}
+		process(blocks[i0 % 2], first);
+		if (next.valid())
+		{
+			next.get();
+		}
+	}
+}
+
+// Reads the samples in the representation selected by g_rawAdcPreAnalysis and analyses them
+void ledPreAnalysisData(const datFile &file, const dataHeader &header, Double_t* outData)
+{
+	auto processFloat = [&](const waveformBlock<float> &data, const uint32_t first)
+	{
+		processLedPreAnalysis(header, data, outData, first);
+	};
+	auto processAdc = [&](const auto &data, const uint32_t first)
+	{
+		processLedPreAnalysisAdc(header, data, outData, first);
+	};
+
+	if (!g_rawAdcPreAnalysis)
+	{
+		preAnalyseInBatches<float>(file, header, readWaveformBatch, processFloat);
+	}
+	else if (header.bit8Buffer)
+	{
+		preAnalyseInBatches<int8_t>(file, header, readAdcBatch<int8_t>, processAdc);
+	}
+	else
+	{
+		preAnalyseInBatches<int16_t>(file, header, readAdcBatch<int16_t>, processAdc);
+	}
+}
+
+void darkPreAnalysisData(const datFile &file, const dataHeader &header, Double_t* outData)
+{
+	auto processFloat = [&](const waveformBlock<float> &data, const uint32_t first)
+	{
+		processDarkPreAnalysis(header, data, outData, first);
+	};
+	auto processAdc = [&](const auto &data, const uint32_t first)
+	{
+		processDarkPreAnalysisAdc(header, data, outData, first);
+	};
+
+	if (!g_rawAdcPreAnalysis)
+	{
+		preAnalyseInBatches<float>(file, header, readWaveformBatch, processFloat);
+	}
+	else if (header.bit8Buffer)
+	{
+		preAnalyseInBatches<int8_t>(file, header, readAdcBatch<int8_t>, processAdc);
+	}
+	else
+	{
+		preAnalyseInBatches<int16_t>(file, header, readAdcBatch<int16_t>, processAdc);
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///                           Analysis functions                            ///
 ///////////////////////////////////////////////////////////////////////////////
@@ -1396,21 +1692,59 @@ void saveMultiGraph(std::string outputFile, std::string title,
 ///                       Pre-Analysis mode functions                       ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void darkPreAnalysis(std::string directory, std::string date, std::string mppcStr,
+// Every file pre-analysis expects, in the order it runs them
+std::vector<catalogQuery> expectedRuns(std::string date, std::string mppcStr)
+{
+	std::vector<catalogQuery> runs;
+	for (const std::string &bias : g_dcp.biasFullVec)
+		for (const std::string &pico : picoscopeNames)
+			runs.push_back({date, bias, "Dark", g_pmt, mppcStr, pico});
+	for (const std::string &bias : g_dcp.biasFullVec)
+		for (const std::string &led : g_dcp.ledShortVec)
+			for (const std::string &pico : picoscopeNames)
+				runs.push_back({date, bias, led, g_pmt, mppcStr, pico});
+	for (const std::string &bias : g_dcp.biasShortVec)
+		for (const std::string &led : g_dcp.ledFullVec)
+			for (const std::string &pico : picoscopeNames)
+				runs.push_back({date, bias, led, g_pmt, mppcStr, pico});
+	return runs;
+}
+
+// Lists every expected file that is missing or unreadable before anything is analysed
+int reportMissingRuns(const datCatalog &catalog, std::string date, std::string mppcStr)
+{
+	int missing(0);
+	for (const catalogQuery &q : expectedRuns(date, mppcStr))
+	{
+		const catalogEntry *e = catalog.find(q);
+		if (e == nullptr || !e->validHeader)
+		{
+			std::cerr << "WARNING: " << (e == nullptr ? "missing " : "unreadable ") << q.bias << "V "
+					  << q.led << (q.led == "Dark" ? " " : "mV ") << q.serial << std::endl;
+			missing++;
+		}
+	}
+	return missing;
+}
+
+void darkPreAnalysis(const datCatalog &catalog, std::string date, std::string mppcStr,
 					 std::vector<TTree *> forest)
 {
 	for (const std::string &bias : g_dcp.biasFullVec)
 	{
 		for (const std::string &pico : picoscopeNames)
 		{
-			std::vector<std::string> fileVec{date, bias + "V", "Dark", g_pmt, mppcStr, pico};
-			std::string fileBasename(combineComponents("_", fileVec));
-			std::string filePath(directory + "/" + fileBasename + ".dat");
+			const catalogEntry *entry = catalog.find({date, bias, "Dark", g_pmt, mppcStr, pico});
+			if (entry == nullptr || !entry->validHeader)
+			{
+				continue; // already reported by reportMissingRuns
+			}
+			std::string filePath(catalog.fullPath(*entry));
 
 			std::cout << "### Next file: " << filePath << std::endl;
 
-			std::ifstream file(filePath, std::ios::binary);
-			if (!file.is_open())
+			datFile file(filePath);
+			if (!file.isOpen())
 			{
 				std::cerr << "ERROR: can not open file." << std::endl;
 				continue;
@@ -1422,8 +1756,6 @@ void darkPreAnalysis(std::string directory, std::string date, std::string mppcSt
 			{
 				printHeader(header);
 			}
-			std::vector<std::vector<std::vector<sample>>> data = readData(file, header);
-			file.close();
 			
 			int wfs = (const int) header.numWaveforms;
 			const int elems = 4 * wfs;
@@ -1432,7 +1764,7 @@ void darkPreAnalysis(std::string directory, std::string date, std::string mppcSt
 
 			std::cout << "###### Starting analysis..." << std::endl;
 
-			processDarkPreAnalysis(header, data, outData);
+			darkPreAnalysisData(file, header, outData);
 
 			for (int i0(0) ; i0 < 4 ; ++i0)
 			{
@@ -1468,8 +1800,8 @@ void ledPreAnalysisFile(std::string filePath, std::string bias,
 {
 	std::cout << "### Next file: " << filePath << std::endl;
 
-	std::ifstream file(filePath, std::ios::binary);
-	if (!file.is_open())
+	datFile file(filePath);
+	if (!file.isOpen())
 	{
 		std::cerr << "ERROR: can not open file." << std::endl;
 		throw;
@@ -1481,8 +1813,6 @@ void ledPreAnalysisFile(std::string filePath, std::string bias,
 	{
 		printHeader(header);
 	}
-	std::vector<std::vector<std::vector<sample>>> data = readData(file, header);
-	file.close();
 
 	const int wfs = (const int) header.numWaveforms;
 	const int elems = 4 * 3 * wfs;
@@ -1491,7 +1821,7 @@ void ledPreAnalysisFile(std::string filePath, std::string bias,
 
 	std::cout << "###### Starting analysis..." << std::endl;
 
-	processLedPreAnalysis(header, data, outData);
+	ledPreAnalysisData(file, header, outData);
 
 	for (int i0(0) ; i0 < 4 ; ++i0)
 	{
@@ -1530,7 +1860,7 @@ void ledPreAnalysisFile(std::string filePath, std::string bias,
 	return;
 }
 
-void ledPreAnalysis(std::string directory, std::string date, std::string mppcStr,
+void ledPreAnalysis(const datCatalog &catalog, std::string date, std::string mppcStr,
 					std::vector<TTree *> forest)
 {
 	for (const std::string &bias : g_dcp.biasFullVec)
@@ -1539,11 +1869,12 @@ void ledPreAnalysis(std::string directory, std::string date, std::string mppcStr
 		{
 			for (const std::string &pico : picoscopeNames)
 			{
-				std::vector<std::string> fileVec{date, bias + "V", led + "mV", g_pmt, mppcStr, pico};
-				std::string fileBasename(combineComponents("_", fileVec));
-				std::string filePath(directory + "/" + fileBasename + ".dat");
-
-				ledPreAnalysisFile(filePath, bias, led, pico, forest);
+				const catalogEntry *entry = catalog.find({date, bias, led, g_pmt, mppcStr, pico});
+				if (entry == nullptr || !entry->validHeader)
+				{
+					continue;
+				}
+				ledPreAnalysisFile(catalog.fullPath(*entry), bias, led, pico, forest);
 			}
 		}
 	}
@@ -1554,11 +1885,12 @@ void ledPreAnalysis(std::string directory, std::string date, std::string mppcStr
 		{
 			for (const std::string &pico : picoscopeNames)
 			{
-				std::vector<std::string> fileVec{date, bias + "V", led + "mV", g_pmt, mppcStr, pico};
-				std::string fileBasename(combineComponents("_", fileVec));
-				std::string filePath(directory + "/" + fileBasename + ".dat");
-
-				ledPreAnalysisFile(filePath, bias, led, pico, forest);
+				const catalogEntry *entry = catalog.find({date, bias, led, g_pmt, mppcStr, pico});
+				if (entry == nullptr || !entry->validHeader)
+				{
+					continue;
+				}
+				ledPreAnalysisFile(catalog.fullPath(*entry), bias, led, pico, forest);
 			}
 		}
 	}
@@ -1577,11 +1909,21 @@ void preAnalyseFolder(std::string directory, std::string date, std::string outpu
 		return;
 	}
 
+	datCatalog catalog(directory);
+	std::cout << "### Indexed " << catalog.entries().size() << " files, "
+			  << catalog.rescanned() << " new or changed" << std::endl;
+
 	std::string mppcStr = directory.substr(directory.find_last_of("/") + 1);
 	std::vector<std::string> mppcNotesVec = stringComponents(mppcStr, '_');
 	std::vector<std::string> mppcVec = stringComponents(mppcNotesVec.at(0), '-');
 	std::string outputFile = outputDirectory + "/" + mppcStr;
 
+	int missing = reportMissingRuns(catalog, date, mppcStr);
+	if (missing > 0)
+	{
+		std::cerr << "WARNING: " << missing << " files will be skipped" << std::endl;
+	}
+
 	/* Structure of root files
 	 * header folder? - metadata
 	 * tree for mppc a/b/c and pmt
@@ -1631,13 +1973,13 @@ void preAnalyseFolder(std::string directory, std::string date, std::string outpu
 	// TCanvas *c = new TCanvas("ctmp");
 	// c->SaveAs((g_tmpPdf + "[").c_str());
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	darkPreAnalysis(directory, date, mppcStr, forest);
+	darkPreAnalysis(catalog, date, mppcStr, forest);
 
 	std::chrono::steady_clock::time_point endDark = std::chrono::steady_clock::now();
 	int diffDark = std::chrono::duration_cast<std::chrono::seconds>(endDark-start).count();
 	std::cout << "### Dark pre-analysis time: " << diffDark << "s" << std::endl;
 
-	ledPreAnalysis(directory, date, mppcStr, forest);
+	ledPreAnalysis(catalog, date, mppcStr, forest);
 
 	std::chrono::steady_clock::time_point endLed = std::chrono::steady_clock::now();
 	int diffLed = std::chrono::duration_cast<std::chrono::seconds>(endLed-endDark).count();
@@ -0,0 +1,163 @@
+/*
+ * Benchmark of the lossless ADC codec: compression ratio, encode and decode
+ * throughput per thread count, against reading the raw payload back from disk
+ * (page cache dropped first with posix_fadvise, so it needs a real file).
+ *
+ * Usage: exec/adcCodecBench [file.dat] [repeats]
+ * Without a file, synthetic 16 bit (8 bit ADC) waveforms with pulses are used.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "datReader.h"
+#include "common/adcCodec.h"
+
+static double bestSeconds(const int repeats, const std::function<void()> &fn)
+{
+	double best(1e30);
+	for (int i0(0); i0 < repeats; ++i0)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+		best = std::min(best, dt.count());
+	}
+	return best;
+}
+
+static void report(const char *name, const size_t bytes, const double seconds)
+{
+	printf("%-34s %8.3f ms %8.2f GB/s\n", name, seconds * 1e3, bytes / seconds / 1e9);
+}
+
+// Reads the whole file after dropping it from the page cache, returns seconds
+static double coldRead(const char *path, const size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	std::vector<char> buffer(1 << 20);
+	auto start = std::chrono::steady_clock::now();
+	size_t total(0);
+	ssize_t n;
+	while ((n = read(fd, buffer.data(), buffer.size())) > 0)
+	{
+		total += n;
+	}
+	std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+	close(fd);
+	return total == size ? dt.count() : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const int repeats = argc > 2 ? atoi(argv[2]) : 5;
+	uint32_t nWaveforms(10000), nSamples(1000), sampleBytes(2);
+	std::vector<uint8_t> payload;
+	size_t fileSize(0);
+
+	if (argc > 1)
+	{
+		// First active channel of a raw file, in host order
+		datFile file(argv[1]);
+		if (!file.isOpen())
+		{
+			printf("ERROR: cannot read '%s'\n", argv[1]);
+			return 1;
+		}
+		int ch(0);
+		while (ch < 4 && !file.isActive(ch))
+		{
+			ch++;
+		}
+		channelView view = file.channel(ch);
+		fileSize = file.size();
+		nWaveforms = view.numWaveforms;
+		nSamples = view.numSamples;
+		sampleBytes = view.sampleBytes();
+		payload.resize((size_t) nWaveforms * nSamples * sampleBytes);
+		for (uint32_t i0(0); i0 < nWaveforms; ++i0)
+		{
+			for (uint32_t i1(0); i1 < nSamples; ++i1)
+			{
+				int16_t v = view.adc(i0, i1);
+				memcpy(payload.data() + ((size_t) i0 * nSamples + i1) * sampleBytes, &v, sampleBytes);
+			}
+		}
+		printf("%s, channel %c\n", argv[1], 'A' + ch);
+	}
+	else
+	{
+		payload.resize((size_t) nWaveforms * nSamples * sampleBytes);
+		int16_t *p = (int16_t *) payload.data();
+		std::mt19937 rng(1);
+		std::normal_distribution<double> noise(0, 1.5);
+		std::uniform_real_distribution<double> amplitude(0, 60);
+		for (uint32_t i0(0); i0 < nWaveforms; ++i0)
+		{
+			const double a = amplitude(rng);
+			for (uint32_t i1(0); i1 < nSamples; ++i1)
+			{
+				double v = -3 + noise(rng) - (i1 >= 200 ? a * exp(-((double) i1 - 200) / 15.0) : 0);
+				p[(size_t) i0 * nSamples + i1] = (int16_t) (256 * std::max(-128L, std::min(127L, lround(v))));
+			}
+		}
+		printf("synthetic 8 bit ADC pulses in 16 bit samples\n");
+	}
+
+	const size_t bytes = payload.size();
+	std::vector<const void *> waveforms(nWaveforms);
+	for (uint32_t i0(0); i0 < nWaveforms; ++i0)
+	{
+		waveforms[i0] = payload.data() + (size_t) i0 * nSamples * sampleBytes;
+	}
+	std::vector<uint8_t> encoded = adcEncode(waveforms.data(), nWaveforms, nSamples, sampleBytes);
+	printf("%u waveforms x %u samples x %u bytes (%.1f MB), encoded %.1f MB, ratio %.2f, best of %d\n",
+		   nWaveforms, nSamples, sampleBytes, bytes / 1e6, encoded.size() / 1e6, (double) bytes / encoded.size(), repeats);
+
+	std::vector<uint8_t> decoded(bytes);
+	const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	char name[64];
+	for (unsigned threads(1); threads <= cores; threads *= 2)
+	{
+		snprintf(name, sizeof(name), "encode, %u thread(s)", threads);
+		report(name, bytes, bestSeconds(repeats, [&]() {
+			encoded = adcEncode(waveforms.data(), nWaveforms, nSamples, sampleBytes, threads);
+		}));
+		snprintf(name, sizeof(name), "decode, %u thread(s)", threads);
+		report(name, bytes, bestSeconds(repeats, [&]() {
+			adcDecode(encoded.data(), encoded.size(), decoded.data(), 0, nWaveforms, nSamples, sampleBytes, threads);
+		}));
+		if (memcmp(decoded.data(), payload.data(), bytes) != 0)
+		{
+			printf("ERROR: decoded payload differs\n");
+			return 1;
+		}
+	}
+
+	if (fileSize > 0)
+	{
+		const double seconds = coldRead(argv[1], fileSize);
+		if (seconds > 0)
+		{
+			report("file read, page cache dropped", fileSize, seconds);
+		}
+	}
+	return 0;
+}
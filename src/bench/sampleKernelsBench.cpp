@@ -0,0 +1,148 @@
+/*
+ * Micro-benchmark of the 16 bit sample kernels against the per-sample loops
+ * they replaced in writeDataOut (bswap16 + ofstream::write per sample) and in
+ * the analysis reader (byte shifts + adc2mv per sample).
+ *
+ * Usage: exec/sampleKernelsBench [samples per waveform] [waveforms] [repeats]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "common/sampleKernels.h"
+
+const int g_rangeMv = 200;
+
+// Copies of the old per-sample code paths
+static int16_t bswap16(int16_t n)
+{
+	return __builtin_bswap16(n);
+}
+
+static float adc2mv(const int16_t value, const int range)
+{
+	return (value / 32512.0f) * range;
+}
+
+static double bestSeconds(const int repeats, const std::function<void()> &fn)
+{
+	double best(1e30);
+	for (int i0(0); i0 < repeats; ++i0)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+		best = std::min(best, dt.count());
+	}
+	return best;
+}
+
+static void report(const char *name, const size_t bytes, const double seconds)
+{
+	printf("%-34s %8.3f ms %8.2f GB/s\n", name, seconds * 1e3, bytes / seconds / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	const size_t nSamples = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+	const size_t nWaveforms = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000;
+	const int repeats = argc > 3 ? atoi(argv[3]) : 5;
+	const size_t n = nSamples * nWaveforms;
+	const size_t bytes = n * sizeof(int16_t);
+
+	std::vector<int16_t> host(n), swapped(n);
+	std::vector<float> mv(n), reference(n);
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> dist(-32512, 32512);
+	for (size_t i0(0); i0 < n; ++i0)
+	{
+		host[i0] = dist(rng);
+	}
+
+	printf("%zu waveforms x %zu samples (%.1f MB), best of %d, default kernels: %s\n",
+		   nWaveforms, nSamples, bytes / 1e6, repeats, sampleIsaName(sampleKernelIsa()));
+
+	// Writer: host order -> big-endian file order
+	std::ofstream devNull("/dev/null", std::ios::binary);
+	report("write, per-sample bswap16+write", bytes, bestSeconds(repeats, [&]() {
+		int16_t o16;
+		for (size_t i0(0); i0 < n; ++i0)
+		{
+			o16 = bswap16(host[i0]);
+			devNull.write((const char *) &o16, sizeof(int16_t));
+		}
+	}));
+	report("swap, per-sample bswap16", bytes, bestSeconds(repeats, [&]() {
+		for (size_t i0(0); i0 < n; ++i0)
+		{
+			swapped[i0] = bswap16(host[i0]);
+		}
+	}));
+	std::vector<int16_t> expected(swapped);
+
+	const sampleIsa defaultIsa = sampleKernelIsa();
+	char name[64];
+	for (sampleIsa isa : {ISA_SCALAR, ISA_SSE41, ISA_AVX2})
+	{
+		if (!setSampleKernelIsa(isa))
+		{
+			printf("%-34s not supported by this CPU\n", sampleIsaName(isa));
+			continue;
+		}
+		snprintf(name, sizeof(name), "swap, swapBigEndian16 (%s)", sampleIsaName(isa));
+		report(name, bytes, bestSeconds(repeats, [&]() {
+			for (size_t i0(0); i0 < nWaveforms; ++i0)
+			{
+				swapBigEndian16(host.data() + i0 * nSamples, swapped.data() + i0 * nSamples, nSamples);
+			}
+		}));
+		if (memcmp(swapped.data(), expected.data(), bytes) != 0)
+		{
+			printf("ERROR: %s swap differs from bswap16\n", sampleIsaName(isa));
+			return 1;
+		}
+	}
+	setSampleKernelIsa(defaultIsa);
+	swapBigEndian16(host.data(), swapped.data(), n);
+
+	// Reader: big-endian file bytes -> mV
+	const uint8_t *file = (const uint8_t *) swapped.data();
+	report("read, per-sample shift+adc2mv", bytes, bestSeconds(repeats, [&]() {
+		for (size_t i0(0); i0 < n; ++i0)
+		{
+			int16_t v = (int16_t) ((file[2 * i0] << 8) | file[2 * i0 + 1]);
+			reference[i0] = adc2mv(v, g_rangeMv) * -1;
+		}
+	}));
+
+	for (sampleIsa isa : {ISA_SCALAR, ISA_SSE41, ISA_AVX2})
+	{
+		if (!setSampleKernelIsa(isa))
+		{
+			continue;
+		}
+		snprintf(name, sizeof(name), "read, beAdcToMv (%s)", sampleIsaName(isa));
+		report(name, bytes, bestSeconds(repeats, [&]() {
+			for (size_t i0(0); i0 < nWaveforms; ++i0)
+			{
+				beAdcToMv(file + i0 * nSamples * sizeof(int16_t), mv.data() + i0 * nSamples,
+						  nSamples, g_rangeMv, true);
+			}
+		}));
+		if (memcmp(mv.data(), reference.data(), n * sizeof(float)) != 0)
+		{
+			printf("ERROR: %s conversion differs from adc2mv\n", sampleIsaName(isa));
+			return 1;
+		}
+	}
+	setSampleKernelIsa(defaultIsa);
+
+	return 0;
+}
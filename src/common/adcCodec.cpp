@@ -0,0 +1,351 @@
+#include "common/adcCodec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <utility>
+
+const uint32_t g_groupSamples = 32;
+const uint32_t g_baselineSamples = 16;  // leading samples averaged for the baseline
+const uint32_t g_maxWidth = 17;         // zigzag of a 16 bit difference
+const size_t g_streamHeaderBytes = 16;
+const size_t g_blockPadding = 8;
+
+static inline uint32_t zigzag(const int32_t v)
+{
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(const uint32_t u)
+{
+	return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+static inline uint32_t loadU32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void storeU32(uint8_t *p, const uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static unsigned threadCount(unsigned threads, const uint32_t jobs)
+{
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return std::max(1u, std::min(threads, jobs));
+}
+
+// Runs job(i) for i in [0, jobs) on up to threads threads
+static void parallelFor(const uint32_t jobs, const unsigned threads, const std::function<void(uint32_t)> &job)
+{
+	const unsigned n = threadCount(threads, jobs);
+	std::atomic<uint32_t> next(0);
+	auto worker = [&]() {
+		for (uint32_t i0 = next++; i0 < jobs; i0 = next++)
+		{
+			job(i0);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned i0(1); i0 < n; ++i0)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &t : pool)
+	{
+		t.join();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 Encode                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static void encodeWaveform(const T *x, const uint32_t n, std::vector<uint8_t> &out)
+{
+	int32_t common(0);
+	for (uint32_t i0(0); i0 < n; ++i0)
+	{
+		common |= x[i0] - x[0];
+	}
+	const int shift = common ? __builtin_ctz(common) : 0;
+	const int32_t step = 1 << shift;
+
+	// Mean of the leading samples, snapped to the grid of the dropped bits so
+	// every residual stays a multiple of step
+	int32_t base = n ? x[0] : 0;
+	const uint32_t m = std::min(n, g_baselineSamples);
+	if (m > 0)
+	{
+		int64_t sum(0);
+		for (uint32_t i0(0); i0 < m; ++i0)
+		{
+			sum += x[i0] - x[0];
+		}
+		base += (int32_t) std::lround((double) sum / m / step) * step;
+	}
+
+	const int16_t base16 = (int16_t) base;
+	const size_t pos = out.size();
+	out.resize(pos + sizeof(int16_t) + 1);
+	memcpy(out.data() + pos, &base16, sizeof(base16));
+	out[pos + sizeof(int16_t)] = (uint8_t) shift;
+
+	uint32_t u[g_groupSamples];
+	for (uint32_t g(0); g < n; g += g_groupSamples)
+	{
+		const uint32_t len = std::min(g_groupSamples, n - g);
+		uint32_t all(0);
+		for (uint32_t i0(0); i0 < g_groupSamples; ++i0)
+		{
+			u[i0] = i0 < len ? zigzag((x[g + i0] - base) >> shift) : 0;
+			all |= u[i0];
+		}
+		const uint32_t width = all ? 32 - __builtin_clz(all) : 0;
+
+		// 32 values of width bits are exactly 4 x width bytes
+		size_t at = out.size();
+		out.resize(at + 1 + 4 * width);
+		uint8_t *p = out.data() + at;
+		*p++ = (uint8_t) width;
+		uint64_t acc(0);
+		uint32_t bits(0);
+		for (uint32_t i0(0); i0 < g_groupSamples && width; ++i0)
+		{
+			acc |= (uint64_t) u[i0] << bits;
+			bits += width;
+			while (bits >= 8)
+			{
+				*p++ = (uint8_t) acc;
+				acc >>= 8;
+				bits -= 8;
+			}
+		}
+	}
+}
+
+template <typename T>
+static void encodeBlock(const void *const *waveforms, const uint32_t first, const uint32_t count,
+						const uint32_t numSamples, std::vector<uint8_t> &out)
+{
+	out.clear();
+	out.reserve((size_t) count * numSamples * sizeof(T) / 2);
+	for (uint32_t i0(first); i0 < first + count; ++i0)
+	{
+		encodeWaveform((const T *) waveforms[i0], numSamples, out);
+	}
+	out.insert(out.end(), g_blockPadding, 0);
+}
+
+std::vector<uint8_t> adcEncode(const void *const *waveforms, const uint32_t numWaveforms, const uint32_t numSamples,
+							   const uint32_t sampleBytes, unsigned threads)
+{
+	const uint32_t blockWaveforms = g_adcCodecBlockWaveforms;
+	const uint32_t numBlocks = (numWaveforms + blockWaveforms - 1) / blockWaveforms;
+
+	std::vector<std::vector<uint8_t>> blocks(numBlocks);
+	parallelFor(numBlocks, threads, [&](const uint32_t b) {
+		const uint32_t first = b * blockWaveforms;
+		const uint32_t count = std::min(blockWaveforms, numWaveforms - first);
+		if (sampleBytes == 1)
+			encodeBlock<int8_t>(waveforms, first, count, numSamples, blocks[b]);
+		else
+			encodeBlock<int16_t>(waveforms, first, count, numSamples, blocks[b]);
+	});
+
+	const size_t tableBytes = g_streamHeaderBytes + numBlocks * sizeof(uint64_t);
+	size_t total(tableBytes);
+	for (const std::vector<uint8_t> &b : blocks)
+	{
+		total += b.size();
+	}
+
+	std::vector<uint8_t> out(tableBytes);
+	out.reserve(total);
+	storeU32(out.data(), numWaveforms);
+	storeU32(out.data() + 4, numSamples);
+	storeU32(out.data() + 8, sampleBytes);
+	storeU32(out.data() + 12, blockWaveforms);
+	for (uint32_t b(0); b < numBlocks; ++b)
+	{
+		out.insert(out.end(), blocks[b].begin(), blocks[b].end());
+		uint64_t end = out.size();
+		memcpy(out.data() + g_streamHeaderBytes + b * sizeof(uint64_t), &end, sizeof(end));
+		std::vector<uint8_t>().swap(blocks[b]);
+	}
+	return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 Decode                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+// One instantiation per width so the shifts and masks are constants
+template <typename T, uint32_t W>
+static void unpackGroup(const uint8_t *p, T *out, const uint32_t len, const int32_t base, const int32_t step)
+{
+	const uint32_t mask = (uint32_t) ((1ull << W) - 1);
+	if (len == g_groupSamples)
+	{
+		// Fully unrolled, every load offset and shift is a constant
+#pragma GCC unroll 32
+		for (uint32_t i0 = 0; i0 < g_groupSamples; ++i0)
+		{
+			const uint32_t bit = i0 * W;
+			uint64_t word;
+			memcpy(&word, p + (bit >> 3), sizeof(word));
+			out[i0] = (T) (base + unzigzag((uint32_t) (word >> (bit & 7)) & mask) * step);
+		}
+		return;
+	}
+	for (uint32_t i0(0); i0 < len; ++i0)
+	{
+		const uint32_t bit = i0 * W;
+		uint64_t word;
+		memcpy(&word, p + (bit >> 3), sizeof(word));
+		out[i0] = (T) (base + unzigzag((uint32_t) (word >> (bit & 7)) & mask) * step);
+	}
+}
+
+template <typename T>
+using unpackFn = void (*)(const uint8_t *, T *, const uint32_t, const int32_t, const int32_t);
+
+template <typename T, uint32_t... W>
+static const unpackFn<T> *unpackTable(std::integer_sequence<uint32_t, W...>)
+{
+	static const unpackFn<T> table[] = {&unpackGroup<T, W>...};
+	return table;
+}
+
+// Decodes (or with out == nullptr skips) one waveform, returns nullptr if it overruns end
+template <typename T>
+static const uint8_t *decodeWaveform(const uint8_t *p, const uint8_t *end, T *out, const uint32_t n)
+{
+	static const unpackFn<T> *unpack = unpackTable<T>(std::make_integer_sequence<uint32_t, g_maxWidth + 1>());
+
+	if (end - p < 3)
+	{
+		return nullptr;
+	}
+	int16_t base;
+	memcpy(&base, p, sizeof(base));
+	const uint8_t shift = p[2];
+	p += 3;
+	if (shift > 15)
+	{
+		return nullptr;
+	}
+	for (uint32_t g(0); g < n; g += g_groupSamples)
+	{
+		if (p >= end || p[0] > g_maxWidth || end - p < 1 + 4 * p[0])
+		{
+			return nullptr;
+		}
+		const uint32_t width = *p++;
+		if (out)
+		{
+			unpack[width](p, out + g, std::min(g_groupSamples, n - g), base, 1 << shift);
+		}
+		p += 4 * width;
+	}
+	return p;
+}
+
+template <typename T>
+static bool decodeBlock(const uint8_t *p, const uint8_t *end, T *out, const uint32_t blockFirst,
+						const uint32_t blockCount, const uint32_t first, const uint32_t count, const uint32_t n)
+{
+	for (uint32_t wf(blockFirst); wf < blockFirst + blockCount; ++wf)
+	{
+		if (wf >= first + count)
+		{
+			break;
+		}
+		T *dst = wf >= first ? out + (size_t) (wf - first) * n : nullptr;
+		p = decodeWaveform(p, end, dst, n);
+		if (p == nullptr)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t adcStreamWaveforms(const uint8_t *in, const size_t size)
+{
+	if (size < g_streamHeaderBytes || loadU32(in + 12) == 0)
+	{
+		return 0;
+	}
+	const uint64_t numBlocks = ((uint64_t) loadU32(in) + loadU32(in + 12) - 1) / loadU32(in + 12);
+	if (size < g_streamHeaderBytes + numBlocks * sizeof(uint64_t))
+	{
+		return 0;
+	}
+	return loadU32(in);
+}
+
+bool adcDecode(const uint8_t *in, const size_t size, void *out, const uint32_t first, const uint32_t count,
+			   const uint32_t numSamples, const uint32_t sampleBytes, unsigned threads)
+{
+	const uint32_t numWaveforms = adcStreamWaveforms(in, size);
+	if (count == 0)
+	{
+		return true;
+	}
+	if (numWaveforms == 0 || loadU32(in + 4) != numSamples || loadU32(in + 8) != sampleBytes
+		|| (sampleBytes != 1 && sampleBytes != 2) || first >= numWaveforms || count > numWaveforms - first)
+	{
+		return false;
+	}
+
+	const uint32_t blockWaveforms = loadU32(in + 12);
+	const uint32_t numBlocks = (numWaveforms + blockWaveforms - 1) / blockWaveforms;
+	const size_t tableBytes = g_streamHeaderBytes + (size_t) numBlocks * sizeof(uint64_t);
+	auto blockEnd = [&](const uint32_t b) -> uint64_t {
+		if (b == 0)
+			return tableBytes;
+		uint64_t end;
+		memcpy(&end, in + g_streamHeaderBytes + (b - 1) * sizeof(uint64_t), sizeof(end));
+		return end;
+	};
+
+	const uint32_t firstBlock = first / blockWaveforms;
+	const uint32_t lastBlock = (first + count - 1) / blockWaveforms;
+	std::atomic<bool> ok(true);
+	parallelFor(lastBlock - firstBlock + 1, threads, [&](const uint32_t i0) {
+		const uint32_t b = firstBlock + i0;
+		const uint64_t begin = blockEnd(b);
+		const uint64_t end = blockEnd(b + 1);
+		if (begin > end || end > size || end - begin < g_blockPadding)
+		{
+			ok = false;
+			return;
+		}
+		// The padding is only there for the 64 bit loads, groups must end before it
+		const uint8_t *p = in + begin;
+		const uint8_t *stop = in + end - g_blockPadding;
+		const uint32_t blockFirst = b * blockWaveforms;
+		const uint32_t blockCount = std::min(blockWaveforms, numWaveforms - blockFirst);
+		bool blockOk = sampleBytes == 1
+			? decodeBlock(p, stop, (int8_t *) out, blockFirst, blockCount, first, count, numSamples)
+			: decodeBlock(p, stop, (int16_t *) out, blockFirst, blockCount, first, count, numSamples);
+		if (!blockOk)
+		{
+			ok = false;
+		}
+	});
+	return ok;
+}
@@ -0,0 +1,91 @@
+#include "common/backgroundWriter.h"
+
+#include <exception>
+#include <stdexcept>
+
+backgroundWriter::~backgroundWriter()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_jobReady.notify_all();
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void backgroundWriter::push(std::function<void()> job)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+		if (!m_thread.joinable())
+		{
+			m_thread = std::thread(&backgroundWriter::run, this);
+		}
+	}
+	m_jobReady.notify_one();
+}
+
+void backgroundWriter::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [this]() {return m_jobs.empty() && !m_running;});
+	if (!m_error.empty())
+	{
+		std::string error;
+		error.swap(m_error);
+		throw std::runtime_error(error);
+	}
+}
+
+size_t backgroundWriter::pending()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_jobs.size() + m_running;
+}
+
+// Drains the queue before honouring m_stop, nothing pushed is dropped
+void backgroundWriter::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_jobReady.wait(lock, [this]() {return m_stop || !m_jobs.empty();});
+		if (m_jobs.empty())
+		{
+			return;
+		}
+		std::function<void()> job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		m_running = true;
+		lock.unlock();
+
+		std::string error;
+		try
+		{
+			job();
+		}
+		catch (std::exception &e)
+		{
+			error = e.what();
+		}
+		catch (...)
+		{
+			error = "unknown error in background write";
+		}
+
+		lock.lock();
+		m_running = false;
+		if (m_error.empty())
+		{
+			m_error = error;
+		}
+		if (m_jobs.empty())
+		{
+			m_idle.notify_all();
+		}
+	}
+}
@@ -0,0 +1,144 @@
+#include "common/captureSignal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// The signal currently being waited on, for the SIGINT handler
+static std::atomic<captureSignal *> s_waiting {nullptr};
+
+static void cancelOnInterrupt(int)
+{
+	captureSignal *signal = s_waiting.load();
+	if (signal != nullptr)
+	{
+		signal->cancel();
+	}
+}
+
+captureSignal::captureSignal()
+{
+	m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_fd < 0)
+	{
+		throw std::runtime_error("Cannot create the capture eventfd");
+	}
+}
+
+captureSignal::~captureSignal()
+{
+	close(m_fd);
+}
+
+void captureSignal::reset(const uint32_t expected)
+{
+	uint64_t drained;
+	while (read(m_fd, &drained, sizeof(drained)) > 0)
+	{
+	}
+	m_expected.store(0); // callbacks arriving meanwhile are ignored
+	if (expected > m_capacity)
+	{
+		m_capacity = std::max<uint32_t>(expected, 2 * m_capacity);
+		m_storage.emplace_back(new runState[m_capacity]);
+		m_runs.store(m_storage.back().get());
+	}
+	runState *runs = m_runs.load();
+	for (uint32_t i0(0); i0 < expected; ++i0)
+	{
+		runs[i0].done.store(false);
+		runs[i0].finishedAt.store(0);
+	}
+	m_finished.store(0);
+	m_cancelled.store(false);
+	m_expected.store(expected);
+}
+
+void captureSignal::notify(const uint32_t run)
+{
+	const uint32_t expected = m_expected.load();
+	runState *runs = m_runs.load();
+	if (run >= expected || runs[run].done.exchange(true))
+	{
+		return;
+	}
+	runs[run].finishedAt.store(std::chrono::steady_clock::now().time_since_epoch().count());
+	if (m_finished.fetch_add(1) + 1 >= expected)
+	{
+		wake();
+	}
+}
+
+std::chrono::steady_clock::time_point captureSignal::finishedAt(const uint32_t run) const
+{
+	return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(m_runs.load()[run].finishedAt.load()));
+}
+
+void captureSignal::cancel()
+{
+	m_cancelled.store(true);
+	wake();
+}
+
+void captureSignal::wake()
+{
+	const uint64_t one = 1;
+	ssize_t n = write(m_fd, &one, sizeof(one));
+	(void) n; // only fails when the counter is saturated, the fd is readable then anyway
+}
+
+captureSignal::result captureSignal::wait(const uint32_t timeoutMs)
+{
+	struct sigaction interrupt = {}, previous;
+	interrupt.sa_handler = cancelOnInterrupt;
+	sigemptyset(&interrupt.sa_mask);
+	s_waiting.store(this);
+	sigaction(SIGINT, &interrupt, &previous);
+
+	const std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	result res = timedOut;
+	while (true)
+	{
+		if (m_finished.load() >= m_expected)
+		{
+			res = completed;
+			break;
+		}
+		if (m_cancelled.load())
+		{
+			res = cancelled;
+			break;
+		}
+
+		int pollMs = -1;
+		if (timeoutMs > 0)
+		{
+			int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0)
+			{
+				break;
+			}
+			pollMs = (int) left;
+		}
+		struct pollfd pfd = {m_fd, POLLIN, 0};
+		if (poll(&pfd, 1, pollMs) > 0)
+		{
+			uint64_t count;
+			ssize_t n = read(m_fd, &count, sizeof(count));
+			(void) n;
+		}
+		// EINTR and timeouts fall through to the checks above
+	}
+
+	sigaction(SIGINT, &previous, nullptr);
+	s_waiting.store(nullptr);
+	return res;
+}
@@ -0,0 +1,580 @@
+#include "common/daqConfig.h"
+#include "common/adcCodec.h"
+#include "common/waveformSummary.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <thread>
+
+uint32_t g_fileFormatVersion = g_datVersion1;
+bool g_compressFiles = false;
+bool g_hugePageBuffers = false;
+bool g_lockDataBuffers = false;
+uint32_t g_rapidBlockWindow = 0;
+bool g_bit8Buffers = true;
+std::vector<uint8_t> g_chDownsampleMode(4, DAT_DOWNSAMPLE_NONE);
+std::vector<uint32_t> g_chDownsampleRatio(4, 1);
+uint8_t g_summaryMode = 0;
+summaryWindow g_summaryBaseline = {0, 100};
+std::vector<summaryWindow> g_summaryWindows = {{160, 275}};
+bool g_doubleBuffered = false;
+backgroundWriter g_writer;
+std::string g_runStatsLog;
+
+static bool isLittleEndian()
+{
+	uint32_t i = 1;
+	char *c = (char*)&i;
+	return bool(*c);
+}
+
+static bool s_littleEndian = isLittleEndian();
+
+uint32_t daqConfig::storedSamples(int ch)
+{
+	return datStoredSamples(chPostSamplesPerWaveform.at(ch) + samplesPreTrigger,
+			chDownsampleMode.at(ch), chDownsampleRatio.at(ch));
+}
+
+uint64_t daqConfig::capturedBytes()
+{
+	uint64_t samples = 0;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (activeChannels.test(ch))
+		{
+			samples += (uint64_t) storedSamples(ch) * numWaveforms;
+		}
+	}
+	return samples * (bit8Buffers ? sizeof(int8_t) : sizeof(int16_t));
+}
+
+void daqConfig::forgetApplied()
+{
+	appliedRanges.clear();
+	appliedTriggers.clear();
+	appliedData.clear();
+}
+
+bool daqConfig::downsampled(int ch)
+{
+	return activeChannels.test(ch) && chDownsampleMode.at(ch) != DAT_DOWNSAMPLE_NONE && chDownsampleRatio.at(ch) > 1;
+}
+
+void daqConfig::print()
+{
+	printf("Data Collection Config Info:\n");
+	printf("Serial Number: %s\n", serial);
+	printf("Active Channels: %u\n", (uint) activeChannels.to_ulong());
+	printf("Active Triggers: %u\n", (uint) activeTriggers.to_ulong());
+	printf("Timebase: %u\n", (uint) timebase.to_ulong());
+	printf("Channel V Ranges: %u\n", (uint) chVoltageRanges.to_ulong());
+	for (int i = 0; i < chTriggerThresholdADC.size(); i++)
+	{
+		printf("%c Trigger Threshold: %i\n", 'A' + i, chTriggerThresholdADC.at(i));
+	}
+	printf("Aux Trigger Threshold: %i\n", auxTriggerThresholdADC);
+	for (int i = 0; i < chPostSamplesPerWaveform.size(); i++)
+	{
+		printf("%c Post Trigger Samples: %i\n", 'A' + i, chPostSamplesPerWaveform.at(i));
+	}
+	printf("Max Post Trigger Samples: %i\n", maxPostSamples);
+	printf("Samples Pre Trigger: %i\n", samplesPreTrigger);
+	printf("Number of Waveforms: %i\n", numWaveforms);
+	printf("Data Configured: %s\n", dataConfigured ? "true" : "false");
+	printf("Unit Initialised: %s\n\n", unitInitialised ? "true" : "false");
+}
+
+int setFileFormatVersion(uint32_t version)
+{
+	g_writer.wait(); // queued files keep the format they were captured with
+	if (version != g_datVersion1 && version != g_datVersion2)
+	{
+		throw std::invalid_argument("Unsupported .dat format version");
+	}
+	g_fileFormatVersion = version;
+	if (version == g_datVersion1)
+	{
+		g_compressFiles = false;
+		g_chDownsampleMode = std::vector<uint8_t>(4, DAT_DOWNSAMPLE_NONE);
+	}
+	return 1;
+}
+
+int setDataBufferOptions(bool hugePages, bool lock)
+{
+	g_hugePageBuffers = hugePages;
+	g_lockDataBuffers = lock;
+	return 1;
+}
+
+int setBit8Buffers(bool enable)
+{
+	g_bit8Buffers = enable;
+	return 1;
+}
+
+int setFileCompression(bool enable)
+{
+	g_writer.wait();
+	if (enable && g_fileFormatVersion != g_datVersion2)
+	{
+		throw std::invalid_argument("Compression needs .dat format version 2");
+	}
+	g_compressFiles = enable;
+	return 1;
+}
+
+int setDownsampling(uint8_t chAMode, uint32_t chARatio, uint8_t chBMode, uint32_t chBRatio,
+                    uint8_t chCMode, uint32_t chCRatio, uint8_t chDMode, uint32_t chDRatio)
+{
+	std::vector<uint8_t> modes = {chAMode, chBMode, chCMode, chDMode};
+	std::vector<uint32_t> ratios = {chARatio, chBRatio, chCRatio, chDRatio};
+	for (int i = 0; i < 4; i++)
+	{
+		if (modes.at(i) > DAT_DOWNSAMPLE_AVERAGE || (modes.at(i) != DAT_DOWNSAMPLE_NONE && ratios.at(i) < 2))
+		{
+			throw std::invalid_argument("Unsupported downsampling mode or ratio");
+		}
+		if (modes.at(i) != DAT_DOWNSAMPLE_NONE && g_fileFormatVersion != g_datVersion2)
+		{
+			throw std::invalid_argument("Downsampling needs .dat format version 2");
+		}
+		ratios.at(i) = modes.at(i) == DAT_DOWNSAMPLE_NONE ? 1 : ratios.at(i);
+	}
+	g_chDownsampleMode = modes;
+	g_chDownsampleRatio = ratios;
+	return 1;
+}
+
+int setSummary(uint8_t mode, uint32_t baselineLower, uint32_t baselineUpper,
+               std::vector<uint32_t> windowLowers, std::vector<uint32_t> windowUppers)
+{
+	g_writer.wait(); // queued captures are summarised with the settings they were taken with
+	if (mode > 2)
+	{
+		throw std::invalid_argument("Unsupported summary mode");
+	}
+	if (windowLowers.size() != windowUppers.size() || windowLowers.size() > g_summaryMaxWindows)
+	{
+		throw std::invalid_argument("Summaries take up to 4 charge windows");
+	}
+	std::vector<summaryWindow> windows;
+	for (int i = 0; i < windowLowers.size(); i++)
+	{
+		windows.push_back({windowLowers.at(i), windowUppers.at(i)});
+	}
+	g_summaryMode = mode;
+	g_summaryBaseline = {baselineLower, baselineUpper};
+	g_summaryWindows = windows;
+	return 1;
+}
+
+int setDoubleBuffering(bool enable)
+{
+	g_writer.wait();
+	g_doubleBuffered = enable;
+	return 1;
+}
+
+int waitForWrites()
+{
+	g_writer.wait();
+	return 1;
+}
+
+int setRunStatsLog(std::string path)
+{
+	g_writer.wait();
+	g_runStatsLog = path;
+	return 1;
+}
+
+void setDataOutput(char *outputFileName, datWriter &of)
+{
+	if (!of.open(outputFileName))
+	{
+		printf("Cannot create %s\n", outputFileName);
+		throw std::runtime_error("Cannot create the data file");
+	}
+}
+
+void closeDataOutput(datWriter &of)
+{
+	if (!of.close())
+	{
+		printf("Writing the data file failed\n");
+		throw std::runtime_error("Writing the data file failed");
+	}
+}
+
+static int16_t bswap16(int16_t n)
+{
+	if (s_littleEndian) {return __builtin_bswap16(n);}
+	else {return n;}
+}
+
+static uint16_t bswapu16(uint16_t n)
+{
+	if (s_littleEndian) {return __builtin_bswap16(n);}
+	else {return n;}
+}
+
+static int32_t bswap32(int32_t n)
+{
+	if (s_littleEndian) {return __builtin_bswap32(n);}
+	else {return n;}
+}
+
+template<std::size_t N>
+static void bitset_reverse(std::bitset<N> &b)
+{
+	for (std::size_t i = 0; i < N/2; ++i)
+	{
+		bool t = b[i];
+		b[i] = b[N-i-1];
+		b[N-i-1] = t;
+	}
+}
+
+char *concatTwoChar(char *line1, char *line2)
+{
+	char *totalLine;
+	int len = asprintf(&totalLine, "%s%s", line1, line2);
+	if (len < 0) abort();
+	return totalLine;
+}
+
+char *formatSerial(char *serial)
+{
+	int max = 31;
+	char outputSerial[max];
+	strcpy(outputSerial, serial);
+
+	for (int i = 0; i < max; i++)
+	{
+		if (outputSerial[i] == '/')
+		{
+			outputSerial[i] = '-';
+		}
+	}
+
+	return concatTwoChar((char *) "_", outputSerial);
+}
+
+char *createFileName(char *serial, char *outputFileBasename)
+{
+	char *formattedSerial = formatSerial(serial);
+	char *name = concatTwoChar(outputFileBasename, formattedSerial);
+	char *file = concatTwoChar(name, (char *) ".dat");
+	free(formattedSerial);
+	free(name);
+	return file;
+}
+
+datHeaderV2 dataHeaderV2(daqConfig &dcc)
+{
+	datHeaderV2 h;
+	datInitHeaderV2(h);
+
+	h.timebase = (uint8_t) dcc.timebase.to_ulong();
+	h.sampleBytes = dcc.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
+	h.activeChannels = (uint8_t) dcc.activeChannels.to_ulong();
+	h.activeTriggers = (uint8_t) dcc.activeTriggers.to_ulong();
+	h.auxTriggerThresholdAdc = dcc.auxTriggerThresholdADC;
+	h.preTriggerSamples = dcc.samplesPreTrigger;
+	h.numWaveforms = dcc.numWaveforms;
+	h.timestamp = time(nullptr);
+	strncpy(h.model, dcc.model.c_str(), sizeof(h.model) - 1);
+	strncpy(h.serial, dcc.serial, sizeof(h.serial) - 1);
+
+	for (int i = 0; i < 4; i++)
+	{
+		h.channels[i].numSamples = dcc.activeChannels.test(i) * dcc.storedSamples(i);
+		if (dcc.downsampled(i))
+		{
+			h.channels[i].downsampleMode = dcc.chDownsampleMode.at(i);
+			h.channels[i].downsampleRatio = dcc.chDownsampleRatio.at(i);
+		}
+		h.channels[i].triggerThresholdAdc = dcc.chTriggerThresholdADC.at(i);
+		h.channels[i].vRange = (dcc.chVoltageRanges.to_ulong() >> (12 - 4 * i)) & 0x0f;
+	}
+	h.codec = g_compressFiles ? DAT_CODEC_ADC : DAT_CODEC_RAW;
+	datLayoutV2(h);
+	return h;
+}
+
+void writeDataHeader(daqConfig &dcc, datWriter &of)
+{
+	if (g_fileFormatVersion == g_datVersion2)
+	{
+		datHeaderV2 h = dataHeaderV2(dcc);
+		of.write((const char *) &h, sizeof(h));
+		return;
+	}
+	if (dcc.downsampled(0) || dcc.downsampled(1) || dcc.downsampled(2) || dcc.downsampled(3))
+	{
+		throw std::runtime_error("Downsampled runs need .dat format version 2");
+	}
+
+	/*
+	 * Bit layout, in order
+	 * 4 bits: timebase (from 0-4 for ps6000)
+	 * 4 bits: ch1-4 active
+	 * 2 bits: padding
+	 * 1 bit: 1 if the data is 1 byte per sample, 0 if its 2 bytes per sample
+	 * 5 bits: ch1-4, aux trigger active
+	 * 16 bits: aux trigger threshold
+	 * 64 (16*4) bits: trigger threshold (ch1-4)
+	 * 16 (4*4): ch1-4 voltage ranges (aux is always +-1V range)
+	 * 64 (4*16) bits: number of TOTAL samples per waveform (including pretrigger)
+	 * 16 bits: number of samples before trigger
+	 * 32 bits: number of waveforms
+	 * 32 bits: unix timestamp (signed integer)
+	 * total above bits: 232 (29 bytes)
+	 * Flexible length, 0 terminated: model string
+	 * Flexible length, 0 terminated: serial number
+	*/
+
+	int16_t o16;
+	uint16_t ou16;
+	int32_t o32;
+
+	bitset_reverse(dcc.activeChannels);
+	bitset_reverse(dcc.activeTriggers);
+
+	uint8_t timebaseActiveCh =  (uint8_t) dcc.timebase.to_ullong() << 4 |
+	                            (uint8_t) dcc.activeChannels.to_ullong();
+	of.write((const char *) &timebaseActiveCh, sizeof(uint8_t));
+
+	uint8_t bufferSizeActiveTriggers =  (uint8_t) dcc.bit8Buffers << 5 |
+	                                    (uint8_t) dcc.activeTriggers.to_ullong();
+	of.write((const char *) &bufferSizeActiveTriggers, sizeof(uint8_t));
+
+	bitset_reverse(dcc.activeChannels);
+	bitset_reverse(dcc.activeTriggers);
+
+	o16 = bswap16(dcc.auxTriggerThresholdADC);
+	of.write((const char *) &o16, sizeof(int16_t));
+
+	for (int i = 0; i < 4; i++)
+	{
+		o16 = bswap16(dcc.chTriggerThresholdADC.at(i));
+		of.write((const char *) &o16, sizeof(int16_t));
+	}
+
+	o16 = bswap16((int16_t) dcc.chVoltageRanges.to_ullong());
+	of.write((const char *) &o16, sizeof(int16_t));
+
+	for (int i = 0; i < 4; i++)
+	{
+		ou16 = dcc.activeChannels.test(i) *
+			bswapu16(dcc.chPostSamplesPerWaveform.at(i) + dcc.samplesPreTrigger);
+		of.write((const char *) &ou16, sizeof(uint16_t));
+	}
+
+	o16 = bswap16(dcc.samplesPreTrigger);
+	of.write((const char *) &o16, sizeof(int16_t));
+
+	o32 = bswap32(dcc.numWaveforms);
+	of.write((const char *) &o32, sizeof(int32_t));
+
+	time_t t = time(nullptr);
+	o32 = bswap32((int32_t) t);
+	of.write((const char *) &o32, sizeof(int32_t));
+
+	of.write(dcc.model.c_str(), dcc.model.size() + 1);
+	of.write(dcc.serial, strnlen(dcc.serial, sizeof(dcc.serial) - 1) + 1);
+}
+
+// Compresses every channel (on all cores), then rewrites the header with the encoded sizes
+static void writeEncodedDataOut(daqConfig &dcc, datWriter &of)
+{
+	datHeaderV2 h = dataHeaderV2(dcc);
+	std::vector<std::vector<uint8_t>> streams(4);
+	int i = 0;
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (!(dcc.activeChannels.test(ch)))
+		{
+			continue;
+		}
+		streams.at(ch) = adcEncode(dcc.dataBuffers.at(i).data(), dcc.numWaveforms,
+		                           h.channels[ch].numSamples, h.sampleBytes);
+		h.channels[ch].bytes = streams.at(ch).size();
+		i++;
+	}
+	datLayoutV2(h);
+
+	of.seekp(0);
+	of.write((const char *) &h, sizeof(h));
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (dcc.activeChannels.test(ch))
+		{
+			of.seekp(h.channels[ch].offset);
+			of.write((const char *) streams.at(ch).data(), streams.at(ch).size());
+		}
+	}
+}
+
+void writeDataOut(daqConfig &dcc, datWriter &of)
+{
+	uint32_t s = dcc.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
+	bool v2 = g_fileFormatVersion == g_datVersion2;
+	if (v2 && g_compressFiles)
+	{
+		writeEncodedDataOut(dcc, of);
+		return;
+	}
+	datHeaderV2 layout = dataHeaderV2(dcc);
+	int i = 0;
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (!(dcc.activeChannels.test(ch)))
+		{
+			continue;
+		}
+		if (v2)
+		{
+			// Payloads start on 4 KiB boundaries, the gap reads back as zeros
+			of.seekp(layout.channels[ch].offset);
+		}
+		uint64_t nSamples = dcc.storedSamples(ch);
+		// Whole channel in a few pwritev calls, v2 samples stay in host order
+		of.writeWaveforms(dcc.dataBuffers.at(i).data(), dcc.numWaveforms, s * nSamples,
+		                  !(dcc.bit8Buffers || v2));
+		i++;
+	}
+}
+
+static summaryHeader summaryHeaderFor(daqConfig &dcc)
+{
+	summaryHeader h;
+	summaryInitHeader(h);
+
+	h.timebase = (uint8_t) dcc.timebase.to_ulong();
+	h.sampleBytes = dcc.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
+	h.activeChannels = (uint8_t) dcc.activeChannels.to_ulong();
+	h.numWindows = g_summaryWindows.size();
+	h.preTriggerSamples = dcc.samplesPreTrigger;
+	h.numWaveforms = dcc.numWaveforms;
+	h.timestamp = time(nullptr);
+	strncpy(h.model, dcc.model.c_str(), sizeof(h.model) - 1);
+	strncpy(h.serial, dcc.serial, sizeof(h.serial) - 1);
+	h.baseline = g_summaryBaseline;
+	std::copy(g_summaryWindows.begin(), g_summaryWindows.end(), h.windows);
+
+	for (int i = 0; i < 4; i++)
+	{
+		h.channels[i].numSamples = dcc.activeChannels.test(i) * dcc.storedSamples(i);
+		if (dcc.downsampled(i))
+		{
+			h.channels[i].downsampleMode = dcc.chDownsampleMode.at(i);
+			h.channels[i].downsampleRatio = dcc.chDownsampleRatio.at(i);
+		}
+		h.channels[i].vRange = (dcc.chVoltageRanges.to_ulong() >> (12 - 4 * i)) & 0x0f;
+	}
+	summaryLayout(h);
+	return h;
+}
+
+// Summarises every channel (on all cores) into outputFile, see common/summaryFormat.h
+static void writeSummaryFile(daqConfig &dcc, char *outputFile)
+{
+	summaryHeader h = summaryHeaderFor(dcc);
+	datWriter of;
+	setDataOutput(outputFile, of);
+	of.write((const char *) &h, sizeof(h));
+	int i = 0;
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		if (!(dcc.activeChannels.test(ch)))
+		{
+			continue;
+		}
+		std::vector<uint8_t> records = summariseWaveforms(dcc.dataBuffers.at(i).data(), dcc.numWaveforms,
+				h.channels[ch].numSamples, h.sampleBytes, g_summaryBaseline, g_summaryWindows,
+				h.channels[ch].downsampleMode == DAT_DOWNSAMPLE_AGGREGATE);
+		of.seekp(h.channels[ch].offset);
+		of.write((const char *) records.data(), records.size());
+		i++;
+	}
+	closeDataOutput(of);
+	printf("Written to file: %s\n", outputFile);
+}
+
+// <name>.dat -> <name>.sum
+static std::string summaryFileName(const std::string &dataFile)
+{
+	std::string base = dataFile;
+	if (base.size() >= 4 && base.compare(base.size() - 4, 4, ".dat") == 0)
+	{
+		base.resize(base.size() - 4);
+	}
+	return base + ".sum";
+}
+
+void writeDataFile(daqConfig &dcc, char *outputFile, std::shared_ptr<runStats> run)
+{
+	stageTimer write(dcc.name, STAGE_WRITE, run);
+	if (g_summaryMode != 0)
+	{
+		writeSummaryFile(dcc, (char *) summaryFileName(outputFile).c_str());
+	}
+	if (g_summaryMode == 2)
+	{
+		return;
+	}
+	datWriter of;
+	setDataOutput(outputFile, of);
+	writeDataHeader(dcc, of);
+	writeDataOut(dcc, of);
+	closeDataOutput(of);
+	printf("Written to file: %s\n", outputFile);
+}
+
+void writeDataFiles(std::vector<daqConfig *> &configs, std::vector<std::string> &outputFiles,
+                    std::shared_ptr<runStats> run)
+{
+	std::vector<std::thread> writers;
+	std::vector<std::string> errors(configs.size());
+	for (int i = 0; i < configs.size(); i++)
+	{
+		writers.emplace_back([&, i]()
+		{
+			try
+			{
+				writeDataFile(*configs.at(i), (char *) outputFiles.at(i).c_str(), run);
+			}
+			catch (std::exception &e)
+			{
+				errors.at(i) = e.what();
+			}
+		});
+	}
+	for (std::thread &t : writers)
+	{
+		t.join();
+	}
+	for (std::string &error : errors)
+	{
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+	}
+}
+
+void finishRunStats(std::shared_ptr<runStats> run)
+{
+	run->setWritten();
+	run->log(g_runStatsLog);
+}
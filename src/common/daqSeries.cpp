@@ -0,0 +1,429 @@
+#include "common/daqSeries.h"
+#include "common/sweepEvents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+namespace py = pybind11;
+
+void setActiveChannels(daqUnit &dcc, int16_t aChVoltage, int16_t bChVoltage, int16_t cChVoltage,
+                       int16_t dChVoltage)
+{
+	int16_t chVoltage[4] = {aChVoltage, bChVoltage, cChVoltage, dChVoltage};
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (chVoltage[i] != 99)
+		{
+			dcc.activeChannels.set(i);
+		}
+	}
+	dcc.chVoltageRanges = chVoltage[0] * dcc.activeChannels.test(0) << 12 |
+	                      chVoltage[1] * dcc.activeChannels.test(1) <<  8 |
+	                      chVoltage[2] * dcc.activeChannels.test(2) <<  4 |
+	                      chVoltage[3] * dcc.activeChannels.test(3);
+
+	dcc.setVoltages(chVoltage);
+}
+
+void setTriggerConfig(daqUnit &dcc, int16_t aTrigVoltageMv, int16_t bTrigVoltageMv, int16_t cTrigVoltageMv,
+                      int16_t dTrigVoltageMv, int16_t auxTrigVoltageMv)
+{
+	int16_t trigVoltageMv[4] = {aTrigVoltageMv, bTrigVoltageMv, cTrigVoltageMv, dTrigVoltageMv};
+	std::vector<int16_t> chTriggerThresholdADC;
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (trigVoltageMv[i] != 0 && dcc.activeChannels.test(i))
+		{
+			dcc.activeTriggers.set(i + 1);
+			chTriggerThresholdADC.push_back(dcc.mvToAdc(i, trigVoltageMv[i]));
+		}
+		else
+		{
+			chTriggerThresholdADC.push_back(0);
+		}
+	}
+	if (auxTrigVoltageMv != 0)
+	{
+		dcc.activeTriggers.set(0);
+		dcc.auxTriggerThresholdADC = dcc.mvToAdc(4, auxTrigVoltageMv);
+	}
+	else
+	{
+		dcc.auxTriggerThresholdADC = 0;
+	}
+
+	dcc.chTriggerThresholdADC = chTriggerThresholdADC;
+	dcc.setTriggers();
+}
+
+void setDataConfig(daqUnit &dcc, uint8_t timebase, uint32_t numWaveforms, int16_t samplesPreTrigger,
+                   uint16_t chAWfSamples, uint16_t chBWfSamples, uint16_t chCWfSamples, uint16_t chDWfSamples,
+                   bool bit8Buffers)
+{
+	dcc.timebase = timebase;
+	dcc.numWaveforms = numWaveforms;
+	dcc.samplesPreTrigger = samplesPreTrigger;
+
+	dcc.chPostSamplesPerWaveform = {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples};
+	dcc.maxPostSamples = *std::max_element(dcc.chPostSamplesPerWaveform.begin(),
+	                                       dcc.chPostSamplesPerWaveform.end());
+
+	if (dcc.samplesPreTrigger < 0)
+	{
+		printf("Setting post-trigger delay of %i samples\n", -1 * dcc.samplesPreTrigger);
+		dcc.setDaqDelay();
+	}
+
+	dcc.bit8Buffers = bit8Buffers;
+	dcc.chDownsampleMode = g_chDownsampleMode;
+	dcc.chDownsampleRatio = g_chDownsampleRatio;
+
+	// Reuses the arena when the new geometry fits in it
+	dcc.arena->setOptions(g_hugePageBuffers, g_lockDataBuffers);
+	dcc.setDataBuffers();
+}
+
+void freeDataBuffers(daqUnit &dcc)
+{
+	dcc.forgetApplied();
+	dcc.dataBuffers.clear();
+	dcc.arena->release();
+	dcc.spareArena->release();
+}
+
+void configureUnit(daqUnit &dcc, std::vector<int16_t> ranges, std::vector<int16_t> triggersMv,
+                   uint8_t timebase, uint32_t numWaveforms, int16_t samplesPreTrigger, std::vector<uint16_t> wfSamples)
+{
+	try
+	{
+		if (ranges != dcc.appliedRanges)
+		{
+			dcc.appliedTriggers.clear();
+			setActiveChannels(dcc, ranges.at(0), ranges.at(1), ranges.at(2), ranges.at(3));
+			dcc.appliedRanges = ranges;
+			printf("%s: Active channel(s) configured\n", dcc.serial);
+		}
+		if (triggersMv != dcc.appliedTriggers)
+		{
+			setTriggerConfig(dcc, triggersMv.at(0), triggersMv.at(1), triggersMv.at(2), triggersMv.at(3),
+					triggersMv.at(4));
+			dcc.appliedTriggers = triggersMv;
+			printf("%s: Trigger channel(s) configured\n", dcc.serial);
+		}
+
+		std::vector<int64_t> data = {(int64_t) dcc.activeChannels.to_ulong(), timebase, numWaveforms,
+		                             samplesPreTrigger, g_bit8Buffers, g_rapidBlockWindow, g_hugePageBuffers,
+		                             g_lockDataBuffers};
+		data.insert(data.end(), wfSamples.begin(), wfSamples.end());
+		data.insert(data.end(), g_chDownsampleMode.begin(), g_chDownsampleMode.end());
+		data.insert(data.end(), g_chDownsampleRatio.begin(), g_chDownsampleRatio.end());
+		if (data != dcc.appliedData)
+		{
+			setDataConfig(dcc, timebase, numWaveforms, samplesPreTrigger,
+					wfSamples.at(0), wfSamples.at(1), wfSamples.at(2), wfSamples.at(3), g_bit8Buffers);
+			dcc.appliedData = data;
+		}
+		else
+		{
+			printf("%s: Data buffers still registered\n", dcc.serial);
+		}
+	}
+	catch (...)
+	{
+		dcc.forgetApplied();
+		throw;
+	}
+}
+
+static void swapDataBuffers(daqUnit &dcc, std::shared_ptr<runStats> run)
+{
+	stageTimer reset(dcc.name, STAGE_RESET, run);
+	std::swap(dcc.arena, dcc.spareArena);
+	dcc.arena->setOptions(g_hugePageBuffers, g_lockDataBuffers);
+	dcc.setDataBuffers();
+}
+
+void queueDataFile(daqUnit &dcc, char *outputFile, std::shared_ptr<runStats> run)
+{
+	daqConfig capture = dcc;
+	std::string file(outputFile);
+	g_writer.push([capture, file, run]() mutable
+	{
+		writeDataFile(capture, (char *) file.c_str(), run);
+		finishRunStats(run);
+	});
+	swapDataBuffers(dcc, run);
+}
+
+// queueDataFile for all units at once, their files are then written in parallel
+static void queueDataFiles(std::vector<daqUnit *> &units, std::vector<std::string> &outputFiles,
+                           std::shared_ptr<runStats> run, std::function<void()> written)
+{
+	std::vector<daqConfig> captures;
+	for (daqUnit *unit : units)
+	{
+		captures.push_back(*unit);
+	}
+	std::vector<std::string> files = outputFiles;
+	g_writer.push([captures, files, run, written]() mutable
+	{
+		std::vector<daqConfig *> configs;
+		for (daqConfig &capture : captures)
+		{
+			configs.push_back(&capture);
+		}
+		writeDataFiles(configs, files, run);
+		finishRunStats(run);
+		if (written)
+		{
+			written();
+		}
+	});
+	for (daqUnit *unit : units)
+	{
+		swapDataBuffers(*unit, run);
+	}
+}
+
+void collectMultiRun(daqModel &model, char *outputFileBasename, std::function<void()> written)
+{
+	model.collectRapidBlocks();
+	std::shared_ptr<runStats> run = runStats::finish(outputFileBasename);
+	std::vector<daqUnit *> units = model.units();
+	std::vector<std::string> outputFiles;
+	for (daqUnit *unit : units)
+	{
+		if (unit->dataConfigured)
+		{
+			run->setData(unit->name, unit->numWaveforms, unit->capturedBytes());
+		}
+		char *outputFile = createFileName(unit->serial, outputFileBasename);
+		outputFiles.push_back(outputFile);
+		free(outputFile);
+	}
+	if (g_doubleBuffered)
+	{
+		g_writer.wait();
+		queueDataFiles(units, outputFiles, run, written);
+	}
+	else
+	{
+		std::vector<daqConfig *> configs(units.begin(), units.end());
+		writeDataFiles(configs, outputFiles, run);
+		finishRunStats(run);
+		if (written)
+		{
+			written();
+		}
+	}
+}
+
+/*
+ * Sweep engine: a whole schedule of multiSeries runs (dark and LED points,
+ * over any number of bias voltages) in one call. Every step is a dict
+ *     name        output basename, as for multiSeriesCollectData
+ *     bias        V, optional, setBias(bias) is called whenever it changes
+ *     ledMv       mV, setLed(ledMv) is called before the capture, 0 for dark runs
+ *     ranges      channels A-D, 99 off
+ *     triggers    mV, channels A-D then aux, 0 off
+ *     samples     post trigger samples per waveform, channels A-D
+ *     timebase, waveforms, preTrigger
+ */
+struct sweepStep
+{
+	std::string name;
+	double bias;
+	double ledMv;
+	std::vector<int16_t> ranges;
+	std::vector<int16_t> triggersMv;
+	std::vector<uint16_t> samples;
+	uint8_t timebase;
+	uint32_t numWaveforms;
+	int16_t samplesPreTrigger;
+};
+
+static sweepStep sweepStepFrom(py::dict d)
+{
+	sweepStep step;
+	step.name = d["name"].cast<std::string>();
+	step.bias = d.contains("bias") && !d["bias"].is_none() ? d["bias"].cast<double>() : NAN;
+	step.ledMv = d.contains("ledMv") ? d["ledMv"].cast<double>() : 0;
+	step.ranges = d["ranges"].cast<std::vector<int16_t>>();
+	step.triggersMv = d["triggers"].cast<std::vector<int16_t>>();
+	step.samples = d["samples"].cast<std::vector<uint16_t>>();
+	step.timebase = d["timebase"].cast<uint8_t>();
+	step.numWaveforms = d["waveforms"].cast<uint32_t>();
+	step.samplesPreTrigger = d.contains("preTrigger") ? d["preTrigger"].cast<int16_t>() : 0;
+	if (step.ranges.size() != 4 || step.triggersMv.size() != 5 || step.samples.size() != 4)
+	{
+		throw std::invalid_argument("Sweep step " + step.name + ": needs 4 ranges, 5 triggers and 4 samples");
+	}
+	return step;
+}
+
+// From the sweep thread, Python errors come back as runtime_error
+template <typename T>
+static void callFromSweep(const py::object &f, T arg)
+{
+	py::gil_scoped_acquire gil;
+	try
+	{
+		f(arg);
+	}
+	catch (py::error_already_set &e)
+	{
+		throw std::runtime_error(e.what());
+	}
+}
+
+/*
+ * The sweep thread. With double buffering the bias, the unit setup and the
+ * LED of a step are set while the files of the step before are written.
+ * Pushes "capturing" before each capture and "written" once its files are on
+ * disk, stops early at the next step once asked to
+ */
+static void runSweepSteps(daqModel &model, std::vector<sweepStep> &steps, const py::object &setBias,
+                          const py::object &setLed, sweepEvents &events)
+{
+	try
+	{
+		double bias = NAN;
+		for (uint32_t i = 0; i < steps.size() && !events.stopRequested(); i++)
+		{
+			sweepStep &step = steps.at(i);
+			if (!std::isnan(step.bias) && step.bias != bias)
+			{
+				callFromSweep(setBias, step.bias);
+				bias = step.bias;
+			}
+			for (daqUnit *unit : model.units())
+			{
+				if (unit->unitInitialised)
+				{
+					stageTimer configure(unit->name, STAGE_CONFIGURE);
+					configureUnit(*unit, step.ranges, step.triggersMv, step.timebase, step.numWaveforms,
+							step.samplesPreTrigger, step.samples);
+					unit->dataConfigured = true;
+				}
+			}
+			callFromSweep(setLed, step.ledMv);
+			events.push(i, "capturing");
+			collectMultiRun(model, (char *) step.name.c_str(), [&events, i]() {events.push(i, "written");});
+		}
+		g_writer.wait();
+		events.finish("");
+	}
+	catch (std::exception &e)
+	{
+		std::string error = e.what();
+		try
+		{
+			g_writer.wait(); // the queued writes still push to events
+		}
+		catch (std::exception &)
+		{
+		}
+		events.finish(error);
+	}
+}
+
+int sweepUnits(daqModel &model, py::list schedule, py::object setBias, py::object setLed, py::object onStep)
+{
+	std::vector<sweepStep> steps;
+	for (py::handle step : schedule)
+	{
+		steps.push_back(sweepStepFrom(step.cast<py::dict>()));
+	}
+	bool anyInitialised = false;
+	for (daqUnit *unit : model.units())
+	{
+		anyInitialised |= unit->unitInitialised;
+	}
+	if (!anyInitialised || steps.empty())
+	{
+		return 0;
+	}
+
+	sweepEvents events;
+	std::thread runner(runSweepSteps, std::ref(model), std::ref(steps), std::cref(setBias), std::cref(setLed),
+	                   std::ref(events));
+	int written = 0;
+	try
+	{
+		while (true)
+		{
+			sweepEvents::event e;
+			sweepEvents::result r;
+			{
+				py::gil_scoped_release release;
+				r = events.next(e, 200);
+			}
+			if (PyErr_CheckSignals() != 0)
+			{
+				throw py::error_already_set();
+			}
+			if (r == sweepEvents::finished)
+			{
+				break;
+			}
+			if (r != sweepEvents::received)
+			{
+				continue;
+			}
+			written += e.stage == "written";
+			if (!onStep.is_none())
+			{
+				py::object keepGoing = onStep(e.step, steps.at(e.step).name, e.stage);
+				if (!keepGoing.is_none() && !py::bool_(keepGoing))
+				{
+					events.stop();
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		printf("Sweep stopping after the current step\n");
+		events.stop();
+		{
+			py::gil_scoped_release release;
+			runner.join();
+		}
+		throw;
+	}
+	runner.join();
+	if (!events.error().empty())
+	{
+		throw std::runtime_error("Sweep stopped: " + events.error());
+	}
+	return written;
+}
+
+py::dict getLastRunStats()
+{
+	std::shared_ptr<runStats> run = runStats::last();
+	py::dict units;
+	for (const runStats::unitStats &u : run->units())
+	{
+		py::dict unit;
+		for (int i = 0; i < DAQ_STAGES; i++)
+		{
+			unit[g_daqStageNames[i]] = u.seconds[i];
+		}
+		unit["waveforms"] = u.waveforms;
+		unit["bytes"] = u.bytes;
+		units[u.unit.c_str()] = unit;
+	}
+	py::dict out;
+	out["name"] = run->name();
+	out["start"] = run->start();
+	out["written"] = run->written();
+	out["units"] = units;
+	return out;
+}
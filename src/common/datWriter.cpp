@@ -0,0 +1,185 @@
+#include "common/datWriter.h"
+#include "common/sampleKernels.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static size_t iovBytes(const std::vector<struct iovec> &iov)
+{
+	size_t bytes(0);
+	for (const struct iovec &v : iov)
+	{
+		bytes += v.iov_len;
+	}
+	return bytes;
+}
+
+datWriter::~datWriter()
+{
+	close();
+}
+
+bool datWriter::open(const char *path)
+{
+	close();
+	m_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	m_ok = m_fd >= 0;
+	m_pos = 0;
+	m_pending.clear();
+	return m_ok;
+}
+
+bool datWriter::close()
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+	flush();
+	if (::close(m_fd) != 0)
+	{
+		m_ok = false;
+	}
+	m_fd = -1;
+	return m_ok;
+}
+
+datWriter &datWriter::write(const char *data, const size_t bytes)
+{
+	m_pending.insert(m_pending.end(), data, data + bytes);
+	if (m_pending.size() >= g_writeStagingBytes)
+	{
+		flush();
+	}
+	return *this;
+}
+
+datWriter &datWriter::seekp(const uint64_t offset)
+{
+	if (offset != tellp())
+	{
+		flush();
+		m_pos = offset;
+	}
+	return *this;
+}
+
+datWriter &datWriter::writeWaveforms(const void *const *waveforms, const uint32_t numWaveforms,
+									 const size_t waveformBytes, const bool bigEndian16)
+{
+	if (!is_open() || numWaveforms == 0 || waveformBytes == 0)
+	{
+		return *this;
+	}
+
+	std::vector<struct iovec> iov;
+	iov.reserve(IOV_MAX);
+	uint64_t offset = m_pos;
+	if (!m_pending.empty())
+	{
+		// The header goes out in the same call as the first waveforms
+		iov.push_back({m_pending.data(), m_pending.size()});
+	}
+
+	if (!bigEndian16)
+	{
+		for (uint32_t i0(0); i0 < numWaveforms; ++i0)
+		{
+			// Waveforms packed back to back (sampleArena slices) merge into one entry
+			if (!iov.empty() && (const char *) iov.back().iov_base + iov.back().iov_len == waveforms[i0]
+				&& iov.back().iov_base != m_pending.data())
+			{
+				iov.back().iov_len += waveformBytes;
+			}
+			else
+			{
+				iov.push_back({(void *) waveforms[i0], waveformBytes});
+			}
+			if (iov.size() == IOV_MAX || i0 + 1 == numWaveforms)
+			{
+				const size_t bytes = iovBytes(iov);
+				pwritevAll(iov.data(), iov.size(), offset);
+				offset += bytes;
+				iov.clear();
+			}
+		}
+	}
+	else
+	{
+		// Whole waveforms per chunk, at least one even if it is larger than the staging size
+		const size_t samples = waveformBytes / sizeof(int16_t);
+		const uint32_t perChunk = std::max<size_t>(1, g_writeStagingBytes / waveformBytes);
+		m_staging.resize(std::min<size_t>(perChunk, numWaveforms) * samples);
+		for (uint32_t i0(0); i0 < numWaveforms; i0 += perChunk)
+		{
+			const uint32_t n = std::min(perChunk, numWaveforms - i0);
+			for (uint32_t i1(0); i1 < n; ++i1)
+			{
+				swapBigEndian16(waveforms[i0 + i1], m_staging.data() + (size_t) i1 * samples, samples);
+			}
+			iov.push_back({m_staging.data(), n * waveformBytes});
+			const size_t bytes = iovBytes(iov);
+			pwritevAll(iov.data(), iov.size(), offset);
+			offset += bytes;
+			iov.clear();
+		}
+	}
+	m_pending.clear();
+	m_pos = offset;
+	return *this;
+}
+
+bool datWriter::flush()
+{
+	if (m_fd < 0 || m_pending.empty())
+	{
+		return m_ok;
+	}
+	struct iovec iov = {m_pending.data(), m_pending.size()};
+	pwritevAll(&iov, 1, m_pos);
+	m_pos += m_pending.size();
+	m_pending.clear();
+	return m_ok;
+}
+
+// Retries short writes, iov is consumed
+bool datWriter::pwritevAll(iovec *iov, int count, uint64_t offset)
+{
+	while (count > 0)
+	{
+		if (iov->iov_len == 0)
+		{
+			iov++;
+			count--;
+			continue;
+		}
+		ssize_t n = pwritev(m_fd, iov, count, offset);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			// Nothing written without an error would never advance
+			m_ok = false;
+			return false;
+		}
+		offset += n;
+		while (count > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#include "common/jsonString.h"
+
+#include <cstdio>
+
+std::string jsonString(const std::string &s)
+{
+	std::string out("\"");
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char) c < 0x20)
+		{
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out += esc;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+	return out + "\"";
+}
@@ -0,0 +1,71 @@
+#include "common/pulseFinder.h"
+
+#include <algorithm>
+
+pulseFinder::pulseFinder(const int16_t threshold, const uint32_t preSamples, const uint32_t postSamples,
+						 snippetFn onSnippet)
+	: m_threshold(threshold), m_falling(threshold < 0), m_pre(preSamples), m_post(std::max<uint32_t>(1, postSamples)),
+	  m_onSnippet(onSnippet), m_history(preSamples, 0), m_snippet(m_pre + m_post)
+{
+}
+
+void pulseFinder::process(const int16_t *samples, const size_t n)
+{
+	for (size_t i0(0); i0 < n; ++i0)
+	{
+		if (!m_collecting && m_armed)
+		{
+			// Quiet stretch: find the next crossing first, then only keep its history
+			size_t end = i0;
+			while (end < n && !beyond(samples[end]))
+			{
+				end++;
+			}
+			for (size_t i1(end - std::min<size_t>(end - i0, m_pre)); i1 < end; ++i1)
+			{
+				m_history[m_historyPos] = samples[i1];
+				m_historyPos = m_historyPos + 1 == m_pre ? 0 : m_historyPos + 1;
+			}
+			i0 = end;
+			if (i0 == n)
+			{
+				break;
+			}
+		}
+		const int16_t v = samples[i0];
+		const uint64_t index = m_samples + i0;
+
+		if (m_armed && beyond(v))
+		{
+			m_pulses++;
+			// No snippet for a crossing in the first m_pre samples of the stream
+			if (!m_collecting && index >= m_pre)
+			{
+				// m_historyPos is the oldest sample
+				std::copy(m_history.begin() + m_historyPos, m_history.end(), m_snippet.begin());
+				std::copy(m_history.begin(), m_history.begin() + m_historyPos, m_snippet.begin() + (m_pre - m_historyPos));
+				m_snippetStart = index - m_pre;
+				m_filled = m_pre;
+				m_collecting = true;
+			}
+		}
+		m_armed = !beyond(v);
+
+		if (m_collecting)
+		{
+			m_snippet[m_filled++] = v;
+			if (m_filled == m_pre + m_post)
+			{
+				m_snippets++;
+				m_onSnippet(m_snippetStart, m_snippet.data(), m_filled);
+				m_collecting = false;
+			}
+		}
+		if (m_pre > 0)
+		{
+			m_history[m_historyPos] = v;
+			m_historyPos = m_historyPos + 1 == m_pre ? 0 : m_historyPos + 1;
+		}
+	}
+	m_samples += n;
+}
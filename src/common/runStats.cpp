@@ -0,0 +1,159 @@
+#include "common/runStats.h"
+#include "common/jsonString.h"
+
+#include <cstdio>
+#include <ctime>
+
+const char *const g_daqStageNames[DAQ_STAGES] = {"configure", "arm", "triggerWait", "transfer", "write", "reset"};
+
+static std::mutex s_runsMutex;
+static std::shared_ptr<runStats> s_current = std::make_shared<runStats>();
+static std::shared_ptr<runStats> s_last = std::make_shared<runStats>();
+
+static double unixTime()
+{
+	timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+runStats::unitStats &runStats::find(const std::string &unit)
+{
+	if (m_start == 0)
+	{
+		m_start = unixTime();
+	}
+	for (unitStats &u : m_units)
+	{
+		if (u.unit == unit)
+		{
+			return u;
+		}
+	}
+	m_units.push_back({unit, {0}, 0, 0});
+	return m_units.back();
+}
+
+void runStats::add(const std::string &unit, const daqStage stage, const double seconds)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	find(unit).seconds[stage] += seconds;
+}
+
+void runStats::setData(const std::string &unit, const uint32_t waveforms, const uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	unitStats &u = find(unit);
+	u.waveforms = waveforms;
+	u.bytes = bytes;
+}
+
+void runStats::setWritten()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_written = true;
+}
+
+std::string runStats::name() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_name;
+}
+
+double runStats::start() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_start;
+}
+
+bool runStats::written() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_written;
+}
+
+std::vector<runStats::unitStats> runStats::units() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_units;
+}
+
+std::string runStats::json() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	char number[64];
+	snprintf(number, sizeof(number), "%.6f", m_start);
+	std::string out = "{\"run\": " + jsonString(m_name) + ", \"start\": " + number + ", \"units\": [";
+	for (size_t i0(0); i0 < m_units.size(); ++i0)
+	{
+		const unitStats &u = m_units[i0];
+		out += (i0 > 0 ? ", {\"unit\": " : "{\"unit\": ") + jsonString(u.unit);
+		snprintf(number, sizeof(number), ", \"waveforms\": %u, \"bytes\": %llu", u.waveforms, (unsigned long long) u.bytes);
+		out += number;
+		for (int i1(0); i1 < DAQ_STAGES; ++i1)
+		{
+			snprintf(number, sizeof(number), ", \"%s\": %.6f", g_daqStageNames[i1], u.seconds[i1]);
+			out += number;
+		}
+		out += "}";
+	}
+	return out + "]}";
+}
+
+void runStats::log(const std::string &path) const
+{
+	if (path.empty())
+	{
+		return;
+	}
+	// One write per line, so concurrent writers do not interleave
+	const std::string line = json() + "\n";
+	FILE *f = fopen(path.c_str(), "a");
+	if (f == nullptr || fwrite(line.data(), 1, line.size(), f) != line.size())
+	{
+		printf("Cannot append to the run stats log %s\n", path.c_str());
+	}
+	if (f != nullptr)
+	{
+		fclose(f);
+	}
+}
+
+std::shared_ptr<runStats> runStats::current()
+{
+	std::lock_guard<std::mutex> lock(s_runsMutex);
+	return s_current;
+}
+
+std::shared_ptr<runStats> runStats::finish(const std::string &name)
+{
+	std::lock_guard<std::mutex> lock(s_runsMutex);
+	{
+		std::lock_guard<std::mutex> runLock(s_current->m_mutex);
+		s_current->m_name = name;
+	}
+	s_last = s_current;
+	s_current = std::make_shared<runStats>();
+	return s_last;
+}
+
+std::shared_ptr<runStats> runStats::last()
+{
+	std::lock_guard<std::mutex> lock(s_runsMutex);
+	return s_last;
+}
+
+stageTimer::stageTimer(const std::string &unit, const daqStage stage, std::shared_ptr<runStats> run)
+	: m_run(run), m_unit(unit), m_stage(stage), m_begin(std::chrono::steady_clock::now())
+{
+}
+
+void stageTimer::stop()
+{
+	if (m_stopped)
+	{
+		return;
+	}
+	m_stopped = true;
+	m_run->add(m_unit, m_stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_begin).count());
+}
@@ -0,0 +1,89 @@
+#include "common/sampleArena.h"
+
+#include <cstdio>
+
+#include <sys/mman.h>
+
+const size_t g_hugePageBytes = 2 << 20;
+const size_t g_pageBytes = 4096;
+
+sampleArena::~sampleArena()
+{
+	release();
+}
+
+void sampleArena::setOptions(const bool hugePages, const bool lock)
+{
+	m_optionsChanged |= hugePages != m_wantHugePages || lock != m_wantLock;
+	m_wantHugePages = hugePages;
+	m_wantLock = lock;
+}
+
+bool sampleArena::reserve(const size_t bytes)
+{
+	if (m_data != nullptr && bytes <= m_capacity && !m_optionsChanged)
+	{
+		return true;
+	}
+	release();
+	m_optionsChanged = false;
+	if (bytes == 0)
+	{
+		return true;
+	}
+
+	size_t mapped = (bytes + g_hugePageBytes - 1) / g_hugePageBytes * g_hugePageBytes;
+	void *map = MAP_FAILED;
+	if (m_wantHugePages)
+	{
+		map = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+				   -1, 0);
+		if (map == MAP_FAILED)
+		{
+			printf("WARNING: no hugetlb pages for %.1f MB of data buffers, using normal pages\n", mapped / 1e6);
+		}
+	}
+	m_hugePages = map != MAP_FAILED;
+	if (map == MAP_FAILED)
+	{
+		map = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED)
+		{
+			return false;
+		}
+		// Transparent hugepages if the kernel has them, then fault every page in now
+		madvise(map, mapped, MADV_HUGEPAGE);
+		for (size_t i0(0); i0 < mapped; i0 += g_pageBytes)
+		{
+			((volatile uint8_t *) map)[i0] = 0;
+		}
+	}
+
+	m_locked = false;
+	if (m_wantLock)
+	{
+		m_locked = mlock(map, mapped) == 0;
+		if (!m_locked)
+		{
+			printf("WARNING: could not mlock %.1f MB of data buffers (RLIMIT_MEMLOCK?)\n", mapped / 1e6);
+		}
+	}
+
+	m_data = (uint8_t *) map;
+	m_capacity = bytes;
+	m_mapped = mapped;
+	return true;
+}
+
+void sampleArena::release()
+{
+	if (m_data != nullptr)
+	{
+		munmap(m_data, m_mapped);
+	}
+	m_data = nullptr;
+	m_capacity = 0;
+	m_mapped = 0;
+	m_hugePages = false;
+	m_locked = false;
+}
@@ -0,0 +1,308 @@
+#include "common/sampleKernels.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SAMPLE_KERNELS_X86
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SAMPLE_KERNELS_BIG_ENDIAN
+#endif
+
+// Full scale in ADC counts, see adc2mv/adc8Bit2mv
+const float g_adc16FullScale = 32512.0f;
+const float g_adc8FullScale = 128.0f;
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 Scalar                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+static inline int16_t loadBigEndian16(const uint8_t *p)
+{
+	return (int16_t) ((p[0] << 8) | p[1]);
+}
+
+static void swapBigEndian16Scalar(const void *in, int16_t *out, const size_t n)
+{
+#ifdef SAMPLE_KERNELS_BIG_ENDIAN
+	memmove(out, in, n * sizeof(int16_t));
+#else
+	const uint8_t *p = (const uint8_t *) in;
+	for (size_t i0(0); i0 < n; ++i0)
+	{
+		uint16_t v;
+		memcpy(&v, p + 2 * i0, sizeof(v));
+		v = __builtin_bswap16(v);
+		memcpy(out + i0, &v, sizeof(v));
+	}
+#endif
+}
+
+template <bool bigEndian>
+static void adc16ToMvScalar(const void *in, float *out, const size_t n, const float range, const float sign)
+{
+	const uint8_t *p = (const uint8_t *) in;
+	for (size_t i0(0); i0 < n; ++i0)
+	{
+		int16_t v;
+		if (bigEndian)
+		{
+			v = loadBigEndian16(p + 2 * i0);
+		}
+		else
+		{
+			memcpy(&v, p + 2 * i0, sizeof(v));
+		}
+		out[i0] = (v / g_adc16FullScale) * range * sign;
+	}
+}
+
+static void adc8ToMvScalar(const int8_t *in, float *out, const size_t n, const float range, const float sign)
+{
+	for (size_t i0(0); i0 < n; ++i0)
+	{
+		out[i0] = (in[i0] / g_adc8FullScale) * range * sign;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 SSE4.1                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef SAMPLE_KERNELS_X86
+
+__attribute__((target("sse4.1")))
+static void swapBigEndian16Sse(const void *in, int16_t *out, const size_t n)
+{
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const uint8_t *p = (const uint8_t *) in;
+	size_t i0(0);
+	for (; i0 + 8 <= n; i0 += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 2 * i0));
+		_mm_storeu_si128((__m128i *) (out + i0), _mm_shuffle_epi8(v, shuffle));
+	}
+	swapBigEndian16Scalar(p + 2 * i0, out + i0, n - i0);
+}
+
+// The division is kept (rather than a reciprocal) so results match the scalar path bit for bit
+template <bool bigEndian>
+__attribute__((target("sse4.1")))
+static void adc16ToMvSse(const void *in, float *out, const size_t n, const float range, const float sign)
+{
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128 fullScale = _mm_set1_ps(g_adc16FullScale);
+	const __m128 rangeV = _mm_set1_ps(range);
+	const __m128 signV = _mm_set1_ps(sign);
+	const uint8_t *p = (const uint8_t *) in;
+	size_t i0(0);
+	for (; i0 + 8 <= n; i0 += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 2 * i0));
+		if (bigEndian)
+		{
+			v = _mm_shuffle_epi8(v, shuffle);
+		}
+		__m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(v));
+		__m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(v, 8)));
+		lo = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(lo, fullScale), rangeV), signV);
+		hi = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(hi, fullScale), rangeV), signV);
+		_mm_storeu_ps(out + i0, lo);
+		_mm_storeu_ps(out + i0 + 4, hi);
+	}
+	adc16ToMvScalar<bigEndian>(p + 2 * i0, out + i0, n - i0, range, sign);
+}
+
+__attribute__((target("sse4.1")))
+static void adc8ToMvSse(const int8_t *in, float *out, const size_t n, const float range, const float sign)
+{
+	const __m128 fullScale = _mm_set1_ps(g_adc8FullScale);
+	const __m128 rangeV = _mm_set1_ps(range);
+	const __m128 signV = _mm_set1_ps(sign);
+	size_t i0(0);
+	for (; i0 + 4 <= n; i0 += 4)
+	{
+		int32_t packed;
+		memcpy(&packed, in + i0, sizeof(packed));
+		__m128 v = _mm_cvtepi32_ps(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(packed)));
+		_mm_storeu_ps(out + i0, _mm_mul_ps(_mm_mul_ps(_mm_div_ps(v, fullScale), rangeV), signV));
+	}
+	adc8ToMvScalar(in + i0, out + i0, n - i0, range, sign);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                  AVX2                                   ///
+///////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static void swapBigEndian16Avx2(const void *in, int16_t *out, const size_t n)
+{
+	const __m256i shuffle = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+											 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const uint8_t *p = (const uint8_t *) in;
+	size_t i0(0);
+	for (; i0 + 16 <= n; i0 += 16)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + 2 * i0));
+		_mm256_storeu_si256((__m256i *) (out + i0), _mm256_shuffle_epi8(v, shuffle));
+	}
+	_mm256_zeroupper(); // the tail runs legacy SSE code
+	swapBigEndian16Sse(p + 2 * i0, out + i0, n - i0);
+}
+
+template <bool bigEndian>
+__attribute__((target("avx2")))
+static void adc16ToMvAvx2(const void *in, float *out, const size_t n, const float range, const float sign)
+{
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m256 fullScale = _mm256_set1_ps(g_adc16FullScale);
+	const __m256 rangeV = _mm256_set1_ps(range);
+	const __m256 signV = _mm256_set1_ps(sign);
+	const uint8_t *p = (const uint8_t *) in;
+	size_t i0(0);
+	for (; i0 + 16 <= n; i0 += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) (p + 2 * i0));
+		__m128i b = _mm_loadu_si128((const __m128i *) (p + 2 * i0 + 16));
+		if (bigEndian)
+		{
+			a = _mm_shuffle_epi8(a, shuffle);
+			b = _mm_shuffle_epi8(b, shuffle);
+		}
+		__m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a));
+		__m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b));
+		lo = _mm256_mul_ps(_mm256_mul_ps(_mm256_div_ps(lo, fullScale), rangeV), signV);
+		hi = _mm256_mul_ps(_mm256_mul_ps(_mm256_div_ps(hi, fullScale), rangeV), signV);
+		_mm256_storeu_ps(out + i0, lo);
+		_mm256_storeu_ps(out + i0 + 8, hi);
+	}
+	_mm256_zeroupper(); // the tail runs legacy SSE code
+	adc16ToMvSse<bigEndian>(p + 2 * i0, out + i0, n - i0, range, sign);
+}
+
+__attribute__((target("avx2")))
+static void adc8ToMvAvx2(const int8_t *in, float *out, const size_t n, const float range, const float sign)
+{
+	const __m256 fullScale = _mm256_set1_ps(g_adc8FullScale);
+	const __m256 rangeV = _mm256_set1_ps(range);
+	const __m256 signV = _mm256_set1_ps(sign);
+	size_t i0(0);
+	for (; i0 + 8 <= n; i0 += 8)
+	{
+		__m256 v = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (in + i0))));
+		_mm256_storeu_ps(out + i0, _mm256_mul_ps(_mm256_mul_ps(_mm256_div_ps(v, fullScale), rangeV), signV));
+	}
+	_mm256_zeroupper(); // the tail runs legacy SSE code
+	adc8ToMvSse(in + i0, out + i0, n - i0, range, sign);
+}
+
+#endif // SAMPLE_KERNELS_X86
+
+///////////////////////////////////////////////////////////////////////////////
+///                                Dispatch                                 ///
+///////////////////////////////////////////////////////////////////////////////
+
+struct sampleKernelSet
+{
+	sampleIsa isa;
+	void (*swap16)(const void *, int16_t *, const size_t);
+	void (*be16ToMv)(const void *, float *, const size_t, const float, const float);
+	void (*host16ToMv)(const void *, float *, const size_t, const float, const float);
+	void (*adc8ToMv)(const int8_t *, float *, const size_t, const float, const float);
+};
+
+static const sampleKernelSet g_scalarKernels = {ISA_SCALAR, swapBigEndian16Scalar, adc16ToMvScalar<true>, adc16ToMvScalar<false>, adc8ToMvScalar};
+#ifdef SAMPLE_KERNELS_X86
+static const sampleKernelSet g_sseKernels = {ISA_SSE41, swapBigEndian16Sse, adc16ToMvSse<true>, adc16ToMvSse<false>, adc8ToMvSse};
+static const sampleKernelSet g_avx2Kernels = {ISA_AVX2, swapBigEndian16Avx2, adc16ToMvAvx2<true>, adc16ToMvAvx2<false>, adc8ToMvAvx2};
+#endif
+
+static bool cpuSupports(const sampleIsa isa)
+{
+#ifdef SAMPLE_KERNELS_BIG_ENDIAN
+	return isa == ISA_SCALAR;
+#elif defined(SAMPLE_KERNELS_X86)
+	switch (isa)
+	{
+		case ISA_AVX2: return __builtin_cpu_supports("avx2");
+		case ISA_SSE41: return __builtin_cpu_supports("sse4.1");
+		default: return true;
+	}
+#else
+	return isa == ISA_SCALAR;
+#endif
+}
+
+static const sampleKernelSet *kernelsFor(const sampleIsa isa)
+{
+#ifdef SAMPLE_KERNELS_X86
+	if (isa == ISA_AVX2) return &g_avx2Kernels;
+	if (isa == ISA_SSE41) return &g_sseKernels;
+#endif
+	return &g_scalarKernels;
+}
+
+static const sampleKernelSet *detectKernels()
+{
+#ifdef SAMPLE_KERNELS_X86
+	__builtin_cpu_init(); // runs before main, from a static initialiser
+#endif
+	if (cpuSupports(ISA_AVX2))
+	{
+		return kernelsFor(ISA_AVX2);
+	}
+	if (cpuSupports(ISA_SSE41))
+	{
+		return kernelsFor(ISA_SSE41);
+	}
+	return &g_scalarKernels;
+}
+
+static const sampleKernelSet *g_kernels = detectKernels();
+
+void swapBigEndian16(const void *in, int16_t *out, const size_t n)
+{
+	g_kernels->swap16(in, out, n);
+}
+
+void beAdcToMv(const void *in, float *out, const size_t n, const int rangeMv, const bool invert)
+{
+	g_kernels->be16ToMv(in, out, n, (float) rangeMv, invert ? -1.0f : 1.0f);
+}
+
+void adc16ToMv(const void *in, float *out, const size_t n, const int rangeMv, const bool invert)
+{
+	g_kernels->host16ToMv(in, out, n, (float) rangeMv, invert ? -1.0f : 1.0f);
+}
+
+void adc8ToMv(const int8_t *in, float *out, const size_t n, const int rangeMv, const bool invert)
+{
+	g_kernels->adc8ToMv(in, out, n, (float) rangeMv, invert ? -1.0f : 1.0f);
+}
+
+sampleIsa sampleKernelIsa()
+{
+	return g_kernels->isa;
+}
+
+const char *sampleIsaName(const sampleIsa isa)
+{
+	switch (isa)
+	{
+		case ISA_AVX2: return "avx2";
+		case ISA_SSE41: return "sse4.1";
+		default: return "scalar";
+	}
+}
+
+bool setSampleKernelIsa(const sampleIsa isa)
+{
+	if (!cpuSupports(isa))
+	{
+		return false;
+	}
+	g_kernels = kernelsFor(isa);
+	return true;
+}
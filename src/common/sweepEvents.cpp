@@ -0,0 +1,41 @@
+#include "common/sweepEvents.h"
+
+#include <chrono>
+
+void sweepEvents::push(const uint32_t step, const std::string &stage)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_events.push_back({step, stage});
+	}
+	m_ready.notify_all();
+}
+
+void sweepEvents::finish(const std::string &error)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_finished = true;
+		m_error = error;
+	}
+	m_ready.notify_all();
+}
+
+sweepEvents::result sweepEvents::next(event &e, const uint32_t timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() {return m_finished || !m_events.empty();});
+	if (!m_events.empty())
+	{
+		e = m_events.front();
+		m_events.pop_front();
+		return received;
+	}
+	return m_finished ? finished : timedOut;
+}
+
+std::string sweepEvents::error()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_error;
+}
@@ -0,0 +1,97 @@
+#include "common/waveformSummary.h"
+#include "common/adcKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+template <typename T>
+static void summariseWaveform(const T *x, const uint32_t n, const summaryWindow &baseline,
+							  const std::vector<summaryWindow> &windows, uint8_t *out)
+{
+	summaryRecord r;
+	memset(&r, 0, sizeof(r));
+	float *charges = (float *) (out + sizeof(r));
+	if (n == 0)
+	{
+		memcpy(out, &r, sizeof(r));
+		std::fill(charges, charges + windows.size(), 0.0f);
+		return;
+	}
+
+	const uint32_t baselineUpper = std::min(baseline.upper, n - 1);
+	if (baseline.lower <= baselineUpper)
+	{
+		r.baseline = (float) adcSum(x, baseline.lower, baselineUpper) / (baselineUpper - baseline.lower + 1);
+	}
+	r.minimumIndex = adcArgMin(x, n);
+	r.minimum = x[r.minimumIndex];
+	memcpy(out, &r, sizeof(r));
+
+	for (size_t i0(0); i0 < windows.size(); ++i0)
+	{
+		const uint32_t upper = std::min(windows[i0].upper, n - 1);
+		float charge(0);
+		if (windows[i0].lower <= upper)
+		{
+			charge = adcSum(x, windows[i0].lower, upper) - r.baseline * (upper - windows[i0].lower + 1);
+		}
+		memcpy(charges + i0, &charge, sizeof(charge));
+	}
+}
+
+template <typename T>
+static void summariseRange(const void *const *waveforms, const uint32_t first, const uint32_t last,
+						   const uint32_t numSamples, const summaryWindow &baseline,
+						   const std::vector<summaryWindow> &windows, const bool aggregated,
+						   const size_t recordBytes, uint8_t *out)
+{
+	// Aggregated waveforms: maxima in the first half, minima in the second
+	const uint32_t skip = aggregated ? numSamples / 2 : 0;
+	for (uint32_t i0(first); i0 < last; ++i0)
+	{
+		summariseWaveform((const T *) waveforms[i0] + skip, numSamples - skip, baseline, windows,
+						  out + (size_t) i0 * recordBytes);
+	}
+}
+
+std::vector<uint8_t> summariseWaveforms(const void *const *waveforms, const uint32_t numWaveforms,
+										const uint32_t numSamples, const uint32_t sampleBytes,
+										const summaryWindow &baseline, const std::vector<summaryWindow> &windows,
+										const bool aggregated, unsigned threads)
+{
+	const size_t recordBytes = sizeof(summaryRecord) + sizeof(float) * windows.size();
+	std::vector<uint8_t> out(recordBytes * numWaveforms);
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::max(1u, std::min(threads, numWaveforms));
+
+	// Contiguous slices, every waveform costs about the same
+	auto job = [&](const uint32_t t) {
+		const uint32_t first = (uint64_t) numWaveforms * t / threads;
+		const uint32_t last = (uint64_t) numWaveforms * (t + 1) / threads;
+		if (sampleBytes == sizeof(int8_t))
+		{
+			summariseRange<int8_t>(waveforms, first, last, numSamples, baseline, windows, aggregated,
+								   recordBytes, out.data());
+		}
+		else
+		{
+			summariseRange<int16_t>(waveforms, first, last, numSamples, baseline, windows, aggregated,
+									recordBytes, out.data());
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned i0(1); i0 < threads; ++i0)
+	{
+		pool.emplace_back(job, i0);
+	}
+	job(0);
+	for (std::thread &t : pool)
+	{
+		t.join();
+	}
+	return out;
+}
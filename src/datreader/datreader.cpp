@@ -0,0 +1,106 @@
+/*
+ * Python bindings of the analysis .dat reader (src/analysis/datReader.cpp).
+ *
+ *   import datreader
+ *   header = datreader.readHeader('run.dat')
+ *   header, data = datreader.readFileAdc('run.dat')
+ *
+ * Headers come back as the same dicts sanityCheck.readHeader builds. Channel
+ * arrays are read-only (numWaveforms, numSamples) views straight into the
+ * memory-mapped file (or the decoded copy for compressed files), in the file's
+ * own byte order, so nothing is copied. They keep the mapping alive: drop them
+ * before the file is overwritten, reading a truncated mapping raises SIGBUS.
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "datReader.h"
+#include "common/datFormat.h"
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+namespace py = pybind11;
+
+static py::dict headerDict(const dataHeader &h)
+{
+	py::dict d;
+	d["version"] = h.version;
+	d["codec"] = h.codec;
+	d["timebase"] = h.timebase;
+	d["activeChannels"] = h.activeChannels;
+	d["activeTriggers"] = h.activeTriggers;
+	d["8bitReadout"] = std::string(h.bit8Buffer ? "1" : "0");
+	d["auxTriggerThreshold"] = h.auxTriggerThreshold;
+	for (int ch(0); ch < 4; ++ch)
+	{
+		const std::string c = std::string("ch") + (char) ('A' + ch);
+		d[(c + "TriggerThreshold").c_str()] = h.chTriggerThreshold.at(ch);
+		d[(c + "VRange").c_str()] = h.chVRanges.at(ch);
+		d[(c + "Samples").c_str()] = h.chSamples.at(ch);
+		d[(c + "Offset").c_str()] = h.chOffset.at(ch);
+		d[(c + "Bytes").c_str()] = h.chBytes.at(ch);
+		d[(c + "DownsampleMode").c_str()] = h.chDownsampleMode.at(ch);
+		d[(c + "DownsampleRatio").c_str()] = h.chDownsampleRatio.at(ch);
+	}
+	d["preTriggerSamples"] = h.preTriggerSamples;
+	d["numWaveforms"] = h.numWaveforms;
+	d["timestamp"] = h.timestamp;
+	d["modelNumber"] = h.modelNumber;
+	d["serialNumber"] = h.serialNumber;
+	return d;
+}
+
+py::dict readHeader(const std::string &filePath)
+{
+	dataHeader h;
+	if (readFileHeader(filePath, h) == 0)
+	{
+		throw std::runtime_error("'" + filePath + "' is missing or not a .dat file");
+	}
+	return headerDict(h);
+}
+
+// (header, [array per active channel]), the arrays share one owner of the mapping
+py::tuple readFileAdc(const std::string &filePath)
+{
+	datFile *file;
+	{
+		// Compressed files are decoded at open, on every core
+		py::gil_scoped_release release;
+		file = new datFile(filePath);
+	}
+	py::capsule owner(file, [](void *p) {delete (datFile *) p;});
+	if (!file->isOpen())
+	{
+		throw std::runtime_error("'" + filePath + "' is missing, truncated or not a .dat file");
+	}
+
+	const dataHeader &h = file->header();
+	// v1 payloads stay big-endian, numpy swaps on the fly
+	py::dtype dtype(std::string(h.bit8Buffer ? "i1" : h.version == g_datVersion1 ? ">i2" : "<i2"));
+	py::list data;
+	for (int ch(0); ch < 4; ++ch)
+	{
+		if (!file->isActive(ch))
+		{
+			continue;
+		}
+		const channelView view = file->channel(ch);
+		const ssize_t sampleBytes = view.sampleBytes();
+		py::array a(dtype, {(ssize_t) view.numWaveforms, (ssize_t) view.numSamples},
+					{(ssize_t) view.numSamples * sampleBytes, sampleBytes}, view.data, owner);
+		a.attr("setflags")(py::arg("write") = false);
+		data.append(a);
+	}
+	return py::make_tuple(headerDict(h), data);
+}
+
+PYBIND11_MODULE(datreader, m)
+{
+	m.doc() = "Zero-copy .dat file reader";
+
+	m.def("readHeader", &readHeader, py::return_value_policy::copy);
+	m.def("readFileAdc", &readFileAdc, py::return_value_policy::copy);
+}
@@ -10,192 +10,61 @@
 #include <memory>
 
 #include "ps3000a/ps3000aWrapper.h"
+#include "common/daqSeries.h"
+#include "common/datWriter.h"
+#include "common/runStats.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 using namespace std;
 namespace py = pybind11;
 
-class dataCollectionConfig 
+// A unit of this model, the driver calls of daqUnit (common/daqSeries.h) on its UNIT
+class dataCollectionConfig : public daqUnit
 {
 public:
     UNIT unit;
-    bitset<4> activeChannels;
-    bitset<5> activeTriggers;
-    bitset<4> timebase;
-    bitset<16> chVoltageRanges;
-    vector<int16_t> chTriggerThresholdADC;
-    int16_t auxTriggerThresholdADC;
-    vector<uint16_t> chPostSamplesPerWaveform; // NOTE: Excludes pre trigger samples
-    uint16_t maxPostSamples;
-    int16_t samplesPreTrigger;
-    uint32_t numWaveforms;
-    vector<vector<void*>> dataBuffers;
-    bool bit8Buffers; // if true, write out only 8 bits to buffer and file
-
-    BOOL dataConfigured = FALSE;
-    BOOL unitInitialised = FALSE;
-
-    char serial[32];
+
     dataCollectionConfig(UNIT &unit, char *serial)
     {
         this->unit = unit;
         strcpy(this->serial, serial);
+        identify();
     }
-    void print()
+    // Name and model for runStats and the file headers, again after findUnit
+    void identify()
     {
-        printf("Data Collection Config Info:\n");
-        printf("Serial Number: %s\n", this->serial);
-        printf("Active Channels: %u\n", (uint) this->activeChannels.to_ulong());
-        printf("Active Triggers: %u\n", (uint) this->activeTriggers.to_ulong());
-        printf("Timebase: %u\n", (uint) this->timebase.to_ulong());
-        printf("Channel V Ranges: %u\n", (uint) this->chVoltageRanges.to_ulong());
-        for (int i = 0; i < this->chTriggerThresholdADC.size(); i++)
-        {
-            printf("%c Trigger Threshold: %i\n", 'A' + i, this->chTriggerThresholdADC.at(i));
-        }
-        printf("Aux Trigger Threshold: %i\n", this->auxTriggerThresholdADC);
-        for (int i = 0; i < this->chPostSamplesPerWaveform.size(); i++)
-        {
-            printf("%c Post Trigger Samples: %i\n", 'A' + i, this->chPostSamplesPerWaveform.at(i));
-        }
-        printf("Max Post Trigger Samples: %i\n", this->maxPostSamples);
-        printf("Samples Pre Trigger: %i\n", this->samplesPreTrigger);
-        printf("Number of Waveforms: %i\n", this->numWaveforms);
-        printf("Data Configured: %s\n", this->dataConfigured ? "true" : "false");
-        printf("Unit Initialised: %s\n\n", this->unitInitialised ? "true" : "false");
+        name = UnitName(&unit);
+        model = string((const char *) unit.modelString, strnlen((const char *) unit.modelString, sizeof(unit.modelString)));
     }
-};
-
-bool isLittleEndian()
-{
-    uint32_t i = 1;
-    char *c = (char*)&i;
-    return bool(*c);
-}
-
-bool g_littleEndian = isLittleEndian();
-
-UNIT g_unit;
-dataCollectionConfig g_dcc(g_unit, (char*) "");
-vector<dataCollectionConfig> g_vecDcc;
-
-void setActiveChannels(dataCollectionConfig &dcc, 
-                       int16_t aChVoltage,
-                       int16_t bChVoltage,
-                       int16_t cChVoltage,
-                       int16_t dChVoltage)
-{
-    int16_t chVoltage[4] = {aChVoltage, bChVoltage, cChVoltage, dChVoltage};
-    uint8_t chVRangeBits[4];
-    uint16_t allVRange;
-
-    for (int i = 0; i < 4; i++)
-    {
-        if (chVoltage[i] != 99) 
-        {
-            dcc.activeChannels.set(i);
-        }
-        chVRangeBits[i] = chVoltage[i] * dcc.activeChannels.test(i);
-    }
-    dcc.chVoltageRanges = chVoltage[0] * dcc.activeChannels.test(0) << 12 |
-                          chVoltage[1] * dcc.activeChannels.test(1) <<  8 |
-                          chVoltage[2] * dcc.activeChannels.test(2) <<  4 |
-                          chVoltage[3] * dcc.activeChannels.test(3);
-
-    SetVoltages(&dcc.unit, chVoltage);
-    return;
-}
-
-void setTriggerConfig(dataCollectionConfig &dcc, 
-                      int16_t aTrigVoltageMv,
-                      int16_t bTrigVoltageMv,
-                      int16_t cTrigVoltageMv,
-                      int16_t dTrigVoltageMv,
-                      int16_t auxTrigVoltageMv)
-{
-
-    int16_t trigVoltageMv[4] = {aTrigVoltageMv,
-                                bTrigVoltageMv,
-                                cTrigVoltageMv,
-                                dTrigVoltageMv};
-
-    vector<int16_t> chTriggerThresholdADC;
-
-    for (int i = 0; i < 4; i++)
+    void setVoltages(int16_t ranges[4]) override
     {
-        if (trigVoltageMv[i] != 0 && dcc.activeChannels.test(i))
-        {
-            dcc.activeTriggers.set(i + 1);
-            chTriggerThresholdADC.push_back(mv_to_adc(trigVoltageMv[i], 
-            dcc.unit.channelSettings[i].range, &dcc.unit));
-        }
-        else
-        {
-            chTriggerThresholdADC.push_back(0);
-        }
+        SetVoltages(&unit, ranges);
     }
-    if (auxTrigVoltageMv != 0)
+    int16_t mvToAdc(int ch, int16_t mv) override
     {
-        dcc.activeTriggers.set(0);
-        dcc.auxTriggerThresholdADC = mv_to_adc(auxTrigVoltageMv, PS_1V, &dcc.unit);
+        return mv_to_adc(mv, ch < 4 ? unit.channelSettings[ch].range : PS_1V, &unit);
     }
-    else
+    void setTriggers() override
     {
-        dcc.auxTriggerThresholdADC = 0;
+        SetTriggers(&unit, activeTriggers, chTriggerThresholdADC, auxTriggerThresholdADC);
     }
-
-    dcc.chTriggerThresholdADC = chTriggerThresholdADC;
-    SetTriggers(&dcc.unit, dcc.activeTriggers, dcc.chTriggerThresholdADC, dcc.auxTriggerThresholdADC);
-
-    return;
-}
-
-void setDataConfig(dataCollectionConfig &dcc, uint8_t timebase,
-    uint32_t numWaveforms, int16_t samplesPreTrigger, uint16_t chAWfSamples,
-    uint16_t chBWfSamples , uint16_t chCWfSamples , uint16_t chDWfSamples, bool bit8Buffers)
-{
-    dcc.timebase = timebase;
-    dcc.numWaveforms = numWaveforms;
-    dcc.samplesPreTrigger = samplesPreTrigger;
-
-    vector<uint16_t> samplesPostPerWaveform = {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples};
-    dcc.chPostSamplesPerWaveform = samplesPostPerWaveform;
-    dcc.maxPostSamples = *max_element(  dcc.chPostSamplesPerWaveform.begin(),
-                                        dcc.chPostSamplesPerWaveform.end());
-
-    if (dcc.samplesPreTrigger < 0)
+    void setDaqDelay() override
     {
-        printf("Setting post-trigger delay of %i samples\n", -1 * dcc.samplesPreTrigger);
-        SetDaqDelay(&dcc.unit, dcc.samplesPreTrigger);
+        SetDaqDelay(&unit, samplesPreTrigger);
     }
-
-    dcc.bit8Buffers = bit8Buffers;
-
-    dcc.dataBuffers = SetDataBuffers(&dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples, bit8Buffers);
-
-    return;
-}
-
-void freeDataBuffers(dataCollectionConfig &dcc)
-{
-    for (int i = 0; i < dcc.activeChannels.count(); i++)
+    void setDataBuffers() override
     {
-        for (int j = 0; j < dcc.numWaveforms; j++)
-        {
-            free(dcc.dataBuffers.at(i).at(j));
-        }
+        dataBuffers = SetDataBuffers(&unit, activeChannels, chPostSamplesPerWaveform, samplesPreTrigger,
+                numWaveforms, maxPostSamples, bit8Buffers, *arena, chDownsampleMode, chDownsampleRatio);
     }
-}
+};
 
-void resetDataBuffers(dataCollectionConfig &dcc)
-{
-    freeDataBuffers(dcc);
-    dcc.dataBuffers = SetDataBuffers(&dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples, dcc.bit8Buffers);
-}
+UNIT g_unit;
+dataCollectionConfig g_dcc(g_unit, (char*) "");
+vector<dataCollectionConfig> g_vecDcc;
 
 void collectRapidBlockData(dataCollectionConfig &dcc)
 {
@@ -242,213 +111,29 @@ void collectMultiRapidBlockData(vector<dataCollectionConfig> &vecDcc)
             vecTimebase, vecNumWaveforms);
 }
 
-void setDataOutput(char *outputFileName, ofstream &of)
-{
-    of.open(outputFileName, ios::out | ios::binary);
-    return;
-}
-
-void closeDataOutput(ofstream &of)
-{
-    of.close();
-    return;
-}
-
-int16_t bswap16(int16_t n)
-{
-    if (g_littleEndian) {return __builtin_bswap16(n);}
-    else {return n;}
-}
-
-uint16_t bswapu16(uint16_t n)
-{
-    if (g_littleEndian) {return __builtin_bswap16(n);}
-    else {return n;}
-}
-
-int32_t bswap32(int32_t n)
-{
-    if (g_littleEndian) {return __builtin_bswap32(n);}
-    else {return n;}
-}
-
-uint32_t bswapu32(uint32_t n)
-{
-    if (g_littleEndian) {return __builtin_bswap32(n);}
-    else {return n;}
-}
-
-template<std::size_t N>
-void bitset_reverse(std::bitset<N> &b) 
-{
-    for(std::size_t i = 0; i < N/2; ++i) 
-    {
-        bool t = b[i];
-        b[i] = b[N-i-1];
-        b[N-i-1] = t;
-    }
-}
-
-char *concatTwoChar(char *line1, char *line2)
-{
-    char *totalLine;
-    int len = asprintf(&totalLine, "%s%s", line1, line2);
-    if (len < 0) abort();
-    return totalLine;
-}
-
-// Replaces '/' with '-' and adds '_' to the start
-char *formatSerial(char *serial)
-{
-    int max = 31;
-    char outputSerial[max];
-    strcpy(outputSerial, serial);
-
-    for (int i = 0; i < max; i++)
-    {
-        if (outputSerial[i] == '/')
-        {
-            outputSerial[i] = '-';
-        }
-    }
-
-    return concatTwoChar((char *) "_", outputSerial); 
-}
-
-char *createFileName(char *serial, char *outputFileBasename)
-{
-    char *formattedSerial = formatSerial(serial);
-    return concatTwoChar(concatTwoChar(outputFileBasename, formattedSerial), (char *) ".dat");
-}
-
-void writeDataHeader(dataCollectionConfig &dcc, ofstream &of)
+// Rapid-block captures taking longer than this are stopped, 0 waits until Ctrl+C.
+// Until set, single-unit captures wait until Ctrl+C and multi-unit captures for 5 s
+int setCaptureTimeout(uint32_t timeoutMs)
 {
-    /*
-     * Bit layout, in order
-     * 4 bits: timebase (from 0-4 for ps6000)
-     * 4 bits: ch1-4 active
-     * 2 bits: padding
-     * 1 bit: 1 if the data is 1 byte per sample, 0 if its 2 bytes per sample
-     * 5 bits: ch1-4, aux trigger active
-     * 16 bits: aux trigger threshold
-     * 64 (16*4) bits: trigger threshold (ch1-4)
-     * 16 (4*4): ch1-4 voltage ranges (aux is always +-1V range)
-     * 64 (4*16) bits: number of TOTAL samples per waveform (including pretrigger)
-     * 16 bits: number of samples before trigger
-     * 32 bits: number of waveforms
-     * 32 bits: unix timestamp (signed integer)
-     * total above bits: 232 (29 bytes)
-     * Flexible length, 0 terminated: model string
-     * Flexible length, 0 terminated: serial number
-    */
-
-    int16_t o16;
-    uint16_t ou16;
-    int32_t o32;
-    uint32_t ou32;
-
-    bitset_reverse(dcc.activeChannels);
-    bitset_reverse(dcc.activeTriggers);
-
-    uint8_t timebaseActiveCh =  (uint8_t) dcc.timebase.to_ullong() << 4 |
-                                (uint8_t) dcc.activeChannels.to_ullong();
-    of.write((const char *) &timebaseActiveCh, sizeof(uint8_t));
-
-
-    uint8_t bufferSizeActiveTriggers =  (uint8_t) dcc.bit8Buffers << 5 |
-                                        (uint8_t) dcc.activeTriggers.to_ullong();
-    of.write((const char *) &bufferSizeActiveTriggers, sizeof(uint8_t));
-
-    bitset_reverse(dcc.activeChannels);
-    bitset_reverse(dcc.activeTriggers);
-
-    o16 = bswap16(dcc.auxTriggerThresholdADC);
-    of.write((const char *) &o16, sizeof(int16_t));
-
-    for (int i = 0; i < 4; i++)
-    {
-        o16 = bswap16(dcc.chTriggerThresholdADC.at(i));
-        of.write((const char *) &o16, sizeof(int16_t));
-    }
-
-    o16 = bswap16((int16_t) dcc.chVoltageRanges.to_ullong());
-    of.write((const char *) &o16, sizeof(int16_t));
-
-    for (int i = 0; i < 4; i++)
-    {
-        ou16 = dcc.activeChannels.test(i) *
-            bswapu16(dcc.chPostSamplesPerWaveform.at(i) + dcc.samplesPreTrigger);
-        of.write((const char *) &ou16, sizeof(uint16_t));
-    }
-
-    o16 = bswap16(dcc.samplesPreTrigger);
-    of.write((const char *) &o16, sizeof(int16_t));
-
-    o32 = bswap32(dcc.numWaveforms);
-    of.write((const char *) &o32, sizeof(int32_t));
-
-    time_t t = time(nullptr);
-    o32 = bswap32((int32_t) t);
-    of.write((const char *) &o32, sizeof(int32_t));
-
-    for (int i = 0; i < sizeof(dcc.unit.modelString); i++)
-    {
-        of.write((const char *) &dcc.unit.modelString[i], 1L);
-        if (dcc.unit.modelString[i] == '\0') {break;}
-    }
-
-    for (int i = 0; i < sizeof(dcc.serial); i++)
-    {
-        of.write((const char *) &dcc.serial[i], 1L);
-        if (dcc.unit.serial[i] == '\0') {break;}
-    }
-
-    return;
+    SetCaptureTimeout(timeoutMs);
+    return 1;
 }
 
-void writeDataOut(dataCollectionConfig &dcc, ofstream &of)
+// Rapid-block runs longer than segments waveforms are captured in windows, 0 disables.
+// Used from the next set*DaqSettings call
+int setRapidBlockWindow(uint32_t segments)
 {
-    uint16_t maxSamples = *max_element( dcc.chPostSamplesPerWaveform.begin(), 
-                                        dcc.chPostSamplesPerWaveform.end());
-    
-    int16_t o16;
-    uint32_t s = dcc.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
-    int i = 0;
-
-    for (int ch = 0; ch < 4; ch++)
-    {
-        if (!(dcc.activeChannels.test(ch)))
-        {
-            continue;
-        }
-
-        int count = 0;
-        uint64_t nSamples = (dcc.chPostSamplesPerWaveform.at(ch) 
-                           + dcc.samplesPreTrigger);
-        for (int j = 0; j < dcc.numWaveforms; j++)
-        {
-            if (dcc.bit8Buffers)
-            {
-                of.write((const char*) dcc.dataBuffers.at(i).at(j), s * nSamples);
-            }
-            else
-            {
-                for (int k = 0; k < nSamples; k++)
-                {
-                    int16_t* p = (int16_t*) dcc.dataBuffers.at(i).at(j);
-                    o16 = bswap16(p[k]);
-                    of.write((const char*) &o16, s);
-                }
-            }
-        }
-        i++;
-    }
+    SetRapidBlockWindow(segments);
+    g_rapidBlockWindow = segments;
+    return 1;
 }
 
 int seriesInitDaq(char *serial)
 {
     if (serial == "") {serial = NULL;}
     findUnit(&g_dcc.unit, (int8_t*) serial);
+    g_dcc.identify();
+    g_dcc.forgetApplied();
     try
     {
         strcpy(g_dcc.serial, serial);
@@ -478,18 +163,12 @@ int seriesSetDaqSettings(
     {
         return 0;
     }
-    if (g_dcc.dataConfigured == TRUE)
-    {
-        freeDataBuffers(g_dcc);
-    }
     try
     {
-        setActiveChannels(g_dcc, chAVRange, chBVRange, chCVRange, chDVRange);
-        printf("Active channels set\n");
-        setTriggerConfig(g_dcc, chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger);
-        printf("Trigger channels set\n");
-        setDataConfig(g_dcc, timebase, numWaveforms, samplesPreTrigger, 
-                chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, false);
+        stageTimer configure(UnitName(&g_dcc.unit), STAGE_CONFIGURE);
+        configureUnit(g_dcc, {chAVRange, chBVRange, chCVRange, chDVRange},
+                {chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger}, timebase, numWaveforms,
+                samplesPreTrigger, {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples});
         printf("All settings configured\n\n");
         g_dcc.dataConfigured = TRUE;
         printf("Data settings updated\n");
@@ -515,15 +194,20 @@ int seriesCollectData(char *outputFileBasename)
     try
     {
         collectRapidBlockData(g_dcc);
+        shared_ptr<runStats> run = runStats::finish(outputFileBasename);
+        run->setData(UnitName(&g_dcc.unit), g_dcc.numWaveforms, g_dcc.capturedBytes());
 
-        ofstream of;
         char *outputFile = concatTwoChar(outputFileBasename, (char *) ".dat");
-        setDataOutput(outputFile, of);
-        writeDataHeader(g_dcc, of);
-        writeDataOut(g_dcc, of);
-        closeDataOutput(of);
-        printf("Written to file: %s\n", outputFile);
-        resetDataBuffers(g_dcc);
+        if (g_doubleBuffered)
+        {
+            g_writer.wait();
+            queueDataFile(g_dcc, outputFile, run);
+        }
+        else
+        {
+            writeDataFile(g_dcc, outputFile, run);
+            finishRunStats(run);
+        }
         printf("Daq finished\n\n");
         return 1;
     }
@@ -540,6 +224,14 @@ int seriesCollectData(char *outputFileBasename)
 
 int seriesCloseDaq()
 {
+    try
+    {
+        g_writer.wait();
+    }
+    catch (exception &e)
+    {
+        printf("Caught: %s\n", e.what());
+    }
     if (g_dcc.dataConfigured)
     {
         freeDataBuffers(g_dcc);
@@ -591,16 +283,10 @@ int multiSeriesSetDaqSettings(
                 printf("Unit uninitialised in multiDcc\n");
                 return 0;
             }
-            if (g_vecDcc.at(i).dataConfigured == TRUE)
-            {
-                freeDataBuffers(g_vecDcc.at(i));
-            }
-            setActiveChannels(g_vecDcc.at(i), chAVRange, chBVRange, chCVRange, chDVRange);
-            printf("%s: Active channel(s) configured\n", g_vecDcc.at(i).serial);
-            setTriggerConfig(g_vecDcc.at(i), chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger);
-            printf("%s: Trigger channel(s) configured\n", g_vecDcc.at(i).serial);
-            setDataConfig(g_vecDcc.at(i), timebase, numWaveforms, samplesPreTrigger, 
-                    chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, false);
+            stageTimer configure(UnitName(&g_vecDcc.at(i).unit), STAGE_CONFIGURE);
+            configureUnit(g_vecDcc.at(i), {chAVRange, chBVRange, chCVRange, chDVRange},
+                    {chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger}, timebase, numWaveforms,
+                    samplesPreTrigger, {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples});
             g_vecDcc.at(i).dataConfigured = TRUE;
             printf("%s: Settings configured\n\n", g_vecDcc.at(i).serial);
 
@@ -633,6 +319,27 @@ int multiSeriesSetDaqSettings(
     return 1;
 }
 
+// g_vecDcc for the multi-unit runs and sweeps of common/daqSeries.h
+class multiSeriesUnits : public daqModel
+{
+public:
+    vector<daqUnit *> units() override
+    {
+        vector<daqUnit *> units;
+        for (dataCollectionConfig &dcc : g_vecDcc)
+        {
+            units.push_back(&dcc);
+        }
+        return units;
+    }
+    void collectRapidBlocks() override
+    {
+        collectMultiRapidBlockData(g_vecDcc);
+    }
+};
+
+multiSeriesUnits g_multiSeries;
+
 int multiSeriesCollectData(char *outputFileBasename)
 {
     // Idk how to decide outputfile names, add a random number? Add serial number?
@@ -654,28 +361,21 @@ int multiSeriesCollectData(char *outputFileBasename)
         return 0;
     }
 
-    collectMultiRapidBlockData(g_vecDcc);
-    for (int i = 0; i < g_vecDcc.size(); i++)
-    {
-        if (!(g_dcc.unitInitialised && g_dcc.dataConfigured))
-        {
-            
-        }
-        ofstream of;
-        char *outputFile = createFileName(g_vecDcc.at(i).serial, outputFileBasename);
-        setDataOutput(outputFile, of);
-        writeDataHeader(g_vecDcc.at(i), of);
-        writeDataOut(g_vecDcc.at(i), of);
-        closeDataOutput(of);
-        printf("Written to file: %s\n", outputFile);
-        resetDataBuffers(g_vecDcc.at(i));
-    }
+    collectMultiRun(g_multiSeries, outputFileBasename);
     printf("Daq finished\n\n");
     return 1;
 }
 
 int multiSeriesCloseDaq()
 {
+    try
+    {
+        g_writer.wait();
+    }
+    catch (exception &e)
+    {
+        printf("Caught: %s\n", e.what());
+    }
     for (int i = 0; i < g_vecDcc.size(); i++)
     {
         if (g_vecDcc.at(i).dataConfigured)
@@ -692,6 +392,12 @@ int multiSeriesCloseDaq()
     return 1;
 }
 
+// A schedule of multiSeries runs on its own thread, see sweepUnits in common/daqSeries.h
+int runSweep(py::list schedule, py::object setBias, py::object setLed, py::object onStep)
+{
+    return sweepUnits(g_multiSeries, schedule, setBias, setLed, onStep);
+}
+
 // to be run from python side
 int runFullDAQ(char *outputFileBasename,
             int16_t chATrigger, int16_t chAVRange, uint16_t chAWfSamples,
@@ -713,14 +419,19 @@ int runFullDAQ(char *outputFileBasename,
                     chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, false);
 
         collectRapidBlockData(dcc);
+        shared_ptr<runStats> run = runStats::finish(outputFileBasename);
+        run->setData(UnitName(unit), dcc.numWaveforms, dcc.capturedBytes());
+        stageTimer write(UnitName(unit), STAGE_WRITE, run);
 
-        ofstream of;
+        datWriter of;
         char *outputFile = concatTwoChar(outputFileBasename, (char *) ".dat");
         setDataOutput(outputFile, of);
         writeDataHeader(dcc, of);
         writeDataOut(dcc, of);
         closeDataOutput(of);
         printf("Data written to %s\n", outputFile);
+        write.stop();
+        finishRunStats(run);
         CloseDevice(unit);
         printf("Device closed\n");
     }
@@ -749,6 +460,7 @@ char* getSerials()
 PYBIND11_MODULE(daq3000a, m)
 {
     m.doc() = "Picoscope 3000a DAQ System";
+    g_bit8Buffers = false; // the ps3000a buffers and files are 16 bit only
 
     m.def("runFullDAQ", &runFullDAQ, py::return_value_policy::copy);
     m.def("seriesInitDaq", &seriesInitDaq, py::return_value_policy::copy);
@@ -760,5 +472,17 @@ PYBIND11_MODULE(daq3000a, m)
     m.def("multiSeriesCollectData", &multiSeriesCollectData, py::return_value_policy::copy);
     m.def("multiSeriesCloseDaq", &multiSeriesCloseDaq, py::return_value_policy::copy);
     m.def("getSerials", &getSerials, py::return_value_policy::copy);
+    m.def("setFileFormatVersion", &setFileFormatVersion, py::return_value_policy::copy);
+    m.def("setCaptureTimeout", &setCaptureTimeout, py::return_value_policy::copy);
+    m.def("setRapidBlockWindow", &setRapidBlockWindow, py::return_value_policy::copy);
+    m.def("setFileCompression", &setFileCompression, py::return_value_policy::copy);
+    m.def("setDownsampling", &setDownsampling, py::return_value_policy::copy);
+    m.def("setSummary", &setSummary, py::return_value_policy::copy);
+    m.def("setDataBufferOptions", &setDataBufferOptions, py::return_value_policy::copy);
+    m.def("setDoubleBuffering", &setDoubleBuffering, py::return_value_policy::copy);
+    m.def("waitForWrites", &waitForWrites, py::return_value_policy::copy);
+    m.def("setRunStatsLog", &setRunStatsLog, py::return_value_policy::copy);
+    m.def("getLastRunStats", &getLastRunStats, py::return_value_policy::copy);
+    m.def("runSweep", &runSweep, py::return_value_policy::copy);
 }
 
@@ -8,6 +8,9 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <map>
+#include <thread>
+#include <tuple>
 
 #ifdef _WIN32
 #include "windows.h"
@@ -26,11 +29,61 @@
 #include <libps3000a/ps3000aApi.h>
 #include <libps3000a/PicoStatus.h>
 #include "ps3000a/ps3000aWrapper.h"
+#include "common/captureSignal.h"
+#include "common/datFormat.h"
+#include "common/runStats.h"
 
 using namespace std;
 
-BOOL	g_ready = FALSE;
-uint8_t g_multiReady = 0;
+captureSignal g_captureDone; // completed by CallBackBlock / MultiCallBackBlock
+uint32_t g_captureTimeoutMs = 0; // single unit, no limit, see SetCaptureTimeout
+uint32_t g_multiCaptureTimeoutMs = 5000; // multi-unit, lets the others carry on without a unit that never triggers
+uint32_t g_windowSegments = 0; // see SetRapidBlockWindow
+
+// Channels fetched by one bulk transfer: same captured length and downsampling
+typedef struct
+{
+	uint32_t nSamples;
+	PS3000A_RATIO_MODE mode;
+	uint32_t ratio;
+	bitset<4> channels;
+} TRANSFER_GROUP;
+
+/*
+ * A run captured in windows of segments: the host buffers hold the whole run,
+ * the scope only holds one window at a time. Kept per handle by SetDataBuffers,
+ * like the buffer registrations in the driver.
+ */
+typedef struct
+{
+	vector<vector<void*>> buffers; // per active channel, per waveform
+	bitset<4> activeChannels;
+	vector<int32_t> chSamples; // captured
+	vector<int32_t> chBufferSamples; // per driver buffer, after downsampling
+	vector<PS3000A_RATIO_MODE> chRatioMode;
+	vector<uint32_t> chRatio;
+	uint32_t numWaveforms;
+	uint32_t segments; // per window
+	uint32_t nSamples; // written by the driver when an overlapped transfer completes
+	vector<int16_t> overflow;
+	vector<TRANSFER_GROUP> groups; // see TransferGroups
+	bitset<4> registered; // channels with buffers in the driver, see SetWindowBuffers
+	uint32_t registeredFirst;
+	uint32_t registeredCount;
+} RAPID_WINDOWS;
+
+map<int16_t, RAPID_WINDOWS> g_rapidWindows;
+
+PS3000A_RATIO_MODE RatioMode(uint8_t downsampleMode)
+{
+	switch (downsampleMode)
+	{
+		case DAT_DOWNSAMPLE_AGGREGATE: return PS3000A_RATIO_MODE_AGGREGATE;
+		case DAT_DOWNSAMPLE_DECIMATE: return PS3000A_RATIO_MODE_DECIMATE;
+		case DAT_DOWNSAMPLE_AVERAGE: return PS3000A_RATIO_MODE_AVERAGE;
+		default: return PS3000A_RATIO_MODE_NONE;
+	}
+}
 
 void set_info(UNIT * unit)
 {
@@ -178,17 +231,106 @@ void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples)
 
 }
 
+/*
+ * The active channels grouped by sample length and downsampling, longest
+ * first. A bulk transfer moves the same number of samples, downsampled the
+ * same way, for every registered channel, so each group gets its own
+ * transfer instead of all of them the longest.
+ */
+vector<TRANSFER_GROUP> TransferGroups(const RAPID_WINDOWS &windows)
+{
+	map<tuple<uint32_t, uint32_t, uint32_t>, bitset<4>, greater<tuple<uint32_t, uint32_t, uint32_t>>> keys;
+	for (int i = 0; i < 4; i++)
+	{
+		if (windows.activeChannels.test(i))
+		{
+			keys[make_tuple((uint32_t) windows.chSamples.at(i), (uint32_t) windows.chRatioMode.at(i), windows.chRatio.at(i))].set(i);
+		}
+	}
+	vector<TRANSFER_GROUP> groups;
+	for (auto &key : keys)
+	{
+		groups.push_back({get<0>(key.first), (PS3000A_RATIO_MODE) get<1>(key.first), get<2>(key.first), key.second});
+	}
+	return groups;
+}
+
+/*
+ * The channels registered for group g's transfer: its own, and those of the
+ * groups with a different ratio mode, since the driver keeps the buffers of
+ * each ratio mode apart. Only groups sharing a ratio mode take turns.
+ */
+bitset<4> GroupChannels(const RAPID_WINDOWS &windows, size_t g)
+{
+	bitset<4> channels = windows.activeChannels;
+	for (size_t h = 0; h < windows.groups.size(); h++)
+	{
+		if (h != g && windows.groups.at(h).mode == windows.groups.at(g).mode)
+		{
+			channels &= ~windows.groups.at(h).channels;
+		}
+	}
+	return channels;
+}
+
+/*
+ * Points scope segments 0 .. count - 1 at waveforms first .. first + count - 1
+ * of the run, for the given channels only. The others are released, so a
+ * transfer does not touch them. Within the window already registered, only
+ * the channels that change are set again.
+ */
+void SetWindowBuffers(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first, uint32_t count, bitset<4> channels)
+{
+	bool sameWindow = windows.registered.any() && first == windows.registeredFirst && count == windows.registeredCount;
+	if (sameWindow && channels == windows.registered) {return;}
+
+	int active = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (!windows.activeChannels.test(i)) {continue;}
+		if (sameWindow && channels.test(i) == windows.registered.test(i))
+		{
+			active++;
+			continue;
+		}
+
+		int32_t n = windows.chBufferSamples.at(i);
+		for (uint32_t j = 0; j < count; j++)
+		{
+			int16_t *buffer = channels.test(i) ? (int16_t*) windows.buffers.at(active).at(first + j) : NULL;
+			if (windows.chRatioMode.at(i) == PS3000A_RATIO_MODE_AGGREGATE)
+			{
+				// Maxima then minima, one waveform of the arena
+				ps3000aSetDataBuffers(unit->handle, (PS3000A_CHANNEL) (i), buffer, 
+					buffer != NULL ? buffer + n : NULL, n, j, PS3000A_RATIO_MODE_AGGREGATE);
+			}
+			else
+			{
+				ps3000aSetDataBuffer(unit->handle, (PS3000A_CHANNEL) (i), buffer, n, j, 
+					windows.chRatioMode.at(i));
+			}
+		}
+		active++;
+	}
+	windows.registered = channels;
+	windows.registeredFirst = first;
+	windows.registeredCount = count;
+}
+
 vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels, 
 	vector<uint16_t> samplesPostPerChannel, int16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers)
+	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers, sampleArena &arena,
+	vector<uint8_t> chDownsampleMode, vector<uint32_t> chDownsampleRatio)
 {//Using rapid block mode only for now
 	vector<vector<void*>> outBuffers(activeChannels.count());
 
 	int32_t nMaxSamples = activeChannels.count() * maxPostSamples;
 	int32_t picoMaxSamples;
 	uint8_t activeCh = 0;
+	// Windowed runs only need one window of scope memory
+	uint32_t segments = (g_windowSegments > 0 && g_windowSegments < numWaveforms) ? g_windowSegments : numWaveforms;
 
-	PICO_STATUS status = ps3000aMemorySegments(unit->handle, numWaveforms, &picoMaxSamples);
+	PICO_STATUS status = ps3000aMemorySegments(unit->handle, segments, &picoMaxSamples);
 	if (status != PICO_OK)
 	{
 		printf("PICO status code: %d\n", status);
@@ -200,7 +342,43 @@ vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 		printf("The program will still run with samples truncated\n"); //XXX: everything here
 		printf("Pester Alex to add partial collections if it becomes a problem\n\n\n");		
 	}
-	ps3000aSetNoOfCaptures(unit->handle, numWaveforms);
+	ps3000aSetNoOfCaptures(unit->handle, segments);
+
+	// One slice per channel in the arena, each waveform packed after the previous one
+	vector<size_t> chOffset(4, 0);
+	vector<size_t> chStored(4, 0);
+	size_t arenaBytes = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (!activeChannels.test(i)) {continue;}
+
+		chStored.at(i) = datStoredSamples(samplesPreTrigger + samplesPostPerChannel.at(i), 
+			chDownsampleMode.at(i), chDownsampleRatio.at(i));
+		if (chStored.at(i) == 0)
+		{
+			printf("Channel %c: downsampling ratio %u is longer than the waveform\n", 'A' + i, 
+				chDownsampleRatio.at(i));
+			throw invalid_argument("Downsampling ratio longer than the waveform");
+		}
+		chOffset.at(i) = arenaBytes;
+		arenaBytes += ((size_t) numWaveforms * chStored.at(i) * sizeof(int16_t)
+					   + g_arenaChannelAlignment - 1) / g_arenaChannelAlignment * g_arenaChannelAlignment;
+	}
+	if (!arena.reserve(arenaBytes))
+	{
+		printf("Memory allocation failed: %.1f MB of data buffers\n", arenaBytes / 1e6);
+		throw runtime_error("Data buffer allocation failed");
+	}
+
+	RAPID_WINDOWS &windows = g_rapidWindows[unit->handle];
+	windows.activeChannels = activeChannels;
+	windows.chSamples = vector<int32_t>(4, 0);
+	windows.chBufferSamples = vector<int32_t>(4, 0);
+	windows.chRatioMode = vector<PS3000A_RATIO_MODE>(4, PS3000A_RATIO_MODE_NONE);
+	windows.chRatio = vector<uint32_t>(4, 1);
+	windows.numWaveforms = numWaveforms;
+	windows.segments = segments;
+	windows.overflow = vector<int16_t>(segments);
 
 	int active = 0;
 	for (int i = 0; i < 4; i++)
@@ -208,24 +386,102 @@ vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 		if (!activeChannels.test(i)) {continue;}
 
 		int32_t chSamples = samplesPreTrigger + samplesPostPerChannel.at(i);
+		windows.chSamples.at(i) = chSamples;
+		windows.chBufferSamples.at(i) = chSamples;
+		if (chDownsampleMode.at(i) != DAT_DOWNSAMPLE_NONE && chDownsampleRatio.at(i) > 1)
+		{
+			// A partial last bin is not captured
+			windows.chRatioMode.at(i) = RatioMode(chDownsampleMode.at(i));
+			windows.chRatio.at(i) = chDownsampleRatio.at(i);
+			windows.chBufferSamples.at(i) = chSamples / chDownsampleRatio.at(i);
+			windows.chSamples.at(i) = windows.chBufferSamples.at(i) * chDownsampleRatio.at(i);
+		}
 		outBuffers.at(active) = vector<void*>(numWaveforms);
 
 		for (int j = 0; j < numWaveforms; j++)
 		{
-			outBuffers.at(active).at(j) = calloc(chSamples, sizeof(int16_t));
-			if (outBuffers.at(active).at(j) == NULL)
-			{
-				printf("Memory allocation failed: Ch %d, Wf %d\n", active, j);
-			}
-			ps3000aSetDataBuffer(unit->handle, (PS3000A_CHANNEL) (i),
-				(int16_t*) outBuffers.at(active).at(j), chSamples, j, PS3000A_RATIO_MODE_NONE);
+			outBuffers.at(active).at(j) = arena.data() + chOffset.at(i) + (size_t) j * chStored.at(i) * sizeof(int16_t);
 		}
 		active++;
 	}
+	windows.buffers = outBuffers;
+	windows.groups = TransferGroups(windows);
+	windows.registered.reset();
+
+	SetWindowBuffers(unit, windows, 0, segments, GroupChannels(windows, 0));
 
 	return outBuffers;
 }
 
+// The buffers SetDataBuffers registered for a run of numWaveforms, nullptr if there are none
+RAPID_WINDOWS *FindLayout(UNIT *unit, uint32_t numWaveforms)
+{
+	map<int16_t, RAPID_WINDOWS>::iterator it = g_rapidWindows.find(unit->handle);
+	if (it == g_rapidWindows.end() || it->second.numWaveforms != numWaveforms)
+	{
+		return nullptr;
+	}
+	return &it->second;
+}
+
+// nullptr when the run fits in one block
+RAPID_WINDOWS *FindWindows(UNIT *unit, uint32_t numWaveforms)
+{
+	RAPID_WINDOWS *windows = FindLayout(unit, numWaveforms);
+	return (windows != nullptr && windows->segments < numWaveforms) ? windows : nullptr;
+}
+
+/*
+ * Fetches waveforms first .. first + count - 1 out of segments 0 .. count - 1,
+ * one bulk transfer per length group from group fromGroup on. The buffers
+ * stay as the last group left them, the next run only registers what differs.
+ */
+void GetGroupValues(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first, uint32_t count, size_t fromGroup)
+{
+	for (size_t g = fromGroup; g < windows.groups.size(); g++)
+	{
+		TRANSFER_GROUP &group = windows.groups.at(g);
+		SetWindowBuffers(unit, windows, first, count, GroupChannels(windows, g));
+		uint32_t nSamples = group.nSamples;
+		PICO_STATUS status = ps3000aGetValuesBulk(unit->handle, &nSamples, 0, count - 1, 
+				group.ratio, group.mode, windows.overflow.data());
+		if (status != PICO_OK)
+		{
+			printf("PICO status code: %d\n", status);
+		}
+	}
+}
+
+/*
+ * Registers the window starting at waveform first and queues its transfer, so
+ * the driver copies it out as soon as it is captured and the next window can
+ * be armed straight after the callback. Only the longest channels go with
+ * it, GetGroupValues(..., 1) fetches the shorter ones. Returns the segments
+ * in the window.
+ */
+uint32_t ArmWindow(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first)
+{
+	TRANSFER_GROUP &longest = windows.groups.front();
+	uint32_t count = min(windows.segments, windows.numWaveforms - first);
+
+	ps3000aSetNoOfCaptures(unit->handle, count);
+	SetWindowBuffers(unit, windows, first, count, GroupChannels(windows, 0));
+	windows.nSamples = longest.nSamples;
+	PICO_STATUS status = ps3000aGetValuesOverlappedBulk(unit->handle, 0, &windows.nSamples, longest.ratio, 
+			longest.mode, 0, count - 1, windows.overflow.data());
+	if (status != PICO_OK)
+	{
+		printf("PICO status code: %d\n", status);
+		throw runtime_error("Could not queue the window transfer");
+	}
+	return count;
+}
+
+void SetRapidBlockWindow(uint32_t segments)
+{
+	g_windowSegments = segments;
+}
+
 void SetSimpleChannelTrigger(UNIT *unit, int16_t threshold, 
 		PS_THRESHOLD_DIRECTION dir, PS_CHANNEL ch)
 {
@@ -350,6 +606,17 @@ int32_t _kbhit()
         return bytesWaiting;
 }
 
+void SetCaptureTimeout(uint32_t timeoutMs)
+{
+	g_captureTimeoutMs = timeoutMs;
+	g_multiCaptureTimeoutMs = timeoutMs;
+}
+
+string UnitName(UNIT *unit)
+{
+	return string((const char *) unit->serial, strnlen((const char *) unit->serial, sizeof(unit->serial)));
+}
+
 void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms)
 {
@@ -359,32 +626,49 @@ void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint32_t timebase32 = timebase;
 	int32_t preTrigger32 = max((int16_t) 0, preTrigger);
 	uint32_t postTriggerMax32 = postTriggerMax;
+	RAPID_WINDOWS *layout = FindLayout(unit, numWaveforms);
+	RAPID_WINDOWS *windows = FindWindows(unit, numWaveforms);
+	uint32_t window = windows != nullptr ? windows->segments : numWaveforms;
+	uint32_t count = numWaveforms;
+	string name = UnitName(unit);
 
 	printf("\n\nStarting DAQ\n\n");
 
 	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
-	ps3000aRunBlock(unit->handle, preTrigger32, postTriggerMax32, timebase32, 0,
-			&timeIndisposed, 0, CallBackBlock, NULL);
-	g_ready = FALSE;
-
-	while (!g_ready && !_kbhit()) // XXX: Should change to only cancel if getch == ctrl+c
+	for (uint32_t first = 0; first < numWaveforms; first += window)
 	{
-		usleep(0);
-	}
-
-	if (!g_ready)
-	{
-		_getch();
-		status = ps3000aStop(unit->handle);
-		status = ps3000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
-		CloseDevice(unit);
+		stageTimer arm(name, STAGE_ARM);
+		if (windows != nullptr)
+		{
+			count = ArmWindow(unit, *windows, first);
+		}
+		g_captureDone.reset(1);
+		ps3000aRunBlock(unit->handle, preTrigger32, postTriggerMax32, timebase32, 0,
+				&timeIndisposed, 0, CallBackBlock, NULL);
+		arm.stop();
+
+		stageTimer triggerWait(name, STAGE_TRIGGER_WAIT);
+		captureSignal::result res = g_captureDone.wait(g_captureTimeoutMs);
+		triggerWait.stop();
+		if (res != captureSignal::completed)
+		{
+			printf(res == captureSignal::cancelled ? "Rapid capture cancelled\n" : "Rapid capture timed out\n");
+			status = ps3000aStop(unit->handle);
+			status = ps3000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
+			CloseDevice(unit);
 
-		printf("Rapid capture aborted. %d complete blocks were captured\n", nCompletedCaptures);
-		printf("Early abort writeout not yet supported\n");
+			printf("Rapid capture aborted. %d complete blocks were captured\n", first + nCompletedCaptures);
+			printf("Early abort writeout not yet supported\n");
 
-		throw runtime_error("aborted, need to implement early cancellation writeout");
+			throw runtime_error("aborted, need to implement early cancellation writeout");
 
+		}
+		if (windows != nullptr)
+		{
+			stageTimer transfer(name, STAGE_TRANSFER);
+			GetGroupValues(unit, *windows, first, count, 1);
+		}
 	}
 
 	chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -399,15 +683,23 @@ void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 
 	uint32_t nSamples = preTrigger + postTriggerMax;
 
-	// Get data
-	status = ps3000aGetValuesBulk(unit->handle, &nSamples, 0, numWaveforms - 1, 
-			1, PS3000A_RATIO_MODE_NONE, NULL); // XXX: Fix this for different sample lengths
+	// Get data, windows were transferred as they completed
+	stageTimer transfer(name, STAGE_TRANSFER);
+	if (windows == nullptr && layout != nullptr)
+	{
+		GetGroupValues(unit, *layout, 0, numWaveforms, 0);
+	}
+	else if (windows == nullptr)
+	{
+		status = ps3000aGetValuesBulk(unit->handle, &nSamples, 0, numWaveforms - 1, 
+				1, PS3000A_RATIO_MODE_NONE, NULL);
+	}
 
-	// Stop
-	status = ps3000aStop(unit->handle);
+	transfer.stop();
 
-	status = ps3000aMemorySegments(unit->handle, 1, NULL);
-	status = ps3000aSetNoOfCaptures(unit->handle, 1);
+	// Stop, the segments and buffer registrations are kept for the next run
+	stageTimer reset(name, STAGE_RESET);
+	status = ps3000aStop(unit->handle);
 
 	return;
 }
@@ -416,7 +708,7 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	vector<uint16_t> vecPostTriggerMax, vector<uint8_t> vecTimebase,
 	vector<uint32_t> vecNumWaveforms)
 {
-	uint8_t len = vecUnit.size();
+	uint32_t len = vecUnit.size();
 	PICO_STATUS status;
 	vector<int32_t> vecTimeIndisposed(len);
 	vector<uint32_t> vecNCompletedCaptures(len);
@@ -424,8 +716,6 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	vector<int32_t> vecPreTrigger32(len);
 	vector<uint32_t> vecPostTriggerMax32(len);
 
-	g_multiReady = 0;
-
 	for (int i = 0; i < len; i++)
 	{
 		vecTimebase32.at(i) = vecTimebase.at(i);
@@ -433,46 +723,109 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 		vecPostTriggerMax32.at(i) = vecPostTriggerMax.at(i);
 	}
 
-	printf("\n\nStarting DAQ\n\n");
-
-	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
+	// Windowed units are stepped through their windows together, one block each per round
+	vector<RAPID_WINDOWS *> vecWindows(len);
+	uint32_t rounds = 1;
 	for (int i = 0; i < len; i++)
 	{
-		intptr_t iPt = i;
-		ps3000aRunBlock(vecUnit.at(i)->handle, vecPreTrigger32.at(i), 
-			vecPostTriggerMax32.at(i), vecTimebase32.at(i), 0,
-			&vecTimeIndisposed.at(i), 0, MultiCallBackBlock, (void*) iPt);
+		vecWindows.at(i) = FindWindows(vecUnit.at(i), vecNumWaveforms.at(i));
+		if (vecWindows.at(i) != nullptr)
+		{
+			uint32_t segments = vecWindows.at(i)->segments;
+			rounds = max(rounds, (vecNumWaveforms.at(i) + segments - 1) / segments);
+		}
 	}
-	
-	while (!(len <= __builtin_popcount(g_multiReady)) && !_kbhit() &&
-		(5 > chrono::duration_cast<std::chrono::seconds>
-		(std::chrono::steady_clock::now() - begin).count())) // XXX: Should change to only cancel if getch == ctrl+c
+
+	vector<string> vecName(len);
+	vector<chrono::steady_clock::time_point> vecArmed(len);
+	for (int i = 0; i < len; i++)
 	{
-		usleep(0);
+		vecName.at(i) = UnitName(vecUnit.at(i));
 	}
 
-	if (!(len <= __builtin_popcount(g_multiReady)))
+	printf("\n\nStarting DAQ\n\n");
+
+	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	for (uint32_t round = 0; round < rounds; round++)
 	{
-		_getch();
-		BOOL contAnyways = TRUE;
+		vector<uint32_t> vecFirst(len, 0);
+		vector<uint32_t> vecCount(len, 0);
+		g_captureDone.reset(len);
 		for (int i = 0; i < len; i++)
 		{
-			status = ps3000aStop(vecUnit.at(i)->handle);
-			status = ps3000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
-			printf("Rapid capture aborted.\n");
-			printf("%s: %d complete blocks were captured\n", vecUnit.at(i)->serial, 
-			(int) vecNCompletedCaptures.at(i));
-			if (vecNCompletedCaptures.at(i) < vecNumWaveforms.at(i))
+			if (vecWindows.at(i) != nullptr)
 			{
-				contAnyways = FALSE;
+				vecFirst.at(i) = round * vecWindows.at(i)->segments;
 			}
+			if (round > 0 && (vecWindows.at(i) == nullptr || vecFirst.at(i) >= vecNumWaveforms.at(i)))
+			{
+				// Whole run already captured
+				vecFirst.at(i) = vecNumWaveforms.at(i);
+				g_captureDone.notify(i);
+				continue;
+			}
+			stageTimer arm(vecName.at(i), STAGE_ARM);
+			if (vecWindows.at(i) != nullptr)
+			{
+				vecCount.at(i) = ArmWindow(vecUnit.at(i), *vecWindows.at(i), vecFirst.at(i));
+			}
+			intptr_t iPt = i;
+			ps3000aRunBlock(vecUnit.at(i)->handle, vecPreTrigger32.at(i), 
+				vecPostTriggerMax32.at(i), vecTimebase32.at(i), 0,
+				&vecTimeIndisposed.at(i), 0, MultiCallBackBlock, (void*) iPt);
+			arm.stop();
+			vecArmed.at(i) = chrono::steady_clock::now();
 		}
-		if (!contAnyways)
+
+		captureSignal::result res = g_captureDone.wait(g_multiCaptureTimeoutMs);
+		if (res != captureSignal::completed)
 		{
-			printf("Early abort writeout not yet supported\n");
+			printf(res == captureSignal::cancelled ? "Rapid capture cancelled\n" : "Rapid capture timed out\n");
+			BOOL contAnyways = TRUE;
+			for (int i = 0; i < len; i++)
+			{
+				vecNCompletedCaptures.at(i) = 0;
+				if (vecFirst.at(i) < vecNumWaveforms.at(i))
+				{
+					status = ps3000aStop(vecUnit.at(i)->handle);
+					status = ps3000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
+				}
+				vecNCompletedCaptures.at(i) += vecFirst.at(i);
+				printf("Rapid capture aborted.\n");
+				printf("%s: %d complete blocks were captured%s\n", vecUnit.at(i)->serial, 
+				(int) vecNCompletedCaptures.at(i), g_captureDone.runFinished(i) ? "" : " (not finished)");
+				if (vecNCompletedCaptures.at(i) < vecNumWaveforms.at(i))
+				{
+					contAnyways = FALSE;
+				}
+			}
+			if (!contAnyways)
+			{
+				printf("Early abort writeout not yet supported\n");
 
-			throw "aborted, need to implement early cancellation writeout";
+				throw runtime_error("aborted, need to implement early cancellation writeout");
+			}
+		}
+		if (res == captureSignal::completed)
+		{
+			// Every unit waited from its own RunBlock to its own callback
+			for (int i = 0; i < len; i++)
+			{
+				if (vecFirst.at(i) < vecNumWaveforms.at(i))
+				{
+					runStats::current()->add(vecName.at(i), STAGE_TRIGGER_WAIT, max(0.0,
+						chrono::duration<double>(g_captureDone.finishedAt(i) - vecArmed.at(i)).count()));
+				}
+			}
+		}
+		for (int i = 0; i < len; i++)
+		{
+			if (vecCount.at(i) > 0)
+			{
+				stageTimer transfer(vecName.at(i), STAGE_TRANSFER);
+				GetGroupValues(vecUnit.at(i), *vecWindows.at(i), vecFirst.at(i), vecCount.at(i), 1);
+			}
 		}
 	}
 
@@ -485,21 +838,42 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	{
 		printf("%s: Trigger rate: %f Hz\n", vecUnit.at(i)->serial,
 			(double) vecNumWaveforms.at(i) / time * 1.0e3);
+	}
 
-		status = ps3000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
-
+	// The units are independent, fetch them all at once rather than one after the other
+	vector<thread> retrieval;
+	for (int i = 0; i < len; i++)
+	{
+		retrieval.emplace_back([&, i]()
+		{
+			UNIT *unit = vecUnit.at(i);
+			PICO_STATUS status = ps3000aGetNoOfCaptures(unit->handle, &vecNCompletedCaptures.at(i));
 
-		uint32_t nSamples = vecPreTrigger.at(i) + vecPostTriggerMax.at(i);
+			uint32_t nSamples = vecPreTrigger.at(i) + vecPostTriggerMax.at(i);
 
-		// Get data
-		status = ps3000aGetValuesBulk(vecUnit.at(i)->handle, &nSamples, 0, 
-				vecNumWaveforms.at(i) - 1, 1, PS3000A_RATIO_MODE_NONE, NULL);
+			// Get data, windows were transferred as they completed
+			stageTimer transfer(vecName.at(i), STAGE_TRANSFER);
+			RAPID_WINDOWS *layout = FindLayout(unit, vecNumWaveforms.at(i));
+			if (vecWindows.at(i) == nullptr && layout != nullptr)
+			{
+				GetGroupValues(unit, *layout, 0, vecNumWaveforms.at(i), 0);
+			}
+			else if (vecWindows.at(i) == nullptr)
+			{
+				status = ps3000aGetValuesBulk(unit->handle, &nSamples, 0, 
+						vecNumWaveforms.at(i) - 1, 1, PS3000A_RATIO_MODE_NONE, NULL);
+			}
 
-		// Stop
-		status = ps3000aStop(vecUnit.at(i)->handle);
+			transfer.stop();
 
-		status = ps3000aMemorySegments(vecUnit.at(i)->handle, 1, NULL);
-		status = ps3000aSetNoOfCaptures(vecUnit.at(i)->handle, 1);
+			// Stop, the segments and buffer registrations are kept for the next run
+			stageTimer reset(vecName.at(i), STAGE_RESET);
+			status = ps3000aStop(unit->handle);
+		});
+	}
+	for (thread &t : retrieval)
+	{
+		t.join();
 	}
 }
 
@@ -653,7 +1027,7 @@ void CallBackBlock(int16_t handle, PICO_STATUS status, void * pParameter)
 		{
 			printf("Exited with status: 0x%.8X", status);
 		}
-		g_ready = TRUE;
+		g_captureDone.notify();
 	}
 }
 
@@ -667,7 +1041,7 @@ void MultiCallBackBlock(int16_t handle, PICO_STATUS status, void *pParameter)
 			printf("Picoscope %i exited with status: 0x%.8X", handle, status);
 		}
 		printf("Run %i has finished\n", (int) runId);
-		g_multiReady |= 1 << runId;
+		g_captureDone.notify(runId);
 	}
 }
 
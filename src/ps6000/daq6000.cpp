@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <fstream>
 #include <bitset>
@@ -9,6 +10,10 @@
 #include <assert.h>
 
 #include "ps6000/ps6000Wrapper.h"
+#include "common/adcCodec.h"
+#include "common/datFormat.h"
+#include "common/datWriter.h"
+#include "common/sampleKernels.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
@@ -19,7 +24,7 @@ namespace py = pybind11;
 class dataCollectionConfig 
 {
 public:
-    ofstream ostream;
+    datWriter ostream;
     UNIT *unit;
     bitset<4> activeChannels;
     bitset<5> activeTriggers;
@@ -31,7 +36,8 @@ public:
     uint16_t maxPostSamples;
     uint16_t samplesPreTrigger;
     uint32_t numWaveforms;
-    vector<vector<int16_t*>> dataBuffers;
+    vector<vector<int16_t*>> dataBuffers; // slices of arena
+    shared_ptr<sampleArena> arena = make_shared<sampleArena>();
 
     BOOL dataConfigured = FALSE;
     BOOL unitInitialised = FALSE;
@@ -52,6 +58,10 @@ bool isLittleEndian()
 }
 
 bool g_littleEndian = isLittleEndian();
+uint32_t g_fileFormatVersion = g_datVersion1; // .dat version written, see common/datFormat.h
+bool g_compressFiles = false; // v2 only, payloads are written through common/adcCodec
+bool g_hugePageBuffers = false; // data buffer arena options, see common/sampleArena.h
+bool g_lockDataBuffers = false;
 
 UNIT g_unit;
 dataCollectionConfig g_dcc(&g_unit, (char*) "");
@@ -143,27 +153,18 @@ void setDataConfig(dataCollectionConfig &dcc, uint8_t *timebase,
     dcc.maxPostSamples = *max_element(  dcc.chPostSamplesPerWaveform.begin(),
                                         dcc.chPostSamplesPerWaveform.end());
 
+    // Reuses the arena when the new geometry fits in it
+    dcc.arena->setOptions(g_hugePageBuffers, g_lockDataBuffers);
     dcc.dataBuffers = SetDataBuffers(dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples);
+            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples, *dcc.arena);
 
     return;
 }
 
 void freeDataBuffers(dataCollectionConfig &dcc)
 {
-    for (int i = 0; i < dcc.activeChannels.count(); i++)
-    {
-        for (int j = 0; j < dcc.numWaveforms; j++)
-        {
-            free(dcc.dataBuffers.at(i).at(j));
-        }
-    }
-}
-
-void resetDataBuffers(dataCollectionConfig &dcc)
-{
-    dcc.dataBuffers = SetDataBuffers(dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples);
+    dcc.dataBuffers.clear();
+    dcc.arena->release();
 }
 
 void collectRapidBlockData(dataCollectionConfig &dcc)
@@ -177,13 +178,21 @@ void collectRapidBlockData(dataCollectionConfig &dcc)
 
 void setDataOutput(dataCollectionConfig &dcc, char *outputFileName)
 {
-    dcc.ostream.open(outputFileName, ios::out | ios::binary);
+    if (!dcc.ostream.open(outputFileName))
+    {
+        printf("Cannot create %s\n", outputFileName);
+        throw runtime_error("Cannot create the data file");
+    }
     return;
 }
 
 void closeDataOutput(dataCollectionConfig &dcc)
 {
-    dcc.ostream.close();
+    if (!dcc.ostream.close())
+    {
+        printf("Writing the data file failed\n");
+        throw runtime_error("Writing the data file failed");
+    }
     return;
 }
 
@@ -223,8 +232,81 @@ void bitset_reverse(std::bitset<N> &b)
 }
 
 
+datHeaderV2 dataHeaderV2(dataCollectionConfig &dcc)
+{
+    datHeaderV2 h;
+    datInitHeaderV2(h);
+
+    h.timebase = (uint8_t) dcc.timebase.to_ulong();
+    h.sampleBytes = sizeof(int16_t);
+    h.activeChannels = (uint8_t) dcc.activeChannels.to_ulong();
+    h.activeTriggers = (uint8_t) dcc.activeTriggers.to_ulong();
+    h.auxTriggerThresholdAdc = dcc.auxTriggerThresholdADC;
+    h.preTriggerSamples = dcc.samplesPreTrigger;
+    h.numWaveforms = dcc.numWaveforms;
+    h.timestamp = time(nullptr);
+    strncpy(h.model, (const char *) dcc.unit->modelString, min(sizeof(h.model) - 1, sizeof(dcc.unit->modelString)));
+    strncpy(h.serial, dcc.serial, sizeof(h.serial) - 1);
+
+    for (int i = 0; i < 4; i++)
+    {
+        h.channels[i].numSamples = dcc.activeChannels.test(i) *
+            (dcc.chPostSamplesPerWaveform.at(i) + dcc.samplesPreTrigger);
+        h.channels[i].triggerThresholdAdc = dcc.chTriggerThresholdADC.at(i);
+        h.channels[i].vRange = (dcc.chVoltageRanges.to_ulong() >> (12 - 4 * i)) & 0x0f;
+    }
+    h.codec = g_compressFiles ? DAT_CODEC_ADC : DAT_CODEC_RAW;
+    datLayoutV2(h);
+    return h;
+}
+
+// Rapid-block captures taking longer than this are stopped, 0 (the default) waits until Ctrl+C
+int setCaptureTimeout(uint32_t timeoutMs)
+{
+    SetCaptureTimeout(timeoutMs);
+    return 1;
+}
+
+int setFileFormatVersion(uint32_t version)
+{
+    if (version != g_datVersion1 && version != g_datVersion2)
+    {
+        throw invalid_argument("Unsupported .dat format version");
+    }
+    g_fileFormatVersion = version;
+    if (version == g_datVersion1)
+    {
+        g_compressFiles = false;
+    }
+    return 1;
+}
+
+int setDataBufferOptions(bool hugePages, bool lock)
+{
+    g_hugePageBuffers = hugePages;
+    g_lockDataBuffers = lock;
+    return 1;
+}
+
+int setFileCompression(bool enable)
+{
+    if (enable && g_fileFormatVersion != g_datVersion2)
+    {
+        throw invalid_argument("Compression needs .dat format version 2");
+    }
+    g_compressFiles = enable;
+    return 1;
+}
+
 void writeDataHeader(dataCollectionConfig &dcc)
 {
+    if (g_fileFormatVersion == g_datVersion2)
+    {
+        datHeaderV2 h = dataHeaderV2(dcc);
+        dcc.ostream.write((const char *) &h, sizeof(h));
+        return;
+    }
+
     /*
      * Bit layout, in order
      * 4 bits: timebase (from 0-4 for ps6000)
@@ -304,26 +386,67 @@ void writeDataHeader(dataCollectionConfig &dcc)
     return;
 }
 
+// Compresses every channel (on all cores), then rewrites the header with the encoded sizes
+void writeEncodedDataOut(dataCollectionConfig &dcc)
+{
+    datHeaderV2 h = dataHeaderV2(dcc);
+    vector<vector<uint8_t>> streams(4);
+    int i = 0;
+
+    for (int ch = 0; ch < 4; ch++)
+    {
+        if (!(dcc.activeChannels.test(ch)))
+        {
+            continue;
+        }
+        vector<const void*> waveforms(dcc.dataBuffers.at(i).begin(), dcc.dataBuffers.at(i).end());
+        streams.at(ch) = adcEncode(waveforms.data(), dcc.numWaveforms, h.channels[ch].numSamples, h.sampleBytes);
+        h.channels[ch].bytes = streams.at(ch).size();
+        i++;
+    }
+    datLayoutV2(h);
+
+    dcc.ostream.seekp(0);
+    dcc.ostream.write((const char *) &h, sizeof(h));
+    for (int ch = 0; ch < 4; ch++)
+    {
+        if (dcc.activeChannels.test(ch))
+        {
+            dcc.ostream.seekp(h.channels[ch].offset);
+            dcc.ostream.write((const char *) streams.at(ch).data(), streams.at(ch).size());
+        }
+    }
+}
+
 void writeDataOut(dataCollectionConfig &dcc)
 {
-    uint16_t maxSamples = *max_element( dcc.chPostSamplesPerWaveform.begin(), 
-                                        dcc.chPostSamplesPerWaveform.end());
-    
-    int16_t o16;
     uint32_t s = sizeof(int16_t);
+    bool v2 = g_fileFormatVersion == g_datVersion2;
+    if (v2 && g_compressFiles)
+    {
+        writeEncodedDataOut(dcc);
+        return;
+    }
+    datHeaderV2 layout = dataHeaderV2(dcc);
+    int i = 0;
 
-    for (int i = 0; i < dcc.activeChannels.count(); i++)
+    for (int ch = 0; ch < 4; ch++)
     {
-        uint64_t nSamples = (dcc.chPostSamplesPerWaveform.at(i) 
-                           + dcc.samplesPreTrigger);
-        for (int j = 0; j < dcc.numWaveforms; j++)
+        if (!(dcc.activeChannels.test(ch)))
+        {
+            continue;
+        }
+        if (v2)
         {
-            for (int k = 0; k < nSamples; k++)
-            {
-                o16 = bswap16((dcc.dataBuffers.at(i).at(j))[k]);
-                dcc.ostream.write((const char*) &o16, s);
-            }
+            // Payloads start on 4 KiB boundaries, the gap reads back as zeros
+            dcc.ostream.seekp(layout.channels[ch].offset);
         }
+        uint64_t nSamples = (dcc.chPostSamplesPerWaveform.at(ch) 
+                           + dcc.samplesPreTrigger);
+        // Whole channel in a few pwritev calls, v2 samples stay in host order
+        vector<const void*> waveforms(dcc.dataBuffers.at(i).begin(), dcc.dataBuffers.at(i).end());
+        dcc.ostream.writeWaveforms(waveforms.data(), dcc.numWaveforms, s * nSamples, !v2);
+        i++;
     }
 }
 
@@ -394,7 +517,6 @@ int seriesCollectData(char *outputFile)
         writeDataOut(g_dcc);
         closeDataOutput(g_dcc);
         printf("Written to file: %s\n", outputFile);
-        resetDataBuffers(g_dcc);
         printf("Daq finished\n\n");
         return 1;
     }
@@ -507,6 +629,10 @@ PYBIND11_MODULE(daq6000, m)
     m.def("seriesCollectData", &seriesCollectData, py::return_value_policy::copy);
     m.def("seriesCloseDaq", &seriesCloseDaq, py::return_value_policy::copy);
     m.def("getSerials", &getSerials, py::return_value_policy::copy);
+    m.def("setFileFormatVersion", &setFileFormatVersion, py::return_value_policy::copy);
+    m.def("setCaptureTimeout", &setCaptureTimeout, py::return_value_policy::copy);
+    m.def("setFileCompression", &setFileCompression, py::return_value_policy::copy);
+    m.def("setDataBufferOptions", &setDataBufferOptions, py::return_value_policy::copy);
     m.def("initFunctionGenerator", &seriesInitDaq, py::return_value_policy::copy);
     m.def("runFunctionGenerator", &runFunctionGenerator, py::return_value_policy::copy);
     m.def("clearFunctionGenerator", &clearFunctionGenerator, py::return_value_policy::copy);
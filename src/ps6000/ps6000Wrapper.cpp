@@ -27,6 +27,7 @@
 #include <libps6000/PicoStatus.h>
 
 #include "ps6000/ps6000Wrapper.h"
+#include "common/captureSignal.h"
 
 using namespace std;
 
@@ -44,7 +45,8 @@ uint16_t inputRanges [PS6000_MAX_RANGES] = {	10,
 												20000,
 												50000};
 
-BOOL g_ready = FALSE;
+captureSignal g_captureDone; // completed by CallBackBlock
+uint32_t g_captureTimeoutMs = 0; // no limit, see SetCaptureTimeout
 
 void set_info(UNIT *unit)
 {
@@ -444,7 +446,7 @@ void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples) // Don't n
 
 vector<vector<int16_t*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels, 
 	vector<uint16_t> samplesPostPerChannel, uint16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples)
+	uint32_t numWaveforms, uint16_t maxPostSamples, sampleArena &arena)
 {//Using rapid block mode only for now
 	vector<vector<int16_t*>> outBuffers(activeChannels.count());
 
@@ -458,23 +460,39 @@ vector<vector<int16_t*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 	}
 	ps6000SetNoOfCaptures(unit->handle, numWaveforms);
 
+	// One slice per channel in the arena, each waveform packed after the previous one
+	vector<size_t> chOffset(4, 0);
+	size_t arenaBytes = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (!activeChannels.test(i)) {continue;}
+
+		chOffset.at(i) = arenaBytes;
+		arenaBytes += ((size_t) numWaveforms * (samplesPreTrigger + samplesPostPerChannel.at(i)) * sizeof(int16_t)
+					   + g_arenaChannelAlignment - 1) / g_arenaChannelAlignment * g_arenaChannelAlignment;
+	}
+	if (!arena.reserve(arenaBytes))
+	{
+		printf("Memory allocation failed: %.1f MB of data buffers\n", arenaBytes / 1e6);
+		throw runtime_error("Data buffer allocation failed");
+	}
+
+	// Indexed by active channel, as writeDataOut reads them
+	int active = 0;
 	for (int i = 0; i < 4; i++)
 	{
 		if (!activeChannels.test(i)) {continue;}
 
 		uint16_t chSamples = samplesPreTrigger + samplesPostPerChannel.at(i);
-		outBuffers.at(i) = vector<int16_t*>(numWaveforms);
+		outBuffers.at(active) = vector<int16_t*>(numWaveforms);
 
 		for (int j = 0; j < numWaveforms; j++)
 		{
-			outBuffers.at(i).at(j) = (int16_t*) calloc(chSamples, sizeof(int16_t));
-			if (outBuffers.at(i).at(j) == NULL)
-			{
-				printf("Memory allocation failed: Ch %d, Wf %d\n", i, j);
-			}
+			outBuffers.at(active).at(j) = (int16_t*) (arena.data() + chOffset.at(i)) + (size_t) j * chSamples;
 			ps6000SetDataBufferBulk(unit->handle, (PS6000_CHANNEL) (ch + i),
-				outBuffers.at(i).at(j), chSamples, j, PS6000_RATIO_MODE_NONE);
+				outBuffers.at(active).at(j), chSamples, j, PS6000_RATIO_MODE_NONE);
 		}
+		active++;
 	}
 
 	return outBuffers;
@@ -599,6 +617,11 @@ int32_t _kbhit()
 }
 
 
+void SetCaptureTimeout(uint32_t timeoutMs)
+{
+	g_captureTimeoutMs = timeoutMs;
+}
+
 void StartRapidBlock(UNIT *unit, uint16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms)
 {
@@ -610,18 +633,14 @@ void StartRapidBlock(UNIT *unit, uint16_t preTrigger, uint16_t postTriggerMax,
 
 	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
+	g_captureDone.reset(1);
 	ps6000RunBlock(unit->handle, preTrigger, postTriggerMax, timebase, 0, 
 			&timeIndisposed, 0, CallBackBlock, NULL);
-	g_ready = FALSE;
 
-	while (!g_ready && !_kbhit()) // XXX: Should change to only cancel if getch == ctrl+c
+	captureSignal::result res = g_captureDone.wait(g_captureTimeoutMs);
+	if (res != captureSignal::completed)
 	{
-		usleep(0);
-	}
-
-	if (!g_ready)
-	{
-		_getch();
+		printf(res == captureSignal::cancelled ? "Rapid capture cancelled\n" : "Rapid capture timed out\n");
 		status = ps6000Stop(unit->handle);
 		status = ps6000GetNoOfCaptures(unit->handle, &nCompletedCaptures);
 
@@ -650,12 +669,9 @@ void StartRapidBlock(UNIT *unit, uint16_t preTrigger, uint16_t postTriggerMax,
 	
 	// ps6000GetValuesTriggerTimeOffsetBulk64
 
-	// Stop
+	// Stop, the segments and buffer registrations are kept for the next run
 	status = ps6000Stop(unit->handle);
 
-	status = ps6000MemorySegments(unit->handle, 1, &nSamples);
-	status = ps6000SetNoOfCaptures(unit->handle, 1);
-
 	return;
 }
 
@@ -797,7 +813,7 @@ void PREF4 CallBackBlock(int16_t handle, PICO_STATUS status, void * pParameter)
 {
 	if (status != PICO_CANCELLED)
 	{
-		g_ready = TRUE;
+		g_captureDone.notify();
 	}
 }
 
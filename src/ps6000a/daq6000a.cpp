@@ -8,194 +8,68 @@
 #include <vector>
 #include <assert.h>
 #include <memory>
+#include <thread>
 
 #include "ps6000a/ps6000aWrapper.h"
+#include "common/daqSeries.h"
+#include "common/datWriter.h"
+#include "common/pulseFinder.h"
+#include "common/runStats.h"
+#include "common/streamFormat.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 using namespace std;
 namespace py = pybind11;
 
-class dataCollectionConfig 
+// A unit of this model, the driver calls of daqUnit (common/daqSeries.h) on its UNIT
+class dataCollectionConfig : public daqUnit
 {
 public:
     UNIT unit;
-    bitset<4> activeChannels;
-    bitset<5> activeTriggers;
-    bitset<4> timebase;
-    bitset<16> chVoltageRanges;
-    vector<int16_t> chTriggerThresholdADC;
-    int16_t auxTriggerThresholdADC;
-    vector<uint16_t> chPostSamplesPerWaveform; // NOTE: Excludes pre trigger samples
-    uint16_t maxPostSamples;
-    int16_t samplesPreTrigger;
-    uint32_t numWaveforms;
-    vector<vector<void*>> dataBuffers;
-    bool bit8Buffers; // if true, write out only 8 bits to buffer and file
-
-    BOOL dataConfigured = FALSE;
-    BOOL unitInitialised = FALSE;
-
-    char serial[32];
+
     dataCollectionConfig(UNIT &unit, char *serial)
     {
         this->unit = unit;
         strcpy(this->serial, serial);
+        identify();
     }
-    void print()
+    // Name and model for runStats and the file headers, again after findUnit
+    void identify()
     {
-        printf("Data Collection Config Info:\n");
-        printf("Serial Number: %s\n", this->serial);
-        printf("Active Channels: %u\n", (uint) this->activeChannels.to_ulong());
-        printf("Active Triggers: %u\n", (uint) this->activeTriggers.to_ulong());
-        printf("Timebase: %u\n", (uint) this->timebase.to_ulong());
-        printf("Channel V Ranges: %u\n", (uint) this->chVoltageRanges.to_ulong());
-        for (int i = 0; i < this->chTriggerThresholdADC.size(); i++)
-        {
-            printf("%c Trigger Threshold: %i\n", 'A' + i, this->chTriggerThresholdADC.at(i));
-        }
-        printf("Aux Trigger Threshold: %i\n", this->auxTriggerThresholdADC);
-        for (int i = 0; i < this->chPostSamplesPerWaveform.size(); i++)
-        {
-            printf("%c Post Trigger Samples: %i\n", 'A' + i, this->chPostSamplesPerWaveform.at(i));
-        }
-        printf("Max Post Trigger Samples: %i\n", this->maxPostSamples);
-        printf("Samples Pre Trigger: %i\n", this->samplesPreTrigger);
-        printf("Number of Waveforms: %i\n", this->numWaveforms);
-        printf("Data Configured: %s\n", this->dataConfigured ? "true" : "false");
-        printf("Unit Initialised: %s\n\n", this->unitInitialised ? "true" : "false");
+        name = UnitName(&unit);
+        model = string((const char *) unit.modelString, strnlen((const char *) unit.modelString, sizeof(unit.modelString)));
     }
-};
-
-bool isLittleEndian()
-{
-    uint32_t i = 1;
-    char *c = (char*)&i;
-    return bool(*c);
-}
-
-bool g_littleEndian = isLittleEndian();
-
-UNIT g_unit;
-dataCollectionConfig g_dcc(g_unit, (char*) "");
-vector<dataCollectionConfig> g_vecDcc;
-
-void setActiveChannels(dataCollectionConfig &dcc, 
-                       int16_t aChVoltage,
-                       int16_t bChVoltage,
-                       int16_t cChVoltage,
-                       int16_t dChVoltage)
-{
-    int16_t chVoltage[4] = {aChVoltage, bChVoltage, cChVoltage, dChVoltage};
-    uint8_t chVRangeBits[4];
-    uint16_t allVRange;
-
-    for (int i = 0; i < 4; i++)
+    void setVoltages(int16_t ranges[4]) override
     {
-        if (chVoltage[i] != 99) 
-        {
-            dcc.activeChannels.set(i);
-        }
-        chVRangeBits[i] = chVoltage[i] * dcc.activeChannels.test(i);
+        SetVoltages(&unit, ranges);
     }
-    dcc.chVoltageRanges = chVoltage[0] * dcc.activeChannels.test(0) << 12 |
-                          chVoltage[1] * dcc.activeChannels.test(1) <<  8 |
-                          chVoltage[2] * dcc.activeChannels.test(2) <<  4 |
-                          chVoltage[3] * dcc.activeChannels.test(3);
-
-    SetVoltages(&dcc.unit, chVoltage);
-    return;
-}
-
-void setTriggerConfig(dataCollectionConfig &dcc, 
-                      int16_t aTrigVoltageMv,
-                      int16_t bTrigVoltageMv,
-                      int16_t cTrigVoltageMv,
-                      int16_t dTrigVoltageMv,
-                      int16_t auxTrigVoltageMv)
-{
-
-    int16_t trigVoltageMv[4] = {aTrigVoltageMv,
-                                bTrigVoltageMv,
-                                cTrigVoltageMv,
-                                dTrigVoltageMv};
-
-    vector<int16_t> chTriggerThresholdADC;
-
-    for (int i = 0; i < 4; i++)
+    int16_t mvToAdc(int ch, int16_t mv) override
     {
-        if (trigVoltageMv[i] != 0 && dcc.activeChannels.test(i))
-        {
-            dcc.activeTriggers.set(i + 1);
-            chTriggerThresholdADC.push_back(mv_to_adc(trigVoltageMv[i], 
-            dcc.unit.channelSettings[i].range, &dcc.unit));
-        }
-        else
-        {
-            chTriggerThresholdADC.push_back(0);
-        }
+        return mv_to_adc(mv, ch < 4 ? unit.channelSettings[ch].range : PS_1V, &unit);
     }
-    if (auxTrigVoltageMv != 0)
+    void setTriggers() override
     {
-        dcc.activeTriggers.set(0);
-        dcc.auxTriggerThresholdADC = mv_to_adc(auxTrigVoltageMv, PS_1V, &dcc.unit);
+        SetTriggers(&unit, activeTriggers, chTriggerThresholdADC, auxTriggerThresholdADC);
     }
-    else
+    void setDaqDelay() override
     {
-        dcc.auxTriggerThresholdADC = 0;
+        SetDaqDelay(&unit, samplesPreTrigger);
     }
-
-    dcc.chTriggerThresholdADC = chTriggerThresholdADC;
-    SetTriggers(&dcc.unit, dcc.activeTriggers, dcc.chTriggerThresholdADC, dcc.auxTriggerThresholdADC);
-
-    return;
-}
-
-void setDataConfig(dataCollectionConfig &dcc, uint8_t timebase,
-    uint32_t numWaveforms, int16_t samplesPreTrigger, uint16_t chAWfSamples,
-    uint16_t chBWfSamples , uint16_t chCWfSamples , uint16_t chDWfSamples, bool bit8Buffers)
-{
-    dcc.timebase = timebase;
-    dcc.numWaveforms = numWaveforms;
-    dcc.samplesPreTrigger = samplesPreTrigger;
-
-    vector<uint16_t> samplesPostPerWaveform = {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples};
-    dcc.chPostSamplesPerWaveform = samplesPostPerWaveform;
-    dcc.maxPostSamples = *max_element(  dcc.chPostSamplesPerWaveform.begin(),
-                                        dcc.chPostSamplesPerWaveform.end());
-
-    if (dcc.samplesPreTrigger < 0)
+    void setDataBuffers() override
     {
-        printf("Setting post-trigger delay of %i samples\n", -1 * dcc.samplesPreTrigger);
-        SetDaqDelay(&dcc.unit, dcc.samplesPreTrigger);
+        dataBuffers = SetDataBuffers(&unit, activeChannels, chPostSamplesPerWaveform, samplesPreTrigger,
+                numWaveforms, maxPostSamples, bit8Buffers, *arena, chDownsampleMode, chDownsampleRatio);
     }
+};
 
-    dcc.bit8Buffers = bit8Buffers;
-
-    dcc.dataBuffers = SetDataBuffers(&dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples, bit8Buffers);
-
-    return;
-}
+const size_t g_streamRingSamples = 1 << 24; // per channel, between the streaming and pulse finding threads
 
-void freeDataBuffers(dataCollectionConfig &dcc)
-{
-    for (int i = 0; i < dcc.activeChannels.count(); i++)
-    {
-        for (int j = 0; j < dcc.numWaveforms; j++)
-        {
-            free(dcc.dataBuffers.at(i).at(j));
-        }
-    }
-}
-
-void resetDataBuffers(dataCollectionConfig &dcc)
-{
-    freeDataBuffers(dcc);
-    dcc.dataBuffers = SetDataBuffers(&dcc.unit, dcc.activeChannels, dcc.chPostSamplesPerWaveform, 
-            dcc.samplesPreTrigger, dcc.numWaveforms, dcc.maxPostSamples, dcc.bit8Buffers);
-}
+UNIT g_unit;
+dataCollectionConfig g_dcc(g_unit, (char*) "");
+vector<dataCollectionConfig> g_vecDcc;
 
 void collectRapidBlockData(dataCollectionConfig &dcc)
 {
@@ -242,204 +116,230 @@ void collectMultiRapidBlockData(vector<dataCollectionConfig> &vecDcc)
             vecTimebase, vecNumWaveforms);
 }
 
-void setDataOutput(char *outputFileName, ofstream &of)
-{
-    of.open(outputFileName, ios::out | ios::binary);
-    return;
-}
-
-void closeDataOutput(ofstream &of)
-{
-    of.close();
-    return;
-}
-
-int16_t bswap16(int16_t n)
+// Rapid-block captures taking longer than this are stopped, 0 waits until Ctrl+C.
+// Until set, single-unit captures wait until Ctrl+C and multi-unit captures for 5 s
+int setCaptureTimeout(uint32_t timeoutMs)
 {
-    if (g_littleEndian) {return __builtin_bswap16(n);}
-    else {return n;}
+    SetCaptureTimeout(timeoutMs);
+    return 1;
 }
 
-uint16_t bswapu16(uint16_t n)
+// Rapid-block runs longer than segments waveforms are captured in windows, 0 disables.
+// Used from the next set*DaqSettings call
+int setRapidBlockWindow(uint32_t segments)
 {
-    if (g_littleEndian) {return __builtin_bswap16(n);}
-    else {return n;}
+    SetRapidBlockWindow(segments);
+    g_rapidBlockWindow = segments;
+    return 1;
 }
 
-int32_t bswap32(int32_t n)
+streamHeader streamHeaderFor(dataCollectionConfig &dcc)
 {
-    if (g_littleEndian) {return __builtin_bswap32(n);}
-    else {return n;}
-}
+    streamHeader h;
+    streamInitHeader(h);
 
-uint32_t bswapu32(uint32_t n)
-{
-    if (g_littleEndian) {return __builtin_bswap32(n);}
-    else {return n;}
-}
+    h.timestamp = time(nullptr);
+    strncpy(h.model, dcc.model.c_str(), sizeof(h.model) - 1);
+    strncpy(h.serial, dcc.serial, sizeof(h.serial) - 1);
+    h.activeChannels = (uint8_t) dcc.activeChannels.to_ulong();
+    h.preSamples = max((int16_t) 0, dcc.samplesPreTrigger);
 
-template<std::size_t N>
-void bitset_reverse(std::bitset<N> &b) 
-{
-    for(std::size_t i = 0; i < N/2; ++i) 
+    for (int i = 0; i < 4; i++)
     {
-        bool t = b[i];
-        b[i] = b[N-i-1];
-        b[N-i-1] = t;
+        h.channels[i].thresholdAdc = dcc.activeChannels.test(i) ? dcc.chTriggerThresholdADC.at(i) : 0;
+        h.channels[i].vRange = (dcc.chVoltageRanges.to_ulong() >> (12 - 4 * i)) & 0x0f;
     }
+    return h;
 }
 
-char *concatTwoChar(char *line1, char *line2)
-{
-    char *totalLine;
-    int len = asprintf(&totalLine, "%s%s", line1, line2);
-    if (len < 0) abort();
-    return totalLine;
-}
-
-// Replaces '/' with '-' and adds '_' to the start
-char *formatSerial(char *serial)
+// What the streaming thread reports, set before it closes the rings
+struct streamResult
 {
-    int max = 31;
-    char outputSerial[max];
-    strcpy(outputSerial, serial);
+    double sampleIntervalNs;
+    uint64_t samples;
+    uint64_t droppedSamples;
+};
 
-    for (int i = 0; i < max; i++)
+/*
+ * Consumer side of a streaming run: finds pulses in every channel's ring as
+ * the samples arrive and writes their snippets, then the final header. The
+ * snippet of a channel is samplesPreTrigger + its post trigger samples long.
+ */
+void writeStreamFile(dataCollectionConfig &dcc, char *outputFile, streamHeader &h,
+                     vector<unique_ptr<sampleRing<int16_t>>> &rings, ringSignal &signal,
+                     const streamResult &result)
+{
+    datWriter of;
+    setDataOutput(outputFile, of);
+    of.write((const char *) &h, sizeof(h));
+
+    vector<unique_ptr<pulseFinder>> finders;
+    vector<int> channels;
+    for (int ch = 0; ch < 4; ch++)
     {
-        if (outputSerial[i] == '/')
+        if (!dcc.activeChannels.test(ch))
+        {
+            continue;
+        }
+        channels.push_back(ch);
+        finders.emplace_back(new pulseFinder(h.channels[ch].thresholdAdc, h.preSamples, 
+                    dcc.chPostSamplesPerWaveform.at(ch), 
+                    [&of, ch](uint64_t sample, const int16_t *snippet, uint32_t n)
+                    {
+                        streamPulse p = {sample, (uint8_t) ch, {0}};
+                        of.write((const char *) &p, sizeof(p));
+                        of.write((const char *) snippet, n * sizeof(int16_t));
+                    }));
+    }
+
+    vector<int16_t> chunk(1 << 16);
+    bool done = false;
+    while (!done)
+    {
+        uint64_t sequence = signal.sequence();
+        done = true;
+        size_t got = 0;
+        for (int i = 0; i < channels.size(); i++)
         {
-            outputSerial[i] = '-';
+            bool last = rings.at(i)->closed();
+            size_t n = rings.at(i)->pop(chunk.data(), chunk.size());
+            if (h.channels[channels.at(i)].thresholdAdc != 0)
+            {
+                finders.at(i)->process(chunk.data(), n);
+            }
+            got += n;
+            done &= last && n == 0;
+        }
+        if (got == 0 && !done)
+        {
+            signal.waitPast(sequence);
         }
     }
 
-    return concatTwoChar((char *) "_", outputSerial); 
-}
-
-char *createFileName(char *serial, char *outputFileBasename)
-{
-    char *formattedSerial = formatSerial(serial);
-    return concatTwoChar(concatTwoChar(outputFileBasename, formattedSerial), (char *) ".dat");
+    h.sampleIntervalNs = result.sampleIntervalNs;
+    h.samples = result.samples;
+    h.droppedSamples = result.droppedSamples;
+    for (int i = 0; i < channels.size(); i++)
+    {
+        streamChannel &c = h.channels[channels.at(i)];
+        c.snippetSamples = finders.at(i)->snippetSamples();
+        c.pulses = finders.at(i)->pulses();
+        c.snippets = finders.at(i)->snippets();
+        printf("%s %c: %lu pulses, %.1f Hz\n", dcc.serial, 'A' + channels.at(i), (unsigned long) c.pulses,
+               h.samples > 0 ? c.pulses / (h.samples * h.sampleIntervalNs * 1e-9) : 0.0);
+    }
+    of.seekp(0);
+    of.write((const char *) &h, sizeof(h));
+    closeDataOutput(of);
+    printf("Written to file: %s\n", outputFile);
 }
 
-void writeDataHeader(dataCollectionConfig &dcc, ofstream &of)
-{
-    /*
-     * Bit layout, in order
-     * 4 bits: timebase (from 0-4 for ps6000)
-     * 4 bits: ch1-4 active
-     * 2 bits: padding
-     * 1 bit: 1 if the data is 1 byte per sample, 0 if its 2 bytes per sample
-     * 5 bits: ch1-4, aux trigger active
-     * 16 bits: aux trigger threshold
-     * 64 (16*4) bits: trigger threshold (ch1-4)
-     * 16 (4*4): ch1-4 voltage ranges (aux is always +-1V range)
-     * 64 (4*16) bits: number of TOTAL samples per waveform (including pretrigger)
-     * 16 bits: number of samples before trigger
-     * 32 bits: number of waveforms
-     * 32 bits: unix timestamp (signed integer)
-     * total above bits: 232 (29 bytes)
-     * Flexible length, 0 terminated: model string
-     * Flexible length, 0 terminated: serial number
-    */
-
-    int16_t o16;
-    uint16_t ou16;
-    int32_t o32;
-    uint32_t ou32;
-
-    bitset_reverse(dcc.activeChannels);
-    bitset_reverse(dcc.activeTriggers);
-
-    uint8_t timebaseActiveCh =  (uint8_t) dcc.timebase.to_ullong() << 4 |
-                                (uint8_t) dcc.activeChannels.to_ullong();
-    of.write((const char *) &timebaseActiveCh, sizeof(uint8_t));
-
-
-    uint8_t bufferSizeActiveTriggers =  (uint8_t) dcc.bit8Buffers << 5 |
-                                        (uint8_t) dcc.activeTriggers.to_ullong();
-    of.write((const char *) &bufferSizeActiveTriggers, sizeof(uint8_t));
-
-    bitset_reverse(dcc.activeChannels);
-    bitset_reverse(dcc.activeTriggers);
-
-    o16 = bswap16(dcc.auxTriggerThresholdADC);
-    of.write((const char *) &o16, sizeof(int16_t));
+/*
+ * Streams every unit for seconds, one streaming and one pulse finding thread
+ * each, writing <basename>_<serial>.pulses. SIGINT ends the run early, the
+ * files are still completed. The units are set back up for rapid block after.
+ */
+void streamUnits(vector<dataCollectionConfig *> units, char *outputFileBasename, 
+                 double sampleIntervalNs, double seconds)
+{
+    int nUnits = units.size();
+    captureSignal stop;
+    vector<streamHeader> headers(nUnits);
+    vector<streamResult> results(nUnits, {sampleIntervalNs, 0, 0});
+    vector<vector<unique_ptr<sampleRing<int16_t>>>> rings(nUnits);
+    vector<unique_ptr<ringSignal>> signals(nUnits);
+    vector<string> streamErrors(nUnits);
+    vector<string> writeErrors(nUnits);
+    vector<thread> threads;
+    uint64_t samples = seconds * 1e9 / sampleIntervalNs;
+
+    stop.reset(nUnits);
+    for (int u = 0; u < nUnits; u++)
+    {
+        dataCollectionConfig &dcc = *units.at(u);
+        headers.at(u) = streamHeaderFor(dcc);
+        headers.at(u).sampleIntervalNs = sampleIntervalNs; // until the scope has chosen one
+        signals.at(u).reset(new ringSignal());
+        for (int i = 0; i < dcc.activeChannels.count(); i++)
+        {
+            rings.at(u).emplace_back(new sampleRing<int16_t>(g_streamRingSamples, signals.at(u).get()));
+        }
+        char *serial = formatSerial(dcc.serial);
+        string file = string(outputFileBasename) + serial + ".pulses";
+        free(serial);
 
-    for (int i = 0; i < 4; i++)
-    {
-        o16 = bswap16(dcc.chTriggerThresholdADC.at(i));
-        of.write((const char *) &o16, sizeof(int16_t));
+        threads.emplace_back([&, u]()
+        {
+            streamResult &r = results.at(u);
+            vector<sampleRing<int16_t> *> unitRings;
+            for (unique_ptr<sampleRing<int16_t>> &ring : rings.at(u))
+            {
+                unitRings.push_back(ring.get());
+            }
+            try
+            {
+                r.samples = StartStreaming(&units.at(u)->unit, units.at(u)->activeChannels, 
+                        r.sampleIntervalNs, samples, unitRings, r.droppedSamples, stop);
+            }
+            catch (exception &e)
+            {
+                streamErrors.at(u) = e.what();
+            }
+            for (sampleRing<int16_t> *ring : unitRings)
+            {
+                ring->close();
+            }
+            stop.notify(u);
+        });
+        threads.emplace_back([&, u, file]()
+        {
+            try
+            {
+                writeStreamFile(*units.at(u), (char *) file.c_str(), headers.at(u), rings.at(u), *signals.at(u), 
+                        results.at(u));
+            }
+            catch (exception &e)
+            {
+                writeErrors.at(u) = e.what();
+            }
+        });
     }
 
-    o16 = bswap16((int16_t) dcc.chVoltageRanges.to_ullong());
-    of.write((const char *) &o16, sizeof(int16_t));
-
-    for (int i = 0; i < 4; i++)
+    if (stop.wait(0) == captureSignal::cancelled)
     {
-        ou16 = dcc.activeChannels.test(i) *
-            bswapu16(dcc.chPostSamplesPerWaveform.at(i) + dcc.samplesPreTrigger);
-        of.write((const char *) &ou16, sizeof(uint16_t));
+        printf("Streaming stopped early\n");
     }
-
-    o16 = bswap16(dcc.samplesPreTrigger);
-    of.write((const char *) &o16, sizeof(int16_t));
-
-    o32 = bswap32(dcc.numWaveforms);
-    of.write((const char *) &o32, sizeof(int32_t));
-
-    time_t t = time(nullptr);
-    o32 = bswap32((int32_t) t);
-    of.write((const char *) &o32, sizeof(int32_t));
-
-    for (int i = 0; i < sizeof(dcc.unit.modelString); i++)
+    for (thread &t : threads)
     {
-        of.write((const char *) &dcc.unit.modelString[i], 1L);
-        if (dcc.unit.modelString[i] == '\0') {break;}
+        t.join();
     }
 
-    for (int i = 0; i < sizeof(dcc.serial); i++)
+    for (int u = 0; u < nUnits; u++)
     {
-        of.write((const char *) &dcc.serial[i], 1L);
-        if (dcc.unit.serial[i] == '\0') {break;}
+        dataCollectionConfig &dcc = *units.at(u);
+        if (results.at(u).droppedSamples > 0)
+        {
+            printf("%s: %lu samples dropped from every channel, the pulse finder fell behind\n", dcc.serial,
+                   (unsigned long) results.at(u).droppedSamples);
+        }
+        dcc.setTriggers();
+        dcc.setDataBuffers();
     }
-
-    return;
-}
-
-void writeDataOut(dataCollectionConfig &dcc, ofstream &of)
-{
-    uint16_t maxSamples = *max_element( dcc.chPostSamplesPerWaveform.begin(), 
-                                        dcc.chPostSamplesPerWaveform.end());
-    
-    int16_t o16;
-    uint32_t s = dcc.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
-    int i = 0;
-
-    for (int ch = 0; ch < 4; ch++)
+    string errors;
+    for (int u = 0; u < nUnits; u++)
     {
-        if (!(dcc.activeChannels.test(ch)))
+        if (!streamErrors.at(u).empty())
         {
-            continue;
+            errors += string(errors.empty() ? "" : "; ") + units.at(u)->serial + " streaming: " + streamErrors.at(u);
         }
-        uint64_t nSamples = (dcc.chPostSamplesPerWaveform.at(ch) 
-                           + dcc.samplesPreTrigger);
-        for (int j = 0; j < dcc.numWaveforms; j++)
+        if (!writeErrors.at(u).empty())
         {
-            if (dcc.bit8Buffers)
-            {
-                of.write((const char*) dcc.dataBuffers.at(i).at(j), s * nSamples);
-            }
-            else
-            {
-                for (int k = 0; k < nSamples; k++)
-                {
-                    int16_t* p = (int16_t*) dcc.dataBuffers.at(i).at(j);
-                    o16 = bswap16(p[k]);
-                    of.write((const char*) &o16, s);
-                }
-            }
+            errors += string(errors.empty() ? "" : "; ") + units.at(u)->serial + " writing: " + writeErrors.at(u);
         }
-        i++;
+    }
+    if (!errors.empty())
+    {
+        throw runtime_error(errors);
     }
 }
 
@@ -447,6 +347,8 @@ int seriesInitDaq(char *serial)
 {
     if (serial == "") {serial = NULL;}
     findUnit(&g_dcc.unit, (int8_t*) serial);
+    g_dcc.identify();
+    g_dcc.forgetApplied();
     try
     {
         strcpy(g_dcc.serial, serial);
@@ -476,18 +378,12 @@ int seriesSetDaqSettings(
     {
         return 0;
     }
-    if (g_dcc.dataConfigured == TRUE)
-    {
-        freeDataBuffers(g_dcc);
-    }
     try
     {
-        setActiveChannels(g_dcc, chAVRange, chBVRange, chCVRange, chDVRange);
-        printf("Active channels set\n");
-        setTriggerConfig(g_dcc, chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger);
-        printf("Trigger channels set\n");
-        setDataConfig(g_dcc, timebase, numWaveforms, samplesPreTrigger, 
-                chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, true);
+        stageTimer configure(UnitName(&g_dcc.unit), STAGE_CONFIGURE);
+        configureUnit(g_dcc, {chAVRange, chBVRange, chCVRange, chDVRange},
+                {chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger}, timebase, numWaveforms,
+                samplesPreTrigger, {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples});
         printf("All settings configured\n\n");
         g_dcc.dataConfigured = TRUE;
         printf("Data settings updated\n");
@@ -513,15 +409,20 @@ int seriesCollectData(char *outputFileBasename)
     try
     {
         collectRapidBlockData(g_dcc);
+        shared_ptr<runStats> run = runStats::finish(outputFileBasename);
+        run->setData(UnitName(&g_dcc.unit), g_dcc.numWaveforms, g_dcc.capturedBytes());
 
-        ofstream of;
         char *outputFile = concatTwoChar(outputFileBasename, (char *) ".dat");
-        setDataOutput(outputFile, of);
-        writeDataHeader(g_dcc, of);
-        writeDataOut(g_dcc, of);
-        closeDataOutput(of);
-        printf("Written to file: %s\n", outputFile);
-        resetDataBuffers(g_dcc);
+        if (g_doubleBuffered)
+        {
+            g_writer.wait();
+            queueDataFile(g_dcc, outputFile, run);
+        }
+        else
+        {
+            writeDataFile(g_dcc, outputFile, run);
+            finishRunStats(run);
+        }
         printf("Daq finished\n\n");
         return 1;
     }
@@ -536,8 +437,28 @@ int seriesCollectData(char *outputFileBasename)
     }
 }
 
+int seriesStreamData(char *outputFileBasename, double sampleIntervalNs, double seconds)
+{
+    if ((g_dcc.unitInitialised == FALSE) || (g_dcc.dataConfigured == FALSE))
+    {
+        return 0;
+    }
+    g_writer.wait();
+    streamUnits({&g_dcc}, outputFileBasename, sampleIntervalNs, seconds);
+    printf("Daq finished\n\n");
+    return 1;
+}
+
 int seriesCloseDaq()
 {
+    try
+    {
+        g_writer.wait();
+    }
+    catch (exception &e)
+    {
+        printf("Caught: %s\n", e.what());
+    }
     if (g_dcc.dataConfigured)
     {
         freeDataBuffers(g_dcc);
@@ -589,16 +510,10 @@ int multiSeriesSetDaqSettings(
                 printf("Unit uninitialised in multiDcc\n");
                 return 0;
             }
-            if (g_vecDcc.at(i).dataConfigured == TRUE)
-            {
-                freeDataBuffers(g_vecDcc.at(i));
-            }
-            setActiveChannels(g_vecDcc.at(i), chAVRange, chBVRange, chCVRange, chDVRange);
-            printf("%s: Active channel(s) configured\n", g_vecDcc.at(i).serial);
-            setTriggerConfig(g_vecDcc.at(i), chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger);
-            printf("%s: Trigger channel(s) configured\n", g_vecDcc.at(i).serial);
-            setDataConfig(g_vecDcc.at(i), timebase, numWaveforms, samplesPreTrigger, 
-                    chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, true);
+            stageTimer configure(UnitName(&g_vecDcc.at(i).unit), STAGE_CONFIGURE);
+            configureUnit(g_vecDcc.at(i), {chAVRange, chBVRange, chCVRange, chDVRange},
+                    {chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger}, timebase, numWaveforms,
+                    samplesPreTrigger, {chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples});
             g_vecDcc.at(i).dataConfigured = TRUE;
             printf("%s: Settings configured\n\n", g_vecDcc.at(i).serial);
 
@@ -631,6 +546,27 @@ int multiSeriesSetDaqSettings(
     return 1;
 }
 
+// g_vecDcc for the multi-unit runs and sweeps of common/daqSeries.h
+class multiSeriesUnits : public daqModel
+{
+public:
+    vector<daqUnit *> units() override
+    {
+        vector<daqUnit *> units;
+        for (dataCollectionConfig &dcc : g_vecDcc)
+        {
+            units.push_back(&dcc);
+        }
+        return units;
+    }
+    void collectRapidBlocks() override
+    {
+        collectMultiRapidBlockData(g_vecDcc);
+    }
+};
+
+multiSeriesUnits g_multiSeries;
+
 int multiSeriesCollectData(char *outputFileBasename)
 {
     // Idk how to decide outputfile names, add a random number? Add serial number?
@@ -652,28 +588,42 @@ int multiSeriesCollectData(char *outputFileBasename)
         return 0;
     }
 
-    collectMultiRapidBlockData(g_vecDcc);
+    collectMultiRun(g_multiSeries, outputFileBasename);
+    printf("Daq finished\n\n");
+    return 1;
+}
+
+// Continuous, untriggered run using the channels and thresholds of the last multiSeriesSetDaqSettings
+int multiSeriesStreamData(char *outputFileBasename, double sampleIntervalNs, double seconds)
+{
+    vector<dataCollectionConfig *> units;
     for (int i = 0; i < g_vecDcc.size(); i++)
     {
-        if (!(g_dcc.unitInitialised && g_dcc.dataConfigured))
+        if (g_vecDcc.at(i).unitInitialised && g_vecDcc.at(i).dataConfigured)
         {
-            
+            units.push_back(&g_vecDcc.at(i));
         }
-        ofstream of;
-        char *outputFile = createFileName(g_vecDcc.at(i).serial, outputFileBasename);
-        setDataOutput(outputFile, of);
-        writeDataHeader(g_vecDcc.at(i), of);
-        writeDataOut(g_vecDcc.at(i), of);
-        closeDataOutput(of);
-        printf("Written to file: %s\n", outputFile);
-        resetDataBuffers(g_vecDcc.at(i));
     }
+    if (units.size() == 0)
+    {
+        return 0;
+    }
+    g_writer.wait(); // the buffers are registered again afterwards
+    streamUnits(units, outputFileBasename, sampleIntervalNs, seconds);
     printf("Daq finished\n\n");
     return 1;
 }
 
 int multiSeriesCloseDaq()
 {
+    try
+    {
+        g_writer.wait();
+    }
+    catch (exception &e)
+    {
+        printf("Caught: %s\n", e.what());
+    }
     for (int i = 0; i < g_vecDcc.size(); i++)
     {
         if (g_vecDcc.at(i).dataConfigured)
@@ -690,6 +640,12 @@ int multiSeriesCloseDaq()
     return 1;
 }
 
+// A schedule of multiSeries runs on its own thread, see sweepUnits in common/daqSeries.h
+int runSweep(py::list schedule, py::object setBias, py::object setLed, py::object onStep)
+{
+    return sweepUnits(g_multiSeries, schedule, setBias, setLed, onStep);
+}
+
 // to be run from python side
 int runFullDAQ(char *outputFileBasename,
             int16_t chATrigger, int16_t chAVRange, uint16_t chAWfSamples,
@@ -708,17 +664,22 @@ int runFullDAQ(char *outputFileBasename,
         setActiveChannels(dcc, chAVRange, chBVRange, chCVRange, chDVRange);
         setTriggerConfig(dcc, chATrigger, chBTrigger, chCTrigger, chDTrigger, auxTrigger);
         setDataConfig(dcc, timebase, numWaveforms, samplesPreTrigger, 
-                    chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, true);
+                    chAWfSamples, chBWfSamples, chCWfSamples, chDWfSamples, g_bit8Buffers);
 
         collectRapidBlockData(dcc);
+        shared_ptr<runStats> run = runStats::finish(outputFileBasename);
+        run->setData(UnitName(unit), dcc.numWaveforms, dcc.capturedBytes());
+        stageTimer write(UnitName(unit), STAGE_WRITE, run);
 
-        ofstream of;
+        datWriter of;
         char *outputFile = concatTwoChar(outputFileBasename, (char *) ".dat");
         setDataOutput(outputFile, of);
         writeDataHeader(dcc, of);
         writeDataOut(dcc, of);
         closeDataOutput(of);
         printf("Data written to %s\n", outputFile);
+        write.stop();
+        finishRunStats(run);
         CloseDevice(unit);
         printf("Device closed\n");
     }
@@ -752,11 +713,26 @@ PYBIND11_MODULE(daq6000a, m)
     m.def("seriesInitDaq", &seriesInitDaq, py::return_value_policy::copy);
     m.def("seriesSetDaqSettings", &seriesSetDaqSettings, py::return_value_policy::copy);
     m.def("seriesCollectData", &seriesCollectData, py::return_value_policy::copy);
+    m.def("seriesStreamData", &seriesStreamData, py::return_value_policy::copy);
     m.def("seriesCloseDaq", &seriesCloseDaq, py::return_value_policy::copy);
     m.def("multiSeriesInitDaq", &multiSeriesInitDaq, py::return_value_policy::copy);
     m.def("multiSeriesSetDaqSettings", &multiSeriesSetDaqSettings, py::return_value_policy::copy);
     m.def("multiSeriesCollectData", &multiSeriesCollectData, py::return_value_policy::copy);
+    m.def("multiSeriesStreamData", &multiSeriesStreamData, py::return_value_policy::copy);
     m.def("multiSeriesCloseDaq", &multiSeriesCloseDaq, py::return_value_policy::copy);
     m.def("getSerials", &getSerials, py::return_value_policy::copy);
+    m.def("setFileFormatVersion", &setFileFormatVersion, py::return_value_policy::copy);
+    m.def("setCaptureTimeout", &setCaptureTimeout, py::return_value_policy::copy);
+    m.def("setRapidBlockWindow", &setRapidBlockWindow, py::return_value_policy::copy);
+    m.def("setFileCompression", &setFileCompression, py::return_value_policy::copy);
+    m.def("setDownsampling", &setDownsampling, py::return_value_policy::copy);
+    m.def("setSummary", &setSummary, py::return_value_policy::copy);
+    m.def("setDataBufferOptions", &setDataBufferOptions, py::return_value_policy::copy);
+    m.def("setBit8Buffers", &setBit8Buffers, py::return_value_policy::copy);
+    m.def("setDoubleBuffering", &setDoubleBuffering, py::return_value_policy::copy);
+    m.def("waitForWrites", &waitForWrites, py::return_value_policy::copy);
+    m.def("setRunStatsLog", &setRunStatsLog, py::return_value_policy::copy);
+    m.def("getLastRunStats", &getLastRunStats, py::return_value_policy::copy);
+    m.def("runSweep", &runSweep, py::return_value_policy::copy);
 }
 
@@ -10,6 +10,9 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <map>
+#include <thread>
+#include <tuple>
 
 #ifdef _WIN32
 #include "windows.h"
@@ -29,6 +32,9 @@
 #include <libps6000a/PicoStatus.h>
 
 #include "ps6000a/ps6000aWrapper.h"
+#include "common/captureSignal.h"
+#include "common/datFormat.h"
+#include "common/runStats.h"
 
 using namespace std;
 
@@ -44,8 +50,57 @@ uint16_t inputRanges [PICO_X1_PROBE_RANGES] = {	10,
 												10000,
 												20000};
 
-BOOL	g_ready = FALSE;
-uint8_t g_multiReady = 0;
+captureSignal g_captureDone; // completed by CallBackBlock / MultiCallBackBlock
+uint32_t g_captureTimeoutMs = 0; // single unit, no limit, see SetCaptureTimeout
+uint32_t g_multiCaptureTimeoutMs = 5000; // multi-unit, lets the others carry on without a unit that never triggers
+uint32_t g_windowSegments = 0; // see SetRapidBlockWindow
+const uint64_t g_streamBufferSamples = 1 << 20; // per driver buffer, two per channel
+
+// Channels fetched by one bulk transfer: same captured length and downsampling
+typedef struct
+{
+	uint64_t nSamples;
+	PICO_RATIO_MODE mode;
+	uint32_t ratio;
+	bitset<4> channels;
+} TRANSFER_GROUP;
+
+/*
+ * A run captured in windows of segments: the host buffers hold the whole run,
+ * the scope only holds one window at a time. Kept per handle by SetDataBuffers,
+ * like the buffer registrations in the driver.
+ */
+typedef struct
+{
+	vector<vector<void*>> buffers; // per active channel, per waveform
+	bitset<4> activeChannels;
+	vector<uint64_t> chSamples; // captured
+	vector<uint64_t> chBufferSamples; // per driver buffer, after downsampling
+	vector<PICO_RATIO_MODE> chRatioMode;
+	vector<uint32_t> chRatio;
+	bool bit8Buffers;
+	uint32_t numWaveforms;
+	uint32_t segments; // per window
+	uint64_t nSamples; // written by the driver when an overlapped transfer completes
+	vector<int16_t> overflow;
+	vector<TRANSFER_GROUP> groups; // see TransferGroups
+	bitset<4> registered; // channels with buffers in the driver, see SetWindowBuffers
+	uint32_t registeredFirst;
+	uint32_t registeredCount;
+} RAPID_WINDOWS;
+
+map<int16_t, RAPID_WINDOWS> g_rapidWindows;
+
+PICO_RATIO_MODE RatioMode(uint8_t downsampleMode)
+{
+	switch (downsampleMode)
+	{
+		case DAT_DOWNSAMPLE_AGGREGATE: return PICO_RATIO_MODE_AGGREGATE;
+		case DAT_DOWNSAMPLE_DECIMATE: return PICO_RATIO_MODE_DECIMATE;
+		case DAT_DOWNSAMPLE_AVERAGE: return PICO_RATIO_MODE_AVERAGE;
+		default: return PICO_RATIO_MODE_RAW;
+	}
+}
 
 void set_info(UNIT * unit)
 {
@@ -190,9 +245,103 @@ void SetTimebase(UNIT *unit, uint8_t timebase, uint16_t maxChSamples) // Don't n
 
 }
 
+/*
+ * The active channels grouped by sample length and downsampling, longest
+ * first. A bulk transfer moves the same number of samples, downsampled the
+ * same way, for every registered channel, so each group gets its own
+ * transfer instead of all of them the longest.
+ */
+vector<TRANSFER_GROUP> TransferGroups(const RAPID_WINDOWS &windows)
+{
+	map<tuple<uint64_t, uint32_t, uint32_t>, bitset<4>, greater<tuple<uint64_t, uint32_t, uint32_t>>> keys;
+	for (int i = PICO_CHANNEL_A; i < 4; i++)
+	{
+		if (windows.activeChannels.test(i))
+		{
+			keys[make_tuple(windows.chSamples.at(i), (uint32_t) windows.chRatioMode.at(i), windows.chRatio.at(i))].set(i);
+		}
+	}
+	vector<TRANSFER_GROUP> groups;
+	for (auto &key : keys)
+	{
+		groups.push_back({get<0>(key.first), (PICO_RATIO_MODE) get<1>(key.first), get<2>(key.first), key.second});
+	}
+	return groups;
+}
+
+/*
+ * The channels registered for group g's transfer: its own, and those of the
+ * groups with a different ratio mode, since the driver keeps the buffers of
+ * each ratio mode apart. Only groups sharing a ratio mode take turns.
+ */
+bitset<4> GroupChannels(const RAPID_WINDOWS &windows, size_t g)
+{
+	bitset<4> channels = windows.activeChannels;
+	for (size_t h = 0; h < windows.groups.size(); h++)
+	{
+		if (h != g && windows.groups.at(h).mode == windows.groups.at(g).mode)
+		{
+			channels &= ~windows.groups.at(h).channels;
+		}
+	}
+	return channels;
+}
+
+/*
+ * Points scope segments 0 .. count - 1 at waveforms first .. first + count - 1
+ * of the run, for the given channels only. The others are left unregistered,
+ * so a transfer does not touch them. Within the window already registered,
+ * only the channels that change are added or cleared.
+ */
+void SetWindowBuffers(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first, uint32_t count, bitset<4> channels)
+{
+	bool sameWindow = windows.registered.any() && first == windows.registeredFirst && count == windows.registeredCount;
+	if (sameWindow && channels == windows.registered) {return;}
+
+	PICO_ACTION action = sameWindow ? PICO_ADD : (PICO_ACTION) (PICO_CLEAR_ALL | PICO_ADD);
+	uint8_t activeCh = 0;
+
+	for (int i = PICO_CHANNEL_A; i < 4; i++)
+	{
+		if (!windows.activeChannels.test(i)) {continue;}
+		bool add = channels.test(i);
+		if (sameWindow ? add == windows.registered.test(i) : !add)
+		{
+			activeCh++;
+			continue;
+		}
+		PICO_ACTION chAction = add ? action : PICO_CLEAR_THIS_DATA_BUFFER;
+
+		PICO_DATA_TYPE type = windows.bit8Buffers ? PICO_INT8_T : PICO_INT16_T;
+		uint64_t n = windows.chBufferSamples.at(i);
+		for (uint64_t j = 0; j < count; j++)
+		{
+			int8_t *buffer = (int8_t *) windows.buffers.at(activeCh).at(first + j);
+			if (windows.chRatioMode.at(i) == PICO_RATIO_MODE_AGGREGATE)
+			{
+				// Maxima then minima, one waveform of the arena
+				ps6000aSetDataBuffers(unit->handle, (PICO_CHANNEL) (i), buffer, 
+					buffer + n * (windows.bit8Buffers ? sizeof(int8_t) : sizeof(int16_t)), n, type, j, 
+					PICO_RATIO_MODE_AGGREGATE, chAction);
+			}
+			else
+			{
+				ps6000aSetDataBuffer(unit->handle, (PICO_CHANNEL) (i), buffer, n, type, j, 
+					windows.chRatioMode.at(i), chAction);
+			}
+			if (add) {chAction = action = PICO_ADD;}
+		}
+		activeCh++;
+	}
+	windows.registered = channels;
+	windows.registeredFirst = first;
+	windows.registeredCount = count;
+}
+
 vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels, 
 	vector<uint16_t> samplesPostPerChannel, int16_t samplesPreTrigger, 
-	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers)
+	uint32_t numWaveforms, uint16_t maxPostSamples, bool bit8Buffers, sampleArena &arena,
+	vector<uint8_t> chDownsampleMode, vector<uint32_t> chDownsampleRatio)
 {//Using rapid block mode only for now
 	vector<vector<void*>> outBuffers(activeChannels.count());
 
@@ -200,8 +349,11 @@ vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 	uint64_t picoMaxSamples;
 	uint64_t numWaveforms64 = numWaveforms;
 	uint8_t activeCh = 0;
+	size_t sampleBytes = bit8Buffers ? sizeof(int8_t) : sizeof(int16_t);
+	// Windowed runs only need one window of scope memory
+	uint64_t segments = (g_windowSegments > 0 && g_windowSegments < numWaveforms) ? g_windowSegments : numWaveforms64;
 
-	PICO_STATUS status = ps6000aMemorySegments(unit->handle, numWaveforms64, &picoMaxSamples);
+	PICO_STATUS status = ps6000aMemorySegments(unit->handle, segments, &picoMaxSamples);
 	if (status != PICO_OK)
 	{
 		printf("PICO status code: %d\n", status);
@@ -213,10 +365,12 @@ vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 		printf("The program will still run with samples truncated\n"); //XXX: everything here
 		printf("Pester Alex to add partial collections if it becomes a problem\n\n\n");		
 	}
-	ps6000aSetNoOfCaptures(unit->handle, numWaveforms64);
-
-	PICO_ACTION action = (PICO_ACTION) (PICO_CLEAR_ALL | PICO_ADD);
+	ps6000aSetNoOfCaptures(unit->handle, segments);
 
+	// One slice per channel in the arena, each waveform packed after the previous one
+	vector<size_t> chOffset(4, 0);
+	vector<uint64_t> chStored(4, 0);
+	size_t arenaBytes = 0;
 	for (int i = PICO_CHANNEL_A; i < 4; i++)
 	{
 		if (!activeChannels.test(i)) {continue;}
@@ -226,30 +380,143 @@ vector<vector<void*>> SetDataBuffers(UNIT *unit, bitset<4> activeChannels,
 			printf("The total number of samples for channel %c is negative!!!\n", 'A' + i);
 			throw runtime_error("Negative total samples");
 		}
+		chStored.at(i) = datStoredSamples(samplesPreTrigger + samplesPostPerChannel.at(i), 
+			chDownsampleMode.at(i), chDownsampleRatio.at(i));
+		if (chStored.at(i) == 0)
+		{
+			printf("Channel %c: downsampling ratio %u is longer than the waveform\n", 'A' + i, 
+				chDownsampleRatio.at(i));
+			throw invalid_argument("Downsampling ratio longer than the waveform");
+		}
+		chOffset.at(i) = arenaBytes;
+		arenaBytes += (numWaveforms64 * chStored.at(i) * sampleBytes
+					   + g_arenaChannelAlignment - 1) / g_arenaChannelAlignment * g_arenaChannelAlignment;
+	}
+	if (!arena.reserve(arenaBytes))
+	{
+		printf("Memory allocation failed: %.1f MB of data buffers\n", arenaBytes / 1e6);
+		throw runtime_error("Data buffer allocation failed");
+	}
+
+	RAPID_WINDOWS &windows = g_rapidWindows[unit->handle];
+	windows.activeChannels = activeChannels;
+	windows.chSamples = vector<uint64_t>(4, 0);
+	windows.chBufferSamples = vector<uint64_t>(4, 0);
+	windows.chRatioMode = vector<PICO_RATIO_MODE>(4, PICO_RATIO_MODE_RAW);
+	windows.chRatio = vector<uint32_t>(4, 1);
+	windows.bit8Buffers = bit8Buffers;
+	windows.numWaveforms = numWaveforms;
+	windows.segments = segments;
+	windows.overflow = vector<int16_t>(segments);
+
+	for (int i = PICO_CHANNEL_A; i < 4; i++)
+	{
+		if (!activeChannels.test(i)) {continue;}
 
 		uint32_t chSamples = samplesPreTrigger + samplesPostPerChannel.at(i);
+		windows.chSamples.at(i) = chSamples;
+		windows.chBufferSamples.at(i) = chSamples;
+		if (chDownsampleMode.at(i) != DAT_DOWNSAMPLE_NONE && chDownsampleRatio.at(i) > 1)
+		{
+			// A partial last bin is not captured
+			windows.chRatioMode.at(i) = RatioMode(chDownsampleMode.at(i));
+			windows.chRatio.at(i) = chDownsampleRatio.at(i);
+			windows.chBufferSamples.at(i) = chSamples / chDownsampleRatio.at(i);
+			windows.chSamples.at(i) = windows.chBufferSamples.at(i) * chDownsampleRatio.at(i);
+		}
 		outBuffers.at(activeCh) = vector<void*>(numWaveforms);
 
 		for (uint64_t j = 0; j < numWaveforms; j++)
 		{
-			outBuffers.at(activeCh).at(j) = calloc(chSamples, bit8Buffers ? sizeof(int8_t) : sizeof(int16_t));
-			if (outBuffers.at(activeCh).at(j) == NULL)
-			{
-				printf("Memory allocation failed: Ch %d, Wf %d\n", i, (int) j);
-			}
-			ps6000aSetDataBuffer(unit->handle, (PICO_CHANNEL) (i),
-				outBuffers.at(activeCh).at(j), chSamples, 
-				bit8Buffers ? PICO_INT8_T : PICO_INT16_T, j, 
-				PICO_RATIO_MODE_RAW, action);
-			action = PICO_ADD;
+			outBuffers.at(activeCh).at(j) = arena.data() + chOffset.at(i) + j * chStored.at(i) * sampleBytes;
 		}
 		activeCh++;
-		printf("Channel %c data buffers set\n", char('A') + i);
+	}
+	windows.buffers = outBuffers;
+	windows.groups = TransferGroups(windows);
+	windows.registered.reset();
+
+	SetWindowBuffers(unit, windows, 0, segments, GroupChannels(windows, 0));
+	for (int i = PICO_CHANNEL_A; i < 4; i++)
+	{
+		if (activeChannels.test(i))
+		{
+			printf("Channel %c data buffers set\n", char('A') + i);
+		}
 	}
 
 	return outBuffers;
 }
 
+// The buffers SetDataBuffers registered for a run of numWaveforms, nullptr if there are none
+RAPID_WINDOWS *FindLayout(UNIT *unit, uint32_t numWaveforms)
+{
+	map<int16_t, RAPID_WINDOWS>::iterator it = g_rapidWindows.find(unit->handle);
+	if (it == g_rapidWindows.end() || it->second.numWaveforms != numWaveforms)
+	{
+		return nullptr;
+	}
+	return &it->second;
+}
+
+// nullptr when the run fits in one block
+RAPID_WINDOWS *FindWindows(UNIT *unit, uint32_t numWaveforms)
+{
+	RAPID_WINDOWS *windows = FindLayout(unit, numWaveforms);
+	return (windows != nullptr && windows->segments < numWaveforms) ? windows : nullptr;
+}
+
+/*
+ * Fetches waveforms first .. first + count - 1 out of segments 0 .. count - 1,
+ * one bulk transfer per length group from group fromGroup on. The buffers
+ * stay as the last group left them, the next run only registers what differs.
+ */
+void GetGroupValues(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first, uint32_t count, size_t fromGroup)
+{
+	for (size_t g = fromGroup; g < windows.groups.size(); g++)
+	{
+		TRANSFER_GROUP &group = windows.groups.at(g);
+		SetWindowBuffers(unit, windows, first, count, GroupChannels(windows, g));
+		uint64_t nSamples = group.nSamples;
+		PICO_STATUS status = ps6000aGetValuesBulk(unit->handle, 0, &nSamples, 0, count - 1, 
+				group.ratio, group.mode, windows.overflow.data());
+		if (status != PICO_OK)
+		{
+			printf("PICO status code: %d\n", status);
+		}
+	}
+}
+
+/*
+ * Registers the window starting at waveform first and queues its transfer, so
+ * the driver copies it out as soon as it is captured and the next window can
+ * be armed straight after the callback. Only the longest channels go with
+ * it, GetGroupValues(..., 1) fetches the shorter ones. Returns the segments
+ * in the window.
+ */
+uint32_t ArmWindow(UNIT *unit, RAPID_WINDOWS &windows, uint32_t first)
+{
+	TRANSFER_GROUP &longest = windows.groups.front();
+	uint32_t count = min(windows.segments, windows.numWaveforms - first);
+
+	ps6000aSetNoOfCaptures(unit->handle, count);
+	SetWindowBuffers(unit, windows, first, count, GroupChannels(windows, 0));
+	windows.nSamples = longest.nSamples;
+	PICO_STATUS status = ps6000aGetValuesOverlapped(unit->handle, 0, &windows.nSamples, longest.ratio, 
+			longest.mode, 0, count - 1, windows.overflow.data());
+	if (status != PICO_OK)
+	{
+		printf("PICO status code: %d\n", status);
+		throw runtime_error("Could not queue the window transfer");
+	}
+	return count;
+}
+
+void SetRapidBlockWindow(uint32_t segments)
+{
+	g_windowSegments = segments;
+}
+
 void SetSimpleChannelTrigger(UNIT *unit, int16_t threshold, 
 		PS_THRESHOLD_DIRECTION dir, PS_CHANNEL ch)
 {
@@ -397,6 +664,17 @@ int32_t _kbhit()
         return bytesWaiting;
 }
 
+void SetCaptureTimeout(uint32_t timeoutMs)
+{
+	g_captureTimeoutMs = timeoutMs;
+	g_multiCaptureTimeoutMs = timeoutMs;
+}
+
+string UnitName(UNIT *unit)
+{
+	return string((const char *) unit->serial, strnlen((const char *) unit->serial, sizeof(unit->serial)));
+}
+
 void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint8_t timebase, uint32_t numWaveforms)
 {
@@ -406,32 +684,49 @@ void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 	uint32_t timebase32 = timebase;
 	int64_t preTrigger64 = max((int16_t) 0, preTrigger);
 	uint64_t postTriggerMax64 = postTriggerMax;
+	RAPID_WINDOWS *layout = FindLayout(unit, numWaveforms);
+	RAPID_WINDOWS *windows = FindWindows(unit, numWaveforms);
+	uint32_t window = windows != nullptr ? windows->segments : numWaveforms;
+	uint32_t count = numWaveforms;
+	string name = UnitName(unit);
 
 	printf("\n\nStarting DAQ\n\n");
 
 	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
-	ps6000aRunBlock(unit->handle, preTrigger64, postTriggerMax64, timebase32,
-			&timeIndisposed, 0, CallBackBlock, NULL);
-	g_ready = FALSE;
-
-	while (!g_ready && !_kbhit()) // XXX: Should change to only cancel if getch == ctrl+c
+	for (uint32_t first = 0; first < numWaveforms; first += window)
 	{
-		usleep(0);
-	}
-
-	if (!g_ready)
-	{
-		_getch();
-		status = ps6000aStop(unit->handle);
-		status = ps6000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
-		CloseDevice(unit);
+		stageTimer arm(name, STAGE_ARM);
+		if (windows != nullptr)
+		{
+			count = ArmWindow(unit, *windows, first);
+		}
+		g_captureDone.reset(1);
+		ps6000aRunBlock(unit->handle, preTrigger64, postTriggerMax64, timebase32,
+				&timeIndisposed, 0, CallBackBlock, NULL);
+		arm.stop();
+
+		stageTimer triggerWait(name, STAGE_TRIGGER_WAIT);
+		captureSignal::result res = g_captureDone.wait(g_captureTimeoutMs);
+		triggerWait.stop();
+		if (res != captureSignal::completed)
+		{
+			printf(res == captureSignal::cancelled ? "Rapid capture cancelled\n" : "Rapid capture timed out\n");
+			status = ps6000aStop(unit->handle);
+			status = ps6000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
+			CloseDevice(unit);
 
-		printf("Rapid capture aborted. %d complete blocks were captured\n", (int) nCompletedCaptures);
-		printf("Early abort writeout not yet supported\n");
+			printf("Rapid capture aborted. %d complete blocks were captured\n", (int) (first + nCompletedCaptures));
+			printf("Early abort writeout not yet supported\n");
 
-		throw runtime_error("aborted, need to implement early cancellation writeout");
+			throw runtime_error("aborted, need to implement early cancellation writeout");
 
+		}
+		if (windows != nullptr)
+		{
+			stageTimer transfer(name, STAGE_TRANSFER);
+			GetGroupValues(unit, *windows, first, count, 1);
+		}
 	}
 
 	chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -446,17 +741,25 @@ void StartRapidBlock(UNIT *unit, int16_t preTrigger, uint16_t postTriggerMax,
 
 	uint64_t nSamples = preTrigger + postTriggerMax;
 
-	// Get data
-	status = ps6000aGetValuesBulk(unit->handle, 0, &nSamples, 0, numWaveforms - 1, 
-			1, PICO_RATIO_MODE_RAW, NULL); // XXX: Fix this for different sample lengths
+	// Get data, windows were transferred as they completed
+	stageTimer transfer(name, STAGE_TRANSFER);
+	if (windows == nullptr && layout != nullptr)
+	{
+		GetGroupValues(unit, *layout, 0, numWaveforms, 0);
+	}
+	else if (windows == nullptr)
+	{
+		status = ps6000aGetValuesBulk(unit->handle, 0, &nSamples, 0, numWaveforms - 1, 
+				1, PICO_RATIO_MODE_RAW, NULL);
+	}
 	
 	// ps6000GetValuesTriggerTimeOffsetBulk64
 
-	// Stop
-	status = ps6000aStop(unit->handle);
+	transfer.stop();
 
-	status = ps6000aMemorySegments(unit->handle, 1, &nSamples);
-	status = ps6000aSetNoOfCaptures(unit->handle, 1);
+	// Stop, the segments and buffer registrations are kept for the next run
+	stageTimer reset(name, STAGE_RESET);
+	status = ps6000aStop(unit->handle);
 
 	return;
 }
@@ -465,7 +768,7 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	vector<uint16_t> vecPostTriggerMax, vector<uint8_t> vecTimebase,
 	vector<uint32_t> vecNumWaveforms)
 {
-	uint8_t len = vecUnit.size();
+	uint32_t len = vecUnit.size();
 	PICO_STATUS status;
 	vector<double> vecTimeIndisposed(len);
 	vector<uint64_t> vecNCompletedCaptures(len);
@@ -473,8 +776,6 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	vector<int64_t> vecPreTrigger64(len);
 	vector<uint64_t> vecPostTriggerMax64(len);
 
-	g_multiReady = 0;
-
 	for (int i = 0; i < len; i++)
 	{
 		vecTimebase32.at(i) = vecTimebase.at(i);
@@ -482,46 +783,109 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 		vecPostTriggerMax64.at(i) = vecPostTriggerMax.at(i);
 	}
 
-	printf("\n\nStarting DAQ\n\n");
-
-	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
+	// Windowed units are stepped through their windows together, one block each per round
+	vector<RAPID_WINDOWS *> vecWindows(len);
+	uint32_t rounds = 1;
 	for (int i = 0; i < len; i++)
 	{
-		intptr_t iPt = i;
-		ps6000aRunBlock(vecUnit.at(i)->handle, vecPreTrigger64.at(i), 
-			vecPostTriggerMax64.at(i), vecTimebase32.at(i),
-			&vecTimeIndisposed.at(i), 0, MultiCallBackBlock, (void*) iPt);
+		vecWindows.at(i) = FindWindows(vecUnit.at(i), vecNumWaveforms.at(i));
+		if (vecWindows.at(i) != nullptr)
+		{
+			uint32_t segments = vecWindows.at(i)->segments;
+			rounds = max(rounds, (vecNumWaveforms.at(i) + segments - 1) / segments);
+		}
 	}
-	
-	while (!(len <= __builtin_popcount(g_multiReady)) && !_kbhit() &&
-		(5 > chrono::duration_cast<std::chrono::seconds>
-		(std::chrono::steady_clock::now() - begin).count())) // XXX: Should change to only cancel if getch == ctrl+c
+
+	vector<string> vecName(len);
+	vector<chrono::steady_clock::time_point> vecArmed(len);
+	for (int i = 0; i < len; i++)
 	{
-		usleep(0);
+		vecName.at(i) = UnitName(vecUnit.at(i));
 	}
 
-	if (!(len <= __builtin_popcount(g_multiReady)))
+	printf("\n\nStarting DAQ\n\n");
+
+	chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	for (uint32_t round = 0; round < rounds; round++)
 	{
-		_getch();
-		BOOL contAnyways = TRUE;
+		vector<uint32_t> vecFirst(len, 0);
+		vector<uint32_t> vecCount(len, 0);
+		g_captureDone.reset(len);
 		for (int i = 0; i < len; i++)
 		{
-			status = ps6000aStop(vecUnit.at(i)->handle);
-			status = ps6000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
-			printf("Rapid capture aborted.\n");
-			printf("%s: %d complete blocks were captured\n", vecUnit.at(i)->serial, 
-			(int) vecNCompletedCaptures.at(i));
-			if (vecNCompletedCaptures.at(i) < vecNumWaveforms.at(i))
+			if (vecWindows.at(i) != nullptr)
+			{
+				vecFirst.at(i) = round * vecWindows.at(i)->segments;
+			}
+			if (round > 0 && (vecWindows.at(i) == nullptr || vecFirst.at(i) >= vecNumWaveforms.at(i)))
+			{
+				// Whole run already captured
+				vecFirst.at(i) = vecNumWaveforms.at(i);
+				g_captureDone.notify(i);
+				continue;
+			}
+			stageTimer arm(vecName.at(i), STAGE_ARM);
+			if (vecWindows.at(i) != nullptr)
 			{
-				contAnyways = FALSE;
+				vecCount.at(i) = ArmWindow(vecUnit.at(i), *vecWindows.at(i), vecFirst.at(i));
 			}
+			intptr_t iPt = i;
+			ps6000aRunBlock(vecUnit.at(i)->handle, vecPreTrigger64.at(i), 
+				vecPostTriggerMax64.at(i), vecTimebase32.at(i),
+				&vecTimeIndisposed.at(i), 0, MultiCallBackBlock, (void*) iPt);
+			arm.stop();
+			vecArmed.at(i) = chrono::steady_clock::now();
 		}
-		if (!contAnyways)
+
+		captureSignal::result res = g_captureDone.wait(g_multiCaptureTimeoutMs);
+		if (res != captureSignal::completed)
 		{
-			printf("Early abort writeout not yet supported\n");
+			printf(res == captureSignal::cancelled ? "Rapid capture cancelled\n" : "Rapid capture timed out\n");
+			BOOL contAnyways = TRUE;
+			for (int i = 0; i < len; i++)
+			{
+				vecNCompletedCaptures.at(i) = 0;
+				if (vecFirst.at(i) < vecNumWaveforms.at(i))
+				{
+					status = ps6000aStop(vecUnit.at(i)->handle);
+					status = ps6000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
+				}
+				vecNCompletedCaptures.at(i) += vecFirst.at(i);
+				printf("Rapid capture aborted.\n");
+				printf("%s: %d complete blocks were captured%s\n", vecUnit.at(i)->serial, 
+				(int) vecNCompletedCaptures.at(i), g_captureDone.runFinished(i) ? "" : " (not finished)");
+				if (vecNCompletedCaptures.at(i) < vecNumWaveforms.at(i))
+				{
+					contAnyways = FALSE;
+				}
+			}
+			if (!contAnyways)
+			{
+				printf("Early abort writeout not yet supported\n");
 
-			throw "aborted, need to implement early cancellation writeout";
+				throw runtime_error("aborted, need to implement early cancellation writeout");
+			}
+		}
+		if (res == captureSignal::completed)
+		{
+			// Every unit waited from its own RunBlock to its own callback
+			for (int i = 0; i < len; i++)
+			{
+				if (vecFirst.at(i) < vecNumWaveforms.at(i))
+				{
+					runStats::current()->add(vecName.at(i), STAGE_TRIGGER_WAIT, max(0.0,
+						chrono::duration<double>(g_captureDone.finishedAt(i) - vecArmed.at(i)).count()));
+				}
+			}
+		}
+		for (int i = 0; i < len; i++)
+		{
+			if (vecCount.at(i) > 0)
+			{
+				stageTimer transfer(vecName.at(i), STAGE_TRANSFER);
+				GetGroupValues(vecUnit.at(i), *vecWindows.at(i), vecFirst.at(i), vecCount.at(i), 1);
+			}
 		}
 	}
 
@@ -534,22 +898,136 @@ void StartMultiRapidBlock(vector<UNIT *> vecUnit, vector<int16_t> vecPreTrigger,
 	{
 		printf("%s: Trigger rate: %f Hz\n", vecUnit.at(i)->serial,
 			(double) vecNumWaveforms.at(i) / time * 1.0e3);
+	}
 
-		status = ps6000aGetNoOfCaptures(vecUnit.at(i)->handle, &vecNCompletedCaptures.at(i));
+	// The units are independent, fetch them all at once rather than one after the other
+	vector<thread> retrieval;
+	for (int i = 0; i < len; i++)
+	{
+		retrieval.emplace_back([&, i]()
+		{
+			UNIT *unit = vecUnit.at(i);
+			PICO_STATUS status = ps6000aGetNoOfCaptures(unit->handle, &vecNCompletedCaptures.at(i));
 
+			uint64_t nSamples = vecPreTrigger.at(i) + vecPostTriggerMax.at(i);
 
-		uint64_t nSamples = vecPreTrigger.at(i) + vecPostTriggerMax.at(i);
+			// Get data, windows were transferred as they completed
+			stageTimer transfer(vecName.at(i), STAGE_TRANSFER);
+			RAPID_WINDOWS *layout = FindLayout(unit, vecNumWaveforms.at(i));
+			if (vecWindows.at(i) == nullptr && layout != nullptr)
+			{
+				GetGroupValues(unit, *layout, 0, vecNumWaveforms.at(i), 0);
+			}
+			else if (vecWindows.at(i) == nullptr)
+			{
+				status = ps6000aGetValuesBulk(unit->handle, 0, &nSamples, 0, 
+						vecNumWaveforms.at(i) - 1, 1, PICO_RATIO_MODE_RAW, NULL);
+			}
 
-		// Get data
-		status = ps6000aGetValuesBulk(vecUnit.at(i)->handle, 0, &nSamples, 0, 
-				vecNumWaveforms.at(i) - 1, 1, PICO_RATIO_MODE_RAW, NULL);
+			transfer.stop();
 
-		// Stop
-		status = ps6000aStop(vecUnit.at(i)->handle);
+			// Stop, the segments and buffer registrations are kept for the next run
+			stageTimer reset(vecName.at(i), STAGE_RESET);
+			status = ps6000aStop(unit->handle);
+		});
+	}
+	for (thread &t : retrieval)
+	{
+		t.join();
+	}
+}
 
-		status = ps6000aMemorySegments(vecUnit.at(i)->handle, 1, &nSamples);
-		status = ps6000aSetNoOfCaptures(vecUnit.at(i)->handle, 1);
+uint64_t StartStreaming(UNIT *unit, bitset<4> activeChannels, double &sampleIntervalNs,
+	uint64_t samples, vector<sampleRing<int16_t> *> rings, uint64_t &dropped, captureSignal &stop)
+{
+	PICO_STATUS status;
+	uint32_t nCh = activeChannels.count();
+	// Two driver buffers per channel, the driver fills one while the other is handed back
+	vector<vector<int16_t>> buffers(2 * nCh, vector<int16_t>(g_streamBufferSamples));
+	vector<int> current(nCh, 0);
+	vector<PICO_CHANNEL> channels;
+	PICO_ACTION action = (PICO_ACTION) (PICO_CLEAR_ALL | PICO_ADD);
+
+	for (int i = PICO_CHANNEL_A; i < 4; i++)
+	{
+		if (!activeChannels.test(i)) {continue;}
+
+		ps6000aSetDataBuffer(unit->handle, (PICO_CHANNEL) i, buffers.at(2 * channels.size()).data(), 
+			g_streamBufferSamples, PICO_INT16_T, 0, PICO_RATIO_MODE_RAW, action);
+		action = PICO_ADD;
+		channels.push_back((PICO_CHANNEL) i);
+	}
+	// That cleared the rapid block buffers, the next run registers them again
+	map<int16_t, RAPID_WINDOWS>::iterator it = g_rapidWindows.find(unit->handle);
+	if (it != g_rapidWindows.end())
+	{
+		it->second.registered.reset();
 	}
+
+	disableTrigger(unit);
+	status = ps6000aRunStreaming(unit->handle, &sampleIntervalNs, PICO_NS, 0, samples, 0, 1, 
+			PICO_RATIO_MODE_RAW);
+	if (status != PICO_OK)
+	{
+		printf("PICO status code: %d\n", status);
+		throw runtime_error("Could not start streaming");
+	}
+	printf("%s: streaming every %.1f ns\n", unit->serial, sampleIntervalNs);
+
+	uint64_t streamed = 0;
+	dropped = 0;
+	vector<PICO_STREAMING_DATA_INFO> info(nCh);
+	PICO_STREAMING_DATA_TRIGGER_INFO triggerInfo;
+	while (streamed < samples && !stop.cancelRequested())
+	{
+		for (int i = 0; i < nCh; i++)
+		{
+			info.at(i) = {channels.at(i), PICO_RATIO_MODE_RAW, PICO_INT16_T, 0, 0, 0, 0};
+		}
+		status = ps6000aGetStreamingLatestValues(unit->handle, info.data(), nCh, &triggerInfo);
+		if (status != PICO_OK && status != PICO_WAITING_FOR_DATA_BUFFERS && 
+			status != PICO_NO_SAMPLES_AVAILABLE && status != PICO_BUSY)
+		{
+			printf("PICO status code: %d\n", status);
+			break;
+		}
+
+		// The same count for every channel so they stay aligned: the fewest new samples of any
+		// channel, cut to the least free space of any ring
+		uint64_t newSamples = samples - streamed;
+		uint64_t fits = samples;
+		for (int i = 0; i < nCh; i++)
+		{
+			newSamples = min<uint64_t>(newSamples, info.at(i).noOfSamples_);
+			fits = min<uint64_t>(fits, rings.at(i)->space());
+		}
+		fits = min(fits, newSamples);
+		for (int i = 0; i < nCh; i++)
+		{
+			const int16_t *data = buffers.at(2 * i + current.at(i)).data() + info.at(i).startIndex_;
+			rings.at(i)->push(data, fits);
+		}
+		dropped += newSamples - fits;
+		streamed += newSamples;
+
+		if (status == PICO_WAITING_FOR_DATA_BUFFERS)
+		{
+			// Everything in the full buffers has been copied out, give the driver the other ones
+			for (int i = 0; i < nCh; i++)
+			{
+				current.at(i) ^= 1;
+				ps6000aSetDataBuffer(unit->handle, channels.at(i), buffers.at(2 * i + current.at(i)).data(), 
+					g_streamBufferSamples, PICO_INT16_T, 0, PICO_RATIO_MODE_RAW, PICO_ADD);
+			}
+		}
+		else if (newSamples == 0)
+		{
+			usleep(1000);
+		}
+	}
+
+	status = ps6000aStop(unit->handle);
+	return streamed;
 }
 
 PICO_STATUS OpenDevice(UNIT *unit, int8_t *serial)
@@ -697,7 +1175,7 @@ void PREF4 CallBackBlock(int16_t handle, PICO_STATUS status, void * pParameter)
 {
 	if (status != PICO_CANCELLED)
 	{
-		g_ready = TRUE;
+		g_captureDone.notify();
 	}
 }
 
@@ -707,7 +1185,7 @@ void PREF4 MultiCallBackBlock(int16_t handle, PICO_STATUS status, void *pParamet
 	if (status != PICO_CANCELLED)
 	{
 		printf("Run %i has finished\n", (int) runId);
-		g_multiReady |= 1 << runId;
+		g_captureDone.notify(runId);
 	}
 }
 
@@ -0,0 +1,1089 @@
+#include <libps6000a/ps6000aApi.h>
+#include <libps6000a/PicoStatus.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/datFormat.h"
+
+/*
+ * Simulated libps6000a: the subset of the driver API used by
+ * ps6000a/ps6000aWrapper.cpp, with no hardware behind it. Linked in place of
+ * -lps6000a by 'make 6ka-sim', so the whole acquisition path (buffer
+ * registration, rapid block, windows, bulk and overlapped transfers,
+ * downsampling, streaming, file writing) runs on any Linux box.
+ *
+ * Captures take numCaptures / trigger rate, transfers take their bytes over
+ * the USB bandwidth. Waveforms are generated when they are transferred:
+ * gaussian noise plus a negative pulse of a Poisson number of photoelectrons,
+ * MPPC shaped on channels A-C and PMT shaped on D by default, quantised like
+ * the 8 bit ADC (16 bit buffers hold multiples of 256). Aux triggered runs put
+ * the pulse PICOSIM_PULSE_DELAY_NS after the trigger, channel triggered runs
+ * at the trigger. Streams carry dark pulses at PICOSIM_DARK_HZ.
+ * A capture's waveforms only depend on the seed, the unit and its index.
+ * PICOSIM_REPLAY plays back the waveforms of a recorded .dat instead, see
+ * replayWaveform.
+ *
+ * Settings, read from the environment when the first unit is opened:
+ *   PICOSIM_UNITS            units found, default 1 (serials SIM00/0001, ...)
+ *   PICOSIM_TRIGGER_HZ       rapid block trigger rate, default 10000
+ *   PICOSIM_USB_MBPS         transfer rate per unit in MB/s, default 300
+ *   PICOSIM_MEMORY_SAMPLES   scope memory, default 2 GS
+ *   PICOSIM_NOISE_MV         noise RMS, default 0.5
+ *   PICOSIM_MEAN_PE          mean photoelectrons per trigger, default 3
+ *   PICOSIM_MPPC_PE_MV       MPPC single photoelectron amplitude, default 6
+ *   PICOSIM_PMT_PE_MV        PMT single photoelectron amplitude, default 4
+ *   PICOSIM_PMT_CHANNELS     channels with PMT pulses, default D
+ *   PICOSIM_PULSE_DELAY_NS   aux trigger to pulse, default 150
+ *   PICOSIM_DARK_HZ          streaming dark pulse rate per channel, default 100000
+ *   PICOSIM_SEED             default 1
+ *   PICOSIM_REPLAY           .dat (version 2, uncompressed) to replay, default none
+ */
+
+struct simConfig
+{
+	int units;
+	double triggerHz;
+	double usbBytesPerSecond;
+	uint64_t memorySamples;
+	double noiseMv;
+	double meanPe;
+	double mppcPeMv;
+	double pmtPeMv;
+	uint8_t pmtChannels; // bit 0 = channel A
+	double pulseDelayNs;
+	double darkHz;
+	uint64_t seed;
+	std::string replay;
+};
+
+static double envDouble(const char *name, const double fallback)
+{
+	const char *value = getenv(name);
+	return value != nullptr && *value != '\0' ? atof(value) : fallback;
+}
+
+static simConfig loadConfig()
+{
+	simConfig c;
+	c.units = std::max(1, (int) envDouble("PICOSIM_UNITS", 1));
+	c.triggerHz = std::max(1e-3, envDouble("PICOSIM_TRIGGER_HZ", 10000));
+	c.usbBytesPerSecond = std::max(1e-3, envDouble("PICOSIM_USB_MBPS", 300)) * 1e6;
+	c.memorySamples = std::max(1.0, envDouble("PICOSIM_MEMORY_SAMPLES", 2e9));
+	c.noiseMv = envDouble("PICOSIM_NOISE_MV", 0.5);
+	c.meanPe = envDouble("PICOSIM_MEAN_PE", 3);
+	c.mppcPeMv = envDouble("PICOSIM_MPPC_PE_MV", 6);
+	c.pmtPeMv = envDouble("PICOSIM_PMT_PE_MV", 4);
+	c.pmtChannels = 0;
+	const char *pmt = getenv("PICOSIM_PMT_CHANNELS");
+	for (const char *p = pmt != nullptr ? pmt : "D"; *p != '\0'; p++)
+	{
+		if (*p >= 'A' && *p <= 'D')
+		{
+			c.pmtChannels |= 1 << (*p - 'A');
+		}
+	}
+	c.pulseDelayNs = envDouble("PICOSIM_PULSE_DELAY_NS", 150);
+	c.darkHz = envDouble("PICOSIM_DARK_HZ", 1e5);
+	c.seed = (uint64_t) envDouble("PICOSIM_SEED", 1);
+	const char *replay = getenv("PICOSIM_REPLAY");
+	c.replay = replay != nullptr ? replay : "";
+	return c;
+}
+
+static const simConfig &config()
+{
+	static const simConfig c = loadConfig();
+	return c;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                 Signal                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+const uint32_t g_noiseTableSize = 1 << 16;
+const int g_rangesMv[] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+
+// Stateless random numbers, a waveform's noise and pulse follow from its key
+static inline uint64_t splitmix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+class simRandom
+{
+public:
+	explicit simRandom(const uint64_t key) : m_state(splitmix(key)) {}
+
+	uint64_t next() {return m_state = splitmix(m_state);}
+	// (0, 1]
+	double uniform() {return ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);}
+	double gauss() {return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());}
+	uint32_t poisson(const double mean)
+	{
+		const double limit = exp(-mean);
+		uint32_t n = 0;
+		for (double p = uniform(); p > limit; p *= uniform())
+		{
+			n++;
+		}
+		return n;
+	}
+
+private:
+	uint64_t m_state;
+};
+
+// Unit gaussian noise, read at a random offset per waveform
+static const std::vector<float> &noiseTable()
+{
+	static const std::vector<float> table = []() {
+		std::vector<float> t(g_noiseTableSize);
+		std::mt19937_64 rng(config().seed);
+		std::normal_distribution<float> normal;
+		for (float &v : t)
+		{
+			v = normal(rng);
+		}
+		return t;
+	}();
+	return table;
+}
+
+// Peak normalised pulse sampled every intervalNs, until it has decayed
+static std::vector<float> pulseTemplate(const bool pmt, const double intervalNs)
+{
+	const double rise = pmt ? 1.5 : 2.0;
+	const double decay = pmt ? 4.0 : 40.0;
+	const double peakTime = rise * decay / (decay - rise) * log(decay / rise);
+	const double peak = exp(-peakTime / decay) - exp(-peakTime / rise);
+	const uint32_t n = std::max(1.0, ceil(decay * log(1000.0) / intervalNs));
+	std::vector<float> shape(n);
+	for (uint32_t i0(0); i0 < n; ++i0)
+	{
+		const double t = i0 * intervalNs;
+		shape[i0] = (exp(-t / decay) - exp(-t / rise)) / peak;
+	}
+	return shape;
+}
+
+static double timebaseIntervalNs(const uint32_t timebase)
+{
+	return timebase < 5 ? 0.2 * (1 << timebase) : 6.4 * (timebase - 4);
+}
+
+// 8 bit ADC count of v mV, scaled to the buffer type
+static inline int32_t quantise(const float v, const int rangeMv, const bool bit8)
+{
+	const int32_t q = std::max(-127L, std::min(127L, lrintf(v / rangeMv * 127)));
+	return bit8 ? q : q * 256;
+}
+
+static void storeSample(void *buffer, const uint64_t i, const int32_t v, const PICO_DATA_TYPE type)
+{
+	if (type == PICO_INT8_T)
+	{
+		((int8_t *) buffer)[i] = (int8_t) v;
+	}
+	else
+	{
+		((int16_t *) buffer)[i] = (int16_t) v;
+	}
+}
+
+// Runs job(i) for i in [0, jobs) on every core
+static void parallelFor(const size_t jobs, const std::function<void(size_t)> &job)
+{
+	const size_t n = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), jobs));
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i0 = next++; i0 < jobs; i0 = next++)
+		{
+			job(i0);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (size_t i0(1); i0 < n; ++i0)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &t : pool)
+	{
+		t.join();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                  Units                                  ///
+///////////////////////////////////////////////////////////////////////////////
+
+struct simBuffer
+{
+	void *max = nullptr;
+	void *min = nullptr; // aggregate only
+	int32_t n = 0;
+	PICO_DATA_TYPE type = PICO_INT16_T;
+	PICO_RATIO_MODE mode = PICO_RATIO_MODE_RAW;
+};
+
+// Settings of a rapid block run, kept for the transfers after it
+struct simRun
+{
+	int16_t handle = 0;
+	uint64_t firstCapture = 0;  // unit wide index of segment 0
+	uint64_t captures = 0;
+	uint64_t samples = 0;       // pre + post trigger
+	int64_t onset = 0;          // pulse start, samples from the start of the waveform
+	int triggerChannel = -1;    // channel whose pulse triggered, -1 for aux or none
+	int rangeMv[4];
+	std::vector<float> shape[4];
+};
+
+struct simStreamChannel
+{
+	uint64_t position = 0;      // filled samples of the registered buffer
+	void *buffer = nullptr;
+	uint64_t nextPulse = 0;
+	std::vector<std::pair<uint64_t, float>> pulses; // start, amplitude in mV, still in the stream
+};
+
+struct simUnit
+{
+	int16_t handle;
+	std::string serial;
+	bool open = false;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	bool enabled[4] = {false, false, false, false};
+	int rangeMv[4] = {50, 50, 50, 50};
+	int triggerChannel = -1;    // A-D, PICO_TRIGGER_AUX or -1
+	uint64_t triggerDelay = 0;  // samples
+
+	uint64_t segments = 1;
+	uint64_t captures = 1;
+	std::vector<simBuffer> buffers[4]; // per segment
+
+	std::thread runThread;
+	bool stopRequested = false;
+	bool running = false;
+	std::chrono::steady_clock::time_point runStart;
+	uint64_t captured = 0;
+	uint64_t nextCapture = 0;
+	simRun run;
+
+	// Queued by GetValuesOverlapped for the next run
+	bool overlapped = false;
+	uint64_t *overlappedSamples = nullptr;
+	uint64_t overlappedRatio = 1;
+	PICO_RATIO_MODE overlappedMode = PICO_RATIO_MODE_RAW;
+	uint64_t overlappedFrom = 0;
+	uint64_t overlappedTo = 0;
+
+	bool streaming = false;
+	std::chrono::steady_clock::time_point streamStart;
+	double streamIntervalNs = 1;
+	uint64_t streamed = 0;
+	uint64_t streamSamples = 0; // autoStop after this many, 0 runs on
+	simStreamChannel stream[4];
+	std::vector<float> streamShape[4];
+};
+
+static std::mutex g_unitsMutex;
+
+static std::vector<std::unique_ptr<simUnit>> &units()
+{
+	static std::vector<std::unique_ptr<simUnit>> all = []() {
+		std::vector<std::unique_ptr<simUnit>> u;
+		for (int i0(0); i0 < config().units; ++i0)
+		{
+			u.emplace_back(new simUnit);
+			u.back()->handle = i0 + 1;
+			char serial[32];
+			snprintf(serial, sizeof(serial), "SIM00/%04d", i0 + 1);
+			u.back()->serial = serial;
+			for (int ch = 0; ch < 4; ch++)
+			{
+				u.back()->buffers[ch].resize(1);
+			}
+		}
+		return u;
+	}();
+	return all;
+}
+
+static simUnit *findUnit(const int16_t handle)
+{
+	std::vector<std::unique_ptr<simUnit>> &all = units();
+	if (handle < 1 || handle > (int16_t) all.size() || !all[handle - 1]->open)
+	{
+		return nullptr;
+	}
+	return all[handle - 1].get();
+}
+
+// Waits for the run thread, must not be called with the unit locked
+static void joinRun(simUnit &u)
+{
+	if (u.runThread.joinable() && u.runThread.get_id() != std::this_thread::get_id())
+	{
+		u.runThread.join();
+	}
+}
+
+static uint64_t capturedSoFar(const simUnit &u)
+{
+	if (!u.running)
+	{
+		return u.captured;
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - u.runStart).count();
+	return std::min<uint64_t>(u.run.captures, elapsed * config().triggerHz);
+}
+
+// A recorded .dat mapped for replay, header is null when there is none
+struct simReplay
+{
+	const datHeaderV2 *header = nullptr;
+	const uint8_t *data = nullptr;
+	uint64_t size = 0;
+};
+
+static simReplay loadReplay(const std::string &path)
+{
+	simReplay r;
+	if (path.empty())
+	{
+		return r;
+	}
+	const int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(datHeaderV2))
+	{
+		printf("Cannot read the replay file %s, generating waveforms\n", path.c_str());
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return r;
+	}
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("Cannot map the replay file %s, generating waveforms\n", path.c_str());
+		return r;
+	}
+	const datHeaderV2 *h = (const datHeaderV2 *) data;
+	bool usable = isDatV2((const uint8_t *) data, st.st_size) && h->codec == DAT_CODEC_RAW &&
+		h->numWaveforms > 0 && (h->activeChannels & 0x0f) != 0;
+	for (int ch = 0; ch < 4 && usable; ch++)
+	{
+		const datChannelV2 &c = h->channels[ch];
+		usable = !(h->activeChannels & (1 << ch)) ||
+			(c.downsampleRatio <= 1 && c.offset + c.bytes <= (uint64_t) st.st_size);
+	}
+	if (!usable)
+	{
+		printf("%s is not an uncompressed, full rate .dat v2, generating waveforms\n", path.c_str());
+		munmap(data, st.st_size);
+		return r;
+	}
+	r.header = h;
+	r.data = (const uint8_t *) data;
+	r.size = st.st_size;
+	return r;
+}
+
+static const simReplay &replay()
+{
+	static const simReplay r = loadReplay(config().replay);
+	return r;
+}
+
+/*
+ * Capture capture of channel ch plays back recorded waveform capture modulo
+ * the recorded count, from the same channel or else the first recorded one.
+ * Recorded waveforms shorter than the run are padded with 0 mV.
+ */
+static void replayWaveform(const simRun &run, const int ch, const uint64_t capture, float *out)
+{
+	const simReplay &r = replay();
+	const datHeaderV2 &h = *r.header;
+	int source = ch;
+	while (!(h.activeChannels & (1 << source)))
+	{
+		source = (source + 1) % 4;
+	}
+	const datChannelV2 &c = h.channels[source];
+	const uint8_t *waveform = r.data + c.offset + (capture % h.numWaveforms) * c.waveformStride;
+	const float mvPerCount = (float) g_rangesMv[std::min<uint32_t>(c.vRange, 11)] / 127 /
+		(h.sampleBytes == sizeof(int8_t) ? 1 : 256);
+	const uint64_t n = std::min<uint64_t>(run.samples, c.numSamples);
+	for (uint64_t i0(0); i0 < n; ++i0)
+	{
+		const int32_t v = h.sampleBytes == sizeof(int8_t) ? ((const int8_t *) waveform)[i0] :
+			((const int16_t *) waveform)[i0];
+		out[i0] = v * mvPerCount;
+	}
+	std::fill(out + n, out + run.samples, 0.0f);
+}
+
+// Renders one waveform of the run into out, in mV
+static void renderWaveform(const simRun &run, const int ch, const uint64_t capture, float *out)
+{
+	if (replay().header != nullptr)
+	{
+		replayWaveform(run, ch, capture, out);
+		return;
+	}
+	const simConfig &c = config();
+	const std::vector<float> &noise = noiseTable();
+	simRandom rng(splitmix(splitmix(c.seed) ^ run.handle) ^ (capture << 2 | ch));
+
+	uint64_t offset = rng.next();
+	for (uint64_t i0(0); i0 < run.samples; ++i0)
+	{
+		out[i0] = c.noiseMv * noise[(offset + i0) & (g_noiseTableSize - 1)];
+	}
+
+	const bool pmt = c.pmtChannels & (1 << ch);
+	uint32_t pe = rng.poisson(c.meanPe);
+	if (ch == run.triggerChannel)
+	{
+		pe = std::max(1u, pe);
+	}
+	if (pe == 0)
+	{
+		return;
+	}
+	const double amplitude = -(pmt ? c.pmtPeMv : c.mppcPeMv) * (pe + 0.1 * sqrt(pe) * rng.gauss());
+	const std::vector<float> &shape = run.shape[ch];
+	for (uint64_t i0(0); i0 < shape.size(); ++i0)
+	{
+		const int64_t i = run.onset + (int64_t) i0;
+		if (i >= 0 && i < (int64_t) run.samples)
+		{
+			out[i] += amplitude * shape[i0];
+		}
+	}
+}
+
+// Fills a registered buffer with segment seg of the run, downsampled. Returns the stored samples
+static uint64_t fillBuffer(const simRun &run, const int ch, const uint64_t seg, const simBuffer &b,
+						   const uint64_t rawSamples, const uint64_t ratio, std::vector<float> &scratch)
+{
+	scratch.resize(run.samples);
+	renderWaveform(run, ch, run.firstCapture + seg, scratch.data());
+
+	const bool bit8 = b.type == PICO_INT8_T;
+	const uint64_t r = b.mode == PICO_RATIO_MODE_RAW ? 1 : std::max<uint64_t>(1, ratio);
+	const uint64_t n = std::min<uint64_t>(std::min(rawSamples, run.samples) / r, b.n);
+	for (uint64_t i0(0); i0 < n; ++i0)
+	{
+		const float *bin = scratch.data() + i0 * r;
+		int32_t first = quantise(bin[0], run.rangeMv[ch], bit8);
+		int32_t hi = first, lo = first;
+		int64_t sum = first;
+		for (uint64_t i1(1); i1 < r; ++i1)
+		{
+			const int32_t v = quantise(bin[i1], run.rangeMv[ch], bit8);
+			hi = std::max(hi, v);
+			lo = std::min(lo, v);
+			sum += v;
+		}
+		switch (b.mode)
+		{
+			case PICO_RATIO_MODE_AGGREGATE:
+				storeSample(b.max, i0, hi, b.type);
+				storeSample(b.min, i0, lo, b.type);
+				break;
+			case PICO_RATIO_MODE_AVERAGE:
+				storeSample(b.max, i0, (int32_t) llround((double) sum / r), b.type);
+				break;
+			default: // raw, decimate
+				storeSample(b.max, i0, first, b.type);
+		}
+	}
+	return n;
+}
+
+/*
+ * Copies segments from .. to of the last run into the buffers registered
+ * with mode, taking as long as the bytes need over USB. Called with the unit
+ * locked. Returns the samples stored per waveform.
+ */
+static uint64_t transfer(simUnit &u, const uint64_t rawSamples, const uint64_t from, const uint64_t to,
+						 const uint64_t ratio, const PICO_RATIO_MODE mode)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::pair<int, uint64_t>> jobs;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		for (uint64_t seg = from; seg <= to && seg < u.segments && seg < u.captured; seg++)
+		{
+			const simBuffer &b = u.buffers[ch][seg];
+			if (b.max != nullptr && u.enabled[ch] && b.mode == mode)
+			{
+				jobs.push_back({ch, seg});
+			}
+		}
+	}
+
+	std::atomic<uint64_t> bytes(0);
+	std::atomic<uint64_t> stored(0);
+	parallelFor(jobs.size(), [&](const size_t i) {
+		thread_local std::vector<float> scratch;
+		const simBuffer &b = u.buffers[jobs[i].first][jobs[i].second];
+		const uint64_t n = fillBuffer(u.run, jobs[i].first, jobs[i].second, b, rawSamples, ratio, scratch);
+		bytes += n * (b.type == PICO_INT8_T ? 1 : 2) * (b.mode == PICO_RATIO_MODE_AGGREGATE ? 2 : 1);
+		stored = n;
+	});
+
+	std::this_thread::sleep_until(start + std::chrono::duration<double>(bytes / config().usbBytesPerSecond));
+	return stored;
+}
+
+static void runBlock(simUnit *u, ps6000aBlockReady ready, PICO_POINTER parameter)
+{
+	PICO_STATUS status = PICO_OK;
+	{
+		std::unique_lock<std::mutex> lock(u->mutex);
+		std::chrono::duration<double> captureTime(u->run.captures / config().triggerHz);
+		u->wake.wait_until(lock, u->runStart + captureTime, [u]() {return u->stopRequested;});
+		u->captured = u->stopRequested ? capturedSoFar(*u) : u->run.captures;
+		u->running = false;
+		if (u->stopRequested && u->captured < u->run.captures)
+		{
+			status = PICO_CANCELLED;
+		}
+		else if (u->overlapped)
+		{
+			uint64_t n = transfer(*u, *u->overlappedSamples, u->overlappedFrom, u->overlappedTo,
+								  u->overlappedRatio, u->overlappedMode);
+			*u->overlappedSamples = n;
+		}
+		u->overlapped = false;
+	}
+	if (ready != nullptr)
+	{
+		ready(u->handle, status, parameter);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                  Stream                                 ///
+///////////////////////////////////////////////////////////////////////////////
+
+// Samples [start, start + n) of a channel's stream into its buffer
+static void renderStream(simUnit &u, const int ch, const uint64_t start, const uint64_t n,
+						 const PICO_DATA_TYPE type, std::vector<float> &scratch)
+{
+	const simConfig &c = config();
+	const std::vector<float> &noise = noiseTable();
+	simStreamChannel &s = u.stream[ch];
+	const std::vector<float> &shape = u.streamShape[ch];
+	const bool pmt = c.pmtChannels & (1 << ch);
+	const double meanGap = 1e9 / std::max(1e-9, c.darkHz) / u.streamIntervalNs;
+	simRandom rng(splitmix(splitmix(~c.seed) ^ u.handle) ^ (start << 2 | ch));
+
+	scratch.resize(n);
+	const uint64_t offset = splitmix(splitmix(c.seed ^ u.handle) ^ ch);
+	for (uint64_t i0(0); i0 < n; ++i0)
+	{
+		scratch[i0] = c.noiseMv * noise[(offset + start + i0) & (g_noiseTableSize - 1)];
+	}
+
+	while (c.darkHz > 0 && s.nextPulse < start + n)
+	{
+		const double amplitude = -(pmt ? c.pmtPeMv : c.mppcPeMv) * (1 + 0.1 * rng.gauss());
+		s.pulses.push_back({s.nextPulse, amplitude});
+		s.nextPulse += 1 + (uint64_t) (-log(rng.uniform()) * meanGap);
+	}
+	for (const std::pair<uint64_t, float> &p : s.pulses)
+	{
+		const uint64_t first = std::max(p.first, start);
+		const uint64_t last = std::min(p.first + shape.size(), start + n);
+		for (uint64_t i0 = first; i0 < last; ++i0)
+		{
+			scratch[i0 - start] += p.second * shape[i0 - p.first];
+		}
+	}
+	s.pulses.erase(std::remove_if(s.pulses.begin(), s.pulses.end(),
+		[&](const std::pair<uint64_t, float> &p) {return p.first + shape.size() <= start + n;}), s.pulses.end());
+
+	for (uint64_t i0(0); i0 < n; ++i0)
+	{
+		storeSample(s.buffer, s.position + i0, quantise(scratch[i0], u.rangeMv[ch], type == PICO_INT8_T), type);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///                                Driver API                               ///
+///////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+
+PICO_STATUS ps6000aEnumerateUnits(int16_t *count, int8_t *serials, int16_t *serialLth)
+{
+	std::string list;
+	for (std::unique_ptr<simUnit> &u : units())
+	{
+		list += (list.empty() ? "" : ",") + u->serial;
+	}
+	*count = units().size();
+	if (serials != nullptr && serialLth != nullptr)
+	{
+		if (*serialLth < (int16_t) list.size() + 1)
+		{
+			return PICO_INVALID_PARAMETER;
+		}
+		memcpy(serials, list.c_str(), list.size() + 1);
+		*serialLth = list.size();
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aOpenUnit(int16_t *handle, int8_t *serial, PICO_DEVICE_RESOLUTION resolution)
+{
+	std::lock_guard<std::mutex> lock(g_unitsMutex);
+	*handle = 0;
+	for (std::unique_ptr<simUnit> &u : units())
+	{
+		if (u->open || (serial != nullptr && u->serial != (const char *) serial))
+		{
+			continue;
+		}
+		u->open = true;
+		*handle = u->handle;
+		printf("Simulated PicoScope %s opened\n", u->serial.c_str());
+		return PICO_OK;
+	}
+	return PICO_NOT_FOUND;
+}
+
+PICO_STATUS ps6000aCloseUnit(int16_t handle)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	ps6000aStop(handle);
+
+	std::lock_guard<std::mutex> lock(g_unitsMutex);
+	std::lock_guard<std::mutex> unitLock(u->mutex);
+	u->open = false;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		u->buffers[ch].assign(u->segments, simBuffer());
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetUnitInfo(int16_t handle, int8_t *string, int16_t stringLength, int16_t *requiredSize,
+							   PICO_INFO info)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	const char *values[] = {"PicoSim 1.0", "3.0", "1", "6424E", u->serial.c_str(), "01Jan26", "1.0",
+							"1", "1", "1.0", "1.0"};
+	const char *value = info < sizeof(values) / sizeof(values[0]) ? values[info] : "";
+	*requiredSize = strlen(value) + 1;
+	if (string != nullptr && stringLength > 0)
+	{
+		strncpy((char *) string, value, stringLength - 1);
+		string[stringLength - 1] = '\0';
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetAdcLimits(int16_t handle, PICO_DEVICE_RESOLUTION resolution, int16_t *minValue,
+								int16_t *maxValue)
+{
+	if (findUnit(handle) == nullptr) {return PICO_INVALID_HANDLE;}
+	*minValue = -32512;
+	*maxValue = 32512;
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetChannelOn(int16_t handle, PICO_CHANNEL channel, PICO_COUPLING coupling,
+								PICO_CONNECT_PROBE_RANGE range, double analogueOffset, PICO_BANDWIDTH_LIMITER bandwidth)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	if (channel < PICO_CHANNEL_A || channel > PICO_CHANNEL_D || range < 0 ||
+		range >= (int) (sizeof(g_rangesMv) / sizeof(g_rangesMv[0])))
+	{
+		return PICO_INVALID_PARAMETER;
+	}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	u->enabled[channel] = true;
+	u->rangeMv[channel] = g_rangesMv[range];
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetChannelOff(int16_t handle, PICO_CHANNEL channel)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	if (channel < PICO_CHANNEL_A || channel > PICO_CHANNEL_D) {return PICO_INVALID_PARAMETER;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	u->enabled[channel] = false;
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetTimebase(int16_t handle, uint32_t timebase, uint64_t noSamples, double *timeIntervalNanoseconds,
+							   uint64_t *maxSamples, uint64_t segmentIndex)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	*timeIntervalNanoseconds = timebaseIntervalNs(timebase);
+	*maxSamples = config().memorySamples / u->segments;
+	return noSamples <= *maxSamples ? PICO_OK : PICO_INVALID_PARAMETER;
+}
+
+PICO_STATUS ps6000aMemorySegments(int16_t handle, uint64_t nSegments, uint64_t *nMaxSamples)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	if (nSegments == 0 || nSegments > config().memorySamples) {return PICO_INVALID_PARAMETER;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	u->segments = nSegments;
+	u->captures = std::min(u->captures, nSegments);
+	for (int ch = 0; ch < 4; ch++)
+	{
+		u->buffers[ch].resize(nSegments);
+	}
+	if (nMaxSamples != nullptr)
+	{
+		*nMaxSamples = config().memorySamples / nSegments;
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetNoOfCaptures(int16_t handle, uint64_t nCaptures)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (nCaptures == 0 || nCaptures > u->segments) {return PICO_INVALID_PARAMETER;}
+	u->captures = nCaptures;
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetDataBuffers(int16_t handle, PICO_CHANNEL channel, PICO_POINTER bufferMax, PICO_POINTER bufferMin,
+								  int32_t nSamples, PICO_DATA_TYPE dataType, uint64_t waveform,
+								  PICO_RATIO_MODE downSampleRatioMode, PICO_ACTION action)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	if (channel < PICO_CHANNEL_A || channel > PICO_CHANNEL_D) {return PICO_INVALID_PARAMETER;}
+	if (dataType != PICO_INT8_T && dataType != PICO_INT16_T) {return PICO_INVALID_PARAMETER;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (action & PICO_CLEAR_ALL)
+	{
+		for (int ch = 0; ch < 4; ch++)
+		{
+			u->buffers[ch].assign(u->segments, simBuffer());
+		}
+	}
+	if (waveform >= u->segments) {return PICO_INVALID_PARAMETER;}
+	simBuffer &b = u->buffers[channel][waveform];
+	if (action & PICO_CLEAR_THIS_DATA_BUFFER)
+	{
+		b = simBuffer();
+	}
+	if (action & PICO_ADD)
+	{
+		b.max = bufferMax;
+		b.min = bufferMin;
+		b.n = nSamples;
+		b.type = dataType;
+		b.mode = downSampleRatioMode;
+		if (u->streaming && waveform == 0)
+		{
+			u->stream[channel].buffer = bufferMax;
+			u->stream[channel].position = 0;
+		}
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetDataBuffer(int16_t handle, PICO_CHANNEL channel, PICO_POINTER buffer, int32_t nSamples,
+								 PICO_DATA_TYPE dataType, uint64_t waveform, PICO_RATIO_MODE downSampleRatioMode,
+								 PICO_ACTION action)
+{
+	if (downSampleRatioMode == PICO_RATIO_MODE_AGGREGATE && (action & PICO_ADD))
+	{
+		return PICO_INVALID_PARAMETER; // needs a min buffer too
+	}
+	return ps6000aSetDataBuffers(handle, channel, buffer, nullptr, nSamples, dataType, waveform,
+								 downSampleRatioMode, action);
+}
+
+PICO_STATUS ps6000aSetSimpleTrigger(int16_t handle, int16_t enable, PICO_CHANNEL source, int16_t threshold,
+									PICO_THRESHOLD_DIRECTION direction, uint64_t delay, uint32_t autoTriggerMicroSeconds)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	u->triggerChannel = enable ? (int) source : -1;
+	u->triggerDelay = delay;
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetTriggerChannelConditions(int16_t handle, PICO_CONDITION *conditions, int16_t nConditions,
+											   PICO_ACTION action)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (action & PICO_CLEAR_ALL)
+	{
+		u->triggerChannel = -1;
+	}
+	for (int16_t i0(0); i0 < nConditions; ++i0)
+	{
+		if (conditions[i0].condition == PICO_CONDITION_TRUE)
+		{
+			u->triggerChannel = conditions[i0].source;
+		}
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aSetTriggerChannelDirections(int16_t handle, PICO_DIRECTION *directions, int16_t nDirections)
+{
+	return findUnit(handle) != nullptr ? PICO_OK : PICO_INVALID_HANDLE;
+}
+
+PICO_STATUS ps6000aSetTriggerChannelProperties(int16_t handle, PICO_TRIGGER_CHANNEL_PROPERTIES *channelProperties,
+											   int16_t nChannelProperties, int16_t auxOutputEnable,
+											   uint32_t autoTriggerMicroSeconds)
+{
+	return findUnit(handle) != nullptr ? PICO_OK : PICO_INVALID_HANDLE;
+}
+
+PICO_STATUS ps6000aSetTriggerDelay(int16_t handle, uint64_t delay)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	u->triggerDelay = delay;
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aRunBlock(int16_t handle, uint64_t noOfPreTriggerSamples, uint64_t noOfPostTriggerSamples,
+							uint32_t timebase, double *timeIndisposedMs, uint64_t segmentIndex,
+							ps6000aBlockReady lpReady, PICO_POINTER pParameter)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	joinRun(*u);
+
+	std::lock_guard<std::mutex> lock(u->mutex);
+	const simConfig &c = config();
+	const double intervalNs = timebaseIntervalNs(timebase);
+	simRun &run = u->run;
+	run.handle = handle;
+	run.firstCapture = u->nextCapture;
+	run.captures = u->captures;
+	run.samples = noOfPreTriggerSamples + noOfPostTriggerSamples;
+	run.triggerChannel = u->triggerChannel >= PICO_CHANNEL_A && u->triggerChannel <= PICO_CHANNEL_D ? u->triggerChannel : -1;
+	run.onset = (int64_t) noOfPreTriggerSamples - (int64_t) u->triggerDelay;
+	if (run.triggerChannel < 0)
+	{
+		run.onset += llround(c.pulseDelayNs / intervalNs);
+	}
+	for (int ch = 0; ch < 4; ch++)
+	{
+		run.rangeMv[ch] = u->rangeMv[ch];
+		run.shape[ch] = pulseTemplate(c.pmtChannels & (1 << ch), intervalNs);
+	}
+	u->nextCapture += run.captures;
+	u->captured = 0;
+	u->stopRequested = false;
+	u->running = true;
+	u->runStart = std::chrono::steady_clock::now();
+	if (timeIndisposedMs != nullptr)
+	{
+		*timeIndisposedMs = 1e3 * run.captures / c.triggerHz;
+	}
+	u->runThread = std::thread(runBlock, u, lpReady, pParameter);
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetNoOfCaptures(int16_t handle, uint64_t *nCaptures)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	*nCaptures = capturedSoFar(*u);
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetValuesBulk(int16_t handle, uint64_t startIndex, uint64_t *noOfSamples, uint64_t fromSegmentIndex,
+								 uint64_t toSegmentIndex, uint64_t downSampleRatio, PICO_RATIO_MODE downSampleRatioMode,
+								 int16_t *overflow)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (u->running) {return PICO_BUSY;}
+	if (fromSegmentIndex > toSegmentIndex) {return PICO_INVALID_PARAMETER;}
+	*noOfSamples = transfer(*u, *noOfSamples, fromSegmentIndex, toSegmentIndex, downSampleRatio, downSampleRatioMode);
+	if (overflow != nullptr)
+	{
+		std::fill(overflow, overflow + (toSegmentIndex - fromSegmentIndex + 1), 0);
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetValuesOverlapped(int16_t handle, uint64_t startIndex, uint64_t *noOfSamples,
+									   uint64_t downSampleRatio, PICO_RATIO_MODE downSampleRatioMode,
+									   uint64_t fromSegmentIndex, uint64_t toSegmentIndex, int16_t *overflow)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (fromSegmentIndex > toSegmentIndex) {return PICO_INVALID_PARAMETER;}
+	u->overlapped = true;
+	u->overlappedSamples = noOfSamples;
+	u->overlappedRatio = downSampleRatio;
+	u->overlappedMode = downSampleRatioMode;
+	u->overlappedFrom = fromSegmentIndex;
+	u->overlappedTo = toSegmentIndex;
+	if (overflow != nullptr)
+	{
+		std::fill(overflow, overflow + (toSegmentIndex - fromSegmentIndex + 1), 0);
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aStop(int16_t handle)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	{
+		std::lock_guard<std::mutex> lock(u->mutex);
+		u->stopRequested = true;
+		u->streaming = false;
+	}
+	u->wake.notify_all();
+	joinRun(*u);
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aRunStreaming(int16_t handle, double *sampleInterval, PICO_TIME_UNITS sampleIntervalTimeUnits,
+								uint64_t maxPreTriggerSamples, uint64_t maxPostTriggerSamples, int16_t autoStop,
+								uint64_t downSampleRatio, PICO_RATIO_MODE downSampleRatioMode)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	if (downSampleRatioMode != PICO_RATIO_MODE_RAW) {return PICO_INVALID_PARAMETER;}
+	joinRun(*u);
+
+	std::lock_guard<std::mutex> lock(u->mutex);
+	const double unitNs[] = {1e-6, 1e-3, 1, 1e3, 1e6, 1e9};
+	if (sampleIntervalTimeUnits < PICO_FS || sampleIntervalTimeUnits > PICO_S) {return PICO_INVALID_PARAMETER;}
+	double ns = std::max(0.2, *sampleInterval * unitNs[sampleIntervalTimeUnits]);
+
+	// Nearest supported interval at or above the request the USB link keeps up with
+	int channels = 0;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		channels += u->enabled[ch] && u->buffers[ch][0].max != nullptr;
+	}
+	ns = std::max(ns, channels * sizeof(int16_t) * 1e9 / config().usbBytesPerSecond);
+	ns = ns <= 3.2 ? 0.2 * pow(2, ceil(log2(ns / 0.2) - 1e-9)) : 6.4 * ceil(ns / 6.4 - 1e-9);
+	*sampleInterval = ns / unitNs[sampleIntervalTimeUnits];
+
+	u->streaming = true;
+	u->stopRequested = false;
+	u->streamStart = std::chrono::steady_clock::now();
+	u->streamIntervalNs = ns;
+	u->streamed = 0;
+	u->streamSamples = autoStop ? maxPreTriggerSamples + maxPostTriggerSamples : 0;
+	for (int ch = 0; ch < 4; ch++)
+	{
+		u->stream[ch] = simStreamChannel();
+		u->stream[ch].buffer = u->buffers[ch][0].max;
+		u->streamShape[ch] = pulseTemplate(config().pmtChannels & (1 << ch), ns);
+	}
+	return PICO_OK;
+}
+
+PICO_STATUS ps6000aGetStreamingLatestValues(int16_t handle, PICO_STREAMING_DATA_INFO *streamingDataInfo,
+											uint64_t nStreamingDataInfos, PICO_STREAMING_DATA_TRIGGER_INFO *triggerInfo)
+{
+	simUnit *u = findUnit(handle);
+	if (u == nullptr) {return PICO_INVALID_HANDLE;}
+	std::lock_guard<std::mutex> lock(u->mutex);
+	if (!u->streaming) {return PICO_INVALID_PARAMETER;}
+
+	const double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - u->streamStart).count();
+	uint64_t target = elapsedNs / u->streamIntervalNs;
+	if (u->streamSamples > 0)
+	{
+		target = std::min(target, u->streamSamples);
+	}
+
+	// Every channel gets the same samples, as far as the fullest buffer allows
+	uint64_t n = target - u->streamed;
+	for (uint64_t i0(0); i0 < nStreamingDataInfos; ++i0)
+	{
+		PICO_CHANNEL ch = streamingDataInfo[i0].channel_;
+		if (ch < PICO_CHANNEL_A || ch > PICO_CHANNEL_D || u->stream[ch].buffer == nullptr) {return PICO_INVALID_PARAMETER;}
+		n = std::min<uint64_t>(n, u->buffers[ch][0].n - u->stream[ch].position);
+	}
+
+	bool full = false;
+	for (uint64_t i0(0); i0 < nStreamingDataInfos; ++i0)
+	{
+		thread_local std::vector<float> scratch;
+		PICO_STREAMING_DATA_INFO &info = streamingDataInfo[i0];
+		simStreamChannel &s = u->stream[info.channel_];
+		renderStream(*u, info.channel_, u->streamed, n, u->buffers[info.channel_][0].type, scratch);
+		info.noOfSamples_ = n;
+		info.startIndex_ = s.position;
+		info.bufferIndex_ = 0;
+		info.overflow_ = 0;
+		s.position += n;
+		full |= s.position >= (uint64_t) u->buffers[info.channel_][0].n;
+	}
+	u->streamed += n;
+	if (triggerInfo != nullptr)
+	{
+		memset(triggerInfo, 0, sizeof(*triggerInfo));
+		triggerInfo->autoStop_ = u->streamSamples > 0 && u->streamed >= u->streamSamples;
+	}
+	if (full)
+	{
+		return PICO_WAITING_FOR_DATA_BUFFERS;
+	}
+	return n > 0 ? PICO_OK : PICO_NO_SAMPLES_AVAILABLE;
+}
+
+}
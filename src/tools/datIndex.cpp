@@ -0,0 +1,91 @@
+/*
+ * Builds or refreshes the .datCatalog of a data directory and queries it.
+ *
+ * Usage: exec/datIndex <directory>
+ *            updates the catalog and prints a summary
+ *        exec/datIndex <directory> list [date=..] [bias=..] [led=..] [pmt=..] [mppc=..] [serial=..]
+ *            prints the path of every matching file with a valid header, one per line
+ *
+ * led is the LED voltage in mV or "Dark", bias is in V (no units in either).
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "datCatalog.h"
+
+static bool parseQuery(const char *arg, catalogQuery &q)
+{
+	const char *eq = strchr(arg, '=');
+	if (eq == nullptr)
+	{
+		return false;
+	}
+	const std::string key(arg, eq - arg);
+	const std::string value(eq + 1);
+	std::string *field = key == "date" ? &q.date : key == "bias" ? &q.bias : key == "led" ? &q.led
+					   : key == "pmt" ? &q.pmt : key == "mppc" ? &q.mppc : key == "serial" ? &q.serial : nullptr;
+	if (field == nullptr)
+	{
+		return false;
+	}
+	*field = value;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || (argc > 2 && strcmp(argv[2], "list") != 0))
+	{
+		fprintf(stderr, "Usage: %s <directory> [list [field=value ...]]\n", argv[0]);
+		return 1;
+	}
+
+	catalogQuery q;
+	for (int i0(3); i0 < argc; ++i0)
+	{
+		if (!parseQuery(argv[i0], q))
+		{
+			fprintf(stderr, "ERROR: unknown query '%s', use date, bias, led, pmt, mppc or serial\n", argv[i0]);
+			return 1;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	datCatalog catalog(argv[1]);
+	std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+
+	if (argc > 2)
+	{
+		for (const catalogEntry *e : catalog.select(q))
+		{
+			if (e->validHeader)
+			{
+				printf("%s\n", catalog.fullPath(*e).c_str());
+			}
+		}
+		return 0;
+	}
+
+	size_t invalid(0), unnamed(0);
+	uint64_t bytes(0);
+	for (const catalogEntry &e : catalog.entries())
+	{
+		invalid += !e.validHeader;
+		unnamed += e.date.empty();
+		bytes += e.size;
+	}
+	printf("%s: %zu files (%.1f GB), %zu re-read, %zu with bad headers, %zu not following the naming scheme, %.1f ms\n",
+		   catalog.directory().c_str(), catalog.entries().size(), bytes / 1e9, catalog.rescanned(), invalid, unnamed,
+		   dt.count() * 1e3);
+	for (const catalogEntry &e : catalog.entries())
+	{
+		if (!e.validHeader)
+		{
+			printf("  bad header: %s\n", e.path.c_str());
+		}
+	}
+	return 0;
+}